@@ -0,0 +1,163 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures the throughput of computing the SHA-256 digests of many small
+// blobs, such as the headers of a translation unit, and compares it with
+// BLAKE3.
+//
+// Usage: digest_benchmark [NUM_BLOBS [ITERATIONS]]
+
+#include <digestgenerator.h>
+#include <env.h>
+#include <sha256multibuffer.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <openssl/evp.h>
+
+using namespace recc;
+
+namespace {
+
+// Blobs of 1 to 20 KiB, the typical size of a header
+std::vector<std::string> generateBlobs(size_t numBlobs)
+{
+    std::mt19937 random(42);
+    std::uniform_int_distribution<size_t> sizes(1024, 20 * 1024);
+    std::vector<std::string> blobs;
+    for (size_t i = 0; i < numBlobs; ++i) {
+        std::string blob(sizes(random), '\0');
+        for (auto &c : blob) {
+            c = static_cast<char>(random());
+        }
+        blobs.push_back(std::move(blob));
+    }
+    return blobs;
+}
+
+// The digest computation previously used by `DigestGenerator`, for
+// comparison: a new context for each blob and a stream to format the hash
+std::string referenceDigest(const std::string &blob)
+{
+    std::unique_ptr<EVP_MD_CTX, void (*)(EVP_MD_CTX *)> context(
+        EVP_MD_CTX_create(), [](EVP_MD_CTX *c) { EVP_MD_CTX_destroy(c); });
+    unsigned char hash[EVP_MAX_MD_SIZE];
+    unsigned int hashSize;
+    EVP_DigestInit_ex(context.get(), EVP_sha256(), nullptr);
+    EVP_DigestUpdate(context.get(), blob.data(), blob.size());
+    EVP_DigestFinal_ex(context.get(), hash, &hashSize);
+
+    std::ostringstream ss;
+    for (unsigned int i = 0; i < hashSize; i++) {
+        ss << std::hex << std::setw(2) << std::setfill('0')
+           << static_cast<int>(hash[i]);
+    }
+    return ss.str();
+}
+
+void run(const std::string &name, size_t totalSize, int iterations,
+         const std::function<void()> &hash)
+{
+    std::vector<double> timings;
+    for (int i = 0; i < iterations; ++i) {
+        const auto start = std::chrono::steady_clock::now();
+        hash();
+        const auto end = std::chrono::steady_clock::now();
+        timings.push_back(
+            std::chrono::duration<double, std::milli>(end - start).count());
+    }
+    std::sort(timings.begin(), timings.end());
+    const double median = timings[timings.size() / 2];
+
+    std::cout << name << ": median " << median << " ms, "
+              << static_cast<double>(totalSize) / 1000.0 / median << " MB/s"
+              << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    const size_t numBlobs =
+        (argc > 1) ? std::strtoul(argv[1], nullptr, 10) : 5000;
+    const int iterations = (argc > 2) ? std::atoi(argv[2]) : 10;
+    if (numBlobs == 0 || iterations <= 0) {
+        std::cerr << "Usage: " << argv[0] << " [NUM_BLOBS [ITERATIONS]]"
+                  << std::endl;
+        return 1;
+    }
+
+    RECC_CAS_DIGEST_FUNCTION = "SHA256";
+    const std::vector<std::string> blobs = generateBlobs(numBlobs);
+    size_t totalSize = 0;
+    for (const auto &blob : blobs) {
+        totalSize += blob.size();
+    }
+    const std::vector<DigestGenerator::BlobView> views(blobs.cbegin(),
+                                                       blobs.cend());
+    std::cout << "Hashing " << blobs.size() << " blobs, " << totalSize
+              << " bytes; multi-buffer SHA-256 "
+              << (Sha256MultiBuffer::isSupported()
+                      ? (Sha256MultiBuffer::isPreferred() ? "preferred"
+                                                          : "supported")
+                      : "not supported")
+              << std::endl;
+
+    run("reference", totalSize, iterations, [&blobs]() {
+        for (const auto &blob : blobs) {
+            referenceDigest(blob);
+        }
+    });
+    run("make_digest", totalSize, iterations, [&blobs]() {
+        for (const auto &blob : blobs) {
+            DigestGenerator::make_digest(blob);
+        }
+    });
+    run("make_digests", totalSize, iterations,
+        [&views]() { DigestGenerator::make_digests(views); });
+
+    RECC_CAS_DIGEST_FUNCTION = "BLAKE3";
+    run("make_digest BLAKE3", totalSize, iterations, [&blobs]() {
+        for (const auto &blob : blobs) {
+            DigestGenerator::make_digest(blob);
+        }
+    });
+    RECC_CAS_DIGEST_FUNCTION = "SHA256";
+
+    if (Sha256MultiBuffer::isSupported()) {
+        std::vector<const char *> messages;
+        std::vector<size_t> sizes;
+        for (const auto &blob : blobs) {
+            messages.push_back(blob.data());
+            sizes.push_back(blob.size());
+        }
+        std::vector<unsigned char> hashes(blobs.size() *
+                                          Sha256MultiBuffer::DIGEST_SIZE);
+        run("multi-buffer", totalSize, iterations, [&]() {
+            Sha256MultiBuffer::hash(messages.data(), sizes.data(),
+                                    blobs.size(), hashes.data());
+        });
+    }
+    return 0;
+}
@@ -0,0 +1,152 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures the throughput of parsing the Make rules written by `-M` for a
+// translation unit including many deeply nested template headers.
+//
+// Usage: makerulesparser_benchmark [NUM_HEADERS [ITERATIONS]]
+
+#include <makerulesparser.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace recc;
+
+namespace {
+
+std::string generateRules(size_t numHeaders)
+{
+    const std::vector<std::string> prefixes = {
+        "/opt/toolchain/include/boost/mpl/aux_/preprocessed/gcc/",
+        "/opt/toolchain/include/boost/fusion/container/vector/detail/",
+        "/opt/toolchain/include/c++/10/bits/",
+        "/home/build/workspace/project/src/generated/templates/"};
+
+    std::string rules = "/home/build/workspace/project/out/large_tu.o: "
+                        "/home/build/workspace/project/src/large_tu.cpp";
+    for (size_t i = 0; i < numHeaders; ++i) {
+        rules += (i % 2 == 0) ? " \\\n " : " ";
+        rules += prefixes[i % prefixes.size()];
+        rules += "instantiation_" + std::to_string(i) + ".hpp";
+    }
+    rules += "\n";
+    return rules;
+}
+
+// The character-at-a-time parser previously used by `Deps`, for comparison
+std::set<std::string> referenceParse(const std::string &rules)
+{
+    std::set<std::string> result;
+    bool saw_colon_on_line = false;
+    bool saw_backslash = false;
+
+    std::string current_filename;
+    for (const char &character : rules) {
+        if (saw_backslash) {
+            saw_backslash = false;
+            if (character != '\n' && saw_colon_on_line) {
+                current_filename += character;
+            }
+        }
+        else if (character == '\\') {
+            saw_backslash = true;
+        }
+        else if (character == ':' && !saw_colon_on_line) {
+            saw_colon_on_line = true;
+        }
+        else if (character == '\n' || character == ' ') {
+            if (character == '\n') {
+                saw_colon_on_line = false;
+            }
+            if (!current_filename.empty()) {
+                result.insert(current_filename);
+            }
+            current_filename.clear();
+        }
+        else if (saw_colon_on_line) {
+            current_filename += character;
+        }
+    }
+    if (!current_filename.empty()) {
+        result.insert(current_filename);
+    }
+    return result;
+}
+
+std::set<std::string> chunkedParse(const std::string &rules, size_t chunkSize)
+{
+    MakeRulesParser parser;
+    for (size_t pos = 0; pos < rules.size(); pos += chunkSize) {
+        parser.parse(rules.data() + pos,
+                     std::min(chunkSize, rules.size() - pos));
+    }
+    parser.finish();
+    return parser.takeDependencies();
+}
+
+void run(const std::string &name, const std::string &rules, int iterations,
+         const std::function<std::set<std::string>()> &parse)
+{
+    std::vector<double> timings;
+    size_t numDependencies = 0;
+    for (int i = 0; i < iterations; ++i) {
+        const auto start = std::chrono::steady_clock::now();
+        numDependencies = parse().size();
+        const auto end = std::chrono::steady_clock::now();
+        timings.push_back(
+            std::chrono::duration<double, std::milli>(end - start).count());
+    }
+    std::sort(timings.begin(), timings.end());
+    const double median = timings[timings.size() / 2];
+
+    std::cout << name << ": " << numDependencies << " dependencies, median "
+              << median << " ms, "
+              << static_cast<double>(rules.size()) / 1000.0 / median
+              << " MB/s" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    const size_t numHeaders =
+        (argc > 1) ? std::strtoul(argv[1], nullptr, 10) : 50000;
+    const int iterations = (argc > 2) ? std::atoi(argv[2]) : 10;
+    if (numHeaders == 0 || iterations <= 0) {
+        std::cerr << "Usage: " << argv[0] << " [NUM_HEADERS [ITERATIONS]]"
+                  << std::endl;
+        return 1;
+    }
+
+    const std::string rules = generateRules(numHeaders);
+    std::cout << "Parsing " << rules.size() << " bytes of Make rules"
+              << std::endl;
+
+    run("reference", rules, iterations,
+        [&rules]() { return referenceParse(rules); });
+    run("whole buffer", rules, iterations,
+        [&rules]() { return chunkedParse(rules, rules.size()); });
+    run("64 KiB chunks", rules, iterations,
+        [&rules]() { return chunkedParse(rules, 65536); });
+    run("4 KiB chunks", rules, iterations,
+        [&rules]() { return chunkedParse(rules, 4096); });
+    return 0;
+}
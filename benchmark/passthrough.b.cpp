@@ -0,0 +1,91 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures how long `recc` takes to start a command that isn't a compile
+// command, by comparing the wall time of running `true` through `recc` with
+// running it directly. With metrics enabled, `recc` still runs such commands
+// in a child process instead of replacing itself with them.
+//
+// Usage: passthrough_benchmark [RECC [ITERATIONS]]
+
+#include <subprocess.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace recc;
+
+namespace {
+
+double run(const std::string &name, int iterations,
+           const std::vector<std::string> &command,
+           const std::map<std::string, std::string> &env)
+{
+    std::vector<double> timings;
+    for (int i = 0; i < iterations; ++i) {
+        const auto start = std::chrono::steady_clock::now();
+        const auto result = Subprocess::execute(command, true, true, env);
+        const auto end = std::chrono::steady_clock::now();
+        if (result.d_exitCode != 0) {
+            std::cerr << name << ": exited with " << result.d_exitCode
+                      << std::endl
+                      << result.d_stdErr;
+            exit(1);
+        }
+        timings.push_back(
+            std::chrono::duration<double, std::milli>(end - start).count());
+    }
+    std::sort(timings.begin(), timings.end());
+
+    const double median = timings[timings.size() / 2];
+    std::cout << name << ": median " << median << " ms" << std::endl;
+    return median;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    const std::string recc = (argc > 1) ? argv[1] : RECC_BINARY;
+    const int iterations = (argc > 2) ? std::atoi(argv[2]) : 200;
+    if (iterations <= 0) {
+        std::cerr << "Usage: " << argv[0] << " [RECC [ITERATIONS]]"
+                  << std::endl;
+        return 1;
+    }
+
+    // Configured so that no warnings are printed
+    const std::map<std::string, std::string> env = {
+        {"RECC_SERVER", "http://localhost:1"},
+        {"RECC_REMOTE_PLATFORM_OSFamily", "linux"}};
+    std::map<std::string, std::string> metricsEnv = env;
+    metricsEnv["RECC_ENABLE_METRICS"] = "1";
+    metricsEnv["RECC_METRICS_FILE"] = "/dev/null";
+
+    const double direct = run("true", iterations, {"true"}, env);
+    const double passthrough =
+        run("recc true", iterations, {recc, "true"}, env);
+    const double child = run("recc true, with metrics", iterations,
+                             {recc, "true"}, metricsEnv);
+
+    std::cout << "Time from starting recc to running the command: "
+              << passthrough - direct << " ms, " << child - direct
+              << " ms with metrics" << std::endl;
+    return 0;
+}
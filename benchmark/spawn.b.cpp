@@ -0,0 +1,103 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Compares the latency of running `true` with `Subprocess::execute()`, which
+// uses `posix_spawn()`, and with the `fork()` and `execvp()` it previously
+// used, as the resident memory of the parent process grows.
+//
+// Usage: spawn_benchmark [ITERATIONS [RSS_MIB...]]
+
+#include <subprocess.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace recc;
+
+namespace {
+
+// What `Subprocess::execute()` previously did, without the pipes
+int forkAndExec(const char *command)
+{
+    const pid_t pid = fork();
+    if (pid == 0) {
+        execlp(command, command, static_cast<char *>(nullptr));
+        _Exit(127);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    return WEXITSTATUS(status);
+}
+
+double run(int iterations, const std::function<int()> &spawn)
+{
+    std::vector<double> timings;
+    for (int i = 0; i < iterations; ++i) {
+        const auto start = std::chrono::steady_clock::now();
+        if (spawn() != 0) {
+            std::cerr << "Could not run `true`" << std::endl;
+            exit(1);
+        }
+        const auto end = std::chrono::steady_clock::now();
+        timings.push_back(
+            std::chrono::duration<double, std::milli>(end - start).count());
+    }
+    std::sort(timings.begin(), timings.end());
+    return timings[timings.size() / 2];
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    const int iterations = (argc > 1) ? std::atoi(argv[1]) : 100;
+    std::vector<size_t> rssSizes;
+    for (int i = 2; i < argc; ++i) {
+        rssSizes.push_back(std::strtoul(argv[i], nullptr, 10));
+    }
+    if (rssSizes.empty()) {
+        rssSizes = {0, 64, 256, 1024};
+    }
+    if (iterations <= 0) {
+        std::cerr << "Usage: " << argv[0] << " [ITERATIONS [RSS_MIB...]]"
+                  << std::endl;
+        return 1;
+    }
+
+    const std::vector<std::string> command = {"true"};
+    for (const size_t rssSize : rssSizes) {
+        // Touch every page so that it is resident
+        std::vector<char> memory(rssSize * 1024 * 1024);
+        for (size_t i = 0; i < memory.size(); i += 4096) {
+            memory[i] = 1;
+        }
+
+        const double forked =
+            run(iterations, []() { return forkAndExec("true"); });
+        const double spawned = run(iterations, [&command]() {
+            return Subprocess::execute(command).d_exitCode;
+        });
+        std::cout << rssSize << " MiB resident: fork() median " << forked
+                  << " ms, posix_spawn() median " << spawned << " ms"
+                  << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,170 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Compares the static partitioning previously used to build Merkle trees with
+// `ThreadPool::parallelFor()` on a skewed distribution of file sizes, where
+// most files are small headers and a few are very large. Hashing is simulated
+// by reading through an in-memory buffer.
+//
+// Usage: threadpool_benchmark [NUM_FILES [NUM_THREADS [ITERATIONS]]]
+
+#include <threadpool.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace recc;
+
+namespace {
+
+// Pareto-distributed sizes between 1 KiB and 64 MiB
+std::vector<size_t> generateFileSizes(size_t numFiles)
+{
+    std::mt19937_64 generator(42);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    const double alpha = 1.1;
+    const double minSize = 1024;
+    const double maxSize = 64.0 * 1024 * 1024;
+
+    std::vector<size_t> sizes;
+    for (size_t i = 0; i < numFiles; ++i) {
+        const double size = minSize / std::pow(1.0 - uniform(generator),
+                                               1.0 / alpha);
+        sizes.push_back(static_cast<size_t>(std::min(size, maxSize)));
+    }
+    // Large generated sources are typically next to each other in a list of
+    // dependencies sorted by name
+    std::sort(sizes.begin() + static_cast<long>(numFiles / 3),
+              sizes.begin() + static_cast<long>(numFiles / 2));
+    return sizes;
+}
+
+uint64_t hashFile(const std::vector<uint8_t> &contents, size_t size)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ contents[i % contents.size()]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+// The partitioning previously done by
+// `ThreadUtils::parallelizeContainerOperations()`: one range of the same
+// number of files per thread, on threads created for each call
+void staticPartitions(size_t numFiles, size_t numThreads,
+                      const std::function<void(size_t, size_t)> &work)
+{
+    const size_t filesPerThread = numFiles / numThreads;
+    std::vector<std::thread> threads;
+    size_t start = 0;
+    for (size_t t = 0; t + 1 < numThreads; ++t) {
+        threads.emplace_back(work, start, start + filesPerThread);
+        start += filesPerThread;
+    }
+    work(start, numFiles);
+    for (auto &thread : threads) {
+        thread.join();
+    }
+}
+
+void run(const std::string &name, int iterations,
+         const std::function<uint64_t()> &hashAll)
+{
+    std::vector<double> timings;
+    uint64_t checksum = 0;
+    for (int i = 0; i < iterations; ++i) {
+        const auto start = std::chrono::steady_clock::now();
+        checksum = hashAll();
+        const auto end = std::chrono::steady_clock::now();
+        timings.push_back(
+            std::chrono::duration<double, std::milli>(end - start).count());
+    }
+    std::sort(timings.begin(), timings.end());
+
+    std::cout << name << ": median " << timings[timings.size() / 2]
+              << " ms (checksum " << checksum << ")" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    const size_t numFiles =
+        (argc > 1) ? std::strtoul(argv[1], nullptr, 10) : 2000;
+    const size_t numThreads =
+        (argc > 2) ? std::strtoul(argv[2], nullptr, 10)
+                   : std::max(std::thread::hardware_concurrency(), 1u);
+    const int iterations = (argc > 3) ? std::atoi(argv[3]) : 5;
+    if (numFiles == 0 || numThreads == 0 || iterations <= 0) {
+        std::cerr << "Usage: " << argv[0]
+                  << " [NUM_FILES [NUM_THREADS [ITERATIONS]]]" << std::endl;
+        return 1;
+    }
+
+    const std::vector<size_t> sizes = generateFileSizes(numFiles);
+    std::vector<uint8_t> contents(1 << 20);
+    std::mt19937 generator(7);
+    for (auto &byte : contents) {
+        byte = static_cast<uint8_t>(generator());
+    }
+
+    uint64_t totalSize = 0;
+    for (const size_t size : sizes) {
+        totalSize += size;
+    }
+    std::cout << "Hashing " << numFiles << " files, "
+              << totalSize / (1024 * 1024) << " MiB in total, on "
+              << numThreads << " threads" << std::endl;
+
+    std::atomic<uint64_t> checksum(0);
+    const auto hashRange = [&](size_t begin, size_t end) {
+        uint64_t result = 0;
+        for (size_t i = begin; i < end; ++i) {
+            result ^= hashFile(contents, sizes[i]);
+        }
+        checksum ^= result;
+    };
+
+    run("static partitions", iterations, [&]() {
+        checksum = 0;
+        staticPartitions(numFiles, numThreads, hashRange);
+        return checksum.load();
+    });
+
+    ThreadPool pool(numThreads - 1);
+    run("thread pool, same cost", iterations, [&]() {
+        checksum = 0;
+        pool.parallelFor(
+            numFiles, [](size_t) -> uint64_t { return 1; }, hashRange);
+        return checksum.load();
+    });
+    run("thread pool, cost by size", iterations, [&]() {
+        checksum = 0;
+        pool.parallelFor(
+            numFiles, [&](size_t i) -> uint64_t { return 4096 + sizes[i]; },
+            hashRange);
+        return checksum.load();
+    });
+    return 0;
+}
@@ -16,16 +16,23 @@
 
 #include <digestgenerator.h>
 #include <env.h>
+#include <filedigestcache.h>
+#include <filehashqueue.h>
 #include <fileutils.h>
+#include <merkletreebuilder.h>
 #include <reccdefaults.h>
+#include <threadpool.h>
 #include <threadutils.h>
 
 #include <buildboxcommon_logging.h>
 #include <buildboxcommonmetrics_durationmetrictimer.h>
 #include <buildboxcommonmetrics_metricteeguard.h>
 
+#include <algorithm>
 #include <set>
+#include <sys/stat.h>
 #include <thread>
+#include <vector>
 
 #define TIMER_NAME_COMPILER_DEPS "recc.compiler_deps"
 #define TIMER_NAME_BUILD_MERKLE_TREE "recc.build_merkle_tree"
@@ -34,6 +41,10 @@ namespace recc {
 
 namespace {
 
+// Cost of adding a file to the Merkle tree besides hashing its contents, in
+// bytes hashed
+const uint64_t FILE_COST = 4096;
+
 // Do path replacement and normalize
 const std::string normalize_replace_root(const std::string &path)
 {
@@ -55,9 +66,25 @@ const std::string normalize_replace_root(const std::string &path)
     return normalizedReplacedRoot;
 }
 
+// Returns the path of a dependency in the input root, before it is made
+// relative to the working directory of the command
+std::string remoteDependencyPath(const std::string &dep,
+                                 const std::string &cwd)
+{
+    if (dep[0] != '/') {
+        return dep;
+    }
+    // Make path relative if needed
+    return FileUtils::rewritePathToRelative(
+        FileUtils::resolvePathFromPrefixMap(dep), cwd);
+}
+
+// Number of files that can be waiting to be hashed while the dependency
+// command runs, per thread
+const size_t PENDING_FILES_PER_THREAD = 64;
+
 } // unnamed namespace
 
-std::mutex ContainerWriteMutex;
 std::mutex LogWriteMutex;
 
 proto::Command ActionBuilder::populateCommandProto(
@@ -147,7 +174,7 @@ ActionBuilder::prefixWorkingDirectory(const std::string &workingDirectory,
 }
 
 std::string getMerklePath(const std::string &path, const std::string &cwd,
-                          buildboxcommon::NestedDirectory *nestedDirectory)
+                          std::vector<std::string> *directories)
 {
     // If this path is relative, prepend the remote cwd to it
     // and normalize it, getting rid of any '../' present
@@ -168,12 +195,8 @@ std::string getMerklePath(const std::string &path, const std::string &cwd,
         }
         if (dotdot != pos) {
             // `..` segment follows a segment that isn't `..`
-            std::string merkleDirectoryPath =
-                buildboxcommon::FileUtils::normalizePath(
-                    merklePath.substr(0, dotdot).c_str());
-
-            const std::lock_guard<std::mutex> lock(ContainerWriteMutex);
-            nestedDirectory->addDirectory(merkleDirectoryPath.c_str());
+            directories->push_back(buildboxcommon::FileUtils::normalizePath(
+                merklePath.substr(0, dotdot).c_str()));
         }
         // Set position right after the processed `..` segment
         pos = dotdot + strlen("/..");
@@ -194,48 +217,68 @@ std::string getMerklePath(const std::string &path, const std::string &cwd,
     return merklePath;
 }
 
-void addFileToMerkleTreeHelper(
-    const PathRewritePair &dep_paths, const std::string &cwd,
-    buildboxcommon::NestedDirectory *nestedDirectory,
-    buildboxcommon::digest_string_map *digest_to_filepaths)
+namespace {
+
+// A dependency ready to be added to the Merkle tree. Entries are filled in
+// parallel, each by the thread that hashed the file, and added to the tree
+// afterwards by a single thread, so that no lock is needed.
+struct MerkleTreeEntry {
+    // Empty if the path is excluded
+    std::string d_merklePath;
+    // Directories that must exist for the `..` segments of the original
+    // path to resolve
+    std::vector<std::string> d_directories;
+    buildboxcommon::File d_file;
+    const std::string *d_sourcePath = nullptr;
+};
+
+void prepareMerkleTreeEntry(const PathRewritePair &dep_paths,
+                            const std::string &cwd,
+                            FileDigestCache *fileDigestCache,
+                            FileHashQueue *hashQueue, MerkleTreeEntry *entry)
 {
-    const std::string merklePath =
-        getMerklePath(dep_paths.second, cwd, nestedDirectory);
-    if (merklePath.empty()) {
+    entry->d_merklePath =
+        getMerklePath(dep_paths.second, cwd, &entry->d_directories);
+    if (entry->d_merklePath.empty()) {
         // Path is excluded
         return;
     }
 
     // This follows symlinks
-    const auto file = buildboxcommon::File(dep_paths.first.c_str());
-
-    {
-        const std::lock_guard<std::mutex> lock(ContainerWriteMutex);
-        nestedDirectory->add(file, merklePath.c_str());
-        (*digest_to_filepaths)[file.d_digest] = dep_paths.first;
-    }
+    if (hashQueue == nullptr ||
+        !hashQueue->take(dep_paths.first, &entry->d_file)) {
+        entry->d_file =
+            fileDigestCache != nullptr
+                ? fileDigestCache->getFile(dep_paths.first)
+                : DigestGenerator::make_file_digest(dep_paths.first);
+    }
+    entry->d_sourcePath = &dep_paths.first;
 }
 
-void addDirectoryToMerkleTreeHelper(
-    const std::string &path, const std::string &cwd,
-    buildboxcommon::NestedDirectory *nestedDirectory)
+} // unnamed namespace
+
+void addDirectoryToMerkleTreeHelper(const std::string &path,
+                                    const std::string &cwd,
+                                    MerkleTreeBuilder *merkleTree)
 {
-    const std::string merklePath = getMerklePath(path, cwd, nestedDirectory);
+    std::vector<std::string> directories;
+    const std::string merklePath = getMerklePath(path, cwd, &directories);
+    for (const auto &directory : directories) {
+        merkleTree->addDirectory(directory);
+    }
     if (merklePath.empty()) {
         // Path is excluded
         return;
     }
 
-    {
-        const std::lock_guard<std::mutex> lock(ContainerWriteMutex);
-        nestedDirectory->addDirectory(merklePath.c_str());
-    }
+    merkleTree->addDirectory(merklePath);
 }
 
 void ActionBuilder::buildMerkleTree(
     DependencyPairs &dependency_paths, const std::string &cwd,
-    buildboxcommon::NestedDirectory *nestedDirectory,
-    buildboxcommon::digest_string_map *digest_to_filepaths)
+    MerkleTreeBuilder *merkleTree,
+    buildboxcommon::digest_string_map *digest_to_filepaths,
+    FileHashQueue *hashQueue)
 { // Timed function
     buildboxcommon::buildboxcommonmetrics::MetricTeeGuard<
         buildboxcommon::buildboxcommonmetrics::DurationMetricTimer>
@@ -243,16 +286,42 @@ void ActionBuilder::buildMerkleTree(
 
     BUILDBOX_LOG_DEBUG("Building Merkle tree");
 
+    // Each dependency has its own entry, so threads never write to the same
+    // memory
+    std::vector<MerkleTreeEntry> entries(dependency_paths.size());
+    const auto firstDependency = dependency_paths.begin();
     std::function<void(DependencyPairs::iterator, DependencyPairs::iterator)>
         createMerkleTreeFromIterators = [&](DependencyPairs::iterator start,
                                             DependencyPairs::iterator end) {
             for (; start != end; ++start) {
-                addFileToMerkleTreeHelper(*start, cwd, nestedDirectory,
-                                          digest_to_filepaths);
+                prepareMerkleTreeEntry(
+                    *start, cwd, d_fileDigestCache, hashQueue,
+                    &entries[static_cast<size_t>(start - firstDependency)]);
             }
         };
-    ThreadUtils::parallelizeContainerOperations(dependency_paths,
-                                                createMerkleTreeFromIterators);
+    // Hashing dominates, so balance the work between threads by file size
+    const std::function<uint64_t(const PathRewritePair &)> hashingCost =
+        [](const PathRewritePair &dep_paths) -> uint64_t {
+        struct stat statResult;
+        if (stat(dep_paths.first.c_str(), &statResult) != 0) {
+            return FILE_COST;
+        }
+        return FILE_COST + static_cast<uint64_t>(statResult.st_size);
+    };
+    ThreadUtils::parallelizeContainerOperations(
+        dependency_paths, createMerkleTreeFromIterators, hashingCost);
+
+    for (const auto &entry : entries) {
+        for (const auto &directory : entry.d_directories) {
+            merkleTree->addDirectory(directory);
+        }
+        if (entry.d_merklePath.empty()) {
+            continue;
+        }
+        merkleTree->addFile(entry.d_merklePath, entry.d_file.d_digest,
+                            entry.d_file.d_executable);
+        (*digest_to_filepaths)[entry.d_file.d_digest] = *entry.d_sourcePath;
+    }
 }
 
 /*
@@ -392,7 +461,9 @@ ActionBuilder::prepareRemoteEnv(const ParsedCommand &command)
 
 void ActionBuilder::getDependencies(const ParsedCommand &command,
                                     std::set<std::string> *dependencies,
-                                    std::set<std::string> *products)
+                                    std::set<std::string> *products,
+                                    FileHashQueue *hashQueue,
+                                    const std::string &cwd)
 {
 
     BUILDBOX_LOG_DEBUG("Getting dependencies using the command:");
@@ -415,9 +486,27 @@ void ActionBuilder::getDependencies(const ParsedCommand &command,
             buildboxcommon::buildboxcommonmetrics::DurationMetricTimer>
             mt(TIMER_NAME_COMPILER_DEPS, d_durationMetricCallback);
              BUILDBOX_LOG_DEBUG("ABOVE FILEINFO OF DEPS7777");
-        fileInfo = Deps::get_file_info(command);
+        Deps::DependencyCallback onDependency;
+        if (hashQueue != nullptr) {
+            // Start hashing the files that will be in the input root while
+            // the compiler is still reporting dependencies
+            onDependency = [hashQueue, &cwd](const std::string &dep) {
+                const std::string remotePath = remoteDependencyPath(dep, cwd);
+                if ((remotePath[0] != '/' || RECC_DEPS_GLOBAL_PATHS) &&
+                    !FileUtils::hasPathPrefixes(remotePath,
+                                                RECC_DEPS_EXCLUDE_PATHS)) {
+                    hashQueue->push(dep);
+                }
+            };
+        }
+        fileInfo = Deps::get_file_info(command, onDependency);
          BUILDBOX_LOG_DEBUG("AFTER FILEINFO OF DEPS7777");
     }
+    if (hashQueue != nullptr) {
+        // Files are only pushed while the dependency command runs, so all
+        // the hashing so far overlapped with it
+        d_depsHashingOverlap = hashQueue->busyTime();
+    }
 
     *dependencies = fileInfo.d_dependencies;
 
@@ -431,23 +520,20 @@ std::shared_ptr<proto::Action> ActionBuilder::BuildAction(
     const ParsedCommand &command, const std::string &cwd,
     buildboxcommon::digest_string_map *blobs,
     buildboxcommon::digest_string_map *digest_to_filepaths,
-    std::set<std::string> *productsPtr)
+    std::set<std::string> *productsPtr,
+    std::set<std::string> *dependenciesPtr)
 {
     if (!command.is_compiler_command() && !RECC_FORCE_REMOTE) {
         return nullptr;
     }
 
+    d_depsHashingOverlap = std::chrono::microseconds(0);
     std::string commandWorkingDirectory;
-    buildboxcommon::NestedDirectory nestedDirectory;
+    MerkleTreeBuilder merkleTree(d_subtreeDigestCache);
 
     std::set<std::string> products = RECC_OUTPUT_FILES_OVERRIDE;
     if (!RECC_DEPS_DIRECTORY_OVERRIDE.empty()) {
         BUILDBOX_LOG_DEBUG("Building Merkle tree using directory override");
-        // When RECC_DEPS_DIRECTORY_OVERRIDE is set, we will not follow
-        // symlinks to help us avoid getting into an endless loop.
-        nestedDirectory = buildboxcommon::make_nesteddirectory(
-            RECC_DEPS_DIRECTORY_OVERRIDE.c_str(), digest_to_filepaths, false);
-
         const auto replacedRoot =
             normalize_replace_root(RECC_DEPS_DIRECTORY_OVERRIDE);
 
@@ -456,24 +542,34 @@ std::shared_ptr<proto::Action> ActionBuilder::BuildAction(
                            << "] to normalized-relative (if)updated: ["
                            << replacedRoot << "]");
 
-        // Create parent directory structure based on the normalized/replaced
-        // path.
-        const auto pathComponents = FileUtils::parseDirectories(replacedRoot);
-        for (auto it = pathComponents.rbegin(); it != pathComponents.rend();
-             it++) {
-            auto parentDirectory = buildboxcommon::NestedDirectory();
-            parentDirectory.d_subdirs->emplace(*it,
-                                               std::move(nestedDirectory));
-            nestedDirectory = std::move(parentDirectory);
+        // Place the directory contents under the normalized/replaced path.
+        // When RECC_DEPS_DIRECTORY_OVERRIDE is set, we will not follow
+        // symlinks to help us avoid getting into an endless loop.
+        std::string merklePath;
+        for (const auto &component :
+             FileUtils::parseDirectories(replacedRoot)) {
+            merklePath += (merklePath.empty() ? "" : "/") + component;
         }
+        merkleTree.addLocalDirectory(RECC_DEPS_DIRECTORY_OVERRIDE, merklePath,
+                                     digest_to_filepaths);
 
         commandWorkingDirectory = RECC_WORKING_DIR_PREFIX;
     }
     else {
         std::set<std::string> deps;
+        std::unique_ptr<FileHashQueue> hashQueue;
         if (RECC_DEPS_OVERRIDE.empty() && !RECC_FORCE_REMOTE) {
+            // Hash files while the dependency command runs if there are
+            // threads to do it
+            ThreadPool &pool = ThreadPool::defaultPool();
+            if (RECC_MAX_THREADS != 0 && pool.numWorkers() > 0) {
+                hashQueue = std::make_unique<FileHashQueue>(
+                    &pool, d_fileDigestCache,
+                    (pool.numWorkers() + 1) * PENDING_FILES_PER_THREAD);
+            }
             try {
-                getDependencies(command, &deps, &products);
+                getDependencies(command, &deps, &products, hashQueue.get(),
+                                cwd);
 
                  BUILDBOX_LOG_DEBUG("Running DEPEnDencies"<<&deps);
                 // If no dependencies are found, there won't be any input files
@@ -506,17 +602,17 @@ std::shared_ptr<proto::Action> ActionBuilder::BuildAction(
             // std::cout << "result in SET :" << deps;
         }
 
+        if (dependenciesPtr != nullptr) {
+            *dependenciesPtr = deps;
+        }
+
         // Go through all the dependencies and apply any required path
         // transformations, constructing DependencyParis
         // corresponding to filesystem path -> transformed merkle tree path
         DependencyPairs dep_path_pairs;
         for (const auto &dep : deps) {
-            std::string modifiedDep(dep);
-            if (modifiedDep[0] == '/') {
-                modifiedDep = FileUtils::resolvePathFromPrefixMap(modifiedDep);
-                // Make path relative if needed
-                modifiedDep =
-                    FileUtils::rewritePathToRelative(modifiedDep, cwd);
+            const std::string modifiedDep = remoteDependencyPath(dep, cwd);
+            if (dep[0] == '/') {
                      BUILDBOX_LOG_DEBUG("in a print path"<<dep);
                 BUILDBOX_LOG_DEBUG("Mapping local path: ["
                                    << dep << "] to remote path: ["
@@ -538,20 +634,20 @@ std::shared_ptr<proto::Action> ActionBuilder::BuildAction(
                 commonAncestor, RECC_WORKING_DIR_PREFIX);
         }
 
-        buildMerkleTree(dep_path_pairs, commandWorkingDirectory,
-                        &nestedDirectory, digest_to_filepaths);
+        buildMerkleTree(dep_path_pairs, commandWorkingDirectory, &merkleTree,
+                        digest_to_filepaths, hashQueue.get());
     }
 
     if (!commandWorkingDirectory.empty()) {
         commandWorkingDirectory = buildboxcommon::FileUtils::normalizePath(
             commandWorkingDirectory.c_str());
-        nestedDirectory.addDirectory(commandWorkingDirectory.c_str());
+        merkleTree.addDirectory(commandWorkingDirectory);
     }
 
     if (command.d_upload_all_include_dirs) {
         for (const auto &include_dir : command.d_includeDirs) {
             addDirectoryToMerkleTreeHelper(
-                include_dir, commandWorkingDirectory, &nestedDirectory);
+                include_dir, commandWorkingDirectory, &merkleTree);
         }
     }
 
@@ -567,7 +663,7 @@ std::shared_ptr<proto::Action> ActionBuilder::BuildAction(
         }
     }
 
-    const auto directoryDigest = nestedDirectory.to_digest(blobs);
+    const auto directoryDigest = merkleTree.build(blobs);
 
     std::map<std::string, std::string> remoteEnv = prepareRemoteEnv(command);
     const proto::Command commandProto = generateCommandProto(
@@ -622,7 +718,10 @@ ActionBuilder::generateCommandProto(
 }
 
 ActionBuilder::ActionBuilder(
-    const WriteMetricCallback &duration_metric_callback)
+    const WriteMetricCallback &duration_metric_callback,
+    FileDigestCache *fileDigestCache, SubtreeDigestCache *subtreeDigestCache)
+    : d_fileDigestCache(fileDigestCache),
+      d_subtreeDigestCache(subtreeDigestCache), d_depsHashingOverlap(0)
 {
     if (duration_metric_callback == nullptr) {
         // no-op callback
@@ -21,12 +21,17 @@
 #include <buildboxcommon_merklize.h>
 #include <buildboxcommonmetrics_durationmetricvalue.h>
 
+#include <chrono>
 #include <memory>
 #include <unordered_map>
 
 namespace recc {
 
-extern std::mutex ContainerWriteMutex;
+class FileDigestCache;
+class FileHashQueue;
+class MerkleTreeBuilder;
+class SubtreeDigestCache;
+
 extern std::mutex LogWriteMutex;
 
 // Path to file on disk and it's associated location
@@ -41,10 +46,20 @@ class ActionBuilder {
         buildboxcommon::buildboxcommonmetrics::DurationMetricValue)>
         WriteMetricCallback;
     WriteMetricCallback d_durationMetricCallback;
+    FileDigestCache *d_fileDigestCache;
+    SubtreeDigestCache *d_subtreeDigestCache;
+    std::chrono::microseconds d_depsHashingOverlap;
 
   public:
+    /**
+     * If `fileDigestCache` is set, it is used to look up the digests of the
+     * input files instead of hashing them. Likewise, `subtreeDigestCache` is
+     * used to look up the directories of the input root.
+     */
     ActionBuilder(
-        const WriteMetricCallback &duration_metric_callback = nullptr);
+        const WriteMetricCallback &duration_metric_callback = nullptr,
+        FileDigestCache *fileDigestCache = nullptr,
+        SubtreeDigestCache *subtreeDigestCache = nullptr);
 
     /**
      * Build an `Action` from the given `ParsedCommand` and working directory.
@@ -56,12 +71,32 @@ class ActionBuilder {
      *
      * `digest_to_filepaths` and `blobs` are used to store parsed input and
      * output files, which will get uploaded to CAS by the caller.
+     *
+     * If `dependencies` is set, it is populated with the local paths of the
+     * dependencies reported by the dependency command (including ones that
+     * are excluded from the input root).
      */
     std::shared_ptr<proto::Action>
     BuildAction(const ParsedCommand &command, const std::string &cwd,
                 buildboxcommon::digest_string_map *digest_to_filepaths,
                 buildboxcommon::digest_string_map *blobs,
-                std::set<std::string> *products = nullptr);
+                std::set<std::string> *products = nullptr,
+                std::set<std::string> *dependencies = nullptr);
+
+    /**
+     * Returns the wall time during which input files were hashed while the
+     * dependency command of the last `BuildAction()` call was still running.
+     */
+    std::chrono::microseconds depsHashingOverlap() const
+    {
+        return d_depsHashingOverlap;
+    }
+
+    /**
+     * Prepare the remote environment.
+     */
+    static std::map<std::string, std::string>
+    prepareRemoteEnv(const ParsedCommand &command);
 
   protected: // for unit testing
     static proto::Command generateCommandProto(
@@ -91,24 +126,31 @@ class ActionBuilder {
      * Given a vector of filesystem -> Merkle path pairs to dependency and
      * output files, builds a Merkle tree.
      *
-     * Adds the files to `buildboxcommon::NestedDirectory` and
-     * `digest_to_filepaths`.
+     * Adds the files to `merkleTree` and `digest_to_filepaths`. Files
+     * already hashed in `hashQueue`, if set, are not hashed again.
      *
      * If necessary, modifies the contents of `commandWorkingDirectory`.
      */
     void
     buildMerkleTree(DependencyPairs &deps_paths, const std::string &cwd,
-                    buildboxcommon::NestedDirectory *nestedDirectory,
-                    buildboxcommon::digest_string_map *digest_to_filepaths);
+                    MerkleTreeBuilder *merkleTree,
+                    buildboxcommon::digest_string_map *digest_to_filepaths,
+                    FileHashQueue *hashQueue = nullptr);
 
     /**
      * Gathers the `CommandFileInfo` belonging to the given `command` and
      * populates its dependency and product list (the latter only if no
      * overrides are set).
+     *
+     * If `hashQueue` is set, the dependencies that will be part of the input
+     * root are pushed to it as soon as the dependency command reports them.
+     * `cwd` is the current working directory.
      */
     void getDependencies(const ParsedCommand &command,
                          std::set<std::string> *dependencies,
-                         std::set<std::string> *products);
+                         std::set<std::string> *products,
+                         FileHashQueue *hashQueue = nullptr,
+                         const std::string &cwd = "");
 
     /** Scans the list of dependencies and output files and strips
      * `workingDirectory` to the level of the common ancestor. For
@@ -132,12 +174,6 @@ class ActionBuilder {
      */
     static void populateRemoteEnvWithNonReccVars(
         const char *const *env, std::map<std::string, std::string> *remoteEnv);
-
-    /**
-     * Prepare the remote environment.
-     */
-    static std::map<std::string, std::string>
-    prepareRemoteEnv(const ParsedCommand &command);
 };
 
 } // namespace recc
@@ -23,12 +23,18 @@
 #include <buildboxcommon_grpcerror.h>
 #include <buildboxcommon_logging.h>
 
+#include <daemonclient.h>
 #include <digestgenerator.h>
 #include <env.h>
 #include <executioncontext.h>
+#include <fileutils.h>
+#include <jobserver.h>
+#include <parsedcommandfactory.h>
 #include <reccdefaults.h>
 #include <remoteexecutionsignals.h>
 #include <requestmetadata.h>
+#include <subprocess.h>
+#include <threadpool.h>
 
 using namespace recc;
 
@@ -51,6 +57,8 @@ const std::string HELP(
     "behavior. To set them in a recc.conf file, omit the \"RECC_\" prefix.\n"
     "\n"
     "RECC_SERVER - the URI of the server to use (e.g. http://localhost:8085)\n"
+    "              or, in cache-only mode, file:///path of a directory\n"
+    "              shared as action cache and CAS\n"
     "\n"
     "RECC_CAS_SERVER - the URI of the CAS server to use (by default, \n"
     "                  uses RECC_ACTION_CACHE_SERVER if set. Else "
@@ -153,6 +161,12 @@ const std::string HELP(
     "RECC_DEPS_ENV_[var] - sets [var] for local dependency detection\n"
     "                      commands\n"
     "\n"
+    "RECC_DEPS_SCANNER - how to determine the dependencies of compile\n"
+    "                    commands: \"compiler\" runs the compiler's\n"
+    "                    dependency command, \"native\" scans #include\n"
+    "                    directives in-process and falls back to the\n"
+    "                    compiler when needed (default: \"compiler\")\n"
+    "\n"
     "RECC_PRESERVE_ENV - if set to any value, preserve all non-recc \n"
     "                    environment variables in the remote"
     "\n"
@@ -193,9 +207,67 @@ const std::string HELP(
     "\n\n"
     "RECC_WORKING_DIR_PREFIX - directory to prefix the command's working\n"
     "                          directory, and input paths relative to it\n"
+    "RECC_DIRECT_MODE - if set to any value, record the dependencies of\n"
+    "                   compile commands in local manifests and use them\n"
+    "                   to look up the action cache without running the\n"
+    "                   dependency command when none of them changed\n"
+    "RECC_FILE_DIGEST_CACHE - if set to any value, cache the digests of\n"
+    "                         input files in RECC_CACHE_DIR, keyed by their\n"
+    "                         inode, size and timestamps, so that unchanged\n"
+    "                         files are not hashed again\n"
+    "RECC_SUBTREE_DIGEST_CACHE - if set to any value, cache the serialized\n"
+    "                            directories of input roots and their\n"
+    "                            digests in RECC_CACHE_DIR, so that\n"
+    "                            unchanged subtrees are not serialized\n"
+    "                            and hashed again\n"
+    "RECC_CAS_PRESENCE_CACHE - if set to any value, cache the digests of\n"
+    "                          blobs found in the CAS in RECC_CACHE_DIR, so\n"
+    "                          that they are not queried again\n"
+    "RECC_CAS_PRESENCE_CACHE_TTL - how long, in seconds, blobs found in the\n"
+    "                              CAS are assumed to stay there\n"
+    "                              (default 600)\n"
+    "RECC_CAS_PRESENCE_CACHE_VERIFY - on average, one in this many uploads\n"
+    "                                 checks all digests with the CAS\n"
+    "                                 (default 50, 0 to disable)\n"
+    "RECC_SPECULATIVE_FIND_MISSING_BLOBS - if set to any value, query the\n"
+    "                                      blobs missing from the CAS\n"
+    "                                      while querying the action cache\n"
+    "RECC_EXECUTE_LIMIT - maximum number of remote executions in flight\n"
+    "                     across recc processes using the same server,\n"
+    "                     lowered when the server is overloaded\n"
+    "                     (default 0, no limit)\n"
+    "RECC_EXECUTE_QUEUE_TARGET_MS - actions queued by the server for\n"
+    "                               longer than this lower the limit\n"
+    "                               (default 1000)\n"
+    "RECC_LOCAL_CAS_MAX_SIZE_MB - maximum size, in megabytes, of a cache\n"
+    "                             of outputs in RECC_CACHE_DIR shared by\n"
+    "                             recc processes, so that they are not\n"
+    "                             fetched again (default 0, disabled)\n"
+    "RECC_LOCAL_CAS_HARDLINKS - if set to any value, write outputs that\n"
+    "                           are not executable as read-only hard\n"
+    "                           links to the local CAS\n"
+    "RECC_LOCAL_ACTION_CACHE - if set to any value, keep the results of\n"
+    "                          actions in RECC_CACHE_DIR and look them up\n"
+    "                          there before querying the action cache\n"
+    "RECC_LOCAL_ACTION_CACHE_TTL - how long, in seconds, results in the\n"
+    "                              local action cache are used\n"
+    "                              (default 600)\n"
+    "RECC_LOCAL_ACTION_CACHE_VERIFY - if set to any value, check that the\n"
+    "                                 outputs of local action cache hits\n"
+    "                                 are still in the CAS\n"
+    "RECC_FILE_CACHE_MAX_SIZE_MB - maximum size, in megabytes, of the cache\n"
+    "                              directories given as file:// URLs\n"
+    "                              (default 10240)\n"
+    "RECC_DAEMON_SOCKET - Unix socket of a reccd to run commands in, so\n"
+    "                     that connections and caches are kept between\n"
+    "                     invocations. Only read from the environment\n"
+    "RECC_CACHE_DIR - directory for local caches (default:\n"
+    "                 $XDG_CACHE_HOME/recc or $HOME/.cache/recc)\n"
     "RECC_MAX_THREADS -   Allow some operations to utilize multiple cores."
     "Default: 4 \n"
     "                     A value of -1 specifies use all available cores.\n"
+    "                     Ignored when run by GNU make with a jobserver:\n"
+    "                     threads then take job slots from make.\n"
     "RECC_REAPI_VERSION - Version of the Remote Execution API to use. "
     "(Default: \"" DEFAULT_RECC_REAPI_VERSION "\")\n"
     "                     Supported values: " +
@@ -259,8 +331,65 @@ int main(int argc, char *argv[])
     }
     
 
+    // Commands that aren't compile commands are run locally. Unless that
+    // needs more than running them, replace this process with the command
+    // rather than setting everything up to wait for it in a child process.
+    bool configParsed = false;
+    try {
+        const std::string cwd = FileUtils::getCurrentWorkingDirectory();
+        const auto command =
+            ParsedCommandFactory::createParsedCommand(&argv[1], cwd.c_str());
+        if (!command.is_compiler_command()) {
+            try {
+                Env::set_config_locations();
+                Env::parse_config_variables();
+            }
+            catch (const std::invalid_argument &e) {
+                BUILDBOX_LOG_ERROR("Error parsing config: " << e.what());
+                throw;
+            }
+            configParsed = true;
+
+            if (!RECC_FORCE_REMOTE && !RECC_NO_EXECUTE &&
+                !RECC_ENABLE_METRICS) {
+                BUILDBOX_LOG_INFO(
+                    "Not a compiler command, so running locally. (Use "
+                    "RECC_FORCE_REMOTE=1 to force remote execution)");
+                return Subprocess::replaceProcess(
+                    ParsedCommandFactory::vectorFromArgv(&argv[1]));
+            }
+        }
+    }
+    catch (const std::invalid_argument &e) {
+        return RC_USAGE;
+    }
+    catch (const std::exception &e) {
+        return RC_EXEC_FAILURE;
+    }
+
+    // Let a daemon with the same configuration run the command if there is
+    // one. Interrupting this process closes the connection, which cancels
+    // the command.
+    const char *daemonSocket = getenv("RECC_DAEMON_SOCKET");
+    if (daemonSocket != nullptr && daemonSocket[0] != '\0') {
+        try {
+            int exitCode;
+            if (DaemonClient::execute(daemonSocket, argc - 1, &argv[1],
+                                      &exitCode)) {
+                return exitCode;
+            }
+        }
+        catch (const std::exception &e) {
+            BUILDBOX_LOG_ERROR(e.what());
+            return RC_EXEC_FAILURE;
+        }
+    }
+
     Signal::setup_signal_handler(SIGINT, setSigintReceived);
 
+    // When run by make, threads beyond this one need a job slot
+    ThreadPool::setDefaultJobServer(JobServer::fromEnvironment());
+
     try {
         // Parsing of recc options is complete. The remaining arguments are the
         // compiler command line.
@@ -273,6 +402,9 @@ int main(int argc, char *argv[])
         }*/
         ExecutionContext context;
         context.setStopToken(s_sigintReceived);
+        if (configParsed) {
+            context.setConfigParsed();
+        }
         return context.execute(argc - 1, &argv[1]);
     }
     catch (const std::invalid_argument &e) {
@@ -0,0 +1,149 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// bin/reccd.cpp
+//
+// Runs the commands of `recc` clients, keeping connections to the servers
+// open between them.
+
+#include <algorithm>
+#include <iostream>
+#include <signal.h>
+#include <string>
+#include <thread>
+
+#include <buildboxcommon_grpcerror.h>
+#include <buildboxcommon_logging.h>
+
+#include <daemonserver.h>
+#include <env.h>
+#include <executioncontext.h>
+#include <remoteexecutionsignals.h>
+
+using namespace recc;
+
+namespace {
+
+const std::string HELP(
+    "USAGE: reccd [--workers=N]\n"
+    "\n"
+    "Listens on the Unix socket at RECC_DAEMON_SOCKET and runs the commands\n"
+    "of recc invocations that have the same configuration, up to N at a\n"
+    "time (default: the number of cores). recc runs commands itself when\n"
+    "no daemon is listening or when its configuration differs.\n"
+    "\n"
+    "reccd reads the same configuration as recc, see \"recc --help\".");
+
+// Same as `recc`
+enum ReturnCode {
+    RC_OK = 0,
+    RC_USAGE = 100,
+    RC_EXEC_FAILURE = 101,
+    RC_GRPC_ERROR = 102
+};
+
+} // namespace
+
+static std::atomic_bool s_stopRequested(false);
+
+static void setStopRequested(int) { s_stopRequested = true; }
+
+int main(int argc, char *argv[])
+{
+    Env::setup_logger_from_environment(argv[0]);
+
+    int numWorkers = static_cast<int>(std::thread::hardware_concurrency());
+    for (int i = 1; i < argc; ++i) {
+        const std::string argument = argv[i];
+        if (argument == "--help" || argument == "-h") {
+            std::cout << HELP << std::endl;
+            return RC_OK;
+        }
+        else if (argument.compare(0, 10, "--workers=") == 0) {
+            try {
+                numWorkers = std::stoi(argument.substr(10));
+            }
+            catch (const std::exception &) {
+                numWorkers = 0;
+            }
+            if (numWorkers <= 0) {
+                std::cerr << "reccd: invalid number of workers '"
+                          << argument.substr(10) << "'" << std::endl;
+                return RC_USAGE;
+            }
+        }
+        else {
+            std::cerr << "reccd: unrecognized option '" << argument << "'"
+                      << std::endl;
+            std::cerr << HELP << std::endl;
+            return RC_USAGE;
+        }
+    }
+    numWorkers = std::max(numWorkers, 1);
+
+    const char *socketPath = getenv("RECC_DAEMON_SOCKET");
+    if (socketPath == nullptr || socketPath[0] == '\0') {
+        std::cerr << "reccd: RECC_DAEMON_SOCKET is not set" << std::endl;
+        return RC_USAGE;
+    }
+
+    // Report configuration errors now rather than to each client
+    try {
+        Env::set_config_locations();
+        Env::parse_config_variables();
+    }
+    catch (const std::exception &e) {
+        BUILDBOX_LOG_ERROR("Error parsing config: " << e.what());
+        return RC_USAGE;
+    }
+
+    // Each worker gets its own copy, set up by its first remote command
+    ExecutionContext::GrpcClients grpcClients;
+    const auto runCommand = [&grpcClients](
+                                int commandArgc, char *commandArgv[],
+                                const std::atomic_bool &stopRequested) {
+        try {
+            ExecutionContext context;
+            context.setStopToken(stopRequested);
+            context.setGrpcClients(&grpcClients);
+            return context.execute(commandArgc, commandArgv);
+        }
+        catch (const std::invalid_argument &e) {
+            return static_cast<int>(RC_USAGE);
+        }
+        catch (const buildboxcommon::GrpcError &e) {
+            if (e.status.error_code() == grpc::StatusCode::CANCELLED) {
+                return 130; // Ctrl+C exit code
+            }
+            return static_cast<int>(RC_GRPC_ERROR);
+        }
+        catch (const std::exception &e) {
+            return static_cast<int>(RC_EXEC_FAILURE);
+        }
+    };
+
+    try {
+        DaemonServer server(runCommand);
+        server.listen(socketPath);
+
+        Signal::setup_signal_handler(SIGINT, setStopRequested);
+        Signal::setup_signal_handler(SIGTERM, setStopRequested);
+        server.run(numWorkers, s_stopRequested);
+    }
+    catch (const std::exception &e) {
+        BUILDBOX_LOG_ERROR(e.what());
+        return RC_EXEC_FAILURE;
+    }
+    return RC_OK;
+}
@@ -0,0 +1,687 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <blake3.h>
+
+#include <cpufeatures.h>
+#include <threadpool.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <future>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define RECC_BLAKE3_AVX2
+#include <immintrin.h>
+#endif
+
+namespace recc {
+
+const size_t Blake3::DIGEST_SIZE;
+
+namespace {
+
+const uint32_t IV[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+// Order in which the words of the block are used by each round
+const uint8_t MESSAGE_SCHEDULE[7][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8},
+    {3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1},
+    {10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6},
+    {12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4},
+    {9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7},
+    {11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13}};
+
+enum Flags : uint8_t {
+    CHUNK_START = 1,
+    CHUNK_END = 2,
+    PARENT = 4,
+    ROOT = 8
+};
+
+const size_t BLOCK_SIZE = 64;
+const size_t CHUNK_SIZE = 1024;
+const size_t BLOCKS_PER_CHUNK = CHUNK_SIZE / BLOCK_SIZE;
+const size_t CV_SIZE = 32;
+const size_t LANES = 8;
+
+// Subtrees of up to this many chunks are hashed by computing the chaining
+// values of all their chunks and then of their parents, level by level
+const size_t MAX_FLAT_SUBTREE_CHUNKS = 64;
+
+// Subtrees larger than this are split between threads
+const size_t MIN_PARALLEL_SUBTREE_SIZE = 256 * 1024;
+
+// Enough chaining values for 2^54 chunks, the maximum input size
+const size_t MAX_STACK_DEPTH = 54;
+
+uint32_t loadLittleEndian(const uint8_t *bytes)
+{
+    return static_cast<uint32_t>(bytes[0]) |
+           (static_cast<uint32_t>(bytes[1]) << 8) |
+           (static_cast<uint32_t>(bytes[2]) << 16) |
+           (static_cast<uint32_t>(bytes[3]) << 24);
+}
+
+void storeLittleEndian(uint32_t word, uint8_t *bytes)
+{
+    bytes[0] = static_cast<uint8_t>(word);
+    bytes[1] = static_cast<uint8_t>(word >> 8);
+    bytes[2] = static_cast<uint8_t>(word >> 16);
+    bytes[3] = static_cast<uint8_t>(word >> 24);
+}
+
+void storeChainingValue(const uint32_t cv[8], uint8_t *bytes)
+{
+    for (size_t i = 0; i < 8; ++i) {
+        storeLittleEndian(cv[i], bytes + 4 * i);
+    }
+}
+
+uint32_t rotateRight(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+inline void mix(uint32_t v[16], size_t a, size_t b, size_t c, size_t d,
+                uint32_t x, uint32_t y)
+{
+    v[a] = v[a] + v[b] + x;
+    v[d] = rotateRight(v[d] ^ v[a], 16);
+    v[c] = v[c] + v[d];
+    v[b] = rotateRight(v[b] ^ v[c], 12);
+    v[a] = v[a] + v[b] + y;
+    v[d] = rotateRight(v[d] ^ v[a], 8);
+    v[c] = v[c] + v[d];
+    v[b] = rotateRight(v[b] ^ v[c], 7);
+}
+
+/**
+ * Compresses one block into the chaining value `cv`.
+ */
+void compress(uint32_t cv[8], const uint8_t *block, uint32_t blockSize,
+              uint64_t counter, uint8_t flags)
+{
+    uint32_t m[16];
+    for (size_t i = 0; i < 16; ++i) {
+        m[i] = loadLittleEndian(block + 4 * i);
+    }
+    uint32_t v[16] = {cv[0],
+                      cv[1],
+                      cv[2],
+                      cv[3],
+                      cv[4],
+                      cv[5],
+                      cv[6],
+                      cv[7],
+                      IV[0],
+                      IV[1],
+                      IV[2],
+                      IV[3],
+                      static_cast<uint32_t>(counter),
+                      static_cast<uint32_t>(counter >> 32),
+                      blockSize,
+                      flags};
+    for (const auto &s : MESSAGE_SCHEDULE) {
+        mix(v, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+        mix(v, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+        mix(v, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+        mix(v, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+        mix(v, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+        mix(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+        mix(v, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+        mix(v, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+    }
+    for (size_t i = 0; i < 8; ++i) {
+        cv[i] = v[i] ^ v[i + 8];
+    }
+}
+
+/**
+ * Hashes one input of `blocks` whole blocks into the chaining value at
+ * `out`, adding `startFlag` to the flags of the first block and `endFlag`
+ * to those of the last.
+ */
+void hashOne(const uint8_t *input, size_t blocks, uint64_t counter,
+             uint8_t flags, uint8_t startFlag, uint8_t endFlag, uint8_t *out)
+{
+    uint32_t cv[8];
+    std::copy(IV, IV + 8, cv);
+    uint8_t blockFlags = flags | startFlag;
+    for (size_t b = 0; b < blocks; ++b) {
+        if (b + 1 == blocks) {
+            blockFlags |= endFlag;
+        }
+        compress(cv, input + b * BLOCK_SIZE, BLOCK_SIZE, counter, blockFlags);
+        blockFlags = flags;
+    }
+    storeChainingValue(cv, out);
+}
+
+#ifdef RECC_BLAKE3_AVX2
+
+// Compiled for AVX2 regardless of the flags of the build, and only called
+// after checking that the CPU supports it
+#define RECC_TARGET_AVX2 __attribute__((target("avx2")))
+
+template <int N> RECC_TARGET_AVX2 inline __m256i rotateRight(__m256i x)
+{
+    return _mm256_or_si256(_mm256_srli_epi32(x, N),
+                           _mm256_slli_epi32(x, 32 - N));
+}
+
+// Rotations by whole bytes are a single shuffle
+template <> RECC_TARGET_AVX2 inline __m256i rotateRight<16>(__m256i x)
+{
+    return _mm256_shuffle_epi8(
+        x, _mm256_set_epi8(13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3,
+                           2, 13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0,
+                           3, 2));
+}
+
+template <> RECC_TARGET_AVX2 inline __m256i rotateRight<8>(__m256i x)
+{
+    return _mm256_shuffle_epi8(
+        x, _mm256_set_epi8(12, 15, 14, 13, 8, 11, 10, 9, 4, 7, 6, 5, 0, 3, 2,
+                           1, 12, 15, 14, 13, 8, 11, 10, 9, 4, 7, 6, 5, 0, 3,
+                           2, 1));
+}
+
+/**
+ * Transposes the 8x8 matrix of words in `rows`, turning eight words of
+ * each lane into each word of the eight lanes and back.
+ */
+RECC_TARGET_AVX2 inline void transpose(__m256i rows[8])
+{
+    const __m256i t0 = _mm256_unpacklo_epi32(rows[0], rows[1]);
+    const __m256i t1 = _mm256_unpackhi_epi32(rows[0], rows[1]);
+    const __m256i t2 = _mm256_unpacklo_epi32(rows[2], rows[3]);
+    const __m256i t3 = _mm256_unpackhi_epi32(rows[2], rows[3]);
+    const __m256i t4 = _mm256_unpacklo_epi32(rows[4], rows[5]);
+    const __m256i t5 = _mm256_unpackhi_epi32(rows[4], rows[5]);
+    const __m256i t6 = _mm256_unpacklo_epi32(rows[6], rows[7]);
+    const __m256i t7 = _mm256_unpackhi_epi32(rows[6], rows[7]);
+
+    const __m256i u0 = _mm256_unpacklo_epi64(t0, t2);
+    const __m256i u1 = _mm256_unpackhi_epi64(t0, t2);
+    const __m256i u2 = _mm256_unpacklo_epi64(t1, t3);
+    const __m256i u3 = _mm256_unpackhi_epi64(t1, t3);
+    const __m256i u4 = _mm256_unpacklo_epi64(t4, t6);
+    const __m256i u5 = _mm256_unpackhi_epi64(t4, t6);
+    const __m256i u6 = _mm256_unpacklo_epi64(t5, t7);
+    const __m256i u7 = _mm256_unpackhi_epi64(t5, t7);
+
+    rows[0] = _mm256_permute2x128_si256(u0, u4, 0x20);
+    rows[1] = _mm256_permute2x128_si256(u1, u5, 0x20);
+    rows[2] = _mm256_permute2x128_si256(u2, u6, 0x20);
+    rows[3] = _mm256_permute2x128_si256(u3, u7, 0x20);
+    rows[4] = _mm256_permute2x128_si256(u0, u4, 0x31);
+    rows[5] = _mm256_permute2x128_si256(u1, u5, 0x31);
+    rows[6] = _mm256_permute2x128_si256(u2, u6, 0x31);
+    rows[7] = _mm256_permute2x128_si256(u3, u7, 0x31);
+}
+
+RECC_TARGET_AVX2 inline void mix(__m256i v[16], size_t a, size_t b, size_t c,
+                                 size_t d, __m256i x, __m256i y)
+{
+    v[a] = _mm256_add_epi32(_mm256_add_epi32(v[a], v[b]), x);
+    v[d] = rotateRight<16>(_mm256_xor_si256(v[d], v[a]));
+    v[c] = _mm256_add_epi32(v[c], v[d]);
+    v[b] = rotateRight<12>(_mm256_xor_si256(v[b], v[c]));
+    v[a] = _mm256_add_epi32(_mm256_add_epi32(v[a], v[b]), y);
+    v[d] = rotateRight<8>(_mm256_xor_si256(v[d], v[a]));
+    v[c] = _mm256_add_epi32(v[c], v[d]);
+    v[b] = rotateRight<7>(_mm256_xor_si256(v[b], v[c]));
+}
+
+/**
+ * Like `hashOne()`, for up to `LANES` inputs `stride` bytes apart starting
+ * at `input`, with the `i`th one at counter `counter + i * counterStep`.
+ * Unused lanes hash the first input again, and their result is discarded.
+ */
+RECC_TARGET_AVX2 void hashLanes(const uint8_t *input, size_t stride,
+                                size_t count, size_t blocks, uint64_t counter,
+                                uint64_t counterStep, uint8_t flags,
+                                uint8_t startFlag, uint8_t endFlag,
+                                uint8_t *out)
+{
+    uint32_t counterLow[LANES], counterHigh[LANES];
+    for (size_t lane = 0; lane < LANES; ++lane) {
+        const uint64_t laneCounter = counter + lane * counterStep;
+        counterLow[lane] = static_cast<uint32_t>(laneCounter);
+        counterHigh[lane] = static_cast<uint32_t>(laneCounter >> 32);
+    }
+
+    __m256i h[8];
+    for (size_t i = 0; i < 8; ++i) {
+        h[i] = _mm256_set1_epi32(static_cast<int>(IV[i]));
+    }
+
+    // x86 is little-endian, so the words of the blocks are loaded as is
+    uint8_t blockFlags = flags | startFlag;
+    for (size_t b = 0; b < blocks; ++b) {
+        if (b + 1 == blocks) {
+            blockFlags |= endFlag;
+        }
+        __m256i m[16];
+        for (size_t lane = 0; lane < LANES; ++lane) {
+            const uint8_t *block =
+                input + (lane < count ? lane : 0) * stride + b * BLOCK_SIZE;
+            m[lane] =
+                _mm256_loadu_si256(reinterpret_cast<const __m256i *>(block));
+            m[LANES + lane] = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i *>(block + 32));
+        }
+        transpose(m);
+        transpose(m + LANES);
+
+        __m256i v[16];
+        std::copy(h, h + 8, v);
+        for (size_t i = 0; i < 4; ++i) {
+            v[8 + i] = _mm256_set1_epi32(static_cast<int>(IV[i]));
+        }
+        v[12] =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(counterLow));
+        v[13] =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(counterHigh));
+        v[14] = _mm256_set1_epi32(static_cast<int>(BLOCK_SIZE));
+        v[15] = _mm256_set1_epi32(blockFlags);
+        for (const auto &s : MESSAGE_SCHEDULE) {
+            mix(v, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+            mix(v, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+            mix(v, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+            mix(v, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+            mix(v, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+            mix(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+            mix(v, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+            mix(v, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+        }
+        for (size_t i = 0; i < 8; ++i) {
+            h[i] = _mm256_xor_si256(v[i], v[i + 8]);
+        }
+        blockFlags = flags;
+    }
+
+    transpose(h);
+    for (size_t lane = 0; lane < count; ++lane) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + lane * CV_SIZE),
+                            h[lane]);
+    }
+}
+
+#endif
+
+/**
+ * Hashes `count` inputs of `blocks` blocks each, `stride` bytes apart,
+ * writing their chaining values one after the other to `out`. All inputs
+ * are read before their outputs are written, so `out` can be `input` when
+ * hashing parents.
+ */
+void hashMany(const uint8_t *input, size_t stride, size_t count,
+              size_t blocks, uint64_t counter, uint64_t counterStep,
+              uint8_t flags, uint8_t startFlag, uint8_t endFlag, uint8_t *out)
+{
+    size_t i = 0;
+#ifdef RECC_BLAKE3_AVX2
+    // Even with some lanes unused, hashing two inputs at once is faster
+    if (CpuFeatures::hasAvx2()) {
+        for (; i + 1 < count; i += LANES) {
+            hashLanes(input + i * stride, stride, std::min(count - i, LANES),
+                      blocks, counter + i * counterStep, counterStep, flags,
+                      startFlag, endFlag, out + i * CV_SIZE);
+        }
+    }
+#endif
+    for (; i < count; ++i) {
+        hashOne(input + i * stride, blocks, counter + i * counterStep, flags,
+                startFlag, endFlag, out + i * CV_SIZE);
+    }
+}
+
+/**
+ * Computes the chaining value of the parent of the two chaining values at
+ * `children`.
+ */
+void hashParent(const uint8_t *children, uint8_t *out)
+{
+    hashOne(children, 1, 0, PARENT, 0, 0, out);
+}
+
+void hashSubtreeChildren(const uint8_t *input, size_t size, uint64_t counter,
+                         ThreadPool *pool, uint8_t *children);
+
+/**
+ * Computes the chaining value of a subtree that is not the root: `size`
+ * bytes starting at chunk `counter`, a power of two number of chunks.
+ */
+void hashSubtree(const uint8_t *input, size_t size, uint64_t counter,
+                 ThreadPool *pool, uint8_t *out)
+{
+    const size_t numChunks = size / CHUNK_SIZE;
+    if (numChunks > MAX_FLAT_SUBTREE_CHUNKS) {
+        uint8_t children[2 * CV_SIZE];
+        hashSubtreeChildren(input, size, counter, pool, children);
+        hashParent(children, out);
+        return;
+    }
+
+    uint8_t cvs[MAX_FLAT_SUBTREE_CHUNKS * CV_SIZE];
+    hashMany(input, CHUNK_SIZE, numChunks, BLOCKS_PER_CHUNK, counter, 1, 0,
+             CHUNK_START, CHUNK_END, cvs);
+    for (size_t n = numChunks; n > 1; n /= 2) {
+        hashMany(cvs, 2 * CV_SIZE, n / 2, 1, 0, 0, PARENT, 0, 0, cvs);
+    }
+    memcpy(out, cvs, CV_SIZE);
+}
+
+/**
+ * Computes the chaining values of the two halves of a subtree of at least
+ * two chunks, in parallel if it is large enough.
+ */
+void hashSubtreeChildren(const uint8_t *input, size_t size, uint64_t counter,
+                         ThreadPool *pool, uint8_t *children)
+{
+    const size_t numChunks = size / CHUNK_SIZE;
+    if (numChunks <= MAX_FLAT_SUBTREE_CHUNKS) {
+        uint8_t cvs[MAX_FLAT_SUBTREE_CHUNKS * CV_SIZE];
+        hashMany(input, CHUNK_SIZE, numChunks, BLOCKS_PER_CHUNK, counter, 1,
+                 0, CHUNK_START, CHUNK_END, cvs);
+        for (size_t n = numChunks; n > 2; n /= 2) {
+            hashMany(cvs, 2 * CV_SIZE, n / 2, 1, 0, 0, PARENT, 0, 0, cvs);
+        }
+        memcpy(children, cvs, 2 * CV_SIZE);
+        return;
+    }
+
+    const size_t half = size / 2;
+    const uint64_t rightCounter = counter + half / CHUNK_SIZE;
+    if (pool == nullptr || size < MIN_PARALLEL_SUBTREE_SIZE) {
+        hashSubtree(input, half, counter, pool, children);
+        hashSubtree(input + half, half, rightCounter, pool,
+                    children + CV_SIZE);
+        return;
+    }
+
+    auto left = pool->submit([input, half, counter, pool, children]() {
+        hashSubtree(input, half, counter, pool, children);
+    });
+    hashSubtree(input + half, half, rightCounter, pool, children + CV_SIZE);
+    pool->wait(left);
+}
+
+/**
+ * The last block of a node, compressed only once it is known whether the
+ * node is the root.
+ */
+struct Output {
+    uint32_t d_cv[8];
+    uint8_t d_block[BLOCK_SIZE];
+    uint32_t d_blockSize;
+    uint64_t d_counter;
+    uint8_t d_flags;
+
+    static Output parent(const uint8_t *children)
+    {
+        Output output;
+        std::copy(IV, IV + 8, output.d_cv);
+        memcpy(output.d_block, children, BLOCK_SIZE);
+        output.d_blockSize = BLOCK_SIZE;
+        output.d_counter = 0;
+        output.d_flags = PARENT;
+        return output;
+    }
+
+    void chainingValue(uint8_t *out) const
+    {
+        uint32_t cv[8];
+        std::copy(d_cv, d_cv + 8, cv);
+        compress(cv, d_block, d_blockSize, d_counter, d_flags);
+        storeChainingValue(cv, out);
+    }
+
+    void root(uint8_t *out) const
+    {
+        uint32_t cv[8];
+        std::copy(d_cv, d_cv + 8, cv);
+        compress(cv, d_block, d_blockSize, 0, d_flags | ROOT);
+        storeChainingValue(cv, out);
+    }
+};
+
+/**
+ * The chunk being hashed by `Blake3::update()`.
+ */
+struct ChunkState {
+    uint32_t d_cv[8];
+    uint64_t d_counter = 0;
+    uint8_t d_block[BLOCK_SIZE];
+    size_t d_blockSize = 0;
+    size_t d_blocksCompressed = 0;
+
+    explicit ChunkState(uint64_t counter) { reset(counter); }
+
+    void reset(uint64_t counter)
+    {
+        std::copy(IV, IV + 8, d_cv);
+        d_counter = counter;
+        memset(d_block, 0, sizeof(d_block));
+        d_blockSize = 0;
+        d_blocksCompressed = 0;
+    }
+
+    size_t size() const
+    {
+        return d_blocksCompressed * BLOCK_SIZE + d_blockSize;
+    }
+
+    uint8_t startFlag() const
+    {
+        return d_blocksCompressed == 0 ? CHUNK_START : 0;
+    }
+
+    void update(const uint8_t *input, size_t size)
+    {
+        while (size > 0) {
+            // The last block is only compressed once more input follows
+            if (d_blockSize == BLOCK_SIZE) {
+                compress(d_cv, d_block, BLOCK_SIZE, d_counter, startFlag());
+                ++d_blocksCompressed;
+                memset(d_block, 0, sizeof(d_block));
+                d_blockSize = 0;
+            }
+            const size_t take = std::min(BLOCK_SIZE - d_blockSize, size);
+            memcpy(d_block + d_blockSize, input, take);
+            d_blockSize += take;
+            input += take;
+            size -= take;
+        }
+    }
+
+    Output output() const
+    {
+        Output output;
+        std::copy(d_cv, d_cv + 8, output.d_cv);
+        memcpy(output.d_block, d_block, BLOCK_SIZE);
+        output.d_blockSize = static_cast<uint32_t>(d_blockSize);
+        output.d_counter = d_counter;
+        output.d_flags = startFlag() | CHUNK_END;
+        return output;
+    }
+};
+
+size_t countBits(uint64_t x)
+{
+    size_t count = 0;
+    for (; x != 0; x &= x - 1) {
+        ++count;
+    }
+    return count;
+}
+
+size_t largestPowerOfTwoAtMost(size_t x)
+{
+    size_t power = 1;
+    while (power <= x / 2) {
+        power *= 2;
+    }
+    return power;
+}
+
+} // namespace
+
+/**
+ * Hashes the input as the reference implementation does: the chaining
+ * values of complete subtrees are kept on a stack and merged as soon as it
+ * is known that they are not on the right edge of the tree.
+ */
+struct Blake3::State {
+    ThreadPool *d_pool;
+    ChunkState d_chunk{0};
+    uint8_t d_stack[MAX_STACK_DEPTH * CV_SIZE];
+    size_t d_stackSize = 0;
+
+    explicit State(ThreadPool *pool) : d_pool(pool) {}
+
+    // Merges the subtrees completed by the first `totalChunks` chunks
+    void merge(uint64_t totalChunks)
+    {
+        const size_t mergedSize = countBits(totalChunks);
+        while (d_stackSize > mergedSize) {
+            uint8_t *children = d_stack + (d_stackSize - 2) * CV_SIZE;
+            hashParent(children, children);
+            --d_stackSize;
+        }
+    }
+
+    void push(const uint8_t *cv, uint64_t chunkCounter)
+    {
+        merge(chunkCounter);
+        memcpy(d_stack + d_stackSize * CV_SIZE, cv, CV_SIZE);
+        ++d_stackSize;
+    }
+
+    void update(const uint8_t *input, size_t size)
+    {
+        // Complete the current chunk
+        if (d_chunk.size() > 0) {
+            const size_t take = std::min(CHUNK_SIZE - d_chunk.size(), size);
+            d_chunk.update(input, take);
+            input += take;
+            size -= take;
+            if (size == 0) {
+                return;
+            }
+            uint8_t cv[CV_SIZE];
+            d_chunk.output().chainingValue(cv);
+            push(cv, d_chunk.d_counter);
+            d_chunk.reset(d_chunk.d_counter + 1);
+        }
+
+        // Hash the largest complete subtrees possible, keeping at least one
+        // byte for the current chunk, as it may be the last
+        while (size > CHUNK_SIZE) {
+            size_t subtreeSize = largestPowerOfTwoAtMost(size);
+            const uint64_t offset = d_chunk.d_counter * CHUNK_SIZE;
+            while (((static_cast<uint64_t>(subtreeSize) - 1) & offset) != 0) {
+                subtreeSize /= 2;
+            }
+            const uint64_t subtreeChunks = subtreeSize / CHUNK_SIZE;
+            if (subtreeChunks == 1) {
+                uint8_t cv[CV_SIZE];
+                hashOne(input, BLOCKS_PER_CHUNK, d_chunk.d_counter, 0,
+                        CHUNK_START, CHUNK_END, cv);
+                push(cv, d_chunk.d_counter);
+            }
+            else {
+                // The subtree may turn out to be the root, so only its
+                // children are pushed
+                uint8_t children[2 * CV_SIZE];
+                hashSubtreeChildren(input, subtreeSize, d_chunk.d_counter,
+                                    d_pool, children);
+                push(children, d_chunk.d_counter);
+                push(children + CV_SIZE,
+                     d_chunk.d_counter + subtreeChunks / 2);
+            }
+            d_chunk.d_counter += subtreeChunks;
+            input += subtreeSize;
+            size -= subtreeSize;
+        }
+
+        if (size > 0) {
+            d_chunk.update(input, size);
+            merge(d_chunk.d_counter);
+        }
+    }
+
+    void finalize(uint8_t *digest) const
+    {
+        if (d_stackSize == 0) {
+            d_chunk.output().root(digest);
+            return;
+        }
+
+        // Merge the right edge of the tree, from the bottom
+        Output output;
+        size_t remaining;
+        if (d_chunk.size() > 0) {
+            output = d_chunk.output();
+            remaining = d_stackSize;
+        }
+        else {
+            remaining = d_stackSize - 2;
+            output = Output::parent(d_stack + remaining * CV_SIZE);
+        }
+        while (remaining > 0) {
+            --remaining;
+            uint8_t children[2 * CV_SIZE];
+            memcpy(children, d_stack + remaining * CV_SIZE, CV_SIZE);
+            output.chainingValue(children + CV_SIZE);
+            output = Output::parent(children);
+        }
+        output.root(digest);
+    }
+};
+
+Blake3::Blake3(ThreadPool *pool) : d_state(new State(pool)) {}
+
+Blake3::~Blake3() {}
+
+void Blake3::update(const char *data, size_t size)
+{
+    d_state->update(reinterpret_cast<const uint8_t *>(data), size);
+}
+
+void Blake3::finalize(unsigned char *digest) const
+{
+    d_state->finalize(digest);
+}
+
+void Blake3::hash(const char *data, size_t size, unsigned char *digest,
+                  ThreadPool *pool)
+{
+    Blake3 hasher(pool);
+    hasher.update(data, size);
+    hasher.finalize(digest);
+}
+
+bool Blake3::isAccelerated()
+{
+#ifdef RECC_BLAKE3_AVX2
+    return CpuFeatures::hasAvx2();
+#else
+    return false;
+#endif
+}
+
+} // namespace recc
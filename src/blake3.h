@@ -0,0 +1,74 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef INCLUDED_BLAKE3
+#define INCLUDED_BLAKE3
+
+#include <cstddef>
+#include <memory>
+
+namespace recc {
+
+class ThreadPool;
+
+/**
+ * Computes BLAKE3 hashes, as specified in
+ * https://github.com/BLAKE3-team/BLAKE3-specs.
+ *
+ * BLAKE3 hashes 1 KiB chunks independently and combines them in a binary
+ * tree, so whole chunks are compressed eight at a time in the lanes of the
+ * AVX2 registers when the CPU supports it, and, given a `ThreadPool`, the
+ * subtrees of large inputs are hashed in parallel.
+ */
+class Blake3 {
+  public:
+    static const size_t DIGEST_SIZE = 32;
+
+    /**
+     * Hashes large inputs in `pool` if it is not null.
+     */
+    explicit Blake3(ThreadPool *pool = nullptr);
+
+    ~Blake3();
+
+    Blake3(const Blake3 &) = delete;
+    Blake3 &operator=(const Blake3 &) = delete;
+
+    void update(const char *data, size_t size);
+
+    /**
+     * Writes the hash of the data given so far to the `DIGEST_SIZE` bytes
+     * at `digest`. More data can be added afterwards.
+     */
+    void finalize(unsigned char *digest) const;
+
+    /**
+     * Writes the hash of the `size` bytes at `data` to `digest`.
+     */
+    static void hash(const char *data, size_t size, unsigned char *digest,
+                     ThreadPool *pool = nullptr);
+
+    /**
+     * Returns whether chunks are compressed with AVX2.
+     */
+    static bool isAccelerated();
+
+  private:
+    struct State;
+    std::unique_ptr<State> d_state;
+};
+
+} // namespace recc
+
+#endif
@@ -0,0 +1,62 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef INCLUDED_CACHEKEY
+#define INCLUDED_CACHEKEY
+
+#include <cstddef>
+#include <map>
+#include <set>
+#include <string>
+
+namespace recc {
+
+/**
+ * Appends a length-prefixed field to the material hashed into the key of a
+ * local cache, so that adjacent values can't be confused with each other.
+ */
+inline void appendField(std::string *keyData, const char *data, size_t size)
+{
+    keyData->append(std::to_string(size));
+    keyData->push_back(':');
+    keyData->append(data, size);
+}
+
+inline void appendField(std::string *keyData, const std::string &value)
+{
+    appendField(keyData, value.data(), value.size());
+}
+
+inline void appendField(std::string *keyData, const std::string &name,
+                        const std::map<std::string, std::string> &values)
+{
+    appendField(keyData, name);
+    for (const auto &it : values) {
+        appendField(keyData, it.first);
+        appendField(keyData, it.second);
+    }
+}
+
+inline void appendField(std::string *keyData, const std::string &name,
+                        const std::set<std::string> &values)
+{
+    appendField(keyData, name);
+    for (const auto &value : values) {
+        appendField(keyData, value);
+    }
+}
+
+} // namespace recc
+
+#endif
@@ -0,0 +1,115 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <caspresencecache.h>
+
+#include <digestgenerator.h>
+#include <shareddigesttable.h>
+
+#include <buildboxcommon_logging.h>
+
+#include <cstdlib>
+#include <ctime>
+
+namespace recc {
+
+namespace {
+
+// Parses up to 16 hexadecimal characters of `hash` starting at `offset`
+uint64_t hashWord(const std::string &hash, size_t offset)
+{
+    if (offset >= hash.size()) {
+        return 0;
+    }
+    return strtoull(hash.substr(offset, 16).c_str(), nullptr, 16);
+}
+
+SharedDigestTable::Key tableKey(const proto::Digest &digest)
+{
+    // Lookups compare the whole hash, so longer ones may be truncated here
+    const std::string &hash = digest.hash();
+    return {{hashWord(hash, 0), hashWord(hash, 16),
+             static_cast<uint64_t>(digest.size_bytes()), hashWord(hash, 32),
+             hashWord(hash, 48)}};
+}
+
+uint32_t currentTime() { return static_cast<uint32_t>(time(nullptr)); }
+
+} // namespace
+
+CasPresenceCache::CasPresenceCache(const std::string &path,
+                                   int64_t ttlSeconds, size_t numSlots)
+    : d_ttlSeconds(ttlSeconds), d_hits(0), d_misses(0)
+{
+    try {
+        d_table = std::make_unique<SharedDigestTable>(path, numSlots);
+    }
+    catch (const std::exception &e) {
+        BUILDBOX_LOG_WARNING("CAS presence cache disabled: " << e.what());
+    }
+}
+
+CasPresenceCache::~CasPresenceCache() {}
+
+std::string CasPresenceCache::path(const std::string &cacheDirectory,
+                                   const std::string &server,
+                                   const std::string &instance,
+                                   const std::string &digestFunction)
+{
+    const std::string scope =
+        DigestGenerator::make_digest(server + "\n" + instance).hash();
+    return cacheDirectory + "/cas-presence-" + scope.substr(0, 16) + "-" +
+           digestFunction;
+}
+
+bool CasPresenceCache::isPresent(const proto::Digest &digest)
+{
+    return isPresent(digest, currentTime());
+}
+
+void CasPresenceCache::markPresent(const proto::Digest &digest)
+{
+    markPresent(digest, currentTime());
+}
+
+void CasPresenceCache::markMissing(const proto::Digest &digest)
+{
+    // An entry stamped with the epoch has always expired
+    markPresent(digest, 0);
+}
+
+bool CasPresenceCache::isPresent(const proto::Digest &digest, uint32_t now)
+{
+    proto::Digest found;
+    uint8_t flags = 0;
+    uint32_t stamp = 0;
+    if (d_table != nullptr &&
+        d_table->lookup(tableKey(digest), &found, &flags, &stamp) &&
+        found.hash() == digest.hash() && stamp <= now &&
+        static_cast<int64_t>(now - stamp) < d_ttlSeconds) {
+        ++d_hits;
+        return true;
+    }
+    ++d_misses;
+    return false;
+}
+
+void CasPresenceCache::markPresent(const proto::Digest &digest, uint32_t now)
+{
+    if (d_table != nullptr) {
+        d_table->store(tableKey(digest), digest, 0, now);
+    }
+}
+
+} // namespace recc
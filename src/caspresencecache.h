@@ -0,0 +1,106 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef INCLUDED_CASPRESENCECACHE
+#define INCLUDED_CASPRESENCECACHE
+
+#include <protos.h>
+#include <reccdefaults.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace recc {
+
+class SharedDigestTable;
+
+/**
+ * Cache of the digests recently found in a CAS, shared by all recc processes
+ * on a machine, so that blobs known to be present are not queried with
+ * `FindMissingBlobs()` again.
+ *
+ * The cache is a `SharedDigestTable` keyed by digest, with each entry
+ * stamped with the time at which the blob was confirmed present or
+ * uploaded. Entries older than the time to live are ignored, as the server
+ * may have evicted the blob since.
+ *
+ * A table only holds digests for a single CAS, see `path()`.
+ *
+ * This class is thread-safe.
+ */
+class CasPresenceCache {
+  public:
+    /**
+     * Opens the cache table at `path`, creating it with `numSlots` slots if
+     * it does not exist. If the table can't be used, a warning is logged and
+     * every lookup misses.
+     */
+    CasPresenceCache(const std::string &path, int64_t ttlSeconds,
+                     size_t numSlots = DEFAULT_RECC_CAS_PRESENCE_CACHE_SLOTS);
+
+    ~CasPresenceCache();
+
+    CasPresenceCache(const CasPresenceCache &) = delete;
+    CasPresenceCache &operator=(const CasPresenceCache &) = delete;
+
+    /**
+     * Returns the path of the table in `cacheDirectory` holding the digests
+     * of the given CAS server and instance.
+     */
+    static std::string path(const std::string &cacheDirectory,
+                            const std::string &server,
+                            const std::string &instance,
+                            const std::string &digestFunction);
+
+    /**
+     * Returns whether the blob was confirmed present in the CAS less than
+     * the time to live ago.
+     */
+    bool isPresent(const proto::Digest &digest);
+
+    /**
+     * Records that the blob was confirmed present in the CAS, or uploaded
+     * to it, just now.
+     */
+    void markPresent(const proto::Digest &digest);
+
+    /**
+     * Records that the blob may be missing from the CAS, so that it is
+     * queried again.
+     */
+    void markMissing(const proto::Digest &digest);
+
+    int64_t hits() const { return d_hits; }
+
+    int64_t misses() const { return d_misses; }
+
+  protected: // for unit testing
+    bool isPresent(const proto::Digest &digest, uint32_t now);
+
+    void markPresent(const proto::Digest &digest, uint32_t now);
+
+  private:
+    // Null if the table can't be used
+    std::unique_ptr<SharedDigestTable> d_table;
+    int64_t d_ttlSeconds;
+    std::atomic<int64_t> d_hits;
+    std::atomic<int64_t> d_misses;
+};
+
+} // namespace recc
+
+#endif
@@ -0,0 +1,75 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cpufeatures.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define RECC_CPUID
+#include <cpuid.h>
+#endif
+
+namespace recc {
+
+namespace {
+
+struct Features {
+    bool d_avx2 = false;
+    bool d_shaExtensions = false;
+
+    Features();
+};
+
+#ifdef RECC_CPUID
+
+Features::Features()
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return;
+    }
+    // The OS must save the AVX registers on context switches
+    const bool osxsave = (ecx & (1u << 27)) != 0;
+    const bool avx = (ecx & (1u << 28)) != 0;
+    if (!osxsave || !avx) {
+        return;
+    }
+    unsigned int xcr0Low, xcr0High;
+    __asm__ volatile("xgetbv" : "=a"(xcr0Low), "=d"(xcr0High) : "c"(0));
+    if ((xcr0Low & 6) != 6 || __get_cpuid_max(0, nullptr) < 7) {
+        return;
+    }
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    d_avx2 = (ebx & (1u << 5)) != 0;
+    d_shaExtensions = (ebx & (1u << 29)) != 0;
+}
+
+#else
+
+Features::Features() {}
+
+#endif
+
+const Features &features()
+{
+    static const Features features;
+    return features;
+}
+
+} // namespace
+
+bool CpuFeatures::hasAvx2() { return features().d_avx2; }
+
+bool CpuFeatures::hasShaExtensions() { return features().d_shaExtensions; }
+
+} // namespace recc
@@ -0,0 +1,39 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef INCLUDED_CPUFEATURES
+#define INCLUDED_CPUFEATURES
+
+namespace recc {
+
+/**
+ * Instruction set extensions of the CPU that recc's hashing code uses when
+ * they are available. Detected once, on first use.
+ */
+struct CpuFeatures {
+    /**
+     * Returns whether the CPU supports AVX2 and the OS saves the AVX
+     * registers.
+     */
+    static bool hasAvx2();
+
+    /**
+     * Returns whether the CPU has the SHA extensions.
+     */
+    static bool hasShaExtensions();
+};
+
+} // namespace recc
+
+#endif
@@ -0,0 +1,125 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <daemonclient.h>
+
+#include <daemonprotocol.h>
+#include <fileutils.h>
+
+#include <buildboxcommon_logging.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+extern char **environ;
+
+namespace recc {
+
+namespace {
+
+// Closes the connection when leaving scope
+class SocketGuard {
+  public:
+    explicit SocketGuard(int fd) : d_fd(fd) {}
+    ~SocketGuard() { close(d_fd); }
+
+    SocketGuard(const SocketGuard &) = delete;
+    SocketGuard &operator=(const SocketGuard &) = delete;
+
+  private:
+    int d_fd;
+};
+
+} // namespace
+
+bool DaemonClient::execute(const std::string &socketPath, int argc,
+                           char *argv[], int *exitCode)
+{
+    struct sockaddr_un address;
+    try {
+        address = DaemonProtocol::socketAddress(socketPath);
+    }
+    catch (const std::runtime_error &e) {
+        BUILDBOX_LOG_WARNING("Ignoring recc daemon socket: " << e.what());
+        return false;
+    }
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        BUILDBOX_LOG_WARNING("Could not create socket: " << strerror(errno));
+        return false;
+    }
+    SocketGuard guard(fd);
+    if (connect(fd, reinterpret_cast<struct sockaddr *>(&address),
+                sizeof(address)) != 0) {
+        BUILDBOX_LOG_DEBUG("No recc daemon listening on \""
+                           << socketPath << "\": " << strerror(errno));
+        return false;
+    }
+    // The request carries the environment and standard streams of this
+    // process, which must not reach a socket bound by another user
+    if (!DaemonProtocol::peerIsSameUser(fd)) {
+        BUILDBOX_LOG_WARNING("Ignoring recc daemon socket \""
+                             << socketPath
+                             << "\": it is not served by the current user");
+        return false;
+    }
+
+    DaemonRequest request;
+    request.d_arguments.assign(argv, argv + argc);
+    request.d_workingDirectory = FileUtils::getCurrentWorkingDirectory();
+    for (char **variable = environ; *variable != nullptr; ++variable) {
+        request.d_environment.push_back(*variable);
+    }
+    request.d_parentPid = getppid();
+    for (int i = 0; i < 3; ++i) {
+        request.d_fds[i] = i;
+    }
+
+    DaemonProtocol::Status status;
+    try {
+        DaemonProtocol::sendRequest(fd, request);
+    }
+    catch (const std::system_error &e) {
+        BUILDBOX_LOG_WARNING(e.what() << ", running the command without it");
+        return false;
+    }
+    if (!DaemonProtocol::receiveStatus(fd, &status)) {
+        BUILDBOX_LOG_WARNING("The recc daemon on \""
+                             << socketPath
+                             << "\" closed the connection, running the "
+                                "command without it");
+        return false;
+    }
+    if (status != DaemonProtocol::ACCEPTED) {
+        BUILDBOX_LOG_DEBUG("The recc daemon on \""
+                           << socketPath
+                           << "\" has a different configuration, running "
+                              "the command without it");
+        return false;
+    }
+
+    if (!DaemonProtocol::receiveExitCode(fd, exitCode)) {
+        throw std::runtime_error("The recc daemon on \"" + socketPath +
+                                 "\" stopped while running the command");
+    }
+    return true;
+}
+
+} // namespace recc
@@ -0,0 +1,41 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef INCLUDED_DAEMONCLIENT
+#define INCLUDED_DAEMONCLIENT
+
+#include <string>
+
+namespace recc {
+
+struct DaemonClient {
+    /**
+     * Runs the given command in the `reccd` listening on `socketPath`, with
+     * the working directory, environment and standard streams of this
+     * process, and writes its exit code to `exitCode`.
+     *
+     * Returns false without running the command if no daemon is listening
+     * or if it refuses the command because its configuration differs, in
+     * which case the caller should run the command itself.
+     *
+     * Throws `std::runtime_error` if the daemon stops responding after
+     * accepting the command.
+     */
+    static bool execute(const std::string &socketPath, int argc,
+                        char *argv[], int *exitCode);
+};
+
+} // namespace recc
+
+#endif
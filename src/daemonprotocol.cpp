@@ -0,0 +1,406 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <daemonprotocol.h>
+
+#include <reccdefaults.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace recc {
+
+namespace {
+
+const uint32_t REQUEST_MAGIC = 0x44434552; // "RECD"
+const uint32_t PROTOCOL_VERSION = 1;
+
+// Requests larger than this are rejected as malformed
+const uint32_t MAX_PAYLOAD_SIZE = 64 * 1024 * 1024;
+
+// Words of the header preceding the payload of a request. `FD_MASK` tells
+// which of the three standard streams are attached to it.
+enum HeaderWord { MAGIC, VERSION, PAYLOAD_SIZE, FD_MASK, HEADER_WORDS };
+
+#ifdef MSG_NOSIGNAL
+const int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+const int SEND_FLAGS = 0;
+#endif
+
+// Environment variables that configuration defaults are derived from
+const char *const DEFAULT_VARIABLES[] = {"HOME=", "TMPDIR=",
+                                         "XDG_CACHE_HOME="};
+
+void sendAll(int socket, const char *data, size_t size)
+{
+    while (size > 0) {
+        const ssize_t sent = send(socket, data, size, SEND_FLAGS);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::system_error(errno, std::system_category(),
+                                    "Could not write to the recc daemon "
+                                    "socket");
+        }
+        data += sent;
+        size -= static_cast<size_t>(sent);
+    }
+}
+
+// Returns false if the connection is closed before `size` bytes are read
+bool receiveAll(int socket, char *data, size_t size)
+{
+    while (size > 0) {
+        const ssize_t received = recv(socket, data, size, 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            return false;
+        }
+        data += received;
+        size -= static_cast<size_t>(received);
+    }
+    return true;
+}
+
+void appendWord(std::string *buffer, uint32_t word)
+{
+    buffer->append(reinterpret_cast<const char *>(&word), sizeof(word));
+}
+
+void appendString(std::string *buffer, const std::string &value)
+{
+    appendWord(buffer, static_cast<uint32_t>(value.size()));
+    buffer->append(value);
+}
+
+void appendStrings(std::string *buffer, const std::vector<std::string> &values)
+{
+    appendWord(buffer, static_cast<uint32_t>(values.size()));
+    for (const auto &value : values) {
+        appendString(buffer, value);
+    }
+}
+
+/**
+ * Reads the fields of a payload in order, failing once any of them
+ * doesn't fit.
+ */
+class PayloadReader {
+  public:
+    explicit PayloadReader(const std::string &payload) : d_payload(payload)
+    {
+    }
+
+    bool readWord(uint32_t *word)
+    {
+        if (d_payload.size() - d_offset < sizeof(*word)) {
+            return false;
+        }
+        memcpy(word, d_payload.data() + d_offset, sizeof(*word));
+        d_offset += sizeof(*word);
+        return true;
+    }
+
+    bool readString(std::string *value)
+    {
+        uint32_t size = 0;
+        if (!readWord(&size) || d_payload.size() - d_offset < size) {
+            return false;
+        }
+        value->assign(d_payload, d_offset, size);
+        d_offset += size;
+        return true;
+    }
+
+    bool readStrings(std::vector<std::string> *values)
+    {
+        uint32_t count = 0;
+        if (!readWord(&count)) {
+            return false;
+        }
+        values->clear();
+        for (uint32_t i = 0; i < count; ++i) {
+            std::string value;
+            if (!readString(&value)) {
+                return false;
+            }
+            values->push_back(std::move(value));
+        }
+        return true;
+    }
+
+    bool atEnd() const { return d_offset == d_payload.size(); }
+
+  private:
+    const std::string &d_payload;
+    size_t d_offset = 0;
+};
+
+void closeFds(DaemonRequest *request)
+{
+    for (int &fd : request->d_fds) {
+        if (fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+}
+
+} // namespace
+
+void DaemonProtocol::sendRequest(int socket, const DaemonRequest &request)
+{
+    std::string payload;
+    appendWord(&payload, static_cast<uint32_t>(request.d_parentPid));
+    appendString(&payload, request.d_workingDirectory);
+    appendStrings(&payload, request.d_arguments);
+    appendStrings(&payload, request.d_environment);
+
+    uint32_t header[HEADER_WORDS] = {};
+    header[MAGIC] = REQUEST_MAGIC;
+    header[VERSION] = PROTOCOL_VERSION;
+    header[PAYLOAD_SIZE] = static_cast<uint32_t>(payload.size());
+
+    int fds[3];
+    size_t numFds = 0;
+    for (size_t i = 0; i < 3; ++i) {
+        if (request.d_fds[i] >= 0) {
+            header[FD_MASK] |= 1u << i;
+            fds[numFds++] = request.d_fds[i];
+        }
+    }
+
+    // The file descriptors are attached to the header
+    struct iovec iov;
+    iov.iov_base = header;
+    iov.iov_len = sizeof(header);
+    union {
+        struct cmsghdr d_header;
+        char d_buffer[CMSG_SPACE(sizeof(fds))];
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    if (numFds > 0) {
+        message.msg_control = control.d_buffer;
+        message.msg_controllen = CMSG_SPACE(numFds * sizeof(int));
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(numFds * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, numFds * sizeof(int));
+    }
+
+    ssize_t sent;
+    do {
+        sent = sendmsg(socket, &message, SEND_FLAGS);
+    } while (sent < 0 && errno == EINTR);
+    if (sent < 0) {
+        throw std::system_error(errno, std::system_category(),
+                                "Could not send request to the recc daemon");
+    }
+    sendAll(socket, reinterpret_cast<const char *>(header) + sent,
+            sizeof(header) - static_cast<size_t>(sent));
+    sendAll(socket, payload.data(), payload.size());
+}
+
+bool DaemonProtocol::receiveRequest(int socket, DaemonRequest *request)
+{
+    uint32_t header[HEADER_WORDS] = {};
+    struct iovec iov;
+    iov.iov_base = header;
+    iov.iov_len = sizeof(header);
+    union {
+        struct cmsghdr d_header;
+        char d_buffer[CMSG_SPACE(3 * sizeof(int))];
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.d_buffer;
+    message.msg_controllen = sizeof(control.d_buffer);
+
+    ssize_t received;
+    do {
+        received = recvmsg(socket, &message, 0);
+    } while (received < 0 && errno == EINTR);
+    if (received <= 0) {
+        return false;
+    }
+
+    std::vector<int> fds;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message); cmsg != nullptr;
+         cmsg = CMSG_NXTHDR(&message, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            const size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (size_t i = 0; i < count; ++i) {
+                int fd;
+                memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(fd));
+                fds.push_back(fd);
+            }
+        }
+    }
+
+    std::string payload;
+    const bool valid =
+        (message.msg_flags & MSG_CTRUNC) == 0 &&
+        receiveAll(socket, reinterpret_cast<char *>(header) + received,
+                   sizeof(header) - static_cast<size_t>(received)) &&
+        header[MAGIC] == REQUEST_MAGIC &&
+        header[VERSION] == PROTOCOL_VERSION &&
+        header[PAYLOAD_SIZE] <= MAX_PAYLOAD_SIZE;
+
+    // Take ownership of the file descriptors, closing any unexpected one
+    closeFds(request);
+    size_t next = 0;
+    for (size_t i = 0; i < 3 && valid && next < fds.size(); ++i) {
+        if (header[FD_MASK] & (1u << i)) {
+            request->d_fds[i] = fds[next++];
+        }
+    }
+    for (; next < fds.size(); ++next) {
+        close(fds[next]);
+    }
+    if (valid) {
+        payload.resize(header[PAYLOAD_SIZE]);
+    }
+
+    PayloadReader reader(payload);
+    uint32_t parentPid = 0;
+    if (!valid || !receiveAll(socket, &payload[0], payload.size()) ||
+        !reader.readWord(&parentPid) ||
+        !reader.readString(&request->d_workingDirectory) ||
+        !reader.readStrings(&request->d_arguments) ||
+        !reader.readStrings(&request->d_environment) || !reader.atEnd()) {
+        closeFds(request);
+        return false;
+    }
+    request->d_parentPid = static_cast<pid_t>(parentPid);
+    return true;
+}
+
+void DaemonProtocol::sendStatus(int socket, Status status)
+{
+    const char byte = static_cast<char>(status);
+    sendAll(socket, &byte, sizeof(byte));
+}
+
+bool DaemonProtocol::receiveStatus(int socket, Status *status)
+{
+    char byte;
+    if (!receiveAll(socket, &byte, sizeof(byte))) {
+        return false;
+    }
+    *status = static_cast<Status>(byte);
+    return true;
+}
+
+void DaemonProtocol::sendExitCode(int socket, int exitCode)
+{
+    const int32_t word = exitCode;
+    sendAll(socket, reinterpret_cast<const char *>(&word), sizeof(word));
+}
+
+bool DaemonProtocol::receiveExitCode(int socket, int *exitCode)
+{
+    int32_t word;
+    if (!receiveAll(socket, reinterpret_cast<char *>(&word), sizeof(word))) {
+        return false;
+    }
+    *exitCode = word;
+    return true;
+}
+
+std::string
+DaemonProtocol::configurationKey(const std::vector<std::string> &environment,
+                                 const std::string &workingDirectory)
+{
+    std::vector<std::string> variables;
+    for (const auto &variable : environment) {
+        bool relevant = variable.compare(0, 5, "RECC_") == 0;
+        for (const char *prefix : DEFAULT_VARIABLES) {
+            relevant = relevant ||
+                       variable.compare(0, strlen(prefix), prefix) == 0;
+        }
+        if (relevant) {
+            variables.push_back(variable);
+        }
+    }
+    std::sort(variables.begin(), variables.end());
+
+    std::string key;
+    for (const auto &variable : variables) {
+        key += variable;
+        key += '\0';
+    }
+
+    // The other configuration files don't depend on the working directory
+    const std::string configFile =
+        workingDirectory + "/recc/" + DEFAULT_RECC_CONFIG;
+    struct stat st;
+    if (stat(configFile.c_str(), &st) == 0) {
+        key += configFile;
+    }
+    return key;
+}
+
+struct sockaddr_un DaemonProtocol::socketAddress(const std::string &path)
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        throw std::runtime_error("Socket path \"" + path + "\" is too long");
+    }
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return address;
+}
+
+bool DaemonProtocol::peerIsSameUser(int socket)
+{
+#if defined(SO_PEERCRED)
+    struct ucred credentials;
+    socklen_t length = sizeof(credentials);
+    return getsockopt(socket, SOL_SOCKET, SO_PEERCRED, &credentials,
+                      &length) == 0 &&
+           credentials.uid == getuid();
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) ||  \
+    defined(__NetBSD__)
+    uid_t uid;
+    gid_t gid;
+    return getpeereid(socket, &uid, &gid) == 0 && uid == getuid();
+#else
+    (void)socket;
+    return false;
+#endif
+}
+
+} // namespace recc
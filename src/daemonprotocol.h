@@ -0,0 +1,106 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef INCLUDED_DAEMONPROTOCOL
+#define INCLUDED_DAEMONPROTOCOL
+
+#include <string>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <vector>
+
+namespace recc {
+
+/**
+ * A command sent by `recc` to `reccd`.
+ */
+struct DaemonRequest {
+    std::vector<std::string> d_arguments;
+    std::string d_workingDirectory;
+    // "VARIABLE=value" entries
+    std::vector<std::string> d_environment;
+    // Parent of the client, identifying the build that invoked it
+    pid_t d_parentPid = 0;
+    // Standard input, output and error of the client, or -1 if they were
+    // not received. The receiver of a request owns them.
+    int d_fds[3] = {-1, -1, -1};
+};
+
+/**
+ * Messages exchanged by `recc` and `reccd` over a Unix socket.
+ *
+ * The client sends a request along with its standard streams, which the
+ * daemon uses for the command. The daemon answers with a status telling
+ * whether it runs the command and, if it does, its exit code once it
+ * finishes.
+ */
+struct DaemonProtocol {
+    enum Status : unsigned char { ACCEPTED = 0, REFUSED = 1 };
+
+    /**
+     * Sends `request`, passing its file descriptors to the receiver.
+     *
+     * Throws `std::system_error` on failure.
+     */
+    static void sendRequest(int socket, const DaemonRequest &request);
+
+    /**
+     * Reads a request. Returns false if the connection was closed first or
+     * the message is malformed.
+     */
+    static bool receiveRequest(int socket, DaemonRequest *request);
+
+    static void sendStatus(int socket, Status status);
+
+    /**
+     * Returns false if the connection was closed before a status was sent.
+     */
+    static bool receiveStatus(int socket, Status *status);
+
+    static void sendExitCode(int socket, int exitCode);
+
+    /**
+     * Returns false if the connection was closed before the exit code was
+     * sent.
+     */
+    static bool receiveExitCode(int socket, int *exitCode);
+
+    /**
+     * Returns a string that differs for two processes if their recc
+     * configuration may differ: the `RECC_` variables of the environment,
+     * the ones used for defaults, and the configuration file in the
+     * working directory.
+     */
+    static std::string
+    configurationKey(const std::vector<std::string> &environment,
+                     const std::string &workingDirectory);
+
+    /**
+     * Returns the address of the Unix socket at `path`.
+     *
+     * Throws `std::runtime_error` if the path doesn't fit in it.
+     */
+    static struct sockaddr_un socketAddress(const std::string &path);
+
+    /**
+     * Returns whether the process at the other end of the connected Unix
+     * socket runs as the same user as this one. Returns false if that can't
+     * be determined.
+     */
+    static bool peerIsSameUser(int socket);
+};
+
+} // namespace recc
+
+#endif
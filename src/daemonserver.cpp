@@ -0,0 +1,371 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <daemonserver.h>
+
+#include <daemonprotocol.h>
+#include <fileutils.h>
+#include <requestmetadata.h>
+
+#include <buildboxcommon_logging.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <poll.h>
+#include <set>
+#include <signal.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+extern char **environ;
+
+namespace recc {
+
+namespace {
+
+void setCloseOnExec(int fd)
+{
+    fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) | FD_CLOEXEC);
+}
+
+/**
+ * Gives this process the standard streams, environment and parent of a
+ * request for as long as it is in scope. The working directory is changed
+ * separately, as that can fail.
+ */
+class RequestScope {
+  public:
+    explicit RequestScope(const DaemonRequest &request)
+        : d_environ(environ)
+    {
+        for (const auto &variable : request.d_environment) {
+            d_environment.push_back(const_cast<char *>(variable.c_str()));
+        }
+        d_environment.push_back(nullptr);
+
+        std::cout.flush();
+        std::cerr.flush();
+        fflush(nullptr);
+        for (int i = 0; i < 3; ++i) {
+            d_savedFds[i] = -1;
+            if (request.d_fds[i] >= 0) {
+                d_savedFds[i] = dup(i);
+                dup2(request.d_fds[i], i);
+            }
+        }
+        environ = d_environment.data();
+        RequestMetadataGenerator::set_parent_pid(request.d_parentPid);
+    }
+
+    ~RequestScope()
+    {
+        RequestMetadataGenerator::set_parent_pid(0);
+        environ = d_environ;
+
+        std::cout.flush();
+        std::cerr.flush();
+        fflush(nullptr);
+        for (int i = 0; i < 3; ++i) {
+            if (d_savedFds[i] >= 0) {
+                dup2(d_savedFds[i], i);
+                close(d_savedFds[i]);
+            }
+        }
+    }
+
+    RequestScope(const RequestScope &) = delete;
+    RequestScope &operator=(const RequestScope &) = delete;
+
+  private:
+    char **d_environ;
+    std::vector<char *> d_environment;
+    int d_savedFds[3];
+};
+
+/**
+ * Sets `stopRequested` if the client closes the connection before the end
+ * of the scope, which it only does when it is interrupted.
+ */
+class DisconnectionWatcher {
+  public:
+    DisconnectionWatcher(int connection, std::atomic_bool *stopRequested)
+    {
+        if (pipe(d_wakeup) != 0) {
+            throw std::system_error(errno, std::system_category(),
+                                    "Could not create pipe");
+        }
+        setCloseOnExec(d_wakeup[0]);
+        setCloseOnExec(d_wakeup[1]);
+
+        const int wakeup = d_wakeup[0];
+        d_thread = std::thread([connection, wakeup, stopRequested]() {
+            struct pollfd fds[2];
+            fds[0].fd = connection;
+            fds[0].events = POLLIN;
+            fds[1].fd = wakeup;
+            fds[1].events = POLLIN;
+            while (poll(fds, 2, -1) < 0 && errno == EINTR) {
+            }
+            if (fds[0].revents != 0 && fds[1].revents == 0) {
+                *stopRequested = true;
+            }
+        });
+    }
+
+    ~DisconnectionWatcher()
+    {
+        const char byte = 0;
+        while (write(d_wakeup[1], &byte, 1) < 0 && errno == EINTR) {
+        }
+        d_thread.join();
+        close(d_wakeup[0]);
+        close(d_wakeup[1]);
+    }
+
+    DisconnectionWatcher(const DisconnectionWatcher &) = delete;
+    DisconnectionWatcher &operator=(const DisconnectionWatcher &) = delete;
+
+  private:
+    int d_wakeup[2];
+    std::thread d_thread;
+};
+
+void closeFds(DaemonRequest *request)
+{
+    for (int &fd : request->d_fds) {
+        if (fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+}
+
+} // namespace
+
+DaemonServer::DaemonServer(const CommandHandler &handler)
+    : d_handler(handler),
+      d_workingDirectory(FileUtils::getCurrentWorkingDirectory())
+{
+    std::vector<std::string> environment;
+    for (char **variable = environ; *variable != nullptr; ++variable) {
+        environment.push_back(*variable);
+    }
+    d_configurationKey =
+        DaemonProtocol::configurationKey(environment, d_workingDirectory);
+}
+
+DaemonServer::~DaemonServer()
+{
+    if (d_socket >= 0) {
+        close(d_socket);
+        if (getpid() == d_ownerPid) {
+            unlink(d_socketPath.c_str());
+        }
+    }
+}
+
+void DaemonServer::listen(const std::string &socketPath)
+{
+    const struct sockaddr_un address =
+        DaemonProtocol::socketAddress(socketPath);
+
+    // A socket nobody listens on was left by a daemon that didn't exit
+    // cleanly
+    const int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    const bool inUse =
+        probe >= 0 &&
+        connect(probe, reinterpret_cast<const struct sockaddr *>(&address),
+                sizeof(address)) == 0;
+    if (probe >= 0) {
+        close(probe);
+    }
+    if (inUse) {
+        throw std::runtime_error("A recc daemon is already listening on \"" +
+                                 socketPath + "\"");
+    }
+    unlink(socketPath.c_str());
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        throw std::system_error(errno, std::system_category(),
+                                "Could not create socket");
+    }
+    setCloseOnExec(fd);
+
+    // Only the user running the daemon may connect to it
+    const mode_t mask = umask(0077);
+    const bool listening =
+        bind(fd, reinterpret_cast<const struct sockaddr *>(&address),
+             sizeof(address)) == 0 &&
+        ::listen(fd, SOMAXCONN) == 0;
+    const int error = errno;
+    umask(mask);
+    if (!listening) {
+        close(fd);
+        throw std::system_error(error, std::system_category(),
+                                "Could not listen on \"" + socketPath + "\"");
+    }
+
+    d_socket = fd;
+    d_socketPath = socketPath;
+    d_ownerPid = getpid();
+    BUILDBOX_LOG_INFO("Listening on \"" << socketPath << "\"");
+}
+
+void DaemonServer::run(int numWorkers, const std::atomic_bool &stopRequested)
+{
+    std::set<pid_t> workers;
+    while (!stopRequested) {
+        while (workers.size() < static_cast<size_t>(numWorkers)) {
+            const pid_t pid = fork();
+            if (pid < 0) {
+                throw std::system_error(errno, std::system_category(),
+                                        "Could not start worker");
+            }
+            if (pid == 0) {
+                runWorker(stopRequested);
+                _exit(0);
+            }
+            workers.insert(pid);
+        }
+
+        int status;
+        const pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::system_error(errno, std::system_category(),
+                                    "Could not wait for workers");
+        }
+        workers.erase(pid);
+        if (!stopRequested) {
+            BUILDBOX_LOG_WARNING("Worker " << pid << " exited with status "
+                                           << status << ", replacing it");
+            // Don't keep replacing workers that fail immediately
+            sleep(1);
+        }
+    }
+
+    for (const pid_t pid : workers) {
+        kill(pid, SIGTERM);
+    }
+    for (const pid_t pid : workers) {
+        int status;
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+        }
+    }
+}
+
+void DaemonServer::runWorker(const std::atomic_bool &stopRequested)
+{
+    while (!stopRequested) {
+        const int connection = accept(d_socket, nullptr, nullptr);
+        if (connection < 0) {
+            if (errno != EINTR && errno != ECONNABORTED) {
+                BUILDBOX_LOG_ERROR("Could not accept connection: "
+                                   << strerror(errno));
+                return;
+            }
+            continue;
+        }
+        setCloseOnExec(connection);
+
+        try {
+            handleConnection(connection);
+        }
+        catch (const std::exception &e) {
+            BUILDBOX_LOG_ERROR("Error while handling request: " << e.what());
+        }
+        close(connection);
+    }
+}
+
+void DaemonServer::handleConnection(int connection)
+{
+    // Commands run as the user of the daemon, with its credentials
+    if (!DaemonProtocol::peerIsSameUser(connection)) {
+        BUILDBOX_LOG_WARNING("Ignoring request from another user");
+        return;
+    }
+
+    DaemonRequest request;
+    if (!DaemonProtocol::receiveRequest(connection, &request)) {
+        BUILDBOX_LOG_WARNING("Ignoring malformed request");
+        return;
+    }
+    for (const int fd : request.d_fds) {
+        if (fd >= 0) {
+            setCloseOnExec(fd);
+        }
+    }
+
+    const bool accepted =
+        !request.d_arguments.empty() &&
+        DaemonProtocol::configurationKey(request.d_environment,
+                                         request.d_workingDirectory) ==
+            d_configurationKey &&
+        chdir(request.d_workingDirectory.c_str()) == 0;
+    if (!accepted) {
+        BUILDBOX_LOG_DEBUG("Refusing to run command in \""
+                           << request.d_workingDirectory << "\"");
+        closeFds(&request);
+        DaemonProtocol::sendStatus(connection, DaemonProtocol::REFUSED);
+        return;
+    }
+    DaemonProtocol::sendStatus(connection, DaemonProtocol::ACCEPTED);
+
+    std::vector<char *> arguments;
+    for (const auto &argument : request.d_arguments) {
+        arguments.push_back(const_cast<char *>(argument.c_str()));
+    }
+    arguments.push_back(nullptr);
+
+    const auto restore = [this, &request]() {
+        closeFds(&request);
+        if (chdir(d_workingDirectory.c_str()) != 0) {
+            BUILDBOX_LOG_WARNING("Could not return to \""
+                                 << d_workingDirectory
+                                 << "\": " << strerror(errno));
+        }
+    };
+
+    int exitCode;
+    try {
+        std::atomic_bool stopRequested(false);
+        DisconnectionWatcher watcher(connection, &stopRequested);
+        RequestScope scope(request);
+        exitCode = d_handler(static_cast<int>(request.d_arguments.size()),
+                             arguments.data(), stopRequested);
+    }
+    catch (...) {
+        restore();
+        throw;
+    }
+    restore();
+
+    DaemonProtocol::sendExitCode(connection, exitCode);
+}
+
+} // namespace recc
@@ -0,0 +1,91 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef INCLUDED_DAEMONSERVER
+#define INCLUDED_DAEMONSERVER
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <sys/types.h>
+
+namespace recc {
+
+/**
+ * Runs the commands sent by `recc` clients over a Unix socket.
+ *
+ * Commands run in worker processes that handle one request at a time, so
+ * that each command can be given the working directory, environment and
+ * standard streams of its client, while state such as connections to the
+ * servers is kept by the worker between commands.
+ *
+ * Only requests whose configuration matches the one of the daemon are run.
+ * The others are refused, and the client then runs them itself.
+ */
+class DaemonServer {
+  public:
+    typedef std::function<int(int argc, char *argv[],
+                              const std::atomic_bool &stopRequested)>
+        CommandHandler;
+
+    /**
+     * Runs accepted commands with `handler`, which returns their exit code.
+     * Requests are accepted if their configuration is the same as the one
+     * of this process.
+     */
+    explicit DaemonServer(const CommandHandler &handler);
+
+    /**
+     * Closes the socket, removing it if it was created by this process.
+     */
+    ~DaemonServer();
+
+    DaemonServer(const DaemonServer &) = delete;
+    DaemonServer &operator=(const DaemonServer &) = delete;
+
+    /**
+     * Listens on a socket at `socketPath`, replacing any stale one.
+     *
+     * Throws `std::runtime_error` if another daemon is listening on it.
+     */
+    void listen(const std::string &socketPath);
+
+    /**
+     * Accepts connections in `numWorkers` worker processes, replacing the
+     * ones that exit, until `stopRequested` becomes true. Running commands
+     * are then allowed to finish.
+     */
+    void run(int numWorkers, const std::atomic_bool &stopRequested);
+
+    /**
+     * Reads a request from `connection` and, if it is accepted, runs its
+     * command and sends back its exit code.
+     */
+    void handleConnection(int connection);
+
+  private:
+    void runWorker(const std::atomic_bool &stopRequested);
+
+    CommandHandler d_handler;
+    std::string d_configurationKey;
+    std::string d_workingDirectory;
+    std::string d_socketPath;
+    int d_socket = -1;
+    // Process that created the socket
+    pid_t d_ownerPid = 0;
+};
+
+} // namespace recc
+
+#endif
@@ -16,6 +16,8 @@
 
 #include <compilerdefaults.h>
 #include <env.h>
+#include <includescanner.h>
+#include <makerulesparser.h>
 #include <subprocess.h>
 
 #include <buildboxcommon_fileutils.h>
@@ -34,65 +36,14 @@
 #include <unistd.h>
 
 namespace recc {
-//BUILDBOX_LOG_DEBUG("RECC_REAPI_VERSION DEPSCPP LOG555");
 std::set<std::string>
 Deps::dependencies_from_make_rules(const std::string &rules,
                                    bool is_sun_format)
 {
-    std::set<std::string> result;
-    bool saw_colon_on_line = false;
-    bool saw_backslash = false;
-
-    std::string current_filename;
-    for (const char &character : rules) {
-        if (saw_backslash) {
-            saw_backslash = false;
-            if (character != '\n' && saw_colon_on_line) {
-                current_filename += character;
-            }
-        }
-        else if (character == '\\') {
-            saw_backslash = true;
-        }
-        else if (character == ':' && !saw_colon_on_line) {
-            saw_colon_on_line = true;
-        }
-        else if (character == '\n') {
-            saw_colon_on_line = false;
-            if (!current_filename.empty()) {
-                result.insert(current_filename);
-            }
-            current_filename.clear();
-        }
-        else if (character == ' ') {
-            if (is_sun_format) {
-                if (!current_filename.empty() && saw_colon_on_line) {
-                    current_filename += character;
-                }
-            }
-            else {
-                if (!current_filename.empty()) {
-                    result.insert(current_filename);
-                }
-                current_filename.clear();
-            }
-        }
-        else if (saw_colon_on_line) {
-            current_filename += character;
-        }
-    }
-    std::cerr<<"Before File_name 555555555 >"<<current_filename<<std::endl;
-    if (!current_filename.empty()) {
-        BUILDBOX_LOG_DEBUG("FILENAME IS EMPTY");
-        result.insert(current_filename);
-    }
-
-   // BUILDBOX_LOG_DEBUG("FILENAME LOG56 :"<<result);
-    BUILDBOX_LOG_DEBUG("FILENAME LOG56 :"<<current_filename);
-    //std::cerr<<"FRESULT 8888888"<<result<<std::endl;
-
-    //std::cout << "result in SET  " << result;
-    return result;
+    MakeRulesParser parser(is_sun_format);
+    parser.parse(rules);
+    parser.finish();
+    return parser.takeDependencies();
 }
 
 std::string Deps::crtbegin_from_clang_v(const std::string &str)
@@ -129,47 +80,29 @@ std::string Deps::crtbegin_from_clang_v(const std::string &str)
     return crtbegin_file;
 }
 
-CommandFileInfo Deps::get_file_info(const ParsedCommand &parsedCommand)
+CommandFileInfo Deps::get_file_info(const ParsedCommand &parsedCommand,
+                                    const DependencyCallback &onDependency)
 {
     BUILDBOX_LOG_DEBUG("RECC_REAPI_VERSION DEPSCPP LOG7");
     CommandFileInfo result;
-    bool is_clang = parsedCommand.is_clang();
-    const auto subprocessResult = Subprocess::execute(
-        parsedCommand.get_dependencies_command(), true, true, RECC_DEPS_ENV);
 
-    if (subprocessResult.d_exitCode != 0) {
-        std::string errorMsg = "Failed to execute get dependencies command: ";
-        for (const auto &token : parsedCommand.get_dependencies_command()) {
-            errorMsg += (token + " ");
+    bool scanned = false;
+    if (RECC_DEPS_SCANNER == "native" &&
+        IncludeScanner::isSupported(parsedCommand)) {
+        try {
+            IncludeScanner scanner(RECC_CACHE_DIR + "/include-paths");
+            result.d_dependencies = scanner.scan(parsedCommand);
+            scanned = true;
+        }
+        catch (const IncludeScanner::unsupported_error &e) {
+            BUILDBOX_LOG_DEBUG("Falling back to the dependencies command: "
+                               << e.what());
         }
-        BUILDBOX_LOG_ERROR(errorMsg);
-        BUILDBOX_LOG_ERROR("Exit status: " << subprocessResult.d_exitCode);
-        BUILDBOX_LOG_DEBUG("stdout: " << subprocessResult.d_stdOut);
-        BUILDBOX_LOG_DEBUG("stderr: " << subprocessResult.d_stdErr);
-        throw subprocess_failed_error(subprocessResult.d_exitCode);
-    }
-
-    std::string dependencies = subprocessResult.d_stdOut;
-
-    // If AIX compiler, read dependency information from temporary file.
-
-    if (parsedCommand.is_AIX()) {
-        dependencies = buildboxcommon::FileUtils::getFileContents(
-            parsedCommand.get_aix_dependency_file_name().c_str());
     }
 
-    result.d_dependencies = dependencies_from_make_rules(
-        dependencies, parsedCommand.produces_sun_make_rules());
-
-    if (RECC_DEPS_GLOBAL_PATHS && is_clang) {
-        // Clang tries to locate GCC installations by looking for crtbegin.o
-        // and then adjusts its system include paths. We need to upload this
-        // file as if it were an input.
-        std::string crtbegin =
-            crtbegin_from_clang_v(subprocessResult.d_stdErr);
-        if (crtbegin != "") {
-            result.d_dependencies.insert(crtbegin);
-        }
+    if (!scanned) {
+        result.d_dependencies =
+            dependencies_from_compiler(parsedCommand, onDependency);
     }
 
     // Add deps products based on -o switch, if -MD/MMD was set
@@ -205,6 +138,61 @@ CommandFileInfo Deps::get_file_info(const ParsedCommand &parsedCommand)
     return result;
 }
 
+std::set<std::string>
+Deps::dependencies_from_compiler(const ParsedCommand &parsedCommand,
+                                 const DependencyCallback &onDependency)
+{
+    bool is_clang = parsedCommand.is_clang();
+
+    // The rules are parsed while the compiler is still writing them, unless
+    // they are written to a file (AIX)
+    MakeRulesParser parser(parsedCommand.produces_sun_make_rules(),
+                           onDependency);
+    Subprocess::OutputCallback onStdOut;
+    if (!parsedCommand.is_AIX()) {
+        onStdOut = [&parser](const char *data, size_t size) {
+            parser.parse(data, size);
+        };
+    }
+
+    const auto subprocessResult =
+        Subprocess::execute(parsedCommand.get_dependencies_command(), true,
+                            true, RECC_DEPS_ENV, onStdOut);
+
+    if (subprocessResult.d_exitCode != 0) {
+        std::string errorMsg = "Failed to execute get dependencies command: ";
+        for (const auto &token : parsedCommand.get_dependencies_command()) {
+            errorMsg += (token + " ");
+        }
+        BUILDBOX_LOG_ERROR(errorMsg);
+        BUILDBOX_LOG_ERROR("Exit status: " << subprocessResult.d_exitCode);
+        BUILDBOX_LOG_DEBUG("stderr: " << subprocessResult.d_stdErr);
+        throw subprocess_failed_error(subprocessResult.d_exitCode);
+    }
+
+    // If AIX compiler, read dependency information from temporary file.
+
+    if (parsedCommand.is_AIX()) {
+        parser.parse(buildboxcommon::FileUtils::getFileContents(
+            parsedCommand.get_aix_dependency_file_name().c_str()));
+    }
+    parser.finish();
+
+    std::set<std::string> result = parser.takeDependencies();
+
+    if (RECC_DEPS_GLOBAL_PATHS && is_clang) {
+        // Clang tries to locate GCC installations by looking for crtbegin.o
+        // and then adjusts its system include paths. We need to upload this
+        // file as if it were an input.
+        std::string crtbegin =
+            crtbegin_from_clang_v(subprocessResult.d_stdErr);
+        if (crtbegin != "") {
+            result.insert(crtbegin);
+        }
+    }
+    return result;
+}
+
 std::set<std::string>
 Deps::determine_products(const ParsedCommand &parsedCommand)
 {
@@ -17,6 +17,7 @@
 
 #include <parsedcommand.h>
 #include <parsedcommandfactory.h>
+#include <functional>
 #include <set>
 #include <stdexcept>
 #include <string>
@@ -53,6 +54,8 @@ struct Deps {
 
     //BUILDBOX_LOG_DEBUG("RECC_REAPI_VERSION DEPSCPP LOG77777");
 
+    typedef std::function<void(const std::string &)> DependencyCallback;
+
     /**
      * Returns the names of the files needed to run the command.
      *
@@ -60,8 +63,26 @@ struct Deps {
      * returns false, the result of calling get_file_info is undefined.
      *
      * Only paths local to the build directory are returned.
+     *
+     * If given, `onDependency` is called with dependencies as soon as the
+     * dependency command reports them (see `dependencies_from_compiler()`).
+     */
+    static CommandFileInfo get_file_info(
+        const ParsedCommand &command,
+        const DependencyCallback &onDependency = DependencyCallback());
+
+    /**
+     * Runs the dependency command of the given compiler command and returns
+     * the dependencies that it reports.
+     *
+     * If given, `onDependency` is called with each dependency as soon as the
+     * compiler has reported it, while the command is still running.
+     *
+     * Throws `subprocess_failed_error` if the command fails.
      */
-    static CommandFileInfo get_file_info(const ParsedCommand &command);
+    static std::set<std::string> dependencies_from_compiler(
+        const ParsedCommand &command,
+        const DependencyCallback &onDependency = DependencyCallback());
 
     /**
      * Parse the given Make rules and return a set containing their
@@ -14,13 +14,20 @@
 
 #include <digestgenerator.h>
 
+#include <blake3.h>
 #include <buildboxcommonmetrics_metricguard.h>
 #include <buildboxcommonmetrics_totaldurationmetrictimer.h>
 #include <env.h>
+#include <filecontents.h>
+#include <sha256multibuffer.h>
+#include <threadpool.h>
 
-#include <iomanip>
-#include <sstream>
+#include <cerrno>
+#include <fcntl.h>
 #include <string>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
 
 #include <openssl/evp.h>
 
@@ -28,6 +35,10 @@
 
 namespace recc {
 
+// As numbered in the versions of the REAPI protos that define it
+const proto::DigestFunction_Value DigestGenerator::DIGEST_FUNCTION_BLAKE3 =
+    static_cast<proto::DigestFunction_Value>(9);
+
 namespace {
 
 // If `status_code` is 0, throw an `std::runtime_error` exception with a
@@ -83,23 +94,48 @@ EVP_MD_CTX_ptr createDigestContext(const EVP_MD *digestFunctionStruct)
 // representation in hexadecimal.
 std::string hashToHex(const unsigned char *hash_buffer, unsigned int hash_size)
 {
-    std::ostringstream ss;
+    static const char hexDigits[] = "0123456789abcdef";
+    std::string result(2 * static_cast<size_t>(hash_size), '\0');
     for (unsigned int i = 0; i < hash_size; i++) {
-        ss << std::hex << std::setw(2) << std::setfill('0')
-           << static_cast<int>(hash_buffer[i]);
+        result[2 * i] = hexDigits[hash_buffer[i] >> 4];
+        result[2 * i + 1] = hexDigits[hash_buffer[i] & 0xf];
     }
-    return ss.str();
+    return result;
 }
 
-// Get the OpenSSL MD struct for the digest function specified in the
-// configuration. (Throws `out_of_range` for values not defined.)
-const EVP_MD *getDigestFunctionStruct()
+// The digest function specified in the configuration, looked up again only
+// when the configuration changes. BLAKE3 is not provided by OpenSSL, so its
+// `d_struct` is null.
+struct DigestFunction {
+    std::string d_name;
+    proto::DigestFunction_Value d_value;
+    const EVP_MD *d_struct;
+
+    bool isBlake3() const
+    {
+        return d_value == DigestGenerator::DIGEST_FUNCTION_BLAKE3;
+    }
+};
+
+// Get the digest function specified in the configuration. (Throws
+// `runtime_error` for values not defined.)
+const DigestFunction &getDigestFunction()
 {
+    thread_local DigestFunction digestFunction = {
+        "", proto::DigestFunction_Value_UNKNOWN, nullptr};
+    if (!digestFunction.d_name.empty() &&
+        digestFunction.d_name == RECC_CAS_DIGEST_FUNCTION) {
+        return digestFunction;
+    }
+
     // Translating the string set in the environment to a
     // `DigestFunction_Value`:
-    const std::string digestFunctionName = RECC_CAS_DIGEST_FUNCTION;
-    const proto::DigestFunction_Value digestValue =
-        DigestGenerator::stringToDigestFunctionMap().at(digestFunctionName);
+    const auto &functions = DigestGenerator::stringToDigestFunctionMap();
+    const auto function = functions.find(RECC_CAS_DIGEST_FUNCTION);
+    if (function == functions.cend()) {
+        throw std::runtime_error("Invalid or not supported digest function: " +
+                                 RECC_CAS_DIGEST_FUNCTION);
+    }
 
     // And from that value getting the OpenSSL MD corresponding to
     // that digest function:
@@ -111,59 +147,309 @@ const EVP_MD *getDigestFunctionStruct()
             {proto::DigestFunction_Value_SHA384, EVP_sha384()},
             {proto::DigestFunction_Value_SHA512, EVP_sha512()}};
 
-    return digestValueToOpenSslStructMap.at(digestValue);
+    const auto openSslStruct =
+        digestValueToOpenSslStructMap.find(function->second);
+    digestFunction.d_name = function->first;
+    digestFunction.d_value = function->second;
+    digestFunction.d_struct =
+        openSslStruct != digestValueToOpenSslStructMap.cend()
+            ? openSslStruct->second
+            : nullptr;
+    return digestFunction;
 }
-} // namespace
 
-proto::Digest DigestGenerator::make_digest(const std::string &blob)
+// Blobs and files up to this size are hashed together with
+// `Sha256MultiBuffer`. Larger ones are better hashed on their own.
+const size_t MAX_BATCHED_BLOB_SIZE = 64 * 1024;
+
+// BLAKE3 hashes blobs from this size in the default thread pool
+const size_t MIN_PARALLEL_HASHING_SIZE = 1024 * 1024;
+
+// Files too large for `FileContentsCache` are hashed in parts of this size
+// rather than read whole
+const size_t FILE_READ_BUFFER_SIZE = 1024 * 1024;
+
+ThreadPool *poolForHashing(size_t size)
 {
+    return size >= MIN_PARALLEL_HASHING_SIZE ? &ThreadPool::defaultPool()
+                                             : nullptr;
+}
 
-    const EVP_MD *hashAlgorithm;
-    try {
-        hashAlgorithm = getDigestFunctionStruct();
+proto::Digest makeDigest(const char *data, size_t size)
+{
+    buildboxcommon::buildboxcommonmetrics::MetricGuard<
+        buildboxcommon::buildboxcommonmetrics::TotalDurationMetricTimer>
+        mt(TIMER_NAME_CALCULATE_DIGESTS_TOTAL);
+
+    const DigestFunction &digestFunction = getDigestFunction();
+    if (digestFunction.isBlake3()) {
+        unsigned char hash[Blake3::DIGEST_SIZE];
+        Blake3::hash(data, size, hash, poolForHashing(size));
+
+        proto::Digest result;
+        result.set_hash(hashToHex(hash, Blake3::DIGEST_SIZE));
+        result.set_size_bytes(static_cast<google::protobuf::int64>(size));
+        return result;
     }
-    catch (const std::out_of_range &) {
-        throw std::runtime_error("Invalid or not supported digest function: " +
-                                 RECC_CAS_DIGEST_FUNCTION);
+
+    // Reuse the context rather than allocating one for each blob
+    const EVP_MD *digestFunctionStruct = digestFunction.d_struct;
+    thread_local EVP_MD_CTX_ptr context(nullptr, &deleteDigestContext);
+    if (!context) {
+        context = createDigestContext(digestFunctionStruct);
+    }
+    else {
+        throwIfNotSuccessful(
+            EVP_DigestInit_ex(context.get(), digestFunctionStruct, nullptr),
+            "EVP_DigestInit_ex()");
     }
 
-    std::string hash;
-    { // Timed block
-        buildboxcommon::buildboxcommonmetrics::MetricGuard<
-            buildboxcommon::buildboxcommonmetrics::TotalDurationMetricTimer>
-            mt(TIMER_NAME_CALCULATE_DIGESTS_TOTAL);
+    unsigned char hashBuffer[EVP_MAX_MD_SIZE];
+    unsigned int messageLength;
+    throwIfNotSuccessful(EVP_DigestUpdate(context.get(), data, size),
+                         "EVP_DigestUpdate()");
+    throwIfNotSuccessful(
+        EVP_DigestFinal_ex(context.get(), hashBuffer, &messageLength),
+        "EVP_DigestFinal_ex()");
 
-        // Initialize context:
-        EVP_MD_CTX_ptr hashContext = createDigestContext(hashAlgorithm);
-        // (Automatically destroyed)
+    proto::Digest result;
+    result.set_hash(hashToHex(hashBuffer, messageLength));
+    result.set_size_bytes(static_cast<google::protobuf::int64>(size));
+    return result;
+}
 
-        // Calculate hash:
-        throwIfNotSuccessful(
-            EVP_DigestUpdate(hashContext.get(), &blob[0], blob.length()),
-            "EVP_DigestUpdate()");
+} // namespace
+
+DigestGenerator::IncrementalDigest::IncrementalDigest()
+    : d_context(nullptr, &deleteDigestContext)
+{
+    const DigestFunction &digestFunction = getDigestFunction();
+    if (digestFunction.isBlake3()) {
+        d_blake3.reset(new Blake3(&ThreadPool::defaultPool()));
+        return;
+    }
+
+    // Initialize context:
+    d_context = createDigestContext(digestFunction.d_struct);
+    // (Automatically destroyed)
+}
+
+DigestGenerator::IncrementalDigest::~IncrementalDigest() {}
 
-        unsigned char hashBuffer[EVP_MAX_MD_SIZE];
-        unsigned int messageLength;
+void DigestGenerator::IncrementalDigest::update(const char *data,
+                                                size_t size)
+{
+    buildboxcommon::buildboxcommonmetrics::MetricGuard<
+        buildboxcommon::buildboxcommonmetrics::TotalDurationMetricTimer>
+        mt(TIMER_NAME_CALCULATE_DIGESTS_TOTAL);
+
+    if (d_blake3) {
+        d_blake3->update(data, size);
+    }
+    else {
+        throwIfNotSuccessful(EVP_DigestUpdate(d_context.get(), data, size),
+                             "EVP_DigestUpdate()");
+    }
+    d_size += static_cast<int64_t>(size);
+}
+
+proto::Digest DigestGenerator::IncrementalDigest::finalize()
+{
+    unsigned char hashBuffer[EVP_MAX_MD_SIZE];
+    unsigned int messageLength;
+    if (d_blake3) {
+        d_blake3->finalize(hashBuffer);
+        messageLength = Blake3::DIGEST_SIZE;
+    }
+    else {
         throwIfNotSuccessful(
-            EVP_DigestFinal_ex(hashContext.get(), hashBuffer, &messageLength),
+            EVP_DigestFinal_ex(d_context.get(), hashBuffer, &messageLength),
             "EVP_DigestFinal_ex()");
-
-        // Generate hash string:
-        hash = hashToHex(hashBuffer, static_cast<unsigned int>(messageLength));
     }
 
     proto::Digest result;
-    result.set_hash(hash);
-    result.set_size_bytes(static_cast<google::protobuf::int64>(blob.size()));
+    // Generate hash string:
+    result.set_hash(
+        hashToHex(hashBuffer, static_cast<unsigned int>(messageLength)));
+    result.set_size_bytes(static_cast<google::protobuf::int64>(d_size));
     return result;
 }
 
+proto::Digest DigestGenerator::make_digest(const std::string &blob)
+{
+    return makeDigest(blob.data(), blob.size());
+}
+
 proto::Digest
 DigestGenerator::make_digest(const google::protobuf::MessageLite &message)
 {
     return make_digest(message.SerializeAsString());
 }
 
+std::vector<proto::Digest>
+DigestGenerator::make_digests(const std::vector<BlobView> &blobs)
+{
+    std::vector<proto::Digest> digests(blobs.size());
+
+    // Small blobs go through the lanes of `Sha256MultiBuffer`, the others
+    // are hashed one at a time
+    std::vector<size_t> batched;
+    if (blobs.size() > 1 &&
+        getDigestFunction().d_value == proto::DigestFunction_Value_SHA256 &&
+        Sha256MultiBuffer::isPreferred()) {
+        for (size_t i = 0; i < blobs.size(); ++i) {
+            if (blobs[i].d_size <= MAX_BATCHED_BLOB_SIZE) {
+                batched.push_back(i);
+            }
+        }
+    }
+    if (batched.size() < 2) {
+        batched.clear();
+    }
+
+    size_t nextBatched = 0;
+    for (size_t i = 0; i < blobs.size(); ++i) {
+        if (nextBatched < batched.size() && batched[nextBatched] == i) {
+            ++nextBatched;
+        }
+        else {
+            digests[i] = makeDigest(blobs[i].d_data, blobs[i].d_size);
+        }
+    }
+    if (batched.empty()) {
+        return digests;
+    }
+
+    buildboxcommon::buildboxcommonmetrics::MetricGuard<
+        buildboxcommon::buildboxcommonmetrics::TotalDurationMetricTimer>
+        mt(TIMER_NAME_CALCULATE_DIGESTS_TOTAL);
+
+    std::vector<const char *> messages;
+    std::vector<size_t> sizes;
+    messages.reserve(batched.size());
+    sizes.reserve(batched.size());
+    for (const size_t i : batched) {
+        messages.push_back(blobs[i].d_data);
+        sizes.push_back(blobs[i].d_size);
+    }
+    std::vector<unsigned char> hashes(batched.size() *
+                                      Sha256MultiBuffer::DIGEST_SIZE);
+    Sha256MultiBuffer::hash(messages.data(), sizes.data(), batched.size(),
+                            hashes.data());
+
+    for (size_t j = 0; j < batched.size(); ++j) {
+        proto::Digest &digest = digests[batched[j]];
+        digest.set_hash(
+            hashToHex(hashes.data() + j * Sha256MultiBuffer::DIGEST_SIZE,
+                      Sha256MultiBuffer::DIGEST_SIZE));
+        digest.set_size_bytes(
+            static_cast<google::protobuf::int64>(sizes[j]));
+    }
+    return digests;
+}
+
+// Hash the file open as `fd` from its start to its end, holding only
+// `FILE_READ_BUFFER_SIZE` bytes of it in memory at a time.
+proto::Digest hashFile(int fd, const std::string &path)
+{
+    DigestGenerator::IncrementalDigest digest;
+    std::unique_ptr<char[]> buffer(new char[FILE_READ_BUFFER_SIZE]);
+    off_t offset = 0;
+    while (true) {
+        const ssize_t bytesRead =
+            pread(fd, buffer.get(), FILE_READ_BUFFER_SIZE, offset);
+        if (bytesRead < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytesRead < 0) {
+            throw std::system_error(errno, std::system_category(),
+                                    "Could not read \"" + path + "\"");
+        }
+        if (bytesRead == 0) {
+            break;
+        }
+        digest.update(buffer.get(), static_cast<size_t>(bytesRead));
+        offset += bytesRead;
+    }
+    return digest.finalize();
+}
+
+std::vector<buildboxcommon::File>
+DigestGenerator::make_file_digests(const std::vector<std::string> &paths)
+{
+    std::vector<buildboxcommon::File> files(paths.size());
+
+    // Read each regular file once, hashing the small ones together and the
+    // others on their own. Their contents are kept for the upload if
+    // `FileContentsCache` has room. Files it can't keep are hashed in parts
+    // and read again from their path if they need to be uploaded.
+    FileContentsCache &cache = FileContentsCache::defaultCache();
+    std::vector<size_t> read;
+    std::vector<std::shared_ptr<const FileContents>> contents;
+    for (size_t i = 0; i < paths.size(); ++i) {
+        const int fd = open(paths[i].c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            throw std::system_error(errno, std::system_category(),
+                                    "Could not open \"" + paths[i] + "\"");
+        }
+        struct stat statResult;
+        if (fstat(fd, &statResult) != 0 || !S_ISREG(statResult.st_mode)) {
+            close(fd);
+            files[i] = buildboxcommon::File(paths[i].c_str());
+            continue;
+        }
+
+        files[i].d_executable = (statResult.st_mode & S_IXUSR) != 0;
+        std::shared_ptr<const FileContents> fileContents;
+        try {
+            if (static_cast<size_t>(statResult.st_size) >
+                FileContentsCache::MAX_FILE_SIZE) {
+                files[i].d_digest = hashFile(fd, paths[i]);
+            }
+            else {
+                fileContents =
+                    std::make_shared<FileContents>(fd, paths[i], statResult);
+            }
+        }
+        catch (...) {
+            close(fd);
+            throw;
+        }
+        close(fd);
+
+        if (!fileContents) {
+            continue;
+        }
+        if (fileContents->size() <= MAX_BATCHED_BLOB_SIZE) {
+            read.push_back(i);
+            contents.push_back(std::move(fileContents));
+        }
+        else {
+            files[i].d_digest =
+                makeDigest(fileContents->data(), fileContents->size());
+            cache.insert(paths[i], files[i].d_digest, fileContents);
+        }
+    }
+
+    std::vector<BlobView> blobs;
+    blobs.reserve(contents.size());
+    for (const auto &fileContents : contents) {
+        blobs.emplace_back(fileContents->data(), fileContents->size());
+    }
+    const std::vector<proto::Digest> digests = make_digests(blobs);
+    for (size_t j = 0; j < read.size(); ++j) {
+        files[read[j]].d_digest = digests[j];
+        cache.insert(paths[read[j]], digests[j], contents[j]);
+    }
+    return files;
+}
+
+buildboxcommon::File
+DigestGenerator::make_file_digest(const std::string &path)
+{
+    return make_file_digests({path}).front();
+}
+
 const std::map<std::string, proto::DigestFunction_Value> &
 DigestGenerator::stringToDigestFunctionMap()
 {
@@ -172,7 +458,8 @@ DigestGenerator::stringToDigestFunctionMap()
                                {"SHA1", proto::DigestFunction_Value_SHA1},
                                {"SHA256", proto::DigestFunction_Value_SHA256},
                                {"SHA384", proto::DigestFunction_Value_SHA384},
-                               {"SHA512", proto::DigestFunction_Value_SHA512}};
+                               {"SHA512", proto::DigestFunction_Value_SHA512},
+                               {"BLAKE3", DIGEST_FUNCTION_BLAKE3}};
 
     return stringToFunctionMap;
 }
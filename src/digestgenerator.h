@@ -17,16 +17,102 @@
 
 #include <protos.h>
 
+#include <buildboxcommon_merklize.h>
+
+#include <cstddef>
+#include <cstdint>
 #include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <openssl/evp.h>
 
 namespace recc {
 
+class Blake3;
+
 struct DigestGenerator {
+    /**
+     * `DigestFunction` value of BLAKE3, which is not defined by the version
+     * of the REAPI protos that recc is built against.
+     */
+    static const proto::DigestFunction_Value DIGEST_FUNCTION_BLAKE3;
+
+    /**
+     * Computes the digest of a blob given in parts, so that it never needs
+     * to be held in memory as a whole.
+     */
+    class IncrementalDigest {
+      public:
+        IncrementalDigest();
+
+        ~IncrementalDigest();
+
+        void update(const char *data, size_t size);
+
+        /**
+         * Returns the digest of the data given so far. No more data can be
+         * added afterwards.
+         */
+        proto::Digest finalize();
+
+      private:
+        // Only one of them is set, depending on the digest function
+        std::unique_ptr<EVP_MD_CTX, void (*)(EVP_MD_CTX *)> d_context;
+        std::unique_ptr<Blake3> d_blake3;
+        int64_t d_size = 0;
+    };
+
+    /**
+     * A blob held in memory by the caller.
+     */
+    struct BlobView {
+        BlobView(const char *data, size_t size) : d_data(data), d_size(size)
+        {
+        }
+
+        BlobView(const std::string &blob)
+            : d_data(blob.data()), d_size(blob.size())
+        {
+        }
+
+        const char *d_data;
+        size_t d_size;
+    };
+
     static proto::Digest make_digest(const std::string &blob);
 
     static proto::Digest
     make_digest(const google::protobuf::MessageLite &message);
 
+    /**
+     * Returns the digests of the given blobs, in the same order. With
+     * SHA-256, small blobs are hashed several at a time with
+     * `Sha256MultiBuffer` where that is faster.
+     */
+    static std::vector<proto::Digest>
+    make_digests(const std::vector<BlobView> &blobs);
+
+    /**
+     * Returns the `File` of each path (following symlinks), in the same
+     * order, hashing small regular files with `make_digests()`. Regular
+     * files up to `FileContentsCache::MAX_FILE_SIZE` are read once, through
+     * `FileContents`, and their contents are added to
+     * `FileContentsCache::defaultCache()`. Larger ones are hashed in parts.
+     *
+     * Throws `std::system_error` if one of the files can't be read.
+     */
+    static std::vector<buildboxcommon::File>
+    make_file_digests(const std::vector<std::string> &paths);
+
+    /**
+     * Returns the `File` of the given path (following symlinks).
+     *
+     * Throws `std::system_error` if the file can't be read.
+     */
+    static buildboxcommon::File make_file_digest(const std::string &path);
+
     static const std::map<std::string, proto::DigestFunction_Value> &
     stringToDigestFunctionMap();
 
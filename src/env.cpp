@@ -65,6 +65,8 @@ std::vector<std::pair<std::string, std::string>> RECC_PREFIX_REPLACEMENT;
 std::string RECC_CAS_DIGEST_FUNCTION = DEFAULT_RECC_CAS_DIGEST_FUNCTION;
 std::string RECC_WORKING_DIR_PREFIX = DEFAULT_RECC_WORKING_DIR_PREFIX;
 std::string RECC_ACTION_SALT = DEFAULT_RECC_ACTION_SALT;
+std::string RECC_CACHE_DIR = DEFAULT_RECC_CACHE_DIR;
+std::string RECC_DEPS_SCANNER = DEFAULT_RECC_DEPS_SCANNER;
 
 bool RECC_NO_EXECUTE = false;
 bool RECC_ENABLE_METRICS = DEFAULT_RECC_ENABLE_METRICS;
@@ -84,6 +86,22 @@ std::string RECC_LOG_DIRECTORY = DEFAULT_RECC_LOG_DIRECTORY;
 bool RECC_VERBOSE = DEFAULT_RECC_VERBOSE;
 bool RECC_CAS_GET_CAPABILITIES = false;
 bool RECC_PRESERVE_ENV = false;
+bool RECC_DIRECT_MODE = DEFAULT_RECC_DIRECT_MODE;
+bool RECC_FILE_DIGEST_CACHE = DEFAULT_RECC_FILE_DIGEST_CACHE;
+bool RECC_SUBTREE_DIGEST_CACHE = DEFAULT_RECC_SUBTREE_DIGEST_CACHE;
+bool RECC_CAS_PRESENCE_CACHE = DEFAULT_RECC_CAS_PRESENCE_CACHE;
+int RECC_CAS_PRESENCE_CACHE_TTL = DEFAULT_RECC_CAS_PRESENCE_CACHE_TTL;
+int RECC_CAS_PRESENCE_CACHE_VERIFY = DEFAULT_RECC_CAS_PRESENCE_CACHE_VERIFY;
+bool RECC_SPECULATIVE_FIND_MISSING_BLOBS =
+    DEFAULT_RECC_SPECULATIVE_FIND_MISSING_BLOBS;
+int RECC_EXECUTE_LIMIT = DEFAULT_RECC_EXECUTE_LIMIT;
+int RECC_EXECUTE_QUEUE_TARGET_MS = DEFAULT_RECC_EXECUTE_QUEUE_TARGET_MS;
+int RECC_LOCAL_CAS_MAX_SIZE_MB = DEFAULT_RECC_LOCAL_CAS_MAX_SIZE_MB;
+bool RECC_LOCAL_CAS_HARDLINKS = DEFAULT_RECC_LOCAL_CAS_HARDLINKS;
+bool RECC_LOCAL_ACTION_CACHE = DEFAULT_RECC_LOCAL_ACTION_CACHE;
+int RECC_LOCAL_ACTION_CACHE_TTL = DEFAULT_RECC_LOCAL_ACTION_CACHE_TTL;
+bool RECC_LOCAL_ACTION_CACHE_VERIFY = DEFAULT_RECC_LOCAL_ACTION_CACHE_VERIFY;
+int RECC_FILE_CACHE_MAX_SIZE_MB = DEFAULT_RECC_FILE_CACHE_MAX_SIZE_MB;
 
 int RECC_RETRY_LIMIT = DEFAULT_RECC_RETRY_LIMIT;
 int RECC_RETRY_DELAY = DEFAULT_RECC_RETRY_DELAY;
@@ -311,6 +329,8 @@ void Env::parse_config_variables(const char *const *env)
         STRVAR(RECC_WORKING_DIR_PREFIX)
         STRVAR(RECC_REAPI_VERSION)
         STRVAR(RECC_ACTION_SALT)
+        STRVAR(RECC_CACHE_DIR)
+        STRVAR(RECC_DEPS_SCANNER)
 
         BOOLVAR(RECC_NO_EXECUTE)
         BOOLVAR(RECC_ENABLE_METRICS)
@@ -327,11 +347,26 @@ void Env::parse_config_variables(const char *const *env)
         BOOLVAR(RECC_CAS_GET_CAPABILITIES)
         BOOLVAR(RECC_PRESERVE_ENV)
         BOOLVAR(RECC_NO_PATH_REWRITE)
+        BOOLVAR(RECC_DIRECT_MODE)
+        BOOLVAR(RECC_FILE_DIGEST_CACHE)
+        BOOLVAR(RECC_SUBTREE_DIGEST_CACHE)
+        BOOLVAR(RECC_CAS_PRESENCE_CACHE)
+        BOOLVAR(RECC_SPECULATIVE_FIND_MISSING_BLOBS)
+        BOOLVAR(RECC_LOCAL_CAS_HARDLINKS)
+        BOOLVAR(RECC_LOCAL_ACTION_CACHE)
+        BOOLVAR(RECC_LOCAL_ACTION_CACHE_VERIFY)
 
         INTVAR(RECC_RETRY_LIMIT)
         INTVAR(RECC_RETRY_DELAY)
         INTVAR(RECC_REQUEST_TIMEOUT)
         INTVAR(RECC_KEEPALIVE_TIME)
+        INTVAR(RECC_CAS_PRESENCE_CACHE_TTL)
+        INTVAR(RECC_CAS_PRESENCE_CACHE_VERIFY)
+        INTVAR(RECC_EXECUTE_LIMIT)
+        INTVAR(RECC_EXECUTE_QUEUE_TARGET_MS)
+        INTVAR(RECC_LOCAL_CAS_MAX_SIZE_MB)
+        INTVAR(RECC_LOCAL_ACTION_CACHE_TTL)
+        INTVAR(RECC_FILE_CACHE_MAX_SIZE_MB)
         INTVAR(RECC_MAX_THREADS)
 
         SETVAR(RECC_DEPS_OVERRIDE, ',')
@@ -508,9 +543,30 @@ void Env::handle_special_defaults()
                 RECC_CAS_DIGEST_FUNCTION + "\".");
     }
 
+    if (RECC_DEPS_SCANNER != "compiler" && RECC_DEPS_SCANNER != "native") {
+        BUILDBOXCOMMON_THROW_EXCEPTION(
+            std::runtime_error,
+            "Unknown dependency scanner set in RECC_DEPS_SCANNER: \"" +
+                RECC_DEPS_SCANNER + "\".");
+    }
+
     if (RECC_MAX_THREADS == 0) {
         RECC_MAX_THREADS = 1;
     }
+
+    if (RECC_CACHE_DIR.empty()) {
+        const char *xdgCacheHome = getenv("XDG_CACHE_HOME");
+        const char *home = getenv("HOME");
+        if (xdgCacheHome != nullptr && xdgCacheHome[0] == '/') {
+            RECC_CACHE_DIR = std::string(xdgCacheHome) + "/recc";
+        }
+        else if (home != nullptr && home[0] != '\0') {
+            RECC_CACHE_DIR = std::string(home) + "/.cache/recc";
+        }
+        else {
+            RECC_CACHE_DIR = TMPDIR + "/recc";
+        }
+    }
 }
 
 void Env::assert_reapi_version_is_valid()
@@ -653,7 +709,7 @@ const std::string Env::backwardsCompatibleURL(const std::string &url)
     // Construct the new URL format if it is in the previous format
     // which doesn't include the protocol
     if (!(url.find("http://") == 0 || url.find("https://") == 0 ||
-          url.find("unix:") == 0)) {
+          url.find("unix:") == 0 || url.find("file://") == 0)) {
         // Use the hint provided by the deprecated flag
         // to use https protocol instead, if set
         if (RECC_SERVER_SSL) {
@@ -664,7 +720,8 @@ const std::string Env::backwardsCompatibleURL(const std::string &url)
         }
     }
     else {
-        if (RECC_SERVER_SSL && url.find("https://") != 0) {
+        if (RECC_SERVER_SSL && url.find("https://") != 0 &&
+            url.find("file://") != 0) {
             BUILDBOXCOMMON_THROW_EXCEPTION(
                 std::runtime_error,
                 "URL set to url=[" + url +
@@ -25,7 +25,8 @@
 namespace recc {
 
 /**
- * The URI of the server to use, e.g. http://localhost:8085
+ * The URI of the server to use, e.g. http://localhost:8085, or a file://
+ * URL of a cache directory, in cache-only mode.
  */
 extern std::string RECC_SERVER;
 
@@ -331,6 +332,117 @@ extern std::string RECC_REAPI_VERSION;
  */
 extern std::string RECC_ACTION_SALT;
 
+/**
+ * Enables direct mode: dependency sets observed for a command are recorded in
+ * local manifests, so that the action cache can be queried without running
+ * the dependency command when none of the recorded files have changed.
+ */
+extern bool RECC_DIRECT_MODE;
+
+/**
+ * Caches the digests of input files in a table in RECC_CACHE_DIR that is
+ * shared by all recc processes, so that unchanged files are not hashed again.
+ */
+extern bool RECC_FILE_DIGEST_CACHE;
+
+/**
+ * Caches the serialized directories of input roots and their digests in
+ * RECC_CACHE_DIR, so that directories whose contents are unchanged are not
+ * serialized and hashed again.
+ */
+extern bool RECC_SUBTREE_DIGEST_CACHE;
+
+/**
+ * Caches the digests of the blobs found in, or uploaded to, the CAS in a
+ * table in RECC_CACHE_DIR that is shared by all recc processes using the
+ * same CAS server and instance, so that they are not sent to
+ * `FindMissingBlobs()` again.
+ */
+extern bool RECC_CAS_PRESENCE_CACHE;
+
+/**
+ * How long, in seconds, a blob found in the CAS is assumed to stay present.
+ */
+extern int RECC_CAS_PRESENCE_CACHE_TTL;
+
+/**
+ * On average, one in RECC_CAS_PRESENCE_CACHE_VERIFY uploads ignores the CAS
+ * presence cache and checks all the digests with the server. 0 disables
+ * verification.
+ */
+extern int RECC_CAS_PRESENCE_CACHE_VERIFY;
+
+/**
+ * Sends the digests of the input root to `FindMissingBlobs()` while the
+ * action cache is queried, so that the blobs to upload are known as soon as
+ * a miss is reported. The result is discarded on a hit.
+ */
+extern bool RECC_SPECULATIVE_FIND_MISSING_BLOBS;
+
+/**
+ * Maximum number of `Execute()` calls in flight across all recc processes
+ * on the machine that use the same server and instance. Within it, the
+ * limit adapts to the load of the server. 0 disables the limit.
+ */
+extern int RECC_EXECUTE_LIMIT;
+
+/**
+ * Actions queued by the server for longer than this, in milliseconds, lower
+ * the limit set by RECC_EXECUTE_LIMIT.
+ */
+extern int RECC_EXECUTE_QUEUE_TARGET_MS;
+
+/**
+ * Maximum size, in megabytes, of the local CAS in RECC_CACHE_DIR that keeps
+ * the outputs fetched or built by all recc processes, so that they are not
+ * fetched again. 0 disables it.
+ */
+extern int RECC_LOCAL_CAS_MAX_SIZE_MB;
+
+/**
+ * Writes outputs that are not executable as read-only hard links to the
+ * blobs of the local CAS instead of copies.
+ */
+extern bool RECC_LOCAL_CAS_HARDLINKS;
+
+/**
+ * Keeps the results of the actions looked up, executed or uploaded in
+ * RECC_CACHE_DIR, shared by all recc processes using the same action cache
+ * server and instance, and looks them up there before querying the server.
+ */
+extern bool RECC_LOCAL_ACTION_CACHE;
+
+/**
+ * How long, in seconds, a result in the local action cache is used.
+ */
+extern int RECC_LOCAL_ACTION_CACHE_TTL;
+
+/**
+ * Checks that the outputs of results found in the local action cache are
+ * still in the CAS before using them.
+ */
+extern bool RECC_LOCAL_ACTION_CACHE_VERIFY;
+
+/**
+ * Maximum size, in megabytes, of the cache directories given as file://
+ * URLs. The least recently used entries are removed when it is exceeded.
+ */
+extern int RECC_FILE_CACHE_MAX_SIZE_MB;
+
+/**
+ * Directory for recc's local caches. Defaults to $XDG_CACHE_HOME/recc,
+ * $HOME/.cache/recc or $TMPDIR/recc, in that order.
+ */
+extern std::string RECC_CACHE_DIR;
+
+/**
+ * How the dependencies of a compile command are determined: "compiler" runs
+ * the compiler's dependency command (e.g. `gcc -M`), "native" scans the
+ * `#include` directives in-process and falls back to the compiler for
+ * constructs it cannot resolve.
+ */
+extern std::string RECC_DEPS_SCANNER;
+
 /**
  * The process environment.
  */
@@ -0,0 +1,348 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <executelimiter.h>
+
+#include <digestgenerator.h>
+
+#include <buildboxcommon_fileutils.h>
+#include <buildboxcommon_logging.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+
+namespace recc {
+
+const size_t ExecuteLimiter::MAX_LIMIT = 4096;
+
+namespace {
+
+const uint64_t STATE_MAGIC = 0x314d494c43434552; // "RECCLIM1"
+const uint64_t STATE_VERSION = 1;
+
+// Words of the header preceding the slots. The limit is stored in
+// thousandths, so that it can grow by fractions of a call. Zero means that
+// it was not set yet.
+enum HeaderWord { MAGIC, VERSION, NUM_SLOTS, LIMIT, LAST_DECREASE };
+const size_t HEADER_WORDS = 8;
+const uint64_t LIMIT_SCALE = 1000;
+
+const size_t NO_SLOT = static_cast<size_t>(-1);
+
+// Bounds of the delay between attempts to take a slot, and how often slots
+// held by processes that no longer exist are looked for while waiting
+const std::chrono::milliseconds MIN_RETRY_DELAY(1);
+const std::chrono::milliseconds MAX_RETRY_DELAY(50);
+const std::chrono::seconds RECLAIM_INTERVAL(1);
+
+size_t stateSize()
+{
+    return (HEADER_WORDS + ExecuteLimiter::MAX_LIMIT) * sizeof(uint64_t);
+}
+
+int64_t currentTime()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+bool processExists(uint64_t pid)
+{
+    return kill(static_cast<pid_t>(pid), 0) == 0 || errno != ESRCH;
+}
+
+/**
+ * Creates the state at `path` unless it already exists. As with the shared
+ * digest tables, it is initialized under a temporary name and then linked
+ * into place.
+ */
+void createState(const std::string &path)
+{
+    const std::string directory = path.substr(0, path.rfind('/'));
+    buildboxcommon::FileUtils::createDirectory(directory.c_str());
+
+    const std::string temporaryPath =
+        path + "." + std::to_string(getpid()) + ".tmp";
+    const int fd =
+        open(temporaryPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw std::system_error(errno, std::system_category(),
+                                "Could not create \"" + temporaryPath + "\"");
+    }
+
+    uint64_t header[HEADER_WORDS] = {};
+    header[MAGIC] = STATE_MAGIC;
+    header[VERSION] = STATE_VERSION;
+    header[NUM_SLOTS] = ExecuteLimiter::MAX_LIMIT;
+    const bool initialized =
+        write(fd, header, sizeof(header)) ==
+            static_cast<ssize_t>(sizeof(header)) &&
+        ftruncate(fd, static_cast<off_t>(stateSize())) == 0;
+    const int error = errno;
+    close(fd);
+
+    if (initialized && link(temporaryPath.c_str(), path.c_str()) != 0 &&
+        errno != EEXIST) {
+        const int linkError = errno;
+        unlink(temporaryPath.c_str());
+        throw std::system_error(linkError, std::system_category(),
+                                "Could not create \"" + path + "\"");
+    }
+    unlink(temporaryPath.c_str());
+    if (!initialized) {
+        throw std::system_error(error, std::system_category(),
+                                "Could not initialize \"" + path + "\"");
+    }
+}
+
+void *mapState(const std::string &path)
+{
+    if (!std::atomic<uint64_t>().is_lock_free()) {
+        throw std::runtime_error(
+            "64-bit atomics are not lock-free on this platform");
+    }
+
+    int fd = open(path.c_str(), O_RDWR);
+    if (fd < 0 && errno == ENOENT) {
+        createState(path);
+        fd = open(path.c_str(), O_RDWR);
+    }
+    if (fd < 0) {
+        throw std::system_error(errno, std::system_category(),
+                                "Could not open \"" + path + "\"");
+    }
+
+    struct stat st;
+    uint64_t header[HEADER_WORDS] = {};
+    const bool readHeader =
+        fstat(fd, &st) == 0 && pread(fd, header, sizeof(header), 0) ==
+                                   static_cast<ssize_t>(sizeof(header));
+    if (!readHeader || header[MAGIC] != STATE_MAGIC ||
+        header[VERSION] != STATE_VERSION ||
+        header[NUM_SLOTS] != ExecuteLimiter::MAX_LIMIT ||
+        static_cast<size_t>(st.st_size) != stateSize()) {
+        close(fd);
+        throw std::runtime_error("\"" + path +
+                                 "\" is not a valid execution limit state");
+    }
+
+    void *mapping = mmap(nullptr, stateSize(), PROT_READ | PROT_WRITE,
+                         MAP_SHARED, fd, 0);
+    const int error = errno;
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        throw std::system_error(error, std::system_category(),
+                                "Could not map \"" + path + "\"");
+    }
+    return mapping;
+}
+
+} // namespace
+
+ExecuteLimiter::ExecuteLimiter(const std::string &path, int maxLimit,
+                               std::chrono::milliseconds queueTarget)
+    : d_maxLimit(std::min<uint64_t>(
+          static_cast<uint64_t>(std::max(maxLimit, 1)), MAX_LIMIT)),
+      d_queueTarget(queueTarget), d_slot(NO_SLOT)
+{
+    try {
+        d_mapping = mapState(path);
+        d_mappingSize = stateSize();
+    }
+    catch (const std::exception &e) {
+        BUILDBOX_LOG_WARNING("Execution limit disabled: " << e.what());
+    }
+}
+
+ExecuteLimiter::~ExecuteLimiter()
+{
+    if (d_mapping == nullptr) {
+        return;
+    }
+    if (d_slot != NO_SLOT) {
+        uint64_t pid = static_cast<uint64_t>(getpid());
+        slots()[d_slot].compare_exchange_strong(pid, 0);
+    }
+    munmap(d_mapping, d_mappingSize);
+}
+
+std::string ExecuteLimiter::path(const std::string &cacheDirectory,
+                                 const std::string &server,
+                                 const std::string &instance)
+{
+    const std::string scope =
+        DigestGenerator::make_digest(server + "\n" + instance).hash();
+    return cacheDirectory + "/execute-limit-" + scope.substr(0, 16);
+}
+
+ExecuteLimiter::Word *ExecuteLimiter::header() const
+{
+    return static_cast<Word *>(d_mapping);
+}
+
+ExecuteLimiter::Word *ExecuteLimiter::slots() const
+{
+    return header() + HEADER_WORDS;
+}
+
+int ExecuteLimiter::limit() const
+{
+    if (d_mapping == nullptr) {
+        return 0;
+    }
+    uint64_t limit = header()[LIMIT].load();
+    if (limit == 0) {
+        // The first caller starts at the maximum
+        const uint64_t initial = d_maxLimit * LIMIT_SCALE;
+        if (header()[LIMIT].compare_exchange_strong(limit, initial)) {
+            limit = initial;
+        }
+    }
+    // Callers may have been configured with a higher maximum
+    limit = std::min(limit, d_maxLimit * LIMIT_SCALE);
+    return static_cast<int>(std::max<uint64_t>(limit / LIMIT_SCALE, 1));
+}
+
+bool ExecuteLimiter::acquire(const std::atomic_bool &stopRequested)
+{
+    if (d_mapping == nullptr || d_slot != NO_SLOT) {
+        return false;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    auto lastReclaim = start;
+    auto delay = MIN_RETRY_DELAY;
+    bool acquired = tryAcquire(currentTime(), false);
+    if (!acquired) {
+        BUILDBOX_LOG_DEBUG("Waiting for one of the " << limit()
+                                                     << " execution slots");
+    }
+    while (!acquired && !stopRequested) {
+        std::this_thread::sleep_for(delay);
+        delay = std::min(delay * 2, MAX_RETRY_DELAY);
+
+        const auto now = std::chrono::steady_clock::now();
+        const bool reclaim = now - lastReclaim >= RECLAIM_INTERVAL;
+        if (reclaim) {
+            lastReclaim = now;
+        }
+        acquired = tryAcquire(currentTime(), reclaim);
+    }
+    d_waitTime += std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start);
+    return acquired;
+}
+
+bool ExecuteLimiter::tryAcquire(int64_t nowMilliseconds,
+                                bool reclaimStaleSlots)
+{
+    if (d_mapping == nullptr || d_slot != NO_SLOT) {
+        return false;
+    }
+
+    // Slots above the limit are not taken, but may still be held by calls
+    // made before it was lowered
+    const uint64_t pid = static_cast<uint64_t>(getpid());
+    const size_t numSlots = static_cast<size_t>(limit());
+    for (size_t i = 0; i < numSlots; ++i) {
+        uint64_t holder = slots()[i].load();
+        const bool available =
+            holder == 0 || (reclaimStaleSlots && holder != pid &&
+                            !processExists(holder));
+        if (available && slots()[i].compare_exchange_strong(holder, pid)) {
+            if (holder != 0) {
+                BUILDBOX_LOG_DEBUG("Reclaimed the execution slot of process "
+                                   << holder);
+            }
+            d_slot = i;
+            d_acquiredAt = nowMilliseconds;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ExecuteLimiter::release(Outcome outcome,
+                             std::chrono::milliseconds queueTime)
+{
+    release(outcome, queueTime, currentTime());
+}
+
+void ExecuteLimiter::release(Outcome outcome,
+                             std::chrono::milliseconds queueTime,
+                             int64_t nowMilliseconds)
+{
+    if (d_mapping == nullptr || d_slot == NO_SLOT) {
+        return;
+    }
+
+    if (outcome == OVERLOADED || queueTime > d_queueTarget) {
+        decrease(nowMilliseconds);
+    }
+    else {
+        increase();
+    }
+
+    uint64_t pid = static_cast<uint64_t>(getpid());
+    slots()[d_slot].compare_exchange_strong(pid, 0);
+    d_slot = NO_SLOT;
+}
+
+void ExecuteLimiter::increase()
+{
+    const uint64_t maxLimit = d_maxLimit * LIMIT_SCALE;
+    uint64_t limit = header()[LIMIT].load();
+    uint64_t increased;
+    do {
+        const uint64_t current =
+            std::max(std::min(limit, maxLimit), LIMIT_SCALE);
+        // One call more per round of calls
+        increased =
+            std::min(current + LIMIT_SCALE * LIMIT_SCALE / current, maxLimit);
+    } while (limit != increased &&
+             !header()[LIMIT].compare_exchange_weak(limit, increased));
+}
+
+void ExecuteLimiter::decrease(int64_t nowMilliseconds)
+{
+    // Only the first overloaded call of a round lowers the limit: the calls
+    // made before that are not affected by it yet
+    uint64_t lastDecrease = header()[LAST_DECREASE].load();
+    if (d_acquiredAt <= static_cast<int64_t>(lastDecrease) ||
+        !header()[LAST_DECREASE].compare_exchange_strong(
+            lastDecrease, static_cast<uint64_t>(nowMilliseconds))) {
+        return;
+    }
+
+    const uint64_t maxLimit = d_maxLimit * LIMIT_SCALE;
+    uint64_t limit = header()[LIMIT].load();
+    uint64_t decreased;
+    do {
+        const uint64_t current = limit == 0 ? maxLimit : limit;
+        decreased = std::max(std::min(current, maxLimit) / 2, LIMIT_SCALE);
+    } while (!header()[LIMIT].compare_exchange_weak(limit, decreased));
+    BUILDBOX_LOG_DEBUG("Execution limit lowered to "
+                       << decreased / LIMIT_SCALE);
+}
+
+} // namespace recc
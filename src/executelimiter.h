@@ -0,0 +1,137 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef INCLUDED_EXECUTELIMITER
+#define INCLUDED_EXECUTELIMITER
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace recc {
+
+/**
+ * Limits the number of `Execute()` calls in flight across all recc
+ * processes on a machine that use the same server and instance.
+ *
+ * The limit is adjusted with AIMD: it grows by one for each limit's worth
+ * of actions that complete without being queued by the server for longer
+ * than the target, and is halved when an action is queued for longer, or
+ * when the server reports that it is overloaded. It is halved at most once
+ * per round of calls, so that the calls in flight when the server becomes
+ * overloaded only reduce it once.
+ *
+ * The state is kept in a small memory-mapped file: the current limit and
+ * one slot per call in flight, holding the PID of the process making it.
+ * Slots held by processes that exited without giving them back are
+ * reclaimed.
+ *
+ * An instance holds at most one slot at a time.
+ */
+class ExecuteLimiter {
+  public:
+    enum Outcome {
+        // The action was executed, or failed for reasons unrelated to load
+        COMPLETED,
+        // The server rejected the call because it is overloaded
+        OVERLOADED
+    };
+
+    /**
+     * Opens the state at `path`, creating it if it does not exist. The
+     * limit never exceeds `maxLimit`, and actions queued for longer than
+     * `queueTarget` reduce it. If the state can't be used, a warning is
+     * logged and calls are not limited.
+     */
+    ExecuteLimiter(const std::string &path, int maxLimit,
+                   std::chrono::milliseconds queueTarget);
+
+    /**
+     * Gives back the slot still held, without adjusting the limit.
+     */
+    ~ExecuteLimiter();
+
+    ExecuteLimiter(const ExecuteLimiter &) = delete;
+    ExecuteLimiter &operator=(const ExecuteLimiter &) = delete;
+
+    /**
+     * Returns the path of the state in `cacheDirectory` shared by the
+     * callers of the given server and instance.
+     */
+    static std::string path(const std::string &cacheDirectory,
+                            const std::string &server,
+                            const std::string &instance);
+
+    /**
+     * Waits until fewer calls than the limit are in flight and takes a
+     * slot. Returns false without a slot if `stopRequested` is set in the
+     * meantime, or if calls are not limited.
+     */
+    bool acquire(const std::atomic_bool &stopRequested);
+
+    /**
+     * Gives back the slot taken by `acquire()`, adjusting the limit with the
+     * outcome of the call. `queueTime` is how long the server queued the
+     * action, zero if it didn't report it.
+     */
+    void release(Outcome outcome, std::chrono::milliseconds queueTime);
+
+    /**
+     * Returns the current limit, zero if calls are not limited.
+     */
+    int limit() const;
+
+    /**
+     * Returns the total time spent waiting in `acquire()`.
+     */
+    std::chrono::milliseconds waitTime() const { return d_waitTime; }
+
+    static const size_t MAX_LIMIT;
+
+  protected: // for unit testing
+    /**
+     * Takes a free slot below the limit if there is one. Slots held by
+     * processes that no longer exist are only reclaimed if
+     * `reclaimStaleSlots` is set, as checking them is more expensive.
+     */
+    bool tryAcquire(int64_t nowMilliseconds, bool reclaimStaleSlots);
+
+    void release(Outcome outcome, std::chrono::milliseconds queueTime,
+                 int64_t nowMilliseconds);
+
+  private:
+    typedef std::atomic<uint64_t> Word;
+
+    Word *header() const;
+    Word *slots() const;
+
+    void increase();
+    void decrease(int64_t nowMilliseconds);
+
+    void *d_mapping = nullptr;
+    size_t d_mappingSize = 0;
+    uint64_t d_maxLimit;
+    std::chrono::milliseconds d_queueTarget;
+
+    // Slot held by this instance, and when it was taken
+    size_t d_slot;
+    int64_t d_acquiredAt = 0;
+    std::chrono::milliseconds d_waitTime{0};
+};
+
+} // namespace recc
+
+#endif
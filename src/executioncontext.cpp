@@ -13,28 +13,47 @@
 // limitations under the License.
 
 #include <actionbuilder.h>
+#include <caspresencecache.h>
 #include <deps.h>
 #include <digestgenerator.h>
 #include <env.h>
+#include <executelimiter.h>
 #include <executioncontext.h>
+#include <filecontents.h>
+#include <filedigestcache.h>
 #include <fileutils.h>
 #include <grpcchannels.h>
+#include <jobserver.h>
+#include <localactioncache.h>
+#include <localcas.h>
+#include <manifestcache.h>
 #include <metricsconfig.h>
+#include <outputdownloader.h>
 #include <parsedcommandfactory.h>
 #include <reccdefaults.h>
 #include <remoteexecutionclient.h>
 #include <requestmetadata.h>
 #include <subprocess.h>
+#include <subtreedigestcache.h>
+#include <threadpool.h>
 
+#include <algorithm>
+#include <chrono>
 #include <cstdio>
 #include <cstring>
+#include <fcntl.h>
+#include <future>
 #include <grpcpp/create_channel.h>
 #include <grpcpp/security/credentials.h>
 #include <iostream>
 #include <random>
 #include <sys/stat.h>
+#include <system_error>
+#include <thread>
 #include <unistd.h>
+#include <unordered_set>
 
+#include <buildboxcommon_grpcerror.h>
 #include <buildboxcommon_logging.h>
 #include <buildboxcommonmetrics_countingmetricutil.h>
 #include <buildboxcommonmetrics_durationmetrictimer.h>
@@ -49,15 +68,234 @@
 #define TIMER_NAME_QUERY_ACTION_CACHE "recc.query_action_cache"
 #define TIMER_NAME_UPLOAD_MISSING_BLOBS "recc.upload_missing_blobs"
 #define TIMER_NAME_DOWNLOAD_BLOBS "recc.download_blobs"
+#define TIMER_NAME_DIRECT_MODE_LOOKUP "recc.direct_mode_lookup"
 
 #define COUNTER_NAME_ACTION_CACHE_HIT "recc.action_cache_hit"
 #define COUNTER_NAME_ACTION_CACHE_MISS "recc.action_cache_miss"
 #define COUNTER_NAME_UPLOAD_BLOBS_CACHE_HIT "recc.upload_blobs_cache_hit"
 #define COUNTER_NAME_UPLOAD_BLOBS_CACHE_MISS "recc.upload_blobs_cache_miss"
 #define COUNTER_NAME_INPUT_SIZE_BYTES "recc.input_size_bytes"
+#define COUNTER_NAME_DIRECT_MODE_HIT "recc.direct_mode_hit"
+#define COUNTER_NAME_DIRECT_MODE_MISS "recc.direct_mode_miss"
+#define COUNTER_NAME_FILE_DIGEST_CACHE_HIT "recc.file_digest_cache_hit"
+#define COUNTER_NAME_FILE_DIGEST_CACHE_MISS "recc.file_digest_cache_miss"
+#define COUNTER_NAME_SUBTREE_DIGEST_CACHE_HIT "recc.subtree_digest_cache_hit"
+#define COUNTER_NAME_SUBTREE_DIGEST_CACHE_MISS "recc.subtree_digest_cache_miss"
+#define COUNTER_NAME_SUBTREE_REUSE_PERCENT "recc.subtree_reuse_percent"
+#define COUNTER_NAME_CAS_PRESENCE_CACHE_HIT "recc.cas_presence_cache_hit"
+#define COUNTER_NAME_CAS_PRESENCE_CACHE_MISS "recc.cas_presence_cache_miss"
+#define COUNTER_NAME_CAS_PRESENCE_CACHE_STALE "recc.cas_presence_cache_stale"
+#define COUNTER_NAME_DEPS_HASHING_OVERLAP "recc.deps_hashing_overlap_ms"
+#define COUNTER_NAME_FIND_MISSING_BLOBS_OVERLAP                               \
+    "recc.find_missing_blobs_overlap_ms"
+#define COUNTER_NAME_JOBSERVER_TOKENS "recc.jobserver_tokens"
+#define COUNTER_NAME_JOBSERVER_TOKEN_WAIT "recc.jobserver_token_wait_ms"
+#define COUNTER_NAME_EXECUTE_LIMIT "recc.execute_limit"
+#define COUNTER_NAME_EXECUTE_LIMIT_WAIT "recc.execute_limit_wait_ms"
+#define COUNTER_NAME_FILE_BYTES_READ "recc.file_bytes_read"
+#define COUNTER_NAME_UNCHANGED_OUTPUTS "recc.unchanged_outputs"
+#define COUNTER_NAME_LOCAL_CAS_HIT "recc.local_cas_hit"
+#define COUNTER_NAME_LOCAL_CAS_MISS "recc.local_cas_miss"
+#define COUNTER_NAME_LOCAL_ACTION_CACHE_HIT "recc.local_action_cache_hit"
+#define COUNTER_NAME_LOCAL_ACTION_CACHE_MISS "recc.local_action_cache_miss"
 
 namespace recc {
 
+namespace {
+
+// Number of digests sent in each `FindMissingBlobs()` request
+const size_t FIND_MISSING_BLOBS_BATCH_SIZE = 1024;
+
+// Output of local commands larger than this is kept in a temporary file
+// rather than in memory until it is uploaded
+const size_t CAPTURED_OUTPUT_MEMORY_LIMIT = 1024 * 1024;
+
+// Number of outputs hashed together by a task
+const size_t OUTPUT_HASHING_BATCH_SIZE = 8;
+
+// Total size of the contents of the files hashed that are kept in memory
+// until they are uploaded
+const size_t FILE_CONTENTS_CACHE_CAPACITY = 256 * 1024 * 1024;
+
+void writeAll(int fd, const char *data, size_t size)
+{
+    while (size > 0) {
+        const ssize_t written = write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::system_error(errno, std::system_category(),
+                                    "Could not write captured output");
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+    }
+}
+
+/**
+ * Records, when going out of scope, the tokens taken from the jobserver in
+ * the meantime and how long workers waited for them.
+ */
+class JobServerMetricsRecorder {
+  public:
+    JobServerMetricsRecorder(JobServer *jobServer,
+                             std::map<std::string, int64_t> *counterMetrics)
+        : d_jobServer(jobServer), d_counterMetrics(counterMetrics)
+    {
+        if (d_jobServer) {
+            d_tokensAtStart = d_jobServer->tokensAcquired();
+            d_waitTimeAtStart = d_jobServer->waitTime();
+        }
+    }
+
+    ~JobServerMetricsRecorder()
+    {
+        if (!d_jobServer) {
+            return;
+        }
+        const int64_t tokens =
+            d_jobServer->tokensAcquired() - d_tokensAtStart;
+        const int64_t waitTime =
+            std::chrono::duration_cast<std::chrono::milliseconds>(
+                d_jobServer->waitTime() - d_waitTimeAtStart)
+                .count();
+        buildboxcommon::buildboxcommonmetrics::CountingMetricUtil::
+            recordCounterMetric(COUNTER_NAME_JOBSERVER_TOKENS, tokens);
+        buildboxcommon::buildboxcommonmetrics::CountingMetricUtil::
+            recordCounterMetric(COUNTER_NAME_JOBSERVER_TOKEN_WAIT, waitTime);
+        (*d_counterMetrics)[COUNTER_NAME_JOBSERVER_TOKENS] = tokens;
+        (*d_counterMetrics)[COUNTER_NAME_JOBSERVER_TOKEN_WAIT] = waitTime;
+    }
+
+    JobServerMetricsRecorder(const JobServerMetricsRecorder &) = delete;
+    JobServerMetricsRecorder &
+    operator=(const JobServerMetricsRecorder &) = delete;
+
+  private:
+    JobServer *d_jobServer;
+    std::map<std::string, int64_t> *d_counterMetrics;
+    int64_t d_tokensAtStart = 0;
+    std::chrono::microseconds d_waitTimeAtStart{0};
+};
+
+/**
+ * Keeps the contents of the files hashed in the meantime for their upload
+ * and records, when going out of scope, the bytes read from files: once to
+ * hash them, and again for those whose contents were not kept.
+ */
+class FileReadMetricsRecorder {
+  public:
+    FileReadMetricsRecorder(const int64_t *bytesReadForUpload,
+                            std::map<std::string, int64_t> *counterMetrics)
+        : d_bytesReadForUpload(bytesReadForUpload),
+          d_counterMetrics(counterMetrics),
+          d_bytesReadAtStart(FileContents::totalBytesRead())
+    {
+        FileContentsCache::defaultCache().setCapacity(
+            FILE_CONTENTS_CACHE_CAPACITY);
+    }
+
+    ~FileReadMetricsRecorder()
+    {
+        FileContentsCache::defaultCache().setCapacity(0);
+
+        const int64_t bytesRead = FileContents::totalBytesRead() -
+                                  d_bytesReadAtStart + *d_bytesReadForUpload;
+        buildboxcommon::buildboxcommonmetrics::CountingMetricUtil::
+            recordCounterMetric(COUNTER_NAME_FILE_BYTES_READ, bytesRead);
+        (*d_counterMetrics)[COUNTER_NAME_FILE_BYTES_READ] = bytesRead;
+    }
+
+    FileReadMetricsRecorder(const FileReadMetricsRecorder &) = delete;
+    FileReadMetricsRecorder &
+    operator=(const FileReadMetricsRecorder &) = delete;
+
+  private:
+    const int64_t *d_bytesReadForUpload;
+    std::map<std::string, int64_t> *d_counterMetrics;
+    int64_t d_bytesReadAtStart;
+};
+
+/**
+ * Passes a stream of a local command through to `terminal` as it is
+ * written, while computing its digest and keeping its contents to upload
+ * them.
+ */
+class CapturedOutput {
+  public:
+    explicit CapturedOutput(std::ostream *terminal) : d_terminal(terminal) {}
+
+    void append(const char *data, size_t size)
+    {
+        d_terminal->write(data, static_cast<std::streamsize>(size));
+        d_terminal->flush();
+        d_digest.update(data, size);
+
+        if (!d_file &&
+            d_contents.size() + size > CAPTURED_OUTPUT_MEMORY_LIMIT) {
+            d_file = std::make_unique<buildboxcommon::TemporaryFile>();
+            writeAll(d_file->fd(), d_contents.data(), d_contents.size());
+            std::string().swap(d_contents);
+        }
+        if (d_file) {
+            writeAll(d_file->fd(), data, size);
+        }
+        else {
+            d_contents.append(data, size);
+        }
+    }
+
+    /**
+     * Returns the digest of the output and marks it for upload. A temporary
+     * file holding it is added to `files`, where it must stay until the
+     * upload.
+     */
+    proto::Digest
+    finish(buildboxcommon::digest_string_map *blobs,
+           buildboxcommon::digest_string_map *digest_to_filepaths,
+           std::vector<std::unique_ptr<buildboxcommon::TemporaryFile>> *files)
+    {
+        const proto::Digest digest = d_digest.finalize();
+        if (d_file) {
+            d_file->close();
+            (*digest_to_filepaths)[digest] = d_file->strname();
+            files->push_back(std::move(d_file));
+        }
+        else {
+            (*blobs)[digest] = std::move(d_contents);
+        }
+        return digest;
+    }
+
+  private:
+    std::ostream *d_terminal;
+    DigestGenerator::IncrementalDigest d_digest;
+    std::string d_contents;
+    std::unique_ptr<buildboxcommon::TemporaryFile> d_file;
+};
+
+int64_t toMilliseconds(const google::protobuf::Timestamp &timestamp)
+{
+    return timestamp.seconds() * 1000 + timestamp.nanos() / 1000000;
+}
+
+// Time the server kept the action queued, zero if it didn't report it
+std::chrono::milliseconds queueTime(const proto::ActionResult &result)
+{
+    const auto &metadata = result.execution_metadata();
+    if (!metadata.has_queued_timestamp() ||
+        !metadata.has_worker_start_timestamp()) {
+        return std::chrono::milliseconds(0);
+    }
+    return std::chrono::milliseconds(
+        std::max<int64_t>(toMilliseconds(metadata.worker_start_timestamp()) -
+                              toMilliseconds(metadata.queued_timestamp()),
+                          0));
+}
+
+} // namespace
+
 int ExecutionContext::execLocally(int argc, char *argv[])
 {
     buildboxcommon::buildboxcommonmetrics::MetricTeeGuard<
@@ -80,27 +318,62 @@ proto::ActionResult ExecutionContext::execLocallyWithActionResult(
 
     proto::ActionResult actionResult;
 
+    // Show the output while the command runs, digesting it as it comes
+    CapturedOutput capturedStdOut(&std::cout);
+    CapturedOutput capturedStdErr(&std::cerr);
     auto subprocessResult = Subprocess::execute(
-        std::vector<std::string>(argv, argv + argc), true, true);
-    std::cout << subprocessResult.d_stdOut;
-    std::cerr << subprocessResult.d_stdErr;
+        std::vector<std::string>(argv, argv + argc), true, true, {},
+        [&capturedStdOut](const char *data, size_t size) {
+            capturedStdOut.append(data, size);
+        },
+        [&capturedStdErr](const char *data, size_t size) {
+            capturedStdErr.append(data, size);
+        });
 
     actionResult.set_exit_code(subprocessResult.d_exitCode);
 
-    // Digest captured streams and mark them for upload
-    const auto stdoutDigest =
-        DigestGenerator::make_digest(subprocessResult.d_stdOut);
-    const auto stderrDigest =
-        DigestGenerator::make_digest(subprocessResult.d_stdErr);
-    (*blobs)[stdoutDigest] = subprocessResult.d_stdOut;
-    (*blobs)[stderrDigest] = subprocessResult.d_stdErr;
+    // Mark the captured streams for upload
+    const auto stdoutDigest = capturedStdOut.finish(
+        blobs, digest_to_filepaths, &d_capturedOutputFiles);
+    const auto stderrDigest = capturedStdErr.finish(
+        blobs, digest_to_filepaths, &d_capturedOutputFiles);
     actionResult.mutable_stdout_digest()->CopyFrom(stdoutDigest);
     actionResult.mutable_stderr_digest()->CopyFrom(stderrDigest);
 
-    for (const std::string &outputPath : products) {
-        // Only upload products produced by the compiler
-        if (buildboxcommon::FileUtils::isRegularFile(outputPath.c_str())) {
-            const auto file = buildboxcommon::File(outputPath.c_str());
+    // Hash the outputs in parallel, a link step can produce large ones.
+    // Small ones are hashed together in batches.
+    ThreadPool &pool = ThreadPool::defaultPool();
+    typedef std::vector<std::pair<std::string, buildboxcommon::File>>
+        HashedOutputs;
+    std::vector<std::future<HashedOutputs>> batches;
+    const std::vector<std::string> outputPaths(products.cbegin(),
+                                               products.cend());
+    for (size_t start = 0; start < outputPaths.size();
+         start += OUTPUT_HASHING_BATCH_SIZE) {
+        const size_t end =
+            std::min(start + OUTPUT_HASHING_BATCH_SIZE, outputPaths.size());
+        batches.push_back(pool.submit([&outputPaths, start, end]() {
+            // Only upload products produced by the compiler
+            std::vector<std::string> paths;
+            for (size_t i = start; i < end; ++i) {
+                if (buildboxcommon::FileUtils::isRegularFile(
+                        outputPaths[i].c_str())) {
+                    paths.push_back(outputPaths[i]);
+                }
+            }
+            const auto files = DigestGenerator::make_file_digests(paths);
+            HashedOutputs outputs;
+            for (size_t i = 0; i < paths.size(); ++i) {
+                outputs.emplace_back(paths[i], files[i]);
+            }
+            return outputs;
+        }));
+    }
+
+    for (auto &batch : batches) {
+        for (const auto &output : pool.wait(batch)) {
+            const std::string &outputPath = output.first;
+            const buildboxcommon::File &file = output.second;
             (*digest_to_filepaths)[file.d_digest] = outputPath;
             auto outputFile = actionResult.add_output_files();
             outputFile->set_path(outputPath);
@@ -112,11 +385,91 @@ proto::ActionResult ExecutionContext::execLocallyWithActionResult(
     return actionResult;
 }
 
+std::vector<proto::Digest> ExecutionContext::digestsToQuery(
+    const std::vector<proto::Digest> &digests,
+    std::unordered_set<proto::Digest> *knownPresent)
+{
+    if (RECC_CAS_PRESENCE_CACHE && !d_casPresenceCache) {
+        d_casPresenceCache = std::make_shared<CasPresenceCache>(
+            CasPresenceCache::path(RECC_CACHE_DIR, RECC_CAS_SERVER,
+                                   RECC_INSTANCE, RECC_CAS_DIGEST_FUNCTION),
+            RECC_CAS_PRESENCE_CACHE_TTL);
+        if (RECC_CAS_PRESENCE_CACHE_VERIFY > 0) {
+            std::random_device randomDevice;
+            std::uniform_int_distribution<int> randomDistribution(
+                1, RECC_CAS_PRESENCE_CACHE_VERIFY);
+            d_verifyCasPresenceCache = randomDistribution(randomDevice) == 1;
+        }
+    }
+    if (!d_casPresenceCache) {
+        return digests;
+    }
+
+    // Only query the digests that aren't known to be in the CAS, unless
+    // verifying that the cache is accurate
+    std::vector<proto::Digest> result;
+    const int64_t presenceCacheHits = d_casPresenceCache->hits();
+    const int64_t presenceCacheMisses = d_casPresenceCache->misses();
+    for (const auto &digest : digests) {
+        if (!d_casPresenceCache->isPresent(digest)) {
+            result.push_back(digest);
+        }
+        else if (d_verifyCasPresenceCache) {
+            result.push_back(digest);
+            knownPresent->insert(digest);
+        }
+    }
+
+    const int64_t hits = d_casPresenceCache->hits() - presenceCacheHits;
+    const int64_t misses = d_casPresenceCache->misses() - presenceCacheMisses;
+    buildboxcommon::buildboxcommonmetrics::CountingMetricUtil::
+        recordCounterMetric(COUNTER_NAME_CAS_PRESENCE_CACHE_HIT, hits);
+    d_counterMetrics[COUNTER_NAME_CAS_PRESENCE_CACHE_HIT] += hits;
+    buildboxcommon::buildboxcommonmetrics::CountingMetricUtil::
+        recordCounterMetric(COUNTER_NAME_CAS_PRESENCE_CACHE_MISS, misses);
+    d_counterMetrics[COUNTER_NAME_CAS_PRESENCE_CACHE_MISS] += misses;
+    return result;
+}
+
+void ExecutionContext::startFindMissingBlobs(
+    const buildboxcommon::digest_string_map &blobs,
+    const buildboxcommon::digest_string_map &digest_to_filepaths)
+{
+    std::vector<proto::Digest> candidates;
+    for (const auto &i : blobs) {
+        candidates.push_back(i.first);
+    }
+    for (const auto &i : digest_to_filepaths) {
+        candidates.push_back(i.first);
+    }
+    d_speculativeCandidates.insert(candidates.begin(), candidates.end());
+    d_speculativeDigests =
+        digestsToQuery(candidates, &d_speculativeKnownPresent);
+
+    if (d_speculativeDigests.empty()) {
+        return;
+    }
+
+    // If the action is cached, the thread is only joined when this context
+    // is destroyed, once the outputs are written
+    const auto casClient = d_casClient;
+    const auto digests = &d_speculativeDigests;
+    std::packaged_task<std::vector<proto::Digest>()> query(
+        [casClient, digests]() {
+            return casClient->findMissingBlobs(*digests);
+        });
+    d_speculativeMissing = query.get_future();
+    d_speculativeThread = std::thread(std::move(query));
+}
+
 /**
- * Upload the given resources to the CAS server. This first sends a
- * FindMissingBlobsRequest to determine which resources need to be
- * uploaded, then uses the ByteStream and BatchUpdateBlobs APIs to upload
- * them.
+ * Upload the given resources to the CAS server. This sends batches of
+ * FindMissingBlobsRequests to determine which resources need to be
+ * uploaded, and uses the ByteStream and BatchUpdateBlobs APIs to upload the
+ * ones missing from each batch while the next batch is being queried.
+ *
+ * If `startFindMissingBlobs()` was called, its result is used for the
+ * digests it queried.
  */
 void ExecutionContext::uploadResources(
     const buildboxcommon::digest_string_map &blobs,
@@ -132,41 +485,159 @@ void ExecutionContext::uploadResources(
         digestsToUpload.push_back(i.first);
     }
 
-    {
-        // Timed block
-        buildboxcommon::buildboxcommonmetrics::MetricTeeGuard<
-            buildboxcommon::buildboxcommonmetrics::DurationMetricTimer>
-            mt(TIMER_NAME_FIND_MISSING_BLOBS, d_addDurationMetricCallback);
+    // Digests that weren't considered by a speculative query
+    std::vector<proto::Digest> remainingDigests;
+    for (const auto &digest : digestsToUpload) {
+        if (!d_speculativeCandidates.count(digest)) {
+            remainingDigests.push_back(digest);
+        }
+    }
+    d_speculativeCandidates.clear();
+    std::unordered_set<proto::Digest> knownPresent =
+        std::move(d_speculativeKnownPresent);
+    const std::vector<proto::Digest> queriedDigests =
+        digestsToQuery(remainingDigests, &knownPresent);
+
+    const auto uploadMissingBlobs =
+        [&](const std::vector<proto::Digest> &queried,
+            const std::vector<proto::Digest> &missing) {
+            std::vector<buildboxcommon::CASClient::UploadRequest>
+                upload_requests;
+            upload_requests.reserve(missing.size());
+            for (const auto &digest : missing) {
+                // Finding the data in one of the source maps:
+                if (blobs.count(digest)) {
+                    upload_requests.emplace_back(digest, blobs.at(digest));
+                }
+                else if (digest_to_filepaths.count(digest)) {
+                    // Files kept in memory since they were hashed aren't
+                    // read again
+                    const auto path = digest_to_filepaths.at(digest);
+                    const auto contents =
+                        FileContentsCache::defaultCache().find(path, digest);
+                    if (contents) {
+                        upload_requests.emplace_back(
+                            digest,
+                            std::string(contents->data(), contents->size()));
+                    }
+                    else {
+                        d_fileBytesReadForUpload += digest.size_bytes();
+                        upload_requests.push_back(
+                            buildboxcommon::CASClient::UploadRequest::
+                                from_path(digest, path));
+                    }
+                }
+                else {
+                    throw std::runtime_error(
+                        "FindMissingBlobs returned non-existent digest");
+                }
+            }
 
-        missingDigests = d_casClient->findMissingBlobs(digestsToUpload);
+            const auto failedUploads =
+                d_casClient->uploadBlobs(upload_requests);
+            if (d_casPresenceCache) {
+                std::unordered_set<proto::Digest> notPresent;
+                for (const auto &result : failedUploads) {
+                    notPresent.insert(result.digest);
+                }
+                for (const auto &digest : queried) {
+                    if (!notPresent.count(digest)) {
+                        d_casPresenceCache->markPresent(digest);
+                    }
+                }
+            }
+        };
+
+    // Query the digests in batches on another thread, uploading the blobs
+    // missing from each batch while the next one is queried. The result of
+    // a speculative query comes first.
+    std::vector<std::vector<proto::Digest>> batches;
+    const bool speculative = d_speculativeMissing.valid();
+    if (speculative) {
+        batches.push_back(d_speculativeDigests);
+    }
+    for (size_t i = 0; i < queriedDigests.size();
+         i += FIND_MISSING_BLOBS_BATCH_SIZE) {
+        const size_t end = std::min(queriedDigests.size(),
+                                    i + FIND_MISSING_BLOBS_BATCH_SIZE);
+        batches.emplace_back(queriedDigests.begin() + i,
+                             queriedDigests.begin() + end);
     }
+    const auto findMissingBlobs =
+        [this](const std::vector<proto::Digest> *batch) {
+            return d_casClient->findMissingBlobs(*batch);
+        };
 
-    std::vector<buildboxcommon::CASClient::UploadRequest> upload_requests;
-    upload_requests.reserve(missingDigests.size());
-    for (const auto &digest : missingDigests) {
-        // Finding the data in one of the source maps:
-        if (blobs.count(digest)) {
-            upload_requests.emplace_back(digest, blobs.at(digest));
-        }
-        else if (digest_to_filepaths.count(digest)) {
-            const auto path = digest_to_filepaths.at(digest);
-            upload_requests.push_back(
-                buildboxcommon::CASClient::UploadRequest::from_path(digest,
-                                                                    path));
+    typedef buildboxcommon::buildboxcommonmetrics::MetricTeeGuard<
+        buildboxcommon::buildboxcommonmetrics::DurationMetricTimer>
+        Timer;
+    std::unique_ptr<Timer> findMissingBlobsTimer;
+    std::unique_ptr<Timer> uploadTimer;
+    std::chrono::steady_clock::time_point firstUpload;
+    std::chrono::steady_clock::time_point lastQuery;
+
+    std::future<std::vector<proto::Digest>> nextMissing;
+    if (!batches.empty()) {
+        findMissingBlobsTimer = std::make_unique<Timer>(
+            TIMER_NAME_FIND_MISSING_BLOBS, d_addDurationMetricCallback);
+        if (speculative) {
+            nextMissing = std::move(d_speculativeMissing);
         }
         else {
-            throw std::runtime_error(
-                "FindMissingBlobs returned non-existent digest");
+            nextMissing =
+                std::async(std::launch::async, findMissingBlobs, &batches[0]);
         }
     }
+    for (size_t i = 0; i < batches.size(); ++i) {
+        const std::vector<proto::Digest> missing = nextMissing.get();
+        missingDigests.insert(missingDigests.end(), missing.begin(),
+                              missing.end());
+        if (i + 1 < batches.size()) {
+            nextMissing = std::async(std::launch::async, findMissingBlobs,
+                                     &batches[i + 1]);
+        }
+        else {
+            findMissingBlobsTimer.reset();
+            lastQuery = std::chrono::steady_clock::now();
+        }
 
-    {
-        // Timed block
-        buildboxcommon::buildboxcommonmetrics::MetricTeeGuard<
-            buildboxcommon::buildboxcommonmetrics::DurationMetricTimer>
-            mt(TIMER_NAME_UPLOAD_MISSING_BLOBS, d_addDurationMetricCallback);
+        if (!uploadTimer) {
+            uploadTimer = std::make_unique<Timer>(
+                TIMER_NAME_UPLOAD_MISSING_BLOBS, d_addDurationMetricCallback);
+            firstUpload = std::chrono::steady_clock::now();
+        }
+        uploadMissingBlobs(batches[i], missing);
+    }
+    uploadTimer.reset();
+
+    if (batches.size() > 1) {
+        // Time spent querying the digests that was hidden by uploads
+        const int64_t overlap =
+            std::chrono::duration_cast<std::chrono::milliseconds>(
+                lastQuery - firstUpload)
+                .count();
+        buildboxcommon::buildboxcommonmetrics::CountingMetricUtil::
+            recordCounterMetric(COUNTER_NAME_FIND_MISSING_BLOBS_OVERLAP,
+                                overlap);
+        d_counterMetrics[COUNTER_NAME_FIND_MISSING_BLOBS_OVERLAP] = overlap;
+    }
 
-        d_casClient->uploadBlobs(upload_requests);
+    if (d_verifyCasPresenceCache) {
+        int64_t stale = 0;
+        for (const auto &digest : missingDigests) {
+            if (knownPresent.count(digest)) {
+                ++stale;
+            }
+        }
+        if (stale > 0) {
+            BUILDBOX_LOG_WARNING(
+                stale << " blobs in the CAS presence cache are missing from "
+                         "the CAS, consider lowering "
+                         "RECC_CAS_PRESENCE_CACHE_TTL");
+        }
+        buildboxcommon::buildboxcommonmetrics::CountingMetricUtil::
+            recordCounterMetric(COUNTER_NAME_CAS_PRESENCE_CACHE_STALE, stale);
+        d_counterMetrics[COUNTER_NAME_CAS_PRESENCE_CACHE_STALE] = stale;
     }
 
     const int64_t uploadCacheHits =
@@ -198,11 +669,363 @@ int64_t ExecutionContext::calculateTotalSize(
     return totalSize;
 }
 
+FileDigestCache *ExecutionContext::fileDigestCache()
+{
+    if (RECC_FILE_DIGEST_CACHE && !d_fileDigestCache) {
+        d_fileDigestCache = std::make_shared<FileDigestCache>(
+            RECC_CACHE_DIR + "/file-digests-" + RECC_CAS_DIGEST_FUNCTION);
+    }
+    return d_fileDigestCache.get();
+}
+
+LocalCas *ExecutionContext::localCas()
+{
+    if (RECC_LOCAL_CAS_MAX_SIZE_MB > 0 && !d_localCas) {
+        d_localCas = std::make_shared<LocalCas>(
+            LocalCas::path(RECC_CACHE_DIR, RECC_CAS_DIGEST_FUNCTION),
+            static_cast<int64_t>(RECC_LOCAL_CAS_MAX_SIZE_MB) * 1024 * 1024,
+            RECC_LOCAL_CAS_HARDLINKS);
+    }
+    return d_localCas.get();
+}
+
+LocalActionCache *ExecutionContext::localActionCache()
+{
+    if (RECC_LOCAL_ACTION_CACHE && !d_localActionCache) {
+        d_localActionCache = std::make_shared<LocalActionCache>(
+            LocalActionCache::path(RECC_CACHE_DIR, RECC_ACTION_CACHE_SERVER,
+                                   RECC_INSTANCE),
+            RECC_LOCAL_ACTION_CACHE_TTL);
+    }
+    return d_localActionCache.get();
+}
+
+void ExecutionContext::addToLocalCas(const proto::ActionResult &result)
+{
+    LocalCas *cas = localCas();
+    if (cas == nullptr) {
+        return;
+    }
+    for (const auto &file : result.output_files()) {
+        const int fd = open(file.path().c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            continue;
+        }
+        // The file may have changed since it was hashed
+        cas->insertFile(file.digest(), fd, true);
+        close(fd);
+    }
+}
+
+std::shared_ptr<proto::Action> ExecutionContext::buildAction(
+    const ParsedCommand &command, const std::string &cwd,
+    buildboxcommon::digest_string_map *blobs,
+    buildboxcommon::digest_string_map *digest_to_filepaths,
+    std::set<std::string> *products, std::set<std::string> *dependencies)
+{
+    fileDigestCache();
+    const int64_t digestCacheHits =
+        d_fileDigestCache ? d_fileDigestCache->hits() : 0;
+    const int64_t digestCacheMisses =
+        d_fileDigestCache ? d_fileDigestCache->misses() : 0;
+    if (RECC_SUBTREE_DIGEST_CACHE && !d_subtreeDigestCache) {
+        d_subtreeDigestCache = std::make_shared<SubtreeDigestCache>(
+            RECC_CACHE_DIR + "/subtrees-" + RECC_CAS_DIGEST_FUNCTION);
+    }
+    const int64_t subtreeCacheHits =
+        d_subtreeDigestCache ? d_subtreeDigestCache->hits() : 0;
+    const int64_t subtreeCacheMisses =
+        d_subtreeDigestCache ? d_subtreeDigestCache->misses() : 0;
+
+    std::shared_ptr<proto::Action> actionPtr;
+    // Trying to build an `Action`:
+    try {
+        ActionBuilder actionBuilder(d_addDurationMetricCallback,
+                                    d_fileDigestCache.get(),
+                                    d_subtreeDigestCache.get());
+        actionPtr =
+            actionBuilder.BuildAction(command, cwd, blobs, digest_to_filepaths,
+                                      products, dependencies);
+
+        // Hashing time hidden by the dependency command
+        const int64_t hashingOverlap =
+            std::chrono::duration_cast<std::chrono::milliseconds>(
+                actionBuilder.depsHashingOverlap())
+                .count();
+        buildboxcommon::buildboxcommonmetrics::CountingMetricUtil::
+            recordCounterMetric(COUNTER_NAME_DEPS_HASHING_OVERLAP,
+                                hashingOverlap);
+        d_counterMetrics[COUNTER_NAME_DEPS_HASHING_OVERLAP] = hashingOverlap;
+    }
+    catch (const std::invalid_argument &) {
+        BUILDBOX_LOG_ERROR(
+            "Invalid `argv[0]` value in command: \"" +
+            command.get_command().at(0) +
+            "\". The Remote Execution API requires it to specify "
+            "either a relative or absolute path to an executable.");
+        throw;
+    }
+
+    // Calculate and record total size of input blobs
+    const int64_t inputSize = calculateTotalSize(*blobs, *digest_to_filepaths);
+    buildboxcommon::buildboxcommonmetrics::CountingMetricUtil::
+        recordCounterMetric(COUNTER_NAME_INPUT_SIZE_BYTES, inputSize);
+    d_counterMetrics[COUNTER_NAME_INPUT_SIZE_BYTES] = inputSize;
+
+    if (d_fileDigestCache) {
+        const int64_t hits = d_fileDigestCache->hits() - digestCacheHits;
+        const int64_t misses =
+            d_fileDigestCache->misses() - digestCacheMisses;
+        buildboxcommon::buildboxcommonmetrics::CountingMetricUtil::
+            recordCounterMetric(COUNTER_NAME_FILE_DIGEST_CACHE_HIT, hits);
+        d_counterMetrics[COUNTER_NAME_FILE_DIGEST_CACHE_HIT] += hits;
+        buildboxcommon::buildboxcommonmetrics::CountingMetricUtil::
+            recordCounterMetric(COUNTER_NAME_FILE_DIGEST_CACHE_MISS, misses);
+        d_counterMetrics[COUNTER_NAME_FILE_DIGEST_CACHE_MISS] += misses;
+    }
+
+    if (d_subtreeDigestCache) {
+        const int64_t hits = d_subtreeDigestCache->hits() - subtreeCacheHits;
+        const int64_t misses =
+            d_subtreeDigestCache->misses() - subtreeCacheMisses;
+        buildboxcommon::buildboxcommonmetrics::CountingMetricUtil::
+            recordCounterMetric(COUNTER_NAME_SUBTREE_DIGEST_CACHE_HIT, hits);
+        d_counterMetrics[COUNTER_NAME_SUBTREE_DIGEST_CACHE_HIT] += hits;
+        buildboxcommon::buildboxcommonmetrics::CountingMetricUtil::
+            recordCounterMetric(COUNTER_NAME_SUBTREE_DIGEST_CACHE_MISS,
+                                misses);
+        d_counterMetrics[COUNTER_NAME_SUBTREE_DIGEST_CACHE_MISS] += misses;
+
+        // Proportion of the directories of this input root that were
+        // already cached
+        if (hits + misses > 0) {
+            const int64_t reusePercent = hits * 100 / (hits + misses);
+            buildboxcommon::buildboxcommonmetrics::CountingMetricUtil::
+                recordCounterMetric(COUNTER_NAME_SUBTREE_REUSE_PERCENT,
+                                    reusePercent);
+            d_counterMetrics[COUNTER_NAME_SUBTREE_REUSE_PERCENT] =
+                reusePercent;
+        }
+    }
+
+    return actionPtr;
+}
+
+bool ExecutionContext::lookupActionCache(RemoteExecutionClient *reClient,
+                                         const proto::Digest &actionDigest,
+                                         const ParsedCommand &command,
+                                         proto::ActionResult *result)
+{
+    if (lookupLocalActionCache(actionDigest, result)) {
+        buildboxcommon::buildboxcommonmetrics::CountingMetricUtil::
+            recordCounterMetric(COUNTER_NAME_ACTION_CACHE_HIT, 1);
+        d_counterMetrics[COUNTER_NAME_ACTION_CACHE_HIT] = 1;
+        BUILDBOX_LOG_INFO("Local action cache hit for [" << actionDigest
+                                                         << "]");
+        return true;
+    }
+
+    bool action_in_cache = false;
+    try {
+        // Timed block
+        buildboxcommon::buildboxcommonmetrics::MetricTeeGuard<
+            buildboxcommon::buildboxcommonmetrics::DurationMetricTimer>
+            mt(TIMER_NAME_QUERY_ACTION_CACHE, d_addDurationMetricCallback);
+
+        action_in_cache = reClient->fetchFromActionCache(
+            actionDigest, command.get_products(), result);
+        if (action_in_cache) {
+            if (localActionCache()) {
+                localActionCache()->store(actionDigest, *result);
+            }
+            buildboxcommon::buildboxcommonmetrics::CountingMetricUtil::
+                recordCounterMetric(COUNTER_NAME_ACTION_CACHE_HIT, 1);
+            d_counterMetrics[COUNTER_NAME_ACTION_CACHE_HIT] = 1;
+            BUILDBOX_LOG_INFO("Action Cache hit for [" << actionDigest << "]");
+        }
+        else {
+            buildboxcommon::buildboxcommonmetrics::CountingMetricUtil::
+                recordCounterMetric(COUNTER_NAME_ACTION_CACHE_MISS, 1);
+            d_counterMetrics[COUNTER_NAME_ACTION_CACHE_MISS] = 1;
+        }
+    }
+    catch (const std::exception &e) {
+        BUILDBOX_LOG_ERROR("Error while querying action cache at \""
+                           << RECC_ACTION_CACHE_SERVER << "\": " << e.what());
+    }
+    return action_in_cache;
+}
+
+bool ExecutionContext::lookupLocalActionCache(
+    const proto::Digest &actionDigest, proto::ActionResult *result)
+{
+    LocalActionCache *cache = localActionCache();
+    if (cache == nullptr) {
+        return false;
+    }
+
+    bool hit = cache->lookup(actionDigest, result);
+    if (hit && RECC_LOCAL_ACTION_CACHE_VERIFY) {
+        std::vector<proto::Digest> outputs;
+        for (const auto &file : result->output_files()) {
+            outputs.push_back(file.digest());
+        }
+        for (const auto &directory : result->output_directories()) {
+            outputs.push_back(directory.tree_digest());
+        }
+        for (const auto &stream :
+             {result->stdout_digest(), result->stderr_digest()}) {
+            if (stream.size_bytes() > 0) {
+                outputs.push_back(stream);
+            }
+        }
+        try {
+            hit = d_casClient->findMissingBlobs(outputs).empty();
+        }
+        catch (const std::exception &e) {
+            BUILDBOX_LOG_WARNING("Could not check the outputs of action ["
+                                 << actionDigest << "]: " << e.what());
+            hit = false;
+        }
+        if (!hit) {
+            BUILDBOX_LOG_DEBUG("Outputs of action ["
+                               << actionDigest
+                               << "] missing from the CAS, ignoring its "
+                                  "local action cache entry");
+            cache->remove(actionDigest);
+            result->Clear();
+        }
+    }
+
+    const char *counterName = hit ? COUNTER_NAME_LOCAL_ACTION_CACHE_HIT
+                                  : COUNTER_NAME_LOCAL_ACTION_CACHE_MISS;
+    buildboxcommon::buildboxcommonmetrics::CountingMetricUtil::
+        recordCounterMetric(counterName, 1);
+    d_counterMetrics[counterName] = 1;
+    d_localActionCacheHit = hit;
+    return hit;
+}
+
+proto::ActionResult
+ExecutionContext::executeAction(RemoteExecutionClient *reClient,
+                                const proto::Digest &actionDigest)
+{
+    if (RECC_EXECUTE_LIMIT <= 0) {
+        return reClient->executeAction(actionDigest, *d_stopRequested,
+                                       RECC_SKIP_CACHE);
+    }
+
+    if (!d_executeLimiter) {
+        d_executeLimiter = std::make_shared<ExecuteLimiter>(
+            ExecuteLimiter::path(RECC_CACHE_DIR, RECC_SERVER, RECC_INSTANCE),
+            RECC_EXECUTE_LIMIT,
+            std::chrono::milliseconds(RECC_EXECUTE_QUEUE_TARGET_MS));
+    }
+    const std::chrono::milliseconds waitTime =
+        d_executeLimiter->waitTime();
+    d_executeLimiter->acquire(*d_stopRequested);
+    const int64_t limit = d_executeLimiter->limit();
+    const int64_t waited =
+        (d_executeLimiter->waitTime() - waitTime).count();
+    buildboxcommon::buildboxcommonmetrics::CountingMetricUtil::
+        recordCounterMetric(COUNTER_NAME_EXECUTE_LIMIT, limit);
+    buildboxcommon::buildboxcommonmetrics::CountingMetricUtil::
+        recordCounterMetric(COUNTER_NAME_EXECUTE_LIMIT_WAIT, waited);
+    d_counterMetrics[COUNTER_NAME_EXECUTE_LIMIT] = limit;
+    d_counterMetrics[COUNTER_NAME_EXECUTE_LIMIT_WAIT] = waited;
+
+    proto::ActionResult result;
+    try {
+        result = reClient->executeAction(actionDigest, *d_stopRequested,
+                                         RECC_SKIP_CACHE);
+    }
+    catch (const buildboxcommon::GrpcError &e) {
+        const grpc::StatusCode code = e.status.error_code();
+        d_executeLimiter->release(
+            code == grpc::StatusCode::RESOURCE_EXHAUSTED ||
+                    code == grpc::StatusCode::UNAVAILABLE
+                ? ExecuteLimiter::OVERLOADED
+                : ExecuteLimiter::COMPLETED,
+            std::chrono::milliseconds(0));
+        throw;
+    }
+    catch (...) {
+        d_executeLimiter->release(ExecuteLimiter::COMPLETED,
+                                  std::chrono::milliseconds(0));
+        throw;
+    }
+    d_executeLimiter->release(ExecuteLimiter::COMPLETED, queueTime(result));
+    return result;
+}
+
+proto::ActionResult ExecutionContext::executeUploadedAction(
+    RemoteExecutionClient *reClient, const proto::Digest &actionDigest,
+    const buildboxcommon::digest_string_map &blobs,
+    const buildboxcommon::digest_string_map &digest_to_filepaths)
+{
+    try {
+        return executeAction(reClient, actionDigest);
+    }
+    catch (const buildboxcommon::GrpcError &e) {
+        if (e.status.error_code() != grpc::StatusCode::FAILED_PRECONDITION) {
+            throw;
+        }
+        BUILDBOX_LOG_WARNING("Inputs of the action are missing from the CAS ("
+                             << e.what() << "), uploading them again");
+    }
+
+    if (d_casPresenceCache) {
+        for (const auto &i : blobs) {
+            d_casPresenceCache->markMissing(i.first);
+        }
+        for (const auto &i : digest_to_filepaths) {
+            d_casPresenceCache->markMissing(i.first);
+        }
+    }
+    uploadResources(blobs, digest_to_filepaths);
+    return executeAction(reClient, actionDigest);
+}
+
+void ExecutionContext::storeManifestEntry(
+    const ManifestCache &manifestCache, const std::string &manifestKey,
+    const std::set<std::string> &products,
+    const std::set<std::string> &dependencies,
+    const buildboxcommon::digest_string_map &digest_to_filepaths)
+{
+    // A failure to record the entry only costs a dependency scan on the next
+    // invocation, so it is not fatal.
+    try {
+        manifestCache.store(
+            manifestKey,
+            ManifestCache::createEntry(d_actionDigest, products, dependencies,
+                                       digest_to_filepaths));
+    }
+    catch (const std::exception &e) {
+        BUILDBOX_LOG_WARNING("Could not store direct mode manifest ["
+                             << manifestKey << "]: " << e.what());
+    }
+}
+
 void ExecutionContext::setStopToken(const std::atomic_bool &stop_requested)
 {
     this->d_stopRequested = &stop_requested;
 }
 
+void ExecutionContext::setGrpcClients(GrpcClients *clients)
+{
+    d_grpcClients = clients;
+}
+
+ExecutionContext::~ExecutionContext()
+{
+    // The query uses the clients, which may be shared with the next context
+    if (d_speculativeThread.joinable()) {
+        d_speculativeThread.join();
+    }
+}
+
+void ExecutionContext::setConfigParsed() { d_configParsed = true; }
+
 std::string getRandomString()
 {
     std::random_device randomDevice;
@@ -216,8 +1039,10 @@ std::string getRandomString()
 int ExecutionContext::execute(int argc, char *argv[])
 {
     try {
-        Env::set_config_locations();
-        Env::parse_config_variables();
+        if (!d_configParsed) {
+            Env::set_config_locations();
+            Env::parse_config_variables();
+        }
     }
     catch (const std::invalid_argument &e) {
         BUILDBOX_LOG_ERROR("Error parsing config: " << e.what());
@@ -240,6 +1065,12 @@ int ExecutionContext::execute(int argc, char *argv[])
     buildboxcommon::buildboxcommonmetrics::PublisherGuard<StatsDPublisherType>
         statsDPublisherGuard(RECC_ENABLE_METRICS, *statsDPublisher);
 
+    // Recorded before the metrics are published
+    const JobServerMetricsRecorder jobServerMetrics(
+        ThreadPool::defaultJobServer().get(), &d_counterMetrics);
+    const FileReadMetricsRecorder fileReadMetrics(&d_fileBytesReadForUpload,
+                                                  &d_counterMetrics);
+
     d_addDurationMetricCallback =
         std::bind(&ExecutionContext::addDurationMetric, this,
                   std::placeholders::_1, std::placeholders::_2);
@@ -251,153 +1082,202 @@ int ExecutionContext::execute(int argc, char *argv[])
     buildboxcommon::digest_string_map blobs;
     buildboxcommon::digest_string_map digest_to_filepaths;
     std::set<std::string> products;
-
-    std::shared_ptr<proto::Action> actionPtr;
-    if (command.is_compiler_command() || RECC_FORCE_REMOTE) {
-        // Trying to build an `Action`:
+    std::set<std::string> dependencies;
+
+    // In direct mode, look for a manifest entry whose recorded dependencies
+    // are unchanged. That gives us the `Action` digest without running the
+    // dependency command or building the input root.
+    std::unique_ptr<ManifestCache> manifestCache;
+    std::string manifestKey;
+    bool directModeHit = false;
+    if (RECC_DIRECT_MODE && ManifestCache::isSupported(command)) {
+        manifestCache =
+            std::make_unique<ManifestCache>(RECC_CACHE_DIR + "/manifests");
+        ManifestCache::Entry entry;
         try {
-            ActionBuilder actionBuilder(d_addDurationMetricCallback);
-            actionPtr = actionBuilder.BuildAction(
-                command, cwd, &blobs, &digest_to_filepaths, &products);
+            // Timed block
+            buildboxcommon::buildboxcommonmetrics::MetricTeeGuard<
+                buildboxcommon::buildboxcommonmetrics::DurationMetricTimer>
+                mt(TIMER_NAME_DIRECT_MODE_LOOKUP, d_addDurationMetricCallback);
+
+            manifestKey = ManifestCache::computeKey(command, cwd);
+            directModeHit = manifestCache->lookup(manifestKey, &entry);
         }
-        catch (const std::invalid_argument &) {
-            BUILDBOX_LOG_ERROR(
-                "Invalid `argv[0]` value in command: \"" +
-                command.get_command().at(0) +
-                "\". The Remote Execution API requires it to specify "
-                "either a relative or absolute path to an executable.");
-            throw;
+        catch (const std::exception &e) {
+            BUILDBOX_LOG_WARNING("Direct mode lookup failed: " << e.what());
+            manifestCache.reset();
         }
 
-        // Calculate and record total size of input blobs
-        const int64_t inputSize =
-            calculateTotalSize(blobs, digest_to_filepaths);
+        const char *counterName = directModeHit
+                                      ? COUNTER_NAME_DIRECT_MODE_HIT
+                                      : COUNTER_NAME_DIRECT_MODE_MISS;
         buildboxcommon::buildboxcommonmetrics::CountingMetricUtil::
-            recordCounterMetric(COUNTER_NAME_INPUT_SIZE_BYTES, inputSize);
-        d_counterMetrics[COUNTER_NAME_INPUT_SIZE_BYTES] = inputSize;
-    }
-    else {
-        BUILDBOX_LOG_INFO("Not a compiler command, so running locally. (Use "
-                          "RECC_FORCE_REMOTE=1 to force remote execution)");
+            recordCounterMetric(counterName, 1);
+        d_counterMetrics[counterName] = 1;
+
+        if (directModeHit) {
+            BUILDBOX_LOG_DEBUG("Direct mode hit for manifest [" << manifestKey
+                                                                << "]");
+            this->d_actionDigest = entry.d_actionDigest;
+            products = entry.d_products;
+            for (const auto &dependency : entry.d_dependencies) {
+                dependencies.insert(dependency.first);
+            }
+        }
     }
 
-    // If we don't need to build an `Action` or if the process fails, we defer
-    // to running the command locally (unless we are in no-build mode):
-    if (!actionPtr) {
-        if (RECC_NO_EXECUTE) {
-            BUILDBOX_LOG_INFO("Command would have run locally but "
-                              "RECC_NO_EXECUTE is enabled, exiting.");
-            return 0;
+    std::shared_ptr<proto::Action> actionPtr;
+    if (!directModeHit) {
+        if (command.is_compiler_command() || RECC_FORCE_REMOTE) {
+            actionPtr = buildAction(command, cwd, &blobs, &digest_to_filepaths,
+                                    &products, &dependencies);
         }
-        return execLocally(argc, argv);
-    }
+        else {
+            BUILDBOX_LOG_INFO(
+                "Not a compiler command, so running locally. (Use "
+                "RECC_FORCE_REMOTE=1 to force remote execution)");
+        }
+
+        // If we don't need to build an `Action` or if the process fails, we
+        // defer to running the command locally (unless we are in no-build
+        // mode):
+        if (!actionPtr) {
+            if (RECC_NO_EXECUTE) {
+                BUILDBOX_LOG_INFO("Command would have run locally but "
+                                  "RECC_NO_EXECUTE is enabled, exiting.");
+                return 0;
+            }
+            return execLocally(argc, argv);
+        }
+
+        this->d_actionDigest = DigestGenerator::make_digest(*actionPtr);
+        BUILDBOX_LOG_DEBUG("Action Digest: "
+                           << d_actionDigest << " Action Contents: "
+                           << actionPtr->ShortDebugString());
 
-    const proto::Action action = *actionPtr;
-    const proto::Digest actionDigest = DigestGenerator::make_digest(action);
-    this->d_actionDigest = actionDigest;
+        if (manifestCache) {
+            storeManifestEntry(*manifestCache, manifestKey, products,
+                               dependencies, digest_to_filepaths);
+        }
+    }
 
-    BUILDBOX_LOG_DEBUG("Action Digest: " << actionDigest
-                                         << " Action Contents: "
-                                         << action.ShortDebugString());
+    proto::Digest actionDigest = this->d_actionDigest;
     if (RECC_NO_EXECUTE) {
         BUILDBOX_LOG_INFO("RECC_NO_EXECUTE is enabled, exiting.");
         return 0;
     }
 
-    // Setting up the gRPC connections:
-    std::unique_ptr<GrpcChannels> returnChannels;
-    try {
-        returnChannels = std::make_unique<GrpcChannels>(
-            GrpcChannels::get_channels_from_config());
+    // Setting up the gRPC connections, unless they are shared with previous
+    // executions:
+    GrpcClients clients;
+    if (d_grpcClients != nullptr) {
+        clients = *d_grpcClients;
     }
-    catch (const std::runtime_error &e) {
-        BUILDBOX_LOG_ERROR("Invalid argument in channel config: " << e.what());
-        throw;
+    const bool connected = clients.d_casClient != nullptr;
+    if (!connected) {
+        std::unique_ptr<GrpcChannels> returnChannels;
+        try {
+            returnChannels = std::make_unique<GrpcChannels>(
+                GrpcChannels::get_channels_from_config());
+        }
+        catch (const std::runtime_error &e) {
+            BUILDBOX_LOG_ERROR(
+                "Invalid argument in channel config: " << e.what());
+            throw;
+        }
+
+        const auto configured_digest_function =
+            DigestGenerator::stringToDigestFunctionMap().at(
+                RECC_CAS_DIGEST_FUNCTION);
+
+        clients.d_cas = std::make_shared<buildboxcommon::GrpcClient>();
+        clients.d_cas->init(*returnChannels->cas());
+        clients.d_execution = std::make_shared<buildboxcommon::GrpcClient>();
+        clients.d_execution->init(*returnChannels->server());
+        clients.d_actionCache =
+            std::make_shared<buildboxcommon::GrpcClient>();
+        clients.d_actionCache->init(*returnChannels->action_cache());
+
+        for (const auto &grpcClient :
+             {clients.d_cas, clients.d_execution, clients.d_actionCache}) {
+            grpcClient->setToolDetails(
+                RequestMetadataGenerator::RECC_METADATA_TOOL_NAME,
+                RequestMetadataGenerator::RECC_METADATA_TOOL_VERSION);
+        }
+
+        clients.d_casClient = std::make_shared<buildboxcommon::CASClient>(
+            clients.d_cas, configured_digest_function);
+    }
+
+    for (const auto &grpcClient :
+         {clients.d_cas, clients.d_execution, clients.d_actionCache}) {
+        grpcClient->setRequestMetadata(
+            proto::toString(actionDigest),
+            RequestMetadataGenerator::tool_invocation_id(),
+            RECC_CORRELATED_INVOCATIONS_ID);
     }
 
-    const auto configured_digest_function =
-        DigestGenerator::stringToDigestFunctionMap().at(
-            RECC_CAS_DIGEST_FUNCTION);
-
-    auto casGrpcClient = std::make_shared<buildboxcommon::GrpcClient>();
-    casGrpcClient->init(*returnChannels->cas());
-    auto executionGrpcClient = std::make_shared<buildboxcommon::GrpcClient>();
-    executionGrpcClient->init(*returnChannels->server());
-    auto actionCacheGrpcClient =
-        std::make_shared<buildboxcommon::GrpcClient>();
-    actionCacheGrpcClient->init(*returnChannels->action_cache());
-
-    casGrpcClient->setToolDetails(
-        RequestMetadataGenerator::RECC_METADATA_TOOL_NAME,
-        RequestMetadataGenerator::RECC_METADATA_TOOL_VERSION);
-    casGrpcClient->setRequestMetadata(
-        proto::toString(actionDigest),
-        RequestMetadataGenerator::tool_invocation_id(),
-        RECC_CORRELATED_INVOCATIONS_ID);
-
-    executionGrpcClient->setToolDetails(
-        RequestMetadataGenerator::RECC_METADATA_TOOL_NAME,
-        RequestMetadataGenerator::RECC_METADATA_TOOL_VERSION);
-    executionGrpcClient->setRequestMetadata(
-        proto::toString(actionDigest),
-        RequestMetadataGenerator::tool_invocation_id(),
-        RECC_CORRELATED_INVOCATIONS_ID);
-
-    actionCacheGrpcClient->setToolDetails(
-        RequestMetadataGenerator::RECC_METADATA_TOOL_NAME,
-        RequestMetadataGenerator::RECC_METADATA_TOOL_VERSION);
-    actionCacheGrpcClient->setRequestMetadata(
-        proto::toString(actionDigest),
-        RequestMetadataGenerator::tool_invocation_id(),
-        RECC_CORRELATED_INVOCATIONS_ID);
-
-    d_casClient = std::make_shared<buildboxcommon::CASClient>(
-        casGrpcClient, configured_digest_function);
-    d_casClient->init(RECC_CAS_GET_CAPABILITIES);
-
-    RemoteExecutionClient reClient(d_casClient, executionGrpcClient,
-                                   actionCacheGrpcClient);
+    if (!connected) {
+        clients.d_casClient->init(RECC_CAS_GET_CAPABILITIES);
+        if (d_grpcClients != nullptr) {
+            *d_grpcClients = clients;
+        }
+    }
+    d_casClient = clients.d_casClient;
+
+    RemoteExecutionClient reClient(d_casClient, clients.d_execution,
+                                   clients.d_actionCache);
     reClient.init();
 
-    bool action_in_cache = false;
     proto::ActionResult result;
 
-    // If allowed, we look in the action cache first:
-    if (!RECC_SKIP_CACHE) {
+    // On a miss, the input root will be uploaded: find out which blobs are
+    // missing while the action cache is queried
+    if (RECC_SPECULATIVE_FIND_MISSING_BLOBS && actionPtr && !RECC_SKIP_CACHE &&
+        !RECC_CACHE_ONLY) {
         try {
-            { // Timed block
-                buildboxcommon::buildboxcommonmetrics::MetricTeeGuard<
-                    buildboxcommon::buildboxcommonmetrics::DurationMetricTimer>
-                    mt(TIMER_NAME_QUERY_ACTION_CACHE,
-                       d_addDurationMetricCallback);
-
-                action_in_cache = reClient.fetchFromActionCache(
-                    actionDigest, command.get_products(), &result);
-                if (action_in_cache) {
-                    buildboxcommon::buildboxcommonmetrics::CountingMetricUtil::
-                        recordCounterMetric(COUNTER_NAME_ACTION_CACHE_HIT, 1);
-                    d_counterMetrics[COUNTER_NAME_ACTION_CACHE_HIT] = 1;
-                    BUILDBOX_LOG_INFO("Action Cache hit for [" << actionDigest
-                                                               << "]");
-                }
-                else {
-                    buildboxcommon::buildboxcommonmetrics::CountingMetricUtil::
-                        recordCounterMetric(COUNTER_NAME_ACTION_CACHE_MISS, 1);
-                    d_counterMetrics[COUNTER_NAME_ACTION_CACHE_MISS] = 1;
-                }
-            }
+            startFindMissingBlobs(blobs, digest_to_filepaths);
         }
         catch (const std::exception &e) {
-            BUILDBOX_LOG_ERROR("Error while querying action cache at \""
-                               << RECC_ACTION_CACHE_SERVER
-                               << "\": " << e.what());
+            BUILDBOX_LOG_WARNING(
+                "Could not start querying missing blobs: " << e.what());
+        }
+    }
+
+    // If allowed, we look in the action cache first:
+    bool action_in_cache =
+        !RECC_SKIP_CACHE &&
+        lookupActionCache(&reClient, actionDigest, command, &result);
+
+    // A direct-mode hit only gives us the `Action` digest. If the action is
+    // not cached after all (for example because it was evicted), build the
+    // `Action` with its input root the usual way.
+    if (!action_in_cache && !actionPtr) {
+        BUILDBOX_LOG_DEBUG("Direct mode hit but action not cached, building "
+                           "the action");
+        actionPtr = buildAction(command, cwd, &blobs, &digest_to_filepaths,
+                                &products, &dependencies);
+        if (!actionPtr) {
+            return execLocally(argc, argv);
+        }
+
+        this->d_actionDigest = DigestGenerator::make_digest(*actionPtr);
+        storeManifestEntry(*manifestCache, manifestKey, products,
+                           dependencies, digest_to_filepaths);
+        if (d_actionDigest != actionDigest) {
+            BUILDBOX_LOG_DEBUG("Action digest ["
+                               << d_actionDigest
+                               << "] differs from the one in the manifest");
+            actionDigest = d_actionDigest;
+            action_in_cache =
+                lookupActionCache(&reClient, actionDigest, command, &result);
         }
     }
 
     // If the results for the action are not cached, we upload the
     // necessary resources to CAS:
     if (!action_in_cache) {
-        blobs[actionDigest] = action.SerializeAsString();
+        blobs[actionDigest] = actionPtr->SerializeAsString();
 
         if (RECC_CACHE_ONLY) {
             bool cache_upload_local_build =
@@ -444,9 +1324,15 @@ int ExecutionContext::execute(int argc, char *argv[])
                         return actionResult.exit_code();
                     }
 
+                    addToLocalCas(actionResult);
+
                     try {
                         reClient.updateActionCache(actionDigest, actionResult);
                         BUILDBOX_LOG_INFO("Action cache updated");
+                        if (localActionCache()) {
+                            localActionCache()->store(actionDigest,
+                                                      actionResult);
+                        }
                     }
                     catch (const std::exception &e) {
                         // Only log warning as local execution was still
@@ -484,10 +1370,15 @@ int ExecutionContext::execute(int argc, char *argv[])
                 buildboxcommon::buildboxcommonmetrics::DurationMetricTimer>
                 mt(TIMER_NAME_EXECUTE_ACTION, d_addDurationMetricCallback);
 
-            result = reClient.executeAction(actionDigest, *d_stopRequested,
-                                            RECC_SKIP_CACHE);
+            result = executeUploadedAction(&reClient, actionDigest, blobs,
+                                           digest_to_filepaths);
             BUILDBOX_LOG_INFO("Remote execution finished with exit code "
                               << result.exit_code());
+            // Only successful results are cached by the server
+            if (localActionCache() && result.exit_code() == 0 &&
+                !RECC_ACTION_UNCACHEABLE) {
+                localActionCache()->store(actionDigest, result);
+            }
         }
         catch (const std::exception &e) {
             BUILDBOX_LOG_ERROR("Error while calling `Execute()` on \""
@@ -514,6 +1405,16 @@ int ExecutionContext::execute(int argc, char *argv[])
             result.clear_output_symlinks();
             result.clear_output_directories();
         }
+        else {
+            // Outputs that were not modified since a previous build don't
+            // need to be fetched again
+            const int64_t unchanged = OutputDownloader::skipUnchangedFiles(
+                &result, dependencies, fileDigestCache());
+            buildboxcommon::buildboxcommonmetrics::CountingMetricUtil::
+                recordCounterMetric(COUNTER_NAME_UNCHANGED_OUTPUTS,
+                                    unchanged);
+            d_counterMetrics[COUNTER_NAME_UNCHANGED_OUTPUTS] = unchanged;
+        }
 
         const auto randomStr = getRandomString();
 
@@ -545,7 +1446,20 @@ int ExecutionContext::execute(int argc, char *argv[])
                 buildboxcommon::buildboxcommonmetrics::DurationMetricTimer>
                 mt(TIMER_NAME_DOWNLOAD_BLOBS, d_addDurationMetricCallback);
 
-            reClient.writeFilesToDisk(result);
+            LocalCas *cas = localCas();
+            const int64_t localCasHits = cas ? cas->hits() : 0;
+            const int64_t localCasMisses = cas ? cas->misses() : 0;
+            reClient.writeFilesToDisk(result, ".", cas);
+            if (cas) {
+                const int64_t hits = cas->hits() - localCasHits;
+                const int64_t misses = cas->misses() - localCasMisses;
+                buildboxcommon::buildboxcommonmetrics::CountingMetricUtil::
+                    recordCounterMetric(COUNTER_NAME_LOCAL_CAS_HIT, hits);
+                d_counterMetrics[COUNTER_NAME_LOCAL_CAS_HIT] = hits;
+                buildboxcommon::buildboxcommonmetrics::CountingMetricUtil::
+                    recordCounterMetric(COUNTER_NAME_LOCAL_CAS_MISS, misses);
+                d_counterMetrics[COUNTER_NAME_LOCAL_CAS_MISS] = misses;
+            }
         }
 
         /* These don't use logging macros because they are compiler output
@@ -571,6 +1485,10 @@ int ExecutionContext::execute(int argc, char *argv[])
     }
     catch (const std::exception &e) {
         BUILDBOX_LOG_ERROR(e.what());
+        // The outputs may have been evicted since the result was stored
+        if (d_localActionCacheHit) {
+            localActionCache()->remove(actionDigest);
+        }
         throw;
     }
 }
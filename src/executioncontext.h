@@ -16,24 +16,78 @@
 #define INCLUDED_EXECUTIONCONTEXT
 
 #include <atomic>
+#include <future>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include <parsedcommand.h>
 
 #include <buildboxcommon_casclient.h>
+#include <buildboxcommon_grpcclient.h>
 #include <buildboxcommon_protos.h>
+#include <buildboxcommon_temporaryfile.h>
 #include <buildboxcommonmetrics_durationmetricvalue.h>
 
 namespace recc {
 
+class CasPresenceCache;
+class ExecuteLimiter;
+class FileDigestCache;
+class LocalActionCache;
+class LocalCas;
+class ManifestCache;
+class RemoteExecutionClient;
+class SubtreeDigestCache;
+
 /**
  * The ExecutionContext class holds the state for command execution.
  */
 class ExecutionContext {
   public:
+    /**
+     * The clients connected to the servers, set up by the first execution
+     * that uses them. A process running several commands can share them
+     * between their contexts so that the connections and the capabilities
+     * of the CAS server are reused.
+     */
+    struct GrpcClients {
+        std::shared_ptr<buildboxcommon::GrpcClient> d_cas;
+        std::shared_ptr<buildboxcommon::GrpcClient> d_execution;
+        std::shared_ptr<buildboxcommon::GrpcClient> d_actionCache;
+        std::shared_ptr<buildboxcommon::CASClient> d_casClient;
+    };
+
+    ExecutionContext() = default;
+
+    /**
+     * Waits for the query started while looking up the action cache, if it
+     * is still running.
+     */
+    ~ExecutionContext();
+
+    ExecutionContext(const ExecutionContext &) = delete;
+    ExecutionContext &operator=(const ExecutionContext &) = delete;
+
     /**
      * Set the stop token, which cancels execution at the next possible point
      * when it becomes true.
      */
     void setStopToken(const std::atomic_bool &stop_requested);
 
+    /**
+     * Use the given clients, which must outlive this context, instead of
+     * connecting to the servers again. They are only meant to be shared by
+     * executions with the same configuration, one at a time.
+     */
+    void setGrpcClients(GrpcClients *clients);
+
+    /**
+     * Use the configuration already parsed by the caller instead of parsing
+     * it again in `execute()`.
+     */
+    void setConfigParsed();
+
     /**
      * Execute the specified command. Depending on the configuration, this may
      * use remote execution or local execution with caching.
@@ -52,32 +106,163 @@ class ExecutionContext {
 
     buildboxcommon::CASClient *getCasClient() const;
 
+  protected: // for unit testing
+    void uploadResources(
+        const buildboxcommon::digest_string_map &blobs,
+        const buildboxcommon::digest_string_map &digest_to_filepaths);
+
+    /**
+     * Calls `executeAction()` once the resources are uploaded. If the server
+     * reports that some are missing, as happens when blobs recorded in the
+     * CAS presence cache were evicted since, they are forgotten by the
+     * cache and uploaded again after querying all of them, and the action
+     * is executed once more.
+     */
+    buildboxcommon::ActionResult executeUploadedAction(
+        RemoteExecutionClient *reClient,
+        const buildboxcommon::Digest &actionDigest,
+        const buildboxcommon::digest_string_map &blobs,
+        const buildboxcommon::digest_string_map &digest_to_filepaths);
+
+    std::function<void(
+        const std::string &,
+        buildboxcommon::buildboxcommonmetrics::DurationMetricValue)>
+        d_addDurationMetricCallback;
+    std::shared_ptr<buildboxcommon::CASClient> d_casClient;
+
   private:
     const std::atomic_bool *d_stopRequested;
     std::map<std::string,
              buildboxcommon::buildboxcommonmetrics::DurationMetricValue>
         d_durationMetrics;
-    std::function<void(
-        const std::string &,
-        buildboxcommon::buildboxcommonmetrics::DurationMetricValue)>
-        d_addDurationMetricCallback;
     std::map<std::string, int64_t> d_counterMetrics;
     buildboxcommon::Digest d_actionDigest;
     buildboxcommon::ActionResult d_actionResult;
 
-    std::shared_ptr<buildboxcommon::CASClient> d_casClient;
+    bool d_configParsed = false;
+    GrpcClients *d_grpcClients = nullptr;
+    std::shared_ptr<CasPresenceCache> d_casPresenceCache;
+    // Whether blobs known to be present are queried anyway, decided once
+    // per invocation
+    bool d_verifyCasPresenceCache = false;
+    std::shared_ptr<FileDigestCache> d_fileDigestCache;
+    std::shared_ptr<SubtreeDigestCache> d_subtreeDigestCache;
+    std::shared_ptr<ExecuteLimiter> d_executeLimiter;
+    std::shared_ptr<LocalCas> d_localCas;
+    std::shared_ptr<LocalActionCache> d_localActionCache;
+    // Whether the result of the action came from the local action cache
+    bool d_localActionCacheHit = false;
+    // Output of local commands too large to be kept in memory until it is
+    // uploaded
+    std::vector<std::unique_ptr<buildboxcommon::TemporaryFile>>
+        d_capturedOutputFiles;
+    // Bytes of the files uploaded that had to be read again
+    int64_t d_fileBytesReadForUpload = 0;
+
+    // Query started by `startFindMissingBlobs()`: the digests it considered,
+    // the ones it sent and the ones known present that it sent anyway. Its
+    // result is only waited for by `uploadResources()`, and the thread
+    // running it is joined on destruction.
+    std::unordered_set<buildboxcommon::Digest> d_speculativeCandidates;
+    std::vector<buildboxcommon::Digest> d_speculativeDigests;
+    std::unordered_set<buildboxcommon::Digest> d_speculativeKnownPresent;
+    std::future<std::vector<buildboxcommon::Digest>> d_speculativeMissing;
+    std::thread d_speculativeThread;
 
     int execLocally(int argc, char *argv[]);
 
+    /**
+     * Returns the file digest cache, opening it on first use, or null if it
+     * is disabled.
+     */
+    FileDigestCache *fileDigestCache();
+
+    /**
+     * Returns the local CAS, opening it on first use, or null if it is
+     * disabled.
+     */
+    LocalCas *localCas();
+
+    /**
+     * Returns the local action cache, or null if it is disabled.
+     */
+    LocalActionCache *localActionCache();
+
+    /**
+     * Adds the output files of a local build to the local CAS, if enabled.
+     */
+    void addToLocalCas(const buildboxcommon::ActionResult &result);
+
     buildboxcommon::ActionResult execLocallyWithActionResult(
         int argc, char *argv[], buildboxcommon::digest_string_map *blobs,
         buildboxcommon::digest_string_map *digest_to_filepaths,
         const std::set<std::string> &products);
 
-    void uploadResources(
+    /**
+     * Returns the digests that need to be sent to `FindMissingBlobs()`,
+     * leaving out the ones known to be in the CAS. Digests known to be in
+     * the CAS but queried anyway to verify the cache are added to
+     * `knownPresent`.
+     */
+    std::vector<buildboxcommon::Digest>
+    digestsToQuery(const std::vector<buildboxcommon::Digest> &digests,
+                   std::unordered_set<buildboxcommon::Digest> *knownPresent);
+
+    /**
+     * Starts querying which of the given blobs are missing from the CAS in
+     * the background. `uploadResources()` uses the result instead of
+     * querying them again.
+     */
+    void startFindMissingBlobs(
         const buildboxcommon::digest_string_map &blobs,
         const buildboxcommon::digest_string_map &digest_to_filepaths);
 
+    /**
+     * Builds the `Action` for the given command, returning `nullptr` if it
+     * should be run locally instead.
+     */
+    std::shared_ptr<buildboxcommon::Action>
+    buildAction(const ParsedCommand &command, const std::string &cwd,
+                buildboxcommon::digest_string_map *blobs,
+                buildboxcommon::digest_string_map *digest_to_filepaths,
+                std::set<std::string> *products,
+                std::set<std::string> *dependencies);
+
+    /**
+     * Queries the action cache, recording the hit or miss. Errors are logged
+     * and treated as a miss.
+     */
+    bool lookupActionCache(RemoteExecutionClient *reClient,
+                           const buildboxcommon::Digest &actionDigest,
+                           const ParsedCommand &command,
+                           buildboxcommon::ActionResult *result);
+
+    /**
+     * Looks up the local action cache, if enabled, recording the hit or
+     * miss. With RECC_LOCAL_ACTION_CACHE_VERIFY, a result whose outputs are
+     * missing from the CAS is a miss.
+     */
+    bool lookupLocalActionCache(const buildboxcommon::Digest &actionDigest,
+                                buildboxcommon::ActionResult *result);
+
+    /**
+     * Calls `Execute()`, first waiting for the number of calls in flight to
+     * be within the limit set by RECC_EXECUTE_LIMIT.
+     */
+    buildboxcommon::ActionResult
+    executeAction(RemoteExecutionClient *reClient,
+                  const buildboxcommon::Digest &actionDigest);
+
+    /**
+     * Records the dependencies that produced `d_actionDigest` in the direct
+     * mode manifest with the given key.
+     */
+    void storeManifestEntry(
+        const ManifestCache &manifestCache, const std::string &manifestKey,
+        const std::set<std::string> &products,
+        const std::set<std::string> &dependencies,
+        const buildboxcommon::digest_string_map &digest_to_filepaths);
+
     int64_t calculateTotalSize(
         const buildboxcommon::digest_string_map &blobs,
         const buildboxcommon::digest_string_map &digest_to_filepaths);
@@ -0,0 +1,521 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <filebackend.h>
+
+#include <digestgenerator.h>
+#include <filecontents.h>
+
+#include <buildboxcommon_logging.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <ctime>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace recc {
+
+const int64_t FileBackend::TOUCH_INTERVAL = 60 * 60;
+const int64_t FileBackend::GC_INTERVAL = 10 * 60;
+
+namespace {
+
+const std::string FILE_URL_PREFIX = "file://";
+
+// A garbage collection that held the lock for longer is assumed to have
+// been interrupted, and so are writes of temporary files
+const int64_t STALE_LOCK_AGE = 60 * 60;
+const int64_t STALE_TEMPORARY_AGE = 60 * 60;
+
+// Garbage collection removes entries until the total size is below this
+// fraction of the maximum, so that it doesn't run again right away
+const int64_t GC_TARGET_PERCENT = 90;
+
+std::atomic<uint64_t> s_temporaryCounter(0);
+
+int64_t ageOf(const struct stat &st)
+{
+    return static_cast<int64_t>(time(nullptr)) - st.st_mtime;
+}
+
+void createDirectoryIfMissing(const std::string &path)
+{
+    if (mkdir(path.c_str(), 0777) != 0 && errno != EEXIST) {
+        throw std::system_error(errno, std::system_category(),
+                                "Could not create \"" + path + "\"");
+    }
+}
+
+// Unique across hosts sharing the cache, and across threads and processes
+// of each of them
+std::string temporaryName()
+{
+    char hostName[256] = {};
+    gethostname(hostName, sizeof(hostName) - 1);
+    return std::string(hostName) + "." + std::to_string(getpid()) + "." +
+           std::to_string(s_temporaryCounter++);
+}
+
+void writeAll(int fd, const std::string &data, const std::string &path)
+{
+    size_t written = 0;
+    while (written < data.size()) {
+        const ssize_t n =
+            write(fd, data.data() + written, data.size() - written);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            throw std::system_error(errno, std::system_category(),
+                                    "Could not write \"" + path + "\"");
+        }
+        written += static_cast<size_t>(n);
+    }
+}
+
+bool readAll(int fd, size_t size, std::string *data)
+{
+    data->resize(size);
+    size_t offset = 0;
+    while (offset < size) {
+        const ssize_t n = pread(fd, &(*data)[offset], size - offset,
+                                static_cast<off_t>(offset));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        offset += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool readFile(const std::string &path, std::string *data,
+              struct stat *st = nullptr)
+{
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat fileStatus;
+    const bool read = fstat(fd, &fileStatus) == 0 &&
+                      readAll(fd, static_cast<size_t>(fileStatus.st_size),
+                              data);
+    close(fd);
+    if (read && st != nullptr) {
+        *st = fileStatus;
+    }
+    return read;
+}
+
+void touchIfStale(const std::string &path, const struct stat &st)
+{
+    if (ageOf(st) >= FileBackend::TOUCH_INTERVAL) {
+        utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+    }
+}
+
+struct Entry {
+    std::string d_path;
+    time_t d_mtime;
+    int64_t d_size;
+};
+
+void listEntries(const std::string &directory, std::vector<Entry> *entries)
+{
+    DIR *dir = opendir(directory.c_str());
+    if (dir == nullptr) {
+        return;
+    }
+    while (const struct dirent *entry = readdir(dir)) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        const std::string path = directory + "/" + entry->d_name;
+        struct stat st;
+        if (lstat(path.c_str(), &st) != 0) {
+            continue;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            listEntries(path, entries);
+        }
+        else if (S_ISREG(st.st_mode)) {
+            entries->push_back({path, st.st_mtime, st.st_size});
+        }
+    }
+    closedir(dir);
+}
+
+} // namespace
+
+FileBackend::FileBackend(const std::string &root, int64_t maxSize)
+    : d_root(root), d_maxSize(maxSize)
+{
+    createDirectoryIfMissing(d_root);
+    for (const char *directory : {"/cas", "/ac", "/tmp"}) {
+        createDirectoryIfMissing(d_root + directory);
+    }
+}
+
+bool FileBackend::isFileUrl(const std::string &url)
+{
+    return url.compare(0, FILE_URL_PREFIX.size(), FILE_URL_PREFIX) == 0;
+}
+
+std::string FileBackend::pathFromUrl(const std::string &url)
+{
+    const std::string path = url.substr(FILE_URL_PREFIX.size());
+    if (!isFileUrl(url) || path.empty() || path[0] != '/') {
+        throw std::invalid_argument("\"" + url +
+                                    "\" is not a file:// URL with an "
+                                    "absolute path");
+    }
+    return path;
+}
+
+std::string FileBackend::blobPath(const proto::Digest &digest) const
+{
+    const std::string &hash = digest.hash();
+    return d_root + "/cas/" + hash.substr(0, 2) + "/" + hash;
+}
+
+std::string
+FileBackend::actionResultPath(const proto::Digest &actionDigest) const
+{
+    const std::string &hash = actionDigest.hash();
+    return d_root + "/ac/" + hash.substr(0, 2) + "/" + hash + "-" +
+           std::to_string(actionDigest.size_bytes());
+}
+
+bool FileBackend::hasBlob(const proto::Digest &digest) const
+{
+    if (digest.size_bytes() == 0) {
+        return true;
+    }
+    const std::string path = blobPath(digest);
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0 || st.st_size != digest.size_bytes()) {
+        return false;
+    }
+    touchIfStale(path, st);
+    return true;
+}
+
+int FileBackend::openBlob(const proto::Digest &digest) const
+{
+    // The empty blob is never written
+    const std::string path =
+        digest.size_bytes() == 0 ? "/dev/null" : blobPath(digest);
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 ||
+        (digest.size_bytes() > 0 && st.st_size != digest.size_bytes())) {
+        close(fd);
+        return -1;
+    }
+    if (digest.size_bytes() > 0) {
+        touchIfStale(path, st);
+    }
+    return fd;
+}
+
+bool FileBackend::readBlob(const proto::Digest &digest,
+                           std::string *data) const
+{
+    const int fd = openBlob(digest);
+    if (fd < 0) {
+        return false;
+    }
+    const bool read =
+        readAll(fd, static_cast<size_t>(digest.size_bytes()), data);
+    close(fd);
+    return read;
+}
+
+int FileBackend::createTemporaryFile(std::string *path) const
+{
+    *path = d_root + "/tmp/" + temporaryName();
+    const int fd =
+        open(path->c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+    if (fd < 0) {
+        throw std::system_error(errno, std::system_category(),
+                                "Could not create \"" + *path + "\"");
+    }
+    return fd;
+}
+
+void FileBackend::moveIntoPlace(const std::string &temporaryPath,
+                                const std::string &path) const
+{
+    if (rename(temporaryPath.c_str(), path.c_str()) == 0) {
+        return;
+    }
+    if (errno == ENOENT) {
+        createDirectoryIfMissing(path.substr(0, path.rfind('/')));
+        if (rename(temporaryPath.c_str(), path.c_str()) == 0) {
+            return;
+        }
+    }
+    const int error = errno;
+    unlink(temporaryPath.c_str());
+    throw std::system_error(error, std::system_category(),
+                            "Could not rename \"" + temporaryPath +
+                                "\" to \"" + path + "\"");
+}
+
+void FileBackend::writeBlob(const proto::Digest &digest,
+                            const std::string &data)
+{
+    if (static_cast<int64_t>(data.size()) != digest.size_bytes() ||
+        DigestGenerator::make_digest(data) != digest) {
+        throw std::invalid_argument("Contents of blob " +
+                                    proto::toString(digest) +
+                                    " don't match its digest");
+    }
+    if (hasBlob(digest)) {
+        return;
+    }
+
+    std::string temporaryPath;
+    const int fd = createTemporaryFile(&temporaryPath);
+    try {
+        writeAll(fd, data, temporaryPath);
+    }
+    catch (...) {
+        close(fd);
+        unlink(temporaryPath.c_str());
+        throw;
+    }
+    close(fd);
+    moveIntoPlace(temporaryPath, blobPath(digest));
+    collectGarbageIfDue();
+}
+
+void FileBackend::commitBlob(const proto::Digest &digest, int fd,
+                             const std::string &path)
+{
+    try {
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            throw std::system_error(errno, std::system_category(),
+                                    "Could not stat \"" + path + "\"");
+        }
+        bool matches = st.st_size == digest.size_bytes();
+        if (matches && st.st_size > 0) {
+            const FileContents contents(fd, path, st,
+                                        FileContents::OWNED);
+            matches = DigestGenerator::make_digests(
+                          {DigestGenerator::BlobView(
+                              contents.data(), contents.size())})[0] ==
+                      digest;
+        }
+        if (!matches) {
+            throw std::invalid_argument("Contents of blob " +
+                                        proto::toString(digest) +
+                                        " don't match its digest");
+        }
+    }
+    catch (...) {
+        unlink(path.c_str());
+        throw;
+    }
+
+    if (hasBlob(digest)) {
+        unlink(path.c_str());
+        return;
+    }
+    moveIntoPlace(path, blobPath(digest));
+    collectGarbageIfDue();
+}
+
+bool FileBackend::hasTreeBlobs(const proto::Digest &treeDigest) const
+{
+    std::string data;
+    proto::Tree tree;
+    if (!readBlob(treeDigest, &data) || !tree.ParseFromString(data)) {
+        return false;
+    }
+    const auto hasFileBlobs = [this](const proto::Directory &directory) {
+        return std::all_of(directory.files().cbegin(),
+                           directory.files().cend(),
+                           [this](const proto::FileNode &file) {
+                               return hasBlob(file.digest());
+                           });
+    };
+    return hasFileBlobs(tree.root()) &&
+           std::all_of(tree.children().cbegin(), tree.children().cend(),
+                       hasFileBlobs);
+}
+
+bool FileBackend::getActionResult(const proto::Digest &actionDigest,
+                                  proto::ActionResult *result) const
+{
+    const std::string path = actionResultPath(actionDigest);
+    std::string data;
+    struct stat st;
+    if (!readFile(path, &data, &st)) {
+        return false;
+    }
+    if (!result->ParseFromString(data)) {
+        BUILDBOX_LOG_WARNING("Ignoring invalid action result \"" << path
+                                                                 << "\"");
+        return false;
+    }
+
+    // The outputs may have been removed by a garbage collection
+    for (const proto::OutputFile &file : result->output_files()) {
+        if (!hasBlob(file.digest())) {
+            return false;
+        }
+    }
+    for (const proto::OutputDirectory &directory :
+         result->output_directories()) {
+        if (!hasTreeBlobs(directory.tree_digest())) {
+            return false;
+        }
+    }
+    if ((result->has_stdout_digest() && !hasBlob(result->stdout_digest())) ||
+        (result->has_stderr_digest() && !hasBlob(result->stderr_digest()))) {
+        return false;
+    }
+
+    touchIfStale(path, st);
+    return true;
+}
+
+void FileBackend::updateActionResult(const proto::Digest &actionDigest,
+                                     const proto::ActionResult &result)
+{
+    std::string temporaryPath;
+    const int fd = createTemporaryFile(&temporaryPath);
+    try {
+        writeAll(fd, result.SerializeAsString(), temporaryPath);
+    }
+    catch (...) {
+        close(fd);
+        unlink(temporaryPath.c_str());
+        throw;
+    }
+    close(fd);
+    moveIntoPlace(temporaryPath, actionResultPath(actionDigest));
+    collectGarbageIfDue();
+}
+
+void FileBackend::collectGarbageIfDue()
+{
+    if (d_maxSize <= 0) {
+        return;
+    }
+    struct stat st;
+    const std::string stampPath = d_root + "/gc-stamp";
+    if (stat(stampPath.c_str(), &st) == 0 && ageOf(st) < GC_INTERVAL) {
+        return;
+    }
+    try {
+        collectGarbage();
+    }
+    catch (const std::exception &e) {
+        BUILDBOX_LOG_WARNING("Could not collect garbage in \""
+                             << d_root << "\": " << e.what());
+    }
+}
+
+bool FileBackend::collectGarbage()
+{
+    // Exclusive creation is atomic on NFS, unlike `flock()`
+    const std::string lockPath = d_root + "/gc-lock";
+    int lock = open(lockPath.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0666);
+    struct stat st;
+    if (lock < 0 && errno == EEXIST && stat(lockPath.c_str(), &st) == 0 &&
+        ageOf(st) >= STALE_LOCK_AGE) {
+        BUILDBOX_LOG_WARNING("Removing stale lock \"" << lockPath << "\"");
+        unlink(lockPath.c_str());
+        lock = open(lockPath.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0666);
+    }
+    if (lock < 0) {
+        if (errno == EEXIST) {
+            return false;
+        }
+        throw std::system_error(errno, std::system_category(),
+                                "Could not create \"" + lockPath + "\"");
+    }
+    close(lock);
+
+    // Other processes don't start another collection until the interval
+    // has passed again
+    const std::string stampPath = d_root + "/gc-stamp";
+    const int stamp = open(stampPath.c_str(), O_WRONLY | O_CREAT, 0666);
+    if (stamp >= 0) {
+        futimens(stamp, nullptr);
+        close(stamp);
+    }
+
+    std::vector<Entry> entries;
+    listEntries(d_root + "/cas", &entries);
+    listEntries(d_root + "/ac", &entries);
+    int64_t totalSize = 0;
+    for (const Entry &entry : entries) {
+        totalSize += entry.d_size;
+    }
+
+    size_t removed = 0;
+    if (d_maxSize > 0 && totalSize > d_maxSize) {
+        std::sort(entries.begin(), entries.end(),
+                  [](const Entry &a, const Entry &b) {
+                      return a.d_mtime < b.d_mtime;
+                  });
+        const int64_t targetSize = d_maxSize / 100 * GC_TARGET_PERCENT;
+        for (const Entry &entry : entries) {
+            if (totalSize <= targetSize) {
+                break;
+            }
+            // Skip entries touched since they were listed
+            if (stat(entry.d_path.c_str(), &st) != 0 ||
+                st.st_mtime != entry.d_mtime) {
+                continue;
+            }
+            if (unlink(entry.d_path.c_str()) == 0) {
+                totalSize -= entry.d_size;
+                ++removed;
+            }
+        }
+    }
+
+    std::vector<Entry> temporaryFiles;
+    listEntries(d_root + "/tmp", &temporaryFiles);
+    const time_t now = time(nullptr);
+    for (const Entry &entry : temporaryFiles) {
+        if (now - entry.d_mtime >= STALE_TEMPORARY_AGE) {
+            unlink(entry.d_path.c_str());
+        }
+    }
+
+    unlink(lockPath.c_str());
+    BUILDBOX_LOG_DEBUG("Removed " << removed << " entries from \"" << d_root
+                                  << "\", " << totalSize
+                                  << " bytes are left");
+    return true;
+}
+
+} // namespace recc
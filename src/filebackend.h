@@ -0,0 +1,153 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef INCLUDED_FILEBACKEND
+#define INCLUDED_FILEBACKEND
+
+#include <protos.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace recc {
+
+/**
+ * An action cache and CAS stored in a directory tree, which may be shared
+ * by recc processes on several hosts, for example over NFS.
+ *
+ * Blobs are stored in `cas/` and action results in `ac/`, sharded by the
+ * first two characters of their hash. Both are written to `tmp/` under a
+ * name unique to the host and process, and then renamed into place, so
+ * that readers only see complete files and concurrent writers of the same
+ * entry leave one of them. No file locks are used, as they are unreliable
+ * on network file systems.
+ *
+ * Files are touched when used, at most once per `TOUCH_INTERVAL`, and
+ * their modification time orders them: access times are often not updated
+ * on network file systems. When files are written and no garbage
+ * collection was started for `GC_INTERVAL`, the least recently used ones
+ * are removed until the total size is below the maximum, by one process at
+ * a time.
+ *
+ * Action results are only returned if all the blobs they refer to are
+ * still stored.
+ *
+ * This class is thread-safe.
+ */
+class FileBackend {
+  public:
+    /**
+     * Uses the cache in `root`, creating it if it does not exist. `maxSize`
+     * is in bytes, and garbage is never collected if it is zero.
+     *
+     * Throws `std::system_error` if the directories can't be created.
+     */
+    FileBackend(const std::string &root, int64_t maxSize);
+
+    /**
+     * Returns whether `url` selects this backend: `file:///path`.
+     */
+    static bool isFileUrl(const std::string &url);
+
+    /**
+     * Returns the directory of a `file://` URL.
+     *
+     * Throws `std::invalid_argument` if it isn't an absolute path.
+     */
+    static std::string pathFromUrl(const std::string &url);
+
+    bool hasBlob(const proto::Digest &digest) const;
+
+    /**
+     * Writes the contents of the given blob to `data`. Returns whether it
+     * was found.
+     */
+    bool readBlob(const proto::Digest &digest, std::string *data) const;
+
+    /**
+     * Returns a descriptor of the given blob open for reading, which the
+     * caller closes, or -1 if it was not found.
+     */
+    int openBlob(const proto::Digest &digest) const;
+
+    /**
+     * Stores `data` as the given blob.
+     *
+     * Throws `std::invalid_argument` if it doesn't match the digest, and
+     * `std::system_error` if it can't be written.
+     */
+    void writeBlob(const proto::Digest &digest, const std::string &data);
+
+    /**
+     * Creates a file in `tmp/` to write a blob to, storing its path in
+     * `path`. Returns its descriptor, which the caller closes.
+     */
+    int createTemporaryFile(std::string *path) const;
+
+    /**
+     * Stores the temporary file at `path`, written through `fd`, as the
+     * given blob, or removes it if its contents don't match the digest.
+     *
+     * Throws as `writeBlob()`.
+     */
+    void commitBlob(const proto::Digest &digest, int fd,
+                    const std::string &path);
+
+    /**
+     * Writes the result stored for the given action to `result` if all
+     * the blobs it refers to are stored. Returns whether it was found.
+     */
+    bool getActionResult(const proto::Digest &actionDigest,
+                         proto::ActionResult *result) const;
+
+    /**
+     * Stores the result of the given action.
+     *
+     * Throws `std::system_error` if it can't be written.
+     */
+    void updateActionResult(const proto::Digest &actionDigest,
+                            const proto::ActionResult &result);
+
+    /**
+     * Removes the least recently used entries until the total size is
+     * below the maximum, and temporary files left behind by writers that
+     * exited. Returns false without doing so if another process is
+     * collecting garbage.
+     */
+    bool collectGarbage();
+
+    static const int64_t TOUCH_INTERVAL;
+    static const int64_t GC_INTERVAL;
+
+  private:
+    std::string blobPath(const proto::Digest &digest) const;
+    std::string actionResultPath(const proto::Digest &actionDigest) const;
+
+    bool hasTreeBlobs(const proto::Digest &treeDigest) const;
+
+    // Renames the temporary file at `temporaryPath` to `path`, creating
+    // its shard if needed
+    void moveIntoPlace(const std::string &temporaryPath,
+                       const std::string &path) const;
+
+    void collectGarbageIfDue();
+
+    std::string d_root;
+    int64_t d_maxSize;
+};
+
+} // namespace recc
+
+#endif
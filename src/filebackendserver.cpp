@@ -0,0 +1,444 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <filebackendserver.h>
+
+#include <digestgenerator.h>
+#include <env.h>
+
+#include <buildboxcommon_logging.h>
+
+#include <google/bytestream/bytestream.grpc.pb.h>
+#include <grpcpp/server_builder.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <system_error>
+#include <unistd.h>
+
+namespace recc {
+
+namespace {
+
+const char *const SOCKET_NAME = "/socket";
+
+// Advertised to clients, which send and fetch larger blobs with ByteStream
+const int64_t MAX_BATCH_SIZE = 4 * 1024 * 1024;
+const size_t READ_CHUNK_SIZE = 1024 * 1024;
+
+/**
+ * Runs `handler`, turning the exceptions thrown by the backend into
+ * statuses.
+ */
+template <typename Handler> grpc::Status handle(const Handler &handler)
+{
+    try {
+        return handler();
+    }
+    catch (const std::invalid_argument &e) {
+        return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, e.what());
+    }
+    catch (const std::exception &e) {
+        BUILDBOX_LOG_WARNING("File backend error: " << e.what());
+        return grpc::Status(grpc::StatusCode::INTERNAL, e.what());
+    }
+}
+
+bool isNumber(const std::string &s)
+{
+    // Sizes that don't fit in 64 bits are rejected too
+    return !s.empty() && s.size() < 19 &&
+           s.find_first_not_of("0123456789") == std::string::npos;
+}
+
+/**
+ * Parses the digest of a ByteStream resource name, either
+ * `{instance}/blobs/{hash}/{size}` or
+ * `{instance}/uploads/{uuid}/blobs/{hash}/{size}`, where `blobs` may be
+ * followed by the name of the digest function.
+ */
+bool parseResourceName(const std::string &resourceName,
+                       proto::Digest *digest)
+{
+    std::vector<std::string> parts;
+    size_t start = 0;
+    while (start <= resourceName.size()) {
+        const size_t end = std::min(resourceName.find('/', start),
+                                    resourceName.size());
+        parts.push_back(resourceName.substr(start, end - start));
+        start = end + 1;
+    }
+
+    for (size_t i = 0; i + 2 < parts.size(); ++i) {
+        if (parts[i] != "blobs") {
+            continue;
+        }
+        size_t hash = i + 1;
+        if (!isNumber(parts[hash + 1]) && hash + 2 < parts.size()) {
+            ++hash;
+        }
+        if (!isNumber(parts[hash + 1]) || parts[hash].empty()) {
+            return false;
+        }
+        digest->set_hash(parts[hash]);
+        digest->set_size_bytes(std::stoll(parts[hash + 1]));
+        return true;
+    }
+    return false;
+}
+
+class CasService final : public proto::ContentAddressableStorage::Service {
+  public:
+    explicit CasService(FileBackend *backend) : d_backend(backend) {}
+
+    grpc::Status
+    FindMissingBlobs(grpc::ServerContext *,
+                     const proto::FindMissingBlobsRequest *request,
+                     proto::FindMissingBlobsResponse *response) override
+    {
+        for (const proto::Digest &digest : request->blob_digests()) {
+            if (!d_backend->hasBlob(digest)) {
+                response->add_missing_blob_digests()->CopyFrom(digest);
+            }
+        }
+        return grpc::Status::OK;
+    }
+
+    grpc::Status
+    BatchUpdateBlobs(grpc::ServerContext *,
+                     const proto::BatchUpdateBlobsRequest *request,
+                     proto::BatchUpdateBlobsResponse *response) override
+    {
+        for (const auto &blob : request->requests()) {
+            auto *blobResponse = response->add_responses();
+            blobResponse->mutable_digest()->CopyFrom(blob.digest());
+            const grpc::Status status = handle([&] {
+                d_backend->writeBlob(blob.digest(), blob.data());
+                return grpc::Status::OK;
+            });
+            blobResponse->mutable_status()->set_code(status.error_code());
+            blobResponse->mutable_status()->set_message(
+                status.error_message());
+        }
+        return grpc::Status::OK;
+    }
+
+    grpc::Status
+    BatchReadBlobs(grpc::ServerContext *,
+                   const proto::BatchReadBlobsRequest *request,
+                   proto::BatchReadBlobsResponse *response) override
+    {
+        for (const proto::Digest &digest : request->digests()) {
+            auto *blobResponse = response->add_responses();
+            blobResponse->mutable_digest()->CopyFrom(digest);
+            const bool found =
+                d_backend->readBlob(digest, blobResponse->mutable_data());
+            blobResponse->mutable_status()->set_code(
+                found ? grpc::StatusCode::OK : grpc::StatusCode::NOT_FOUND);
+        }
+        return grpc::Status::OK;
+    }
+
+  private:
+    FileBackend *d_backend;
+};
+
+class ActionCacheService final : public proto::ActionCache::Service {
+  public:
+    explicit ActionCacheService(FileBackend *backend) : d_backend(backend)
+    {
+    }
+
+    grpc::Status GetActionResult(grpc::ServerContext *,
+                                 const proto::GetActionResultRequest *request,
+                                 proto::ActionResult *result) override
+    {
+        return handle([&] {
+            if (!d_backend->getActionResult(request->action_digest(),
+                                            result)) {
+                return grpc::Status(grpc::StatusCode::NOT_FOUND,
+                                    "Action result not found");
+            }
+            return grpc::Status::OK;
+        });
+    }
+
+    grpc::Status
+    UpdateActionCache(grpc::ServerContext *,
+                      const proto::UpdateActionCacheRequest *request,
+                      proto::ActionResult *result) override
+    {
+        return handle([&] {
+            d_backend->updateActionResult(request->action_digest(),
+                                          request->action_result());
+            result->CopyFrom(request->action_result());
+            return grpc::Status::OK;
+        });
+    }
+
+  private:
+    FileBackend *d_backend;
+};
+
+class CapabilitiesService final : public proto::Capabilities::Service {
+  public:
+    grpc::Status GetCapabilities(grpc::ServerContext *,
+                                 const proto::GetCapabilitiesRequest *,
+                                 proto::ServerCapabilities *response) override
+    {
+        auto *cache = response->mutable_cache_capabilities();
+        cache->add_digest_functions(
+            DigestGenerator::stringToDigestFunctionMap().at(
+                RECC_CAS_DIGEST_FUNCTION));
+        cache->mutable_action_cache_update_capabilities()->set_update_enabled(
+            true);
+        cache->set_max_batch_total_size_bytes(MAX_BATCH_SIZE);
+        response->mutable_low_api_version()->set_major(2);
+        response->mutable_high_api_version()->set_major(2);
+        response->mutable_high_api_version()->set_minor(2);
+        return grpc::Status::OK;
+    }
+};
+
+class ByteStreamService final
+    : public google::bytestream::ByteStream::Service {
+  public:
+    explicit ByteStreamService(FileBackend *backend) : d_backend(backend) {}
+
+    grpc::Status
+    Read(grpc::ServerContext *,
+         const google::bytestream::ReadRequest *request,
+         grpc::ServerWriter<google::bytestream::ReadResponse> *writer) override
+    {
+        proto::Digest digest;
+        if (!parseResourceName(request->resource_name(), &digest)) {
+            return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT,
+                                "Invalid resource name \"" +
+                                    request->resource_name() + "\"");
+        }
+        if (request->read_offset() < 0 || request->read_limit() < 0 ||
+            request->read_offset() > digest.size_bytes()) {
+            return grpc::Status(grpc::StatusCode::OUT_OF_RANGE,
+                                "Invalid read offset or limit");
+        }
+        const int fd = d_backend->openBlob(digest);
+        if (fd < 0) {
+            return grpc::Status(grpc::StatusCode::NOT_FOUND,
+                                "Blob " + proto::toString(digest) +
+                                    " not found");
+        }
+
+        int64_t offset = request->read_offset();
+        const int64_t end =
+            request->read_limit() > 0
+                ? std::min(digest.size_bytes(),
+                           offset + request->read_limit())
+                : digest.size_bytes();
+        google::bytestream::ReadResponse response;
+        while (offset < end) {
+            const size_t size = static_cast<size_t>(
+                std::min<int64_t>(end - offset, READ_CHUNK_SIZE));
+            std::string *data = response.mutable_data();
+            data->resize(size);
+            const ssize_t n = pread(fd, &(*data)[0], size, offset);
+            if (n <= 0) {
+                close(fd);
+                return grpc::Status(grpc::StatusCode::INTERNAL,
+                                    "Could not read blob " +
+                                        proto::toString(digest));
+            }
+            data->resize(static_cast<size_t>(n));
+            if (!writer->Write(response)) {
+                break;
+            }
+            offset += n;
+        }
+        close(fd);
+        return grpc::Status::OK;
+    }
+
+    grpc::Status
+    Write(grpc::ServerContext *,
+          grpc::ServerReader<google::bytestream::WriteRequest> *reader,
+          google::bytestream::WriteResponse *response) override
+    {
+        google::bytestream::WriteRequest request;
+        proto::Digest digest;
+        if (!reader->Read(&request) ||
+            !parseResourceName(request.resource_name(), &digest)) {
+            return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT,
+                                "Invalid resource name \"" +
+                                    request.resource_name() + "\"");
+        }
+
+        return handle([&] {
+            std::string path;
+            const int fd = d_backend->createTemporaryFile(&path);
+            int64_t committed = 0;
+            bool finished = false;
+            bool valid = true;
+            do {
+                valid = request.write_offset() == committed &&
+                        writeData(fd, request.data());
+                committed += static_cast<int64_t>(request.data().size());
+                finished = request.finish_write();
+            } while (valid && !finished && reader->Read(&request));
+
+            if (!valid || !finished) {
+                close(fd);
+                unlink(path.c_str());
+                return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT,
+                                    "Incomplete write of blob " +
+                                        proto::toString(digest));
+            }
+            try {
+                d_backend->commitBlob(digest, fd, path);
+            }
+            catch (...) {
+                close(fd);
+                throw;
+            }
+            close(fd);
+            response->set_committed_size(committed);
+            return grpc::Status::OK;
+        });
+    }
+
+  private:
+    static bool writeData(int fd, const std::string &data)
+    {
+        size_t written = 0;
+        while (written < data.size()) {
+            const ssize_t n =
+                write(fd, data.data() + written, data.size() - written);
+            if (n < 0 && errno != EINTR) {
+                return false;
+            }
+            written += static_cast<size_t>(std::max<ssize_t>(n, 0));
+        }
+        return true;
+    }
+
+    FileBackend *d_backend;
+};
+
+void removeSocketDirectory(const std::string &directory)
+{
+    unlink((directory + SOCKET_NAME).c_str());
+    rmdir(directory.c_str());
+}
+
+/**
+ * The servers started by `urlFor()`. They are never destroyed, as they
+ * may be used until the process exits: only their sockets are removed
+ * then.
+ */
+struct Registry {
+    std::mutex d_mutex;
+    pid_t d_pid = 0;
+    std::map<std::string, FileBackendServer *> d_servers;
+};
+
+Registry &registry()
+{
+    static Registry *registry = new Registry();
+    return *registry;
+}
+
+void removeRegisteredSockets()
+{
+    Registry &servers = registry();
+    const std::lock_guard<std::mutex> lock(servers.d_mutex);
+    // Those of the parent of a forked process are left to it
+    if (servers.d_pid != getpid()) {
+        return;
+    }
+    for (const auto &server : servers.d_servers) {
+        const std::string &url = server.second->url();
+        const std::string path = url.substr(url.find(':') + 1);
+        removeSocketDirectory(path.substr(0, path.rfind('/')));
+    }
+}
+
+} // namespace
+
+FileBackendServer::FileBackendServer(const std::string &root,
+                                     int64_t maxSize)
+    : d_backend(root, maxSize)
+{
+    const char *tmpdir = getenv("TMPDIR");
+    std::string pattern = std::string(tmpdir != nullptr && tmpdir[0] != '\0'
+                                          ? tmpdir
+                                          : "/tmp") +
+                          "/recc-file-backend-XXXXXX";
+    if (mkdtemp(&pattern[0]) == nullptr) {
+        throw std::system_error(errno, std::system_category(),
+                                "Could not create \"" + pattern + "\"");
+    }
+    d_directory = pattern;
+    d_url = "unix:" + d_directory + SOCKET_NAME;
+
+    d_services.emplace_back(new CasService(&d_backend));
+    d_services.emplace_back(new ActionCacheService(&d_backend));
+    d_services.emplace_back(new CapabilitiesService());
+    d_services.emplace_back(new ByteStreamService(&d_backend));
+
+    grpc::ServerBuilder builder;
+    builder.AddListeningPort(d_url, grpc::InsecureServerCredentials());
+    // Batches are bounded by the clients
+    builder.SetMaxReceiveMessageSize(-1);
+    for (const auto &service : d_services) {
+        builder.RegisterService(service.get());
+    }
+    d_server = builder.BuildAndStart();
+    if (d_server == nullptr) {
+        removeSocketDirectory(d_directory);
+        throw std::runtime_error("Could not serve \"" + root + "\" on \"" +
+                                 d_url + "\"");
+    }
+    BUILDBOX_LOG_DEBUG("Serving \"" << root << "\" on \"" << d_url << "\"");
+}
+
+FileBackendServer::~FileBackendServer()
+{
+    d_server->Shutdown();
+    removeSocketDirectory(d_directory);
+}
+
+std::string FileBackendServer::urlFor(const std::string &fileUrl,
+                                      int64_t maxSize)
+{
+    Registry &servers = registry();
+    const std::lock_guard<std::mutex> lock(servers.d_mutex);
+    if (servers.d_pid != getpid()) {
+        // The servers of the parent don't run in a forked process
+        if (servers.d_pid == 0) {
+            atexit(removeRegisteredSockets);
+        }
+        servers.d_pid = getpid();
+        servers.d_servers.clear();
+    }
+
+    FileBackendServer *&server = servers.d_servers[fileUrl];
+    if (server == nullptr) {
+        server =
+            new FileBackendServer(FileBackend::pathFromUrl(fileUrl), maxSize);
+    }
+    return server->url();
+}
+
+} // namespace recc
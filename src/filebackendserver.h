@@ -0,0 +1,77 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef INCLUDED_FILEBACKENDSERVER
+#define INCLUDED_FILEBACKENDSERVER
+
+#include <filebackend.h>
+#include <protos.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace recc {
+
+/**
+ * Serves a `FileBackend` from this process with the `ActionCache`,
+ * `ContentAddressableStorage`, `Capabilities` and `ByteStream` services,
+ * on a Unix socket in a new temporary directory, so that the clients used
+ * with remote servers work unchanged with a `file://` URL.
+ *
+ * Actions can't be executed, so the backend is only usable in cache-only
+ * mode. Instance names are ignored.
+ */
+class FileBackendServer {
+  public:
+    /**
+     * Starts serving the cache in `root`, with a maximum size of `maxSize`
+     * bytes.
+     *
+     * Throws `std::runtime_error` if the server can't be started.
+     */
+    FileBackendServer(const std::string &root, int64_t maxSize);
+
+    /**
+     * Stops the server and removes its socket.
+     */
+    ~FileBackendServer();
+
+    FileBackendServer(const FileBackendServer &) = delete;
+    FileBackendServer &operator=(const FileBackendServer &) = delete;
+
+    /**
+     * Returns the `unix:` URL of the server.
+     */
+    const std::string &url() const { return d_url; }
+
+    /**
+     * Returns the URL of the server of the cache at the `file://` URL
+     * `fileUrl`, starting it on first use in this process. It runs until
+     * the process exits.
+     */
+    static std::string urlFor(const std::string &fileUrl, int64_t maxSize);
+
+  private:
+    FileBackend d_backend;
+    std::vector<std::unique_ptr<grpc::Service>> d_services;
+    std::unique_ptr<grpc::Server> d_server;
+    std::string d_directory;
+    std::string d_url;
+};
+
+} // namespace recc
+
+#endif
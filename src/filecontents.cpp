@@ -0,0 +1,179 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <filecontents.h>
+
+#include <atomic>
+#include <cerrno>
+#include <sys/mman.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace recc {
+
+// Below this size, reading a file is cheaper than setting up a mapping
+const size_t FileContents::MIN_MAPPED_SIZE = 256 * 1024;
+
+// The default size of the batches of `BatchUpdateBlobs()` requests is 4 MiB
+const size_t FileContentsCache::MAX_FILE_SIZE = 2 * 1024 * 1024;
+
+namespace {
+
+std::atomic<int64_t> s_totalBytesRead(0);
+
+// Read up to `size` bytes at the start of `fd` into `buffer`, stopping only
+// at the end of the file. Returns the number of bytes read.
+size_t readFully(int fd, const std::string &path, char *buffer, size_t size)
+{
+    size_t offset = 0;
+    while (offset < size) {
+        const ssize_t bytesRead = pread(fd, buffer + offset, size - offset,
+                                        static_cast<off_t>(offset));
+        if (bytesRead < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytesRead < 0) {
+            throw std::system_error(errno, std::system_category(),
+                                    "Could not read \"" + path + "\"");
+        }
+        if (bytesRead == 0) {
+            break;
+        }
+        offset += static_cast<size_t>(bytesRead);
+    }
+    return offset;
+}
+
+int64_t modificationTimeNs(const struct stat &st)
+{
+#ifdef __APPLE__
+    const struct timespec &time = st.st_mtimespec;
+#else
+    const struct timespec &time = st.st_mtim;
+#endif
+    return static_cast<int64_t>(time.tv_sec) * 1000000000 + time.tv_nsec;
+}
+
+} // namespace
+
+FileContents::FileContents(int fd, const std::string &path,
+                           const struct stat &st, Ownership ownership)
+    : d_size(static_cast<size_t>(st.st_size)), d_device(st.st_dev),
+      d_inode(st.st_ino), d_mtimeNs(modificationTimeNs(st))
+{
+    if (ownership == OWNED && d_size >= MIN_MAPPED_SIZE) {
+        void *mapping = mmap(nullptr, d_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        // Accessing the mapping beyond the end of a truncated file would crash
+        struct stat mapped;
+        if (mapping != MAP_FAILED &&
+            (fstat(fd, &mapped) != 0 ||
+             static_cast<size_t>(mapped.st_size) != d_size)) {
+            munmap(mapping, d_size);
+            mapping = MAP_FAILED;
+        }
+        if (mapping != MAP_FAILED) {
+            // Hashing reads it once from start to end
+            madvise(mapping, d_size, MADV_SEQUENTIAL);
+            madvise(mapping, d_size, MADV_WILLNEED);
+            d_mapping = mapping;
+            d_data = static_cast<const char *>(mapping);
+            s_totalBytesRead += static_cast<int64_t>(d_size);
+            return;
+        }
+    }
+
+    d_buffer.resize(d_size);
+    // Shorter if truncated since it was stat'ed
+    d_buffer.resize(readFully(fd, path, &d_buffer[0], d_size));
+    d_data = d_buffer.data();
+    d_size = d_buffer.size();
+    s_totalBytesRead += static_cast<int64_t>(d_size);
+}
+
+FileContents::~FileContents()
+{
+    if (d_mapping != nullptr) {
+        munmap(d_mapping, d_size);
+    }
+}
+
+bool FileContents::isUnchanged(const std::string &path) const
+{
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && st.st_dev == d_device &&
+           st.st_ino == d_inode &&
+           static_cast<size_t>(st.st_size) == d_size &&
+           modificationTimeNs(st) == d_mtimeNs;
+}
+
+int64_t FileContents::totalBytesRead() { return s_totalBytesRead; }
+
+FileContentsCache &FileContentsCache::defaultCache()
+{
+    static FileContentsCache cache;
+    return cache;
+}
+
+void FileContentsCache::setCapacity(size_t capacity)
+{
+    const std::lock_guard<std::mutex> lock(d_mutex);
+    d_capacity = capacity;
+    if (capacity == 0) {
+        d_entries.clear();
+        d_size = 0;
+    }
+}
+
+void FileContentsCache::insert(
+    const std::string &path, const proto::Digest &digest,
+    const std::shared_ptr<const FileContents> &contents)
+{
+    if (contents->size() > MAX_FILE_SIZE) {
+        return;
+    }
+
+    const std::lock_guard<std::mutex> lock(d_mutex);
+    const auto it = d_entries.find(path);
+    const size_t replaced =
+        it != d_entries.end() ? it->second.second->size() : 0;
+    if (d_size - replaced + contents->size() > d_capacity) {
+        return;
+    }
+    d_entries[path] = Entry(digest, contents);
+    d_size = d_size - replaced + contents->size();
+}
+
+std::shared_ptr<const FileContents>
+FileContentsCache::find(const std::string &path,
+                        const proto::Digest &digest) const
+{
+    std::shared_ptr<const FileContents> contents;
+    {
+        const std::lock_guard<std::mutex> lock(d_mutex);
+        const auto it = d_entries.find(path);
+        if (it == d_entries.end() || it->second.first != digest) {
+            return nullptr;
+        }
+        contents = it->second.second;
+    }
+    return contents->isUnchanged(path) ? contents : nullptr;
+}
+
+size_t FileContentsCache::size() const
+{
+    const std::lock_guard<std::mutex> lock(d_mutex);
+    return d_size;
+}
+
+} // namespace recc
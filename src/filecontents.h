@@ -0,0 +1,146 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef INCLUDED_FILECONTENTS
+#define INCLUDED_FILECONTENTS
+
+#include <protos.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/stat.h>
+#include <utility>
+
+namespace recc {
+
+/**
+ * The contents of a regular file, read once. Files owned by recc that are
+ * at least `MIN_MAPPED_SIZE` large are memory-mapped for sequential
+ * access, others are read into memory.
+ *
+ * As with any mapping, truncating a mapped file while its contents are
+ * accessed makes the process crash, so files that others may modify, such
+ * as the inputs of a command, are never mapped.
+ */
+class FileContents {
+  public:
+    enum Ownership {
+        // May be modified by other processes while it is read
+        SHARED,
+        // Only modified by this process, such as its temporary files
+        OWNED
+    };
+
+    /**
+     * Reads the regular file open as `fd`, with the status `st`. Files that
+     * can't be mapped are read into memory instead.
+     *
+     * Throws `std::system_error` if it can't be read.
+     */
+    FileContents(int fd, const std::string &path, const struct stat &st,
+                 Ownership ownership = SHARED);
+
+    ~FileContents();
+
+    FileContents(const FileContents &) = delete;
+    FileContents &operator=(const FileContents &) = delete;
+
+    const char *data() const { return d_data; }
+    size_t size() const { return d_size; }
+    bool isMapped() const { return d_mapping != nullptr; }
+
+    /**
+     * Returns whether the file at `path` is still the one read, with the
+     * same size and modification time.
+     */
+    bool isUnchanged(const std::string &path) const;
+
+    /**
+     * Returns the number of bytes read or mapped by all instances so far.
+     */
+    static int64_t totalBytesRead();
+
+    static const size_t MIN_MAPPED_SIZE;
+
+  private:
+    std::string d_buffer;
+    void *d_mapping = nullptr;
+    const char *d_data;
+    size_t d_size;
+    dev_t d_device;
+    ino_t d_inode;
+    int64_t d_mtimeNs;
+};
+
+/**
+ * Keeps the contents of the files read to hash them, so that those which
+ * turn out to be missing from the CAS can be uploaded without reading them
+ * again.
+ *
+ * Nothing is kept until a capacity is set, and files larger than
+ * `MAX_FILE_SIZE` are never kept: they are uploaded in parts anyway.
+ *
+ * This class is thread-safe.
+ */
+class FileContentsCache {
+  public:
+    /**
+     * Returns the cache filled by `DigestGenerator::make_file_digests()`.
+     */
+    static FileContentsCache &defaultCache();
+
+    /**
+     * Sets the total size of the contents kept. Setting it to zero drops
+     * them and stops keeping new ones.
+     */
+    void setCapacity(size_t capacity);
+
+    /**
+     * Keeps `contents` as those of the file at `path`, with the given
+     * digest, if they fit.
+     */
+    void insert(const std::string &path, const proto::Digest &digest,
+                const std::shared_ptr<const FileContents> &contents);
+
+    /**
+     * Returns the contents of the file at `path` if they were kept with the
+     * given digest and the file is unchanged since, null otherwise.
+     */
+    std::shared_ptr<const FileContents>
+    find(const std::string &path, const proto::Digest &digest) const;
+
+    /**
+     * Returns the total size of the contents kept.
+     */
+    size_t size() const;
+
+    static const size_t MAX_FILE_SIZE;
+
+  private:
+    typedef std::pair<proto::Digest, std::shared_ptr<const FileContents>>
+        Entry;
+
+    mutable std::mutex d_mutex;
+    std::map<std::string, Entry> d_entries;
+    size_t d_capacity = 0;
+    size_t d_size = 0;
+};
+
+} // namespace recc
+
+#endif
@@ -0,0 +1,173 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <filedigestcache.h>
+
+#include <digestgenerator.h>
+#include <shareddigesttable.h>
+
+#include <buildboxcommon_logging.h>
+
+#include <algorithm>
+#include <chrono>
+#include <sys/stat.h>
+
+namespace recc {
+
+namespace {
+
+const uint8_t FLAG_EXECUTABLE = 1;
+
+// Files changed more recently than this are not stored. This covers
+// filesystems with timestamp granularities of up to two seconds.
+const int64_t MODIFICATION_WINDOW_NS = 2000000000;
+
+int64_t toNanoseconds(const struct timespec &time)
+{
+    return static_cast<int64_t>(time.tv_sec) * 1000000000 + time.tv_nsec;
+}
+
+FileDigestCache::Key keyFromStat(const struct stat &st)
+{
+    FileDigestCache::Key key;
+    key.d_device = static_cast<uint64_t>(st.st_dev);
+    key.d_inode = static_cast<uint64_t>(st.st_ino);
+    key.d_size = static_cast<uint64_t>(st.st_size);
+#ifdef __APPLE__
+    key.d_mtimeNs = toNanoseconds(st.st_mtimespec);
+    key.d_ctimeNs = toNanoseconds(st.st_ctimespec);
+#else
+    key.d_mtimeNs = toNanoseconds(st.st_mtim);
+    key.d_ctimeNs = toNanoseconds(st.st_ctim);
+#endif
+    return key;
+}
+
+bool operator==(const FileDigestCache::Key &a, const FileDigestCache::Key &b)
+{
+    return a.d_device == b.d_device && a.d_inode == b.d_inode &&
+           a.d_size == b.d_size && a.d_mtimeNs == b.d_mtimeNs &&
+           a.d_ctimeNs == b.d_ctimeNs;
+}
+
+SharedDigestTable::Key tableKey(const FileDigestCache::Key &key)
+{
+    // The device and inode identify a file, so a newer version of it
+    // replaces the older entry
+    return {{key.d_device, key.d_inode, key.d_size,
+             static_cast<uint64_t>(key.d_mtimeNs),
+             static_cast<uint64_t>(key.d_ctimeNs)}};
+}
+
+} // namespace
+
+FileDigestCache::FileDigestCache(const std::string &path, size_t numSlots)
+    : d_hits(0), d_misses(0)
+{
+    try {
+        d_table = std::make_unique<SharedDigestTable>(path, numSlots);
+    }
+    catch (const std::exception &e) {
+        BUILDBOX_LOG_WARNING("File digest cache disabled: " << e.what());
+    }
+}
+
+FileDigestCache::~FileDigestCache() {}
+
+bool FileDigestCache::lookup(const Key &key, proto::Digest *digest,
+                             bool *executable) const
+{
+    uint8_t flags = 0;
+    if (d_table == nullptr ||
+        !d_table->lookup(tableKey(key), digest, &flags)) {
+        return false;
+    }
+    *executable = (flags & FLAG_EXECUTABLE) != 0;
+    return true;
+}
+
+void FileDigestCache::store(const Key &key, const proto::Digest &digest,
+                            bool executable)
+{
+    if (d_table != nullptr) {
+        d_table->store(tableKey(key), digest,
+                       executable ? FLAG_EXECUTABLE : 0);
+    }
+}
+
+buildboxcommon::File FileDigestCache::getFile(const std::string &path)
+{
+    return getFiles({path}).front();
+}
+
+std::vector<buildboxcommon::File>
+FileDigestCache::getFiles(const std::vector<std::string> &paths)
+{
+    std::vector<buildboxcommon::File> files(paths.size());
+
+    // Indexes of the files to hash, and their keys. Only regular files
+    // have one.
+    std::vector<size_t> missed;
+    std::vector<std::string> missedPaths;
+    std::vector<Key> missedKeys;
+    std::vector<bool> hasKey;
+    for (size_t i = 0; i < paths.size(); ++i) {
+        struct stat before;
+        if (stat(paths[i].c_str(), &before) != 0 ||
+            !S_ISREG(before.st_mode)) {
+            missedKeys.push_back(Key());
+            hasKey.push_back(false);
+        }
+        else {
+            const Key key = keyFromStat(before);
+            if (lookup(key, &files[i].d_digest, &files[i].d_executable)) {
+                ++d_hits;
+                continue;
+            }
+            missedKeys.push_back(key);
+            hasKey.push_back(true);
+        }
+        ++d_misses;
+        missed.push_back(i);
+        missedPaths.push_back(paths[i]);
+    }
+    if (missed.empty()) {
+        return files;
+    }
+
+    const std::vector<buildboxcommon::File> hashed =
+        DigestGenerator::make_file_digests(missedPaths);
+
+    // Only store the digest if the file was not modified while it was being
+    // hashed, and not so recently that a further modification could leave
+    // its timestamps unchanged
+    const int64_t now =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch())
+            .count();
+    for (size_t j = 0; j < missed.size(); ++j) {
+        files[missed[j]] = hashed[j];
+        const Key &key = missedKeys[j];
+        struct stat after;
+        if (hasKey[j] && stat(missedPaths[j].c_str(), &after) == 0 &&
+            keyFromStat(after) == key &&
+            std::max(key.d_mtimeNs, key.d_ctimeNs) <
+                now - MODIFICATION_WINDOW_NS) {
+            store(key, hashed[j].d_digest, hashed[j].d_executable);
+        }
+    }
+    return files;
+}
+
+} // namespace recc
@@ -0,0 +1,115 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef INCLUDED_FILEDIGESTCACHE
+#define INCLUDED_FILEDIGESTCACHE
+
+#include <protos.h>
+#include <reccdefaults.h>
+
+#include <buildboxcommon_merklize.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace recc {
+
+class SharedDigestTable;
+
+/**
+ * Cache of file digests shared by all recc processes on a machine.
+ *
+ * The cache is a `SharedDigestTable` keyed by the device, inode, size,
+ * modification time and status change time of a file.
+ *
+ * Files modified shortly before they are hashed are not stored, as a later
+ * modification within the timestamp granularity of the filesystem would not
+ * change the key.
+ *
+ * This class is thread-safe.
+ */
+class FileDigestCache {
+  public:
+    struct Key {
+        uint64_t d_device;
+        uint64_t d_inode;
+        uint64_t d_size;
+        int64_t d_mtimeNs;
+        int64_t d_ctimeNs;
+    };
+
+    /**
+     * Opens the cache table at `path`, creating it with `numSlots` slots if
+     * it does not exist. If the table can't be used, a warning is logged and
+     * every lookup misses.
+     */
+    explicit FileDigestCache(
+        const std::string &path,
+        size_t numSlots = DEFAULT_RECC_FILE_DIGEST_CACHE_SLOTS);
+
+    ~FileDigestCache();
+
+    FileDigestCache(const FileDigestCache &) = delete;
+    FileDigestCache &operator=(const FileDigestCache &) = delete;
+
+    /**
+     * Returns the `File` for the given path (following symlinks), hashing
+     * it only if it is not in the cache.
+     *
+     * Throws `std::system_error` if the file can't be read.
+     */
+    buildboxcommon::File getFile(const std::string &path);
+
+    /**
+     * Returns the `File` for each of the given paths, in the same order.
+     * The files that are not in the cache are hashed together with
+     * `DigestGenerator::make_file_digests()`.
+     *
+     * Throws `std::system_error` if one of the files can't be read.
+     */
+    std::vector<buildboxcommon::File>
+    getFiles(const std::vector<std::string> &paths);
+
+    int64_t hits() const { return d_hits; }
+
+    int64_t misses() const { return d_misses; }
+
+  protected: // for unit testing
+    /**
+     * Looks up the entry with the given key, writing its contents to
+     * `digest` and `executable` on a hit.
+     */
+    bool lookup(const Key &key, proto::Digest *digest,
+                bool *executable) const;
+
+    /**
+     * Stores an entry, replacing any entry for the same file. Does nothing
+     * if the slot is being written by another process.
+     */
+    void store(const Key &key, const proto::Digest &digest, bool executable);
+
+  private:
+    // Null if the table can't be used
+    std::unique_ptr<SharedDigestTable> d_table;
+    std::atomic<int64_t> d_hits;
+    std::atomic<int64_t> d_misses;
+};
+
+} // namespace recc
+
+#endif
@@ -0,0 +1,161 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <filehashqueue.h>
+
+#include <digestgenerator.h>
+#include <filedigestcache.h>
+#include <threadpool.h>
+
+#include <algorithm>
+#include <exception>
+#include <thread>
+
+namespace recc {
+
+const size_t FileHashQueue::BATCH_SIZE = 8;
+
+namespace {
+
+void runPendingTasksWhile(ThreadPool *pool,
+                          const std::atomic<size_t> &pending, size_t limit)
+{
+    while (pending > limit) {
+        if (!pool->runPendingTask()) {
+            // The remaining tasks are running on other threads
+            std::this_thread::yield();
+        }
+    }
+}
+
+} // namespace
+
+FileHashQueue::FileHashQueue(ThreadPool *pool,
+                             FileDigestCache *fileDigestCache,
+                             size_t maxPending)
+    : d_pool(pool), d_fileDigestCache(fileDigestCache),
+      d_maxPending(maxPending > 0 ? maxPending : 1),
+      d_batchSize(std::min(BATCH_SIZE, d_maxPending)), d_pending(0),
+      d_activeBatches(0), d_busyTime(0)
+{
+}
+
+FileHashQueue::~FileHashQueue()
+{
+    // Tasks refer to this object
+    runPendingTasksWhile(d_pool, d_pending, 0);
+}
+
+void FileHashQueue::push(const std::string &path)
+{
+    if (d_files.count(path)) {
+        return;
+    }
+
+    if (d_batch == nullptr) {
+        d_batch.reset(new Batch());
+    }
+    d_batch->d_paths.push_back(path);
+    d_batch->d_files.emplace_back();
+    d_files.emplace(path, d_batch->d_files.back().get_future().share());
+
+    if (d_batch->d_paths.size() >= d_batchSize) {
+        runPendingTasksWhile(d_pool, d_pending,
+                             d_maxPending - d_batch->d_paths.size());
+        submitBatch();
+    }
+}
+
+void FileHashQueue::submitBatch()
+{
+    std::shared_ptr<Batch> batch(std::move(d_batch));
+    d_pending += batch->d_paths.size();
+    d_pool->submit([this, batch]() {
+        {
+            std::lock_guard<std::mutex> lock(d_busyMutex);
+            if (d_activeBatches++ == 0) {
+                d_busySince = std::chrono::steady_clock::now();
+            }
+        }
+        hashBatch(batch.get());
+        {
+            std::lock_guard<std::mutex> lock(d_busyMutex);
+            if (--d_activeBatches == 0) {
+                d_busyTime +=
+                    std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::steady_clock::now() - d_busySince);
+            }
+        }
+        d_pending -= batch->d_paths.size();
+    });
+}
+
+void FileHashQueue::hashBatch(Batch *batch)
+{
+    const auto &paths = batch->d_paths;
+    try {
+        const std::vector<buildboxcommon::File> files =
+            d_fileDigestCache != nullptr
+                ? d_fileDigestCache->getFiles(paths)
+                : DigestGenerator::make_file_digests(paths);
+        for (size_t i = 0; i < files.size(); ++i) {
+            batch->d_files[i].set_value(files[i]);
+        }
+        return;
+    }
+    catch (...) {
+        // Hash the files one at a time to find the ones that failed
+    }
+
+    for (size_t i = 0; i < paths.size(); ++i) {
+        try {
+            batch->d_files[i].set_value(
+                d_fileDigestCache != nullptr
+                    ? d_fileDigestCache->getFile(paths[i])
+                    : DigestGenerator::make_file_digest(paths[i]));
+        }
+        catch (...) {
+            batch->d_files[i].set_exception(std::current_exception());
+        }
+    }
+}
+
+bool FileHashQueue::take(const std::string &path, buildboxcommon::File *file)
+{
+    const auto it = d_files.find(path);
+    if (it == d_files.end()) {
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(d_batchMutex);
+        if (d_batch != nullptr) {
+            submitBatch();
+        }
+    }
+    *file = d_pool->wait(it->second);
+    return true;
+}
+
+std::chrono::microseconds FileHashQueue::busyTime() const
+{
+    std::lock_guard<std::mutex> lock(d_busyMutex);
+    if (d_activeBatches == 0) {
+        return d_busyTime;
+    }
+    return d_busyTime +
+           std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now() - d_busySince);
+}
+
+} // namespace recc
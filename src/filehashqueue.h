@@ -0,0 +1,123 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef INCLUDED_FILEHASHQUEUE
+#define INCLUDED_FILEHASHQUEUE
+
+#include <buildboxcommon_merklize.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace recc {
+
+class FileDigestCache;
+class ThreadPool;
+
+/**
+ * Hashes files in a `ThreadPool` as soon as their paths are known, so that
+ * hashing overlaps with whatever produces the paths (e.g. the dependency
+ * command), and hands out the results later.
+ *
+ * Files are hashed in batches of up to `BATCH_SIZE`, one task per batch, so
+ * that small files can be hashed together by
+ * `DigestGenerator::make_file_digests()`. The last, partial batch is
+ * scheduled by the first `take()`.
+ *
+ * The number of files being hashed is bounded: once `maxPending` files are
+ * queued, `push()` runs pending tasks on the calling thread until some
+ * complete.
+ *
+ * `push()` must not be called concurrently with any other method. `take()`
+ * can be called concurrently for different paths.
+ */
+class FileHashQueue {
+  public:
+    FileHashQueue(ThreadPool *pool, FileDigestCache *fileDigestCache,
+                  size_t maxPending);
+
+    /**
+     * Waits for the files being hashed.
+     */
+    ~FileHashQueue();
+
+    FileHashQueue(const FileHashQueue &) = delete;
+    FileHashQueue &operator=(const FileHashQueue &) = delete;
+
+    /**
+     * Schedules hashing the file at `path` (following symlinks), unless it
+     * was already pushed.
+     */
+    void push(const std::string &path);
+
+    /**
+     * If `path` was pushed, waits for it to be hashed, writes the result to
+     * `file` and returns `true`. Rethrows the error if the file couldn't be
+     * hashed. A path can be taken several times.
+     */
+    bool take(const std::string &path, buildboxcommon::File *file);
+
+    /**
+     * Returns the wall time so far during which files were being hashed by
+     * at least one thread.
+     */
+    std::chrono::microseconds busyTime() const;
+
+    static const size_t BATCH_SIZE;
+
+  private:
+    struct Batch {
+        std::vector<std::string> d_paths;
+        std::vector<std::promise<buildboxcommon::File>> d_files;
+    };
+
+    /**
+     * Schedules hashing the files of the current batch.
+     */
+    void submitBatch();
+
+    /**
+     * Hashes the files of `batch`, setting the result of each.
+     */
+    void hashBatch(Batch *batch);
+
+    ThreadPool *d_pool;
+    FileDigestCache *d_fileDigestCache;
+    size_t d_maxPending;
+    size_t d_batchSize;
+    std::unordered_map<std::string, std::shared_future<buildboxcommon::File>>
+        d_files;
+    // Files pushed but not scheduled yet
+    std::unique_ptr<Batch> d_batch;
+    std::mutex d_batchMutex;
+    std::atomic<size_t> d_pending;
+    // Batches being hashed, since when there have been some, and the busy
+    // time accumulated before that
+    mutable std::mutex d_busyMutex;
+    size_t d_activeBatches;
+    std::chrono::steady_clock::time_point d_busySince;
+    std::chrono::microseconds d_busyTime;
+};
+
+} // namespace recc
+
+#endif
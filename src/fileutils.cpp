@@ -17,6 +17,7 @@
 #include <buildboxcommon_fileutils.h>
 #include <buildboxcommon_logging.h>
 
+#include <cstdlib>
 #include <cstring>
 #include <env.h>
 #include <fstream>
@@ -284,4 +285,36 @@ FileUtils::rewritePathToRelative(const std::string &path,
     return modifiedPath;
 }
 
+std::string FileUtils::resolveExecutable(const std::string &program)
+{
+    if (program.find('/') != std::string::npos) {
+        return program;
+    }
+
+    const char *pathVar = getenv("PATH");
+    std::istringstream pathStream(pathVar != nullptr ? pathVar : "");
+    std::string directory;
+    while (std::getline(pathStream, directory, ':')) {
+        const std::string candidate =
+            (directory.empty() ? "." : directory) + "/" + program;
+        if (access(candidate.c_str(), X_OK) == 0) {
+            return candidate;
+        }
+    }
+    return program;
+}
+
+std::string FileUtils::executableIdentity(const std::string &program)
+{
+    const std::string path = resolveExecutable(program);
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        return path;
+    }
+    std::ostringstream identity;
+    identity << path << ":" << st.st_size << ":" << st.st_ino << ":"
+             << st.st_mtime;
+    return identity.str();
+}
+
 } // namespace recc
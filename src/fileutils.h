@@ -121,6 +121,20 @@ struct FileUtils {
     static std::string
     rewritePathToRelative(const std::string &path,
                           const std::string &workingDirectory);
+
+    /**
+     * Return the path of the executable that will be run for `program`,
+     * using the same lookup as `execvp()`. If it cannot be found in `PATH`,
+     * `program` is returned unmodified.
+     */
+    static std::string resolveExecutable(const std::string &program);
+
+    /**
+     * Identify the executable that will be run for `program` by its path,
+     * size, inode and modification time, which is cheap to compute and
+     * changes when it is upgraded.
+     */
+    static std::string executableIdentity(const std::string &program);
 };
 
 } // namespace recc
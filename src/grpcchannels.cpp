@@ -14,9 +14,12 @@
 //
 
 #include <env.h>
+#include <filebackend.h>
+#include <filebackendserver.h>
 #include <grpcchannels.h>
 
 #include <sstream>
+#include <stdexcept>
 #include <string>
 
 namespace recc {
@@ -25,9 +28,30 @@ GrpcChannels GrpcChannels::get_channels_from_config()
 {
     buildboxcommon::ConnectionOptions options[3];
 
-    options[0].setUrl(RECC_SERVER);
-    options[1].setUrl(RECC_CAS_SERVER);
-    options[2].setUrl(RECC_ACTION_CACHE_SERVER);
+    // Cache directories are served from this process: they can't execute
+    // actions, and remote workers can't read the inputs stored in them
+    if (!RECC_CACHE_ONLY) {
+        for (const std::string *url :
+             {&RECC_SERVER, &RECC_CAS_SERVER, &RECC_ACTION_CACHE_SERVER}) {
+            if (FileBackend::isFileUrl(*url)) {
+                throw std::runtime_error("\"" + *url +
+                                         "\" can only be used in "
+                                         "cache-only mode");
+            }
+        }
+    }
+    const auto serverUrl = [](const std::string &url) {
+        if (!FileBackend::isFileUrl(url)) {
+            return url;
+        }
+        return FileBackendServer::urlFor(
+            url, static_cast<int64_t>(RECC_FILE_CACHE_MAX_SIZE_MB) * 1024 *
+                     1024);
+    };
+
+    options[0].setUrl(serverUrl(RECC_SERVER));
+    options[1].setUrl(serverUrl(RECC_CAS_SERVER));
+    options[2].setUrl(serverUrl(RECC_ACTION_CACHE_SERVER));
 
     for (auto &option : options) {
         const std::string retryLimitStr = std::to_string(RECC_RETRY_LIMIT);
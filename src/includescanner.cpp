@@ -0,0 +1,957 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <includescanner.h>
+
+#include <cachekey.h>
+#include <compilerdefaults.h>
+#include <deps.h>
+#include <digestgenerator.h>
+#include <env.h>
+#include <fileutils.h>
+#include <subprocess.h>
+
+#include <buildboxcommon_exception.h>
+#include <buildboxcommon_fileutils.h>
+#include <buildboxcommon_logging.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+
+namespace recc {
+
+namespace {
+
+const std::string SEARCH_PATH_HEADER = "recc-include-paths 1";
+
+// Environment variables that the compiler uses to extend its search path
+const std::vector<std::string> SEARCH_PATH_ENVIRONMENT = {
+    "CPATH",           "C_INCLUDE_PATH", "CPLUS_INCLUDE_PATH",
+    "GCC_EXEC_PREFIX", "COMPILER_PATH",  "SDKROOT"};
+
+// Options whose effect on the set of files read by the compiler isn't
+// modelled by the scanner
+const std::vector<std::string> UNSUPPORTED_OPTION_PREFIXES = {
+    "@",           "-F",
+    "-iframework", "-fmodule",
+    "-fprebuilt-module", "-fimplicit-module",
+    "-ivfsoverlay", "-include-pch",
+    "--include",   "--imacros",
+    "--embed-dir"};
+
+bool startsWith(const std::string &value, const std::string &prefix)
+{
+    return value.compare(0, prefix.size(), prefix) == 0;
+}
+
+bool isIdentifierCharacter(char c)
+{
+    return isalnum(static_cast<unsigned char>(c)) || c == '_';
+}
+
+/**
+ * Joins a directory and a file name the way the compiler does, so that the
+ * resulting paths match the ones it reports.
+ */
+std::string joinPath(const std::string &directory, const std::string &name)
+{
+    if (directory.empty() || (!name.empty() && name[0] == '/')) {
+        return name;
+    }
+    if (directory.back() == '/') {
+        return directory + name;
+    }
+    return directory + "/" + name;
+}
+
+std::string directoryOf(const std::string &path)
+{
+    const auto slash = path.rfind('/');
+    if (slash == std::string::npos) {
+        return "";
+    }
+    return slash == 0 ? "/" : path.substr(0, slash);
+}
+
+/**
+ * Returns the length of the line splice (backslash-newline) at `pos`, or 0
+ * if there is none.
+ */
+size_t spliceLength(const std::string &source, size_t pos)
+{
+    if (source[pos] != '\\') {
+        return 0;
+    }
+    size_t next = pos + 1;
+    if (next < source.size() && source[next] == '\r') {
+        ++next;
+    }
+    return (next < source.size() && source[next] == '\n') ? next + 1 - pos
+                                                          : 0;
+}
+
+size_t skipBlockComment(const std::string &source, size_t pos)
+{
+    const auto end = source.find("*/", pos + 2);
+    return (end == std::string::npos) ? source.size() : end + 2;
+}
+
+/**
+ * Returns the position of the newline ending the line comment at `pos`.
+ */
+size_t skipLineComment(const std::string &source, size_t pos)
+{
+    while (true) {
+        const auto newline = source.find('\n', pos);
+        if (newline == std::string::npos) {
+            return source.size();
+        }
+        size_t last = newline;
+        if (last > pos && source[last - 1] == '\r') {
+            --last;
+        }
+        if (last == pos || source[last - 1] != '\\') {
+            return newline;
+        }
+        pos = newline + 1;
+    }
+}
+
+/**
+ * Skips the string or character literal starting at `pos`, stopping at the
+ * end of the line if it is unterminated. If `out` is set, the literal is
+ * appended to it.
+ */
+size_t skipLiteral(const std::string &source, size_t pos, std::string *out)
+{
+    const char quote = source[pos];
+    size_t end = pos + 1;
+    while (end < source.size() && source[end] != quote &&
+           source[end] != '\n') {
+        end += (source[end] == '\\') ? 2 : 1;
+    }
+    end = std::min(end + 1, source.size());
+    if (out != nullptr) {
+        out->append(source, pos, end - pos);
+    }
+    return end;
+}
+
+bool isRawStringPrefix(const std::string &identifier)
+{
+    return identifier == "R" || identifier == "u8R" || identifier == "uR" ||
+           identifier == "UR" || identifier == "LR";
+}
+
+/**
+ * Skips the raw string literal whose opening quote is at `pos`.
+ */
+size_t skipRawString(const std::string &source, size_t pos)
+{
+    const auto open = source.find('(', pos + 1);
+    if (open == std::string::npos || open - pos - 1 > 16) {
+        return pos + 1;
+    }
+    const std::string delimiter = source.substr(pos + 1, open - pos - 1);
+    if (delimiter.find_first_of(" \\\t\n\"") != std::string::npos) {
+        return pos + 1;
+    }
+    const auto end = source.find(")" + delimiter + "\"", open + 1);
+    return (end == std::string::npos) ? source.size()
+                                      : end + delimiter.size() + 2;
+}
+
+/**
+ * Reads the directive starting at `pos` (after the '#') up to the end of
+ * its logical line into `line`, removing line splices and comments. Returns
+ * the position of the terminating newline.
+ */
+size_t readDirective(const std::string &source, size_t pos, std::string *line)
+{
+    while (pos < source.size() && source[pos] != '\n') {
+        const char c = source[pos];
+        const char next = (pos + 1 < source.size()) ? source[pos + 1] : '\0';
+        if (const size_t splice = spliceLength(source, pos)) {
+            pos += splice;
+        }
+        else if (c == '/' && next == '*') {
+            pos = skipBlockComment(source, pos);
+            line->push_back(' ');
+        }
+        else if (c == '/' && next == '/') {
+            return skipLineComment(source, pos);
+        }
+        else if (c == '"' || c == '\'') {
+            pos = skipLiteral(source, pos, line);
+        }
+        else {
+            line->push_back(c);
+            ++pos;
+        }
+    }
+    return pos;
+}
+
+/**
+ * Skips whitespace and block comments in a directive starting at `pos`.
+ * Returns the length of `line` if the rest of it is a line comment.
+ */
+size_t skipWhitespace(const std::string &line, size_t pos)
+{
+    while (pos < line.size()) {
+        if (line[pos] == ' ' || line[pos] == '\t' || line[pos] == '\r' ||
+            line[pos] == '\f' || line[pos] == '\v') {
+            ++pos;
+        }
+        else if (line.compare(pos, 2, "/*") == 0) {
+            const auto end = line.find("*/", pos + 2);
+            pos = (end == std::string::npos) ? line.size() : end + 2;
+        }
+        else if (line.compare(pos, 2, "//") == 0) {
+            return line.size();
+        }
+        else {
+            break;
+        }
+    }
+    return pos;
+}
+
+/**
+ * Parses a header name ("name" or <name>) starting at `pos`. Returns false
+ * if there is none.
+ */
+bool parseHeaderName(const std::string &line, size_t pos, bool *angled,
+                     std::string *name)
+{
+    if (pos >= line.size() || (line[pos] != '<' && line[pos] != '"')) {
+        return false;
+    }
+    *angled = (line[pos] == '<');
+    const auto end = line.find(*angled ? '>' : '"', pos + 1);
+    if (end == std::string::npos) {
+        return false;
+    }
+    *name = line.substr(pos + 1, end - pos - 1);
+    return true;
+}
+
+/**
+ * Records the uses of `__has_include()` in the expression of an `#if`,
+ * `#elif` or `#define` directive.
+ */
+void parseHasInclude(const std::string &line, size_t pos,
+                     std::vector<IncludeScanner::Directive> *result)
+{
+    while (pos < line.size()) {
+        const char c = line[pos];
+        if (c == '"' || c == '\'') {
+            // Skip string and character literals
+            ++pos;
+            while (pos < line.size() && line[pos] != c) {
+                pos += (line[pos] == '\\') ? 2 : 1;
+            }
+            ++pos;
+            continue;
+        }
+        if (!isIdentifierCharacter(c)) {
+            ++pos;
+            continue;
+        }
+
+        const size_t start = pos;
+        while (pos < line.size() && isIdentifierCharacter(line[pos])) {
+            ++pos;
+        }
+        const std::string identifier = line.substr(start, pos - start);
+        IncludeScanner::Directive::Kind kind;
+        if (identifier == "__has_include" ||
+            identifier == "__has_include__" || identifier == "__has_embed") {
+            kind = IncludeScanner::Directive::HasInclude;
+        }
+        else if (identifier == "__has_include_next" ||
+                 identifier == "__has_include_next__") {
+            kind = IncludeScanner::Directive::HasIncludeNext;
+        }
+        else {
+            continue;
+        }
+
+        // Only an invocation reads the file system (`defined(...)` and
+        // aliases like `#define has_include __has_include` don't)
+        size_t argument = skipWhitespace(line, pos);
+        if (argument >= line.size() || line[argument] != '(') {
+            continue;
+        }
+        if (identifier == "__has_embed") {
+            throw IncludeScanner::unsupported_error(
+                "__has_embed is not supported");
+        }
+
+        argument = skipWhitespace(line, argument + 1);
+        IncludeScanner::Directive directive;
+        directive.d_kind = kind;
+        if (!parseHeaderName(line, argument, &directive.d_angled,
+                             &directive.d_name)) {
+            throw IncludeScanner::unsupported_error(
+                identifier + " without a literal header name: " + line);
+        }
+        result->push_back(directive);
+    }
+}
+
+/**
+ * Parses a single (logical) preprocessor directive line, excluding the
+ * leading '#'.
+ */
+void parseDirective(const std::string &line,
+                    std::vector<IncludeScanner::Directive> *result)
+{
+    size_t pos = skipWhitespace(line, 0);
+    const size_t start = pos;
+    while (pos < line.size() && isIdentifierCharacter(line[pos])) {
+        ++pos;
+    }
+    const std::string name = line.substr(start, pos - start);
+
+    if (name == "include" || name == "include_next" || name == "import") {
+        pos = skipWhitespace(line, pos);
+        if (pos >= line.size()) {
+            return;
+        }
+
+        IncludeScanner::Directive directive;
+        directive.d_kind = (name == "include_next")
+                               ? IncludeScanner::Directive::IncludeNext
+                               : IncludeScanner::Directive::Include;
+        if (!parseHeaderName(line, pos, &directive.d_angled,
+                             &directive.d_name)) {
+            throw IncludeScanner::unsupported_error("Computed include: #" +
+                                                    line);
+        }
+        result->push_back(directive);
+    }
+    else if (name == "embed") {
+        throw IncludeScanner::unsupported_error("#embed is not supported");
+    }
+    else if (name == "if" || name == "elif" || name == "define") {
+        parseHasInclude(line, pos, result);
+    }
+}
+
+/**
+ * Returns the contents of the directory, or a null pointer if it can't be
+ * listed.
+ */
+std::unique_ptr<std::unordered_set<std::string>>
+listDirectory(const std::string &directory)
+{
+    DIR *dir = opendir(directory.empty() ? "." : directory.c_str());
+    if (dir == nullptr) {
+        return nullptr;
+    }
+    auto listing = std::make_unique<std::unordered_set<std::string>>();
+    while (const struct dirent *entry = readdir(dir)) {
+        listing->emplace(entry->d_name);
+    }
+    closedir(dir);
+    return listing;
+}
+
+/**
+ * Returns the language used to determine the search path for an input
+ * file, or an empty string if it isn't supported.
+ */
+std::string languageOf(const std::string &file, const std::string &compiler)
+{
+    const bool isCxxCompiler =
+        (compiler == "g++" || compiler == "c++" || compiler == "clang++");
+    const auto dot = file.rfind('.');
+    const std::string suffix =
+        (dot == std::string::npos) ? "" : file.substr(dot + 1);
+    if (suffix == "c" || suffix == "h") {
+        return isCxxCompiler ? "c++" : "c";
+    }
+    if (Deps::is_source_file(file) || Deps::is_header_file(file)) {
+        return "c++";
+    }
+    return "";
+}
+
+void checkSupportedOption(const std::string &option, bool isClang)
+{
+    for (const auto &prefix : UNSUPPORTED_OPTION_PREFIXES) {
+        if (startsWith(option, prefix)) {
+            throw IncludeScanner::unsupported_error("Unsupported option " +
+                                                    option);
+        }
+    }
+    // "-I-" changes the meaning of the search path
+    // and clang reads sanitizer ignore lists
+    if (option == "-I-" || (isClang && startsWith(option, "-fsanitize"))) {
+        throw IncludeScanner::unsupported_error("Unsupported option " +
+                                                option);
+    }
+}
+
+} // namespace
+
+IncludeScanner::IncludeScanner(const std::string &cacheDirectory)
+    : d_cacheDirectory(cacheDirectory)
+{
+}
+
+bool IncludeScanner::isSupported(const ParsedCommand &command)
+{
+    return command.is_compiler_command() &&
+           (command.is_gcc() || command.is_clang()) && !command.is_AIX() &&
+           !command.produces_sun_make_rules();
+}
+
+std::set<std::string> IncludeScanner::scan(const ParsedCommand &command)
+{
+    const std::vector<std::string> dependenciesCommand =
+        command.get_dependencies_command();
+    if (dependenciesCommand.empty() || command.d_inputFiles.empty()) {
+        throw unsupported_error("No input files");
+    }
+
+    // Strip the options that make the compiler print dependencies
+    const std::vector<std::string> &defaultDeps = command.d_defaultDepsCommand;
+    size_t end = dependenciesCommand.size();
+    if (end > defaultDeps.size() &&
+        std::equal(defaultDeps.begin(), defaultDeps.end(),
+                   dependenciesCommand.end() -
+                       static_cast<std::ptrdiff_t>(defaultDeps.size()))) {
+        end -= defaultDeps.size();
+    }
+
+    // The command used to obtain the search path omits the input files and
+    // the options that don't affect it, so that it can be shared between
+    // compile commands.
+    const std::set<std::string> inputFiles(command.d_inputFiles.begin(),
+                                           command.d_inputFiles.end());
+    std::vector<std::string> probeCommand = {dependenciesCommand[0]};
+    std::vector<Directive> commandLineIncludes;
+    std::string language;
+    // gcc implicitly includes <stdc-predef.h> if it exists
+    bool implicitPredefines = command.is_gcc();
+    for (size_t i = 1; i < end; ++i) {
+        const std::string &argument = dependenciesCommand[i];
+        if (inputFiles.count(argument)) {
+            continue;
+        }
+        checkSupportedOption(argument, command.is_clang());
+
+        if (argument == "-include" || argument == "-imacros") {
+            if (++i >= end) {
+                throw unsupported_error("Missing argument to " + argument);
+            }
+            commandLineIncludes.push_back(
+                {Directive::Include, false, dependenciesCommand[i]});
+        }
+        else if (startsWith(argument, "-include") ||
+                 startsWith(argument, "-imacros")) {
+            commandLineIncludes.push_back(
+                {Directive::Include, false, argument.substr(8)});
+        }
+        else if (argument == "-Xpreprocessor" || argument == "-Xclang") {
+            if (++i >= end) {
+                throw unsupported_error("Missing argument to " + argument);
+            }
+            const std::string &value = dependenciesCommand[i];
+            checkSupportedOption(value, command.is_clang());
+            if (startsWith(value, "-include") ||
+                startsWith(value, "-imacros")) {
+                throw unsupported_error("Unsupported option " + argument +
+                                        " " + value);
+            }
+            probeCommand.push_back(argument);
+            probeCommand.push_back(value);
+        }
+        else if (argument == "-D" || argument == "-U") {
+            ++i;
+        }
+        else if (startsWith(argument, "-D") || startsWith(argument, "-U") ||
+                 startsWith(argument, "-W") || startsWith(argument, "-O") ||
+                 startsWith(argument, "-g") || argument == "-c") {
+            // Doesn't affect the search path
+        }
+        else {
+            if (argument == "-x" && i + 1 < end) {
+                language = dependenciesCommand[i + 1];
+            }
+            else if (startsWith(argument, "-x") && argument.size() > 2) {
+                language = argument.substr(2);
+            }
+            else if (argument == "-nostdinc" || argument == "-ffreestanding") {
+                implicitPredefines = false;
+            }
+            probeCommand.push_back(argument);
+        }
+    }
+
+    std::string probeLanguage;
+    if (!language.empty()) {
+        if (SupportedCompilers::GccSupportedLanguages.count(language) == 0) {
+            throw unsupported_error("Unsupported language " + language);
+        }
+        probeLanguage =
+            (language == "c" || language == "c-header") ? "c" : "c++";
+    }
+    else {
+        for (const auto &inputFile : command.d_inputFiles) {
+            const std::string fileLanguage =
+                languageOf(inputFile, command.get_compiler());
+            if (fileLanguage.empty() ||
+                (!probeLanguage.empty() && fileLanguage != probeLanguage)) {
+                throw unsupported_error("Unsupported input file " +
+                                        inputFile);
+            }
+            probeLanguage = fileLanguage;
+        }
+    }
+    probeCommand.insert(probeCommand.end(),
+                        {"-E", "-v", "-x", probeLanguage, "/dev/null"});
+
+    const SearchPath searchPath = getSearchPath(probeCommand);
+    if (searchPath.d_hasFrameworks) {
+        throw unsupported_error("Framework directories are not supported");
+    }
+
+    if (implicitPredefines) {
+        commandLineIncludes.push_back(
+            {Directive::Include, true, "stdc-predef.h"});
+    }
+
+    std::set<std::string> result =
+        scanFiles(command.d_inputFiles, commandLineIncludes, searchPath);
+
+    if (RECC_DEPS_GLOBAL_PATHS && command.is_clang() &&
+        !searchPath.d_crtbegin.empty()) {
+        // See `Deps::get_file_info()`
+        result.insert(searchPath.d_crtbegin);
+    }
+    return result;
+}
+
+std::vector<IncludeScanner::Directive>
+IncludeScanner::parseDirectives(const std::string &source)
+{
+    std::vector<Directive> result;
+    const size_t size = source.size();
+
+    // Comments and literals are skipped so that text in them isn't mistaken
+    // for a directive
+    bool atLineStart = true;
+    size_t pos = 0;
+    while (pos < size) {
+        const char c = source[pos];
+        const char next = (pos + 1 < size) ? source[pos + 1] : '\0';
+        if (c == '\n') {
+            atLineStart = true;
+            ++pos;
+        }
+        else if (c == ' ' || c == '\t' || c == '\r' || c == '\f' ||
+                 c == '\v') {
+            ++pos;
+        }
+        else if (const size_t splice = spliceLength(source, pos)) {
+            pos += splice;
+        }
+        else if (c == '/' && next == '*') {
+            pos = skipBlockComment(source, pos);
+        }
+        else if (c == '/' && next == '/') {
+            pos = skipLineComment(source, pos);
+        }
+        else if (c == '#' && atLineStart) {
+            std::string line;
+            pos = readDirective(source, pos + 1, &line);
+            parseDirective(line, &result);
+        }
+        else if (c == '"' || c == '\'') {
+            atLineStart = false;
+            pos = skipLiteral(source, pos, nullptr);
+        }
+        else if (isIdentifierCharacter(c)) {
+            atLineStart = false;
+            const size_t start = pos;
+            while (pos < size && isIdentifierCharacter(source[pos])) {
+                ++pos;
+            }
+            if (pos < size && source[pos] == '"' &&
+                isRawStringPrefix(source.substr(start, pos - start))) {
+                pos = skipRawString(source, pos);
+            }
+        }
+        else {
+            atLineStart = false;
+            ++pos;
+        }
+    }
+    return result;
+}
+
+IncludeScanner::SearchPath
+IncludeScanner::parseSearchPath(const std::string &compilerOutput)
+{
+    SearchPath result;
+    enum { Other, Quote, Bracket } section = Other;
+
+    const std::string missingPrefix = "ignoring nonexistent directory \"";
+    std::istringstream lines(compilerOutput);
+    std::string line;
+    while (std::getline(lines, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+
+        if (startsWith(line, "#include \"...\" search starts here")) {
+            section = Quote;
+        }
+        else if (startsWith(line, "#include <...> search starts here")) {
+            section = Bracket;
+            result.d_bracketStart = result.d_directories.size();
+        }
+        else if (startsWith(line, "End of search list")) {
+            section = Other;
+        }
+        else if (section != Other && startsWith(line, " ")) {
+            std::string directory = line.substr(1);
+            const std::string framework = " (framework directory)";
+            if (directory.size() > framework.size() &&
+                directory.compare(directory.size() - framework.size(),
+                                  framework.size(), framework) == 0) {
+                result.d_hasFrameworks = true;
+                continue;
+            }
+            result.d_directories.push_back(directory);
+        }
+        else if (startsWith(line, missingPrefix) && line.back() == '"') {
+            result.d_missingDirectories.push_back(line.substr(
+                missingPrefix.size(),
+                line.size() - missingPrefix.size() - 1));
+        }
+    }
+
+    if (compilerOutput.find("Selected GCC installation") !=
+        std::string::npos) {
+        result.d_crtbegin = Deps::crtbegin_from_clang_v(compilerOutput);
+    }
+    return result;
+}
+
+std::string IncludeScanner::serializeSearchPath(const SearchPath &searchPath)
+{
+    std::ostringstream out;
+    out << SEARCH_PATH_HEADER << "\n";
+    for (size_t i = 0; i < searchPath.d_directories.size(); ++i) {
+        out << (i < searchPath.d_bracketStart ? "quote " : "bracket ")
+            << searchPath.d_directories[i] << "\n";
+    }
+    for (const auto &directory : searchPath.d_missingDirectories) {
+        out << "missing " << directory << "\n";
+    }
+    if (searchPath.d_hasFrameworks) {
+        out << "frameworks\n";
+    }
+    if (!searchPath.d_crtbegin.empty()) {
+        out << "crtbegin " << searchPath.d_crtbegin << "\n";
+    }
+    return out.str();
+}
+
+IncludeScanner::SearchPath
+IncludeScanner::deserializeSearchPath(const std::string &data)
+{
+    std::istringstream in(data);
+    std::string line;
+    if (!std::getline(in, line) || line != SEARCH_PATH_HEADER) {
+        BUILDBOXCOMMON_THROW_EXCEPTION(std::runtime_error,
+                                       "Unsupported search path format");
+    }
+
+    SearchPath result;
+    while (std::getline(in, line)) {
+        const auto space = line.find(' ');
+        const std::string tag = line.substr(0, space);
+        const std::string value =
+            (space == std::string::npos) ? "" : line.substr(space + 1);
+        if (tag == "quote" && !value.empty() &&
+            result.d_bracketStart == result.d_directories.size()) {
+            result.d_directories.push_back(value);
+            result.d_bracketStart++;
+        }
+        else if (tag == "bracket" && !value.empty()) {
+            result.d_directories.push_back(value);
+        }
+        else if (tag == "missing" && !value.empty()) {
+            result.d_missingDirectories.push_back(value);
+        }
+        else if (tag == "frameworks" && value.empty()) {
+            result.d_hasFrameworks = true;
+        }
+        else if (tag == "crtbegin" && !value.empty()) {
+            result.d_crtbegin = value;
+        }
+        else {
+            BUILDBOXCOMMON_THROW_EXCEPTION(
+                std::runtime_error, "Malformed search path entry: " + line);
+        }
+    }
+    return result;
+}
+
+IncludeScanner::SearchPath
+IncludeScanner::getSearchPath(const std::vector<std::string> &probeCommand)
+{
+    std::string keyData;
+    appendField(&keyData, SEARCH_PATH_HEADER);
+    appendField(&keyData, FileUtils::getCurrentWorkingDirectory());
+    appendField(&keyData, FileUtils::executableIdentity(probeCommand.at(0)));
+    appendField(&keyData, std::to_string(probeCommand.size()));
+    for (const auto &argument : probeCommand) {
+        appendField(&keyData, argument);
+    }
+    for (const auto &it : RECC_DEPS_ENV) {
+        appendField(&keyData, it.first);
+        appendField(&keyData, it.second);
+    }
+    for (const auto &variable : SEARCH_PATH_ENVIRONMENT) {
+        const char *value = getenv(variable.c_str());
+        appendField(&keyData, value != nullptr ? variable + "=" + value : "");
+    }
+    const std::string key = DigestGenerator::make_digest(keyData).hash();
+    const std::string directory = d_cacheDirectory + "/" + key.substr(0, 2);
+    const std::string path = directory + "/" + key;
+
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    if (file.good()) {
+        std::ostringstream contents;
+        contents << file.rdbuf();
+        try {
+            const SearchPath cached = deserializeSearchPath(contents.str());
+            const bool stillMissing = std::none_of(
+                cached.d_missingDirectories.begin(),
+                cached.d_missingDirectories.end(),
+                [](const std::string &missing) {
+                    struct stat st;
+                    return stat(missing.c_str(), &st) == 0;
+                });
+            if (stillMissing) {
+                return cached;
+            }
+        }
+        catch (const std::runtime_error &e) {
+            BUILDBOX_LOG_WARNING("Ignoring cached search path \""
+                                 << path << "\": " << e.what());
+        }
+    }
+
+    const auto subprocessResult =
+        Subprocess::execute(probeCommand, true, true, RECC_DEPS_ENV);
+    if (subprocessResult.d_exitCode != 0) {
+        BUILDBOX_LOG_DEBUG("stderr: " << subprocessResult.d_stdErr);
+        throw unsupported_error(
+            "Failed to determine the include search path, exit status " +
+            std::to_string(subprocessResult.d_exitCode));
+    }
+
+    const SearchPath searchPath = parseSearchPath(subprocessResult.d_stdErr);
+    try {
+        buildboxcommon::FileUtils::createDirectory(directory.c_str());
+        buildboxcommon::FileUtils::writeFileAtomically(
+            path, serializeSearchPath(searchPath), 0644, directory);
+    }
+    catch (const std::exception &e) {
+        BUILDBOX_LOG_WARNING("Failed to cache search path in \""
+                             << path << "\": " << e.what());
+    }
+    return searchPath;
+}
+
+std::set<std::string>
+IncludeScanner::scanFiles(const std::vector<std::string> &sources,
+                          const std::vector<Directive> &commandLineIncludes,
+                          const SearchPath &searchPath)
+{
+    std::set<std::string> result;
+    std::vector<FoundFile> pending;
+    // A header found in different places of the search path can include
+    // different files through `#include_next`
+    std::unordered_set<std::string> visited;
+
+    const auto visit = [&](const FoundFile &file) {
+        result.insert(file.d_path);
+        if (visited
+                .insert(file.d_path + '\n' +
+                        std::to_string(file.d_nextIndex))
+                .second) {
+            pending.push_back(file);
+        }
+    };
+
+    const auto checkPrecompiled = [&](const FoundFile &file) {
+        const std::string directory = directoryOf(file.d_path);
+        const std::string name = file.d_path.substr(
+            directory.empty() ? 0 : file.d_path.rfind('/') + 1);
+        if (fileType(directory, name + ".gch") != FileType::Missing ||
+            fileType(directory, name + ".pch") != FileType::Missing) {
+            throw unsupported_error("Precompiled header for " + file.d_path);
+        }
+    };
+
+    const FoundFile commandLine = {"", -1};
+    for (const auto &directive : commandLineIncludes) {
+        FoundFile found;
+        if (resolve(directive, commandLine, searchPath, &found)) {
+            checkPrecompiled(found);
+            visit(found);
+        }
+    }
+    for (const auto &source : sources) {
+        visit({source, -1});
+    }
+
+    while (!pending.empty()) {
+        const FoundFile file = pending.back();
+        pending.pop_back();
+
+        for (const auto &directive : directivesOf(file.d_path)) {
+            FoundFile found;
+            if (!resolve(directive, file, searchPath, &found)) {
+                // Either under an inactive condition, or the compile
+                // command will fail
+                continue;
+            }
+
+            if (directive.d_kind == Directive::HasInclude ||
+                directive.d_kind == Directive::HasIncludeNext) {
+                result.insert(found.d_path);
+            }
+            else {
+                checkPrecompiled(found);
+                visit(found);
+            }
+        }
+    }
+    return result;
+}
+
+bool IncludeScanner::resolve(const Directive &directive,
+                             const FoundFile &includer,
+                             const SearchPath &searchPath, FoundFile *result)
+{
+    const std::string &name = directive.d_name;
+    if (name.empty()) {
+        return false;
+    }
+    if (name[0] == '/') {
+        if (isFile("", name)) {
+            *result = {name, -1};
+            return true;
+        }
+        return false;
+    }
+
+    const bool isNext = (directive.d_kind == Directive::IncludeNext ||
+                         directive.d_kind == Directive::HasIncludeNext);
+    size_t start;
+    if (isNext && includer.d_nextIndex >= 0) {
+        start = static_cast<size_t>(includer.d_nextIndex);
+    }
+    else if (directive.d_angled) {
+        start = searchPath.d_bracketStart;
+    }
+    else {
+        // The directory of the current file is searched first (for files
+        // given on the command line, the working directory)
+        const std::string directory = directoryOf(includer.d_path);
+        if (isFile(directory, name)) {
+            *result = {joinPath(directory, name), 0};
+            return true;
+        }
+        start = 0;
+    }
+
+    for (size_t i = start; i < searchPath.d_directories.size(); ++i) {
+        if (isFile(searchPath.d_directories[i], name)) {
+            *result = {joinPath(searchPath.d_directories[i], name),
+                       static_cast<int>(i + 1)};
+            return true;
+        }
+    }
+    return false;
+}
+
+IncludeScanner::FileType
+IncludeScanner::fileType(const std::string &directory, const std::string &name)
+{
+    const std::string path = joinPath(directory, name);
+    const auto cached = d_fileTypes.find(path);
+    if (cached != d_fileTypes.end()) {
+        return cached->second;
+    }
+
+    FileType type = FileType::Missing;
+#ifndef __APPLE__
+    // Listings can't be used on case-insensitive file systems
+    const std::string component = name.substr(0, name.find('/'));
+    bool listed = true;
+    if (!component.empty() && name[0] != '/') {
+        auto listing = d_directoryListings.find(directory);
+        if (listing == d_directoryListings.end()) {
+            listing = d_directoryListings
+                          .emplace(directory, listDirectory(directory))
+                          .first;
+        }
+        listed = !listing->second || listing->second->count(component) > 0;
+    }
+    if (listed) {
+#endif
+        struct stat st;
+        if (stat(path.c_str(), &st) == 0) {
+            type = S_ISDIR(st.st_mode) ? FileType::Directory : FileType::File;
+        }
+#ifndef __APPLE__
+    }
+#endif
+
+    d_fileTypes.emplace(path, type);
+    return type;
+}
+
+const std::vector<IncludeScanner::Directive> &
+IncludeScanner::directivesOf(const std::string &path)
+{
+    auto it = d_directives.find(path);
+    if (it == d_directives.end()) {
+        std::ifstream file(path, std::ios::in | std::ios::binary);
+        if (!file.good()) {
+            throw unsupported_error("Could not read " + path);
+        }
+        std::ostringstream contents;
+        contents << file.rdbuf();
+        it = d_directives.emplace(path, parseDirectives(contents.str())).first;
+    }
+    return it->second;
+}
+
+} // namespace recc
@@ -0,0 +1,188 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef INCLUDED_INCLUDESCANNER
+#define INCLUDED_INCLUDESCANNER
+
+#include <parsedcommand.h>
+
+#include <memory>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace recc {
+
+/**
+ * Determines the dependencies of a gcc or clang compile command without
+ * running the preprocessor.
+ *
+ * The include search path is obtained once from the compiler (`-E -v`) and
+ * cached below the given cache directory. The `#include`, `#include_next`
+ * and `#import` directives of the source files, of the files given with
+ * `-include` and `-imacros` and of every header found are then resolved
+ * against it the same way the compiler does.
+ *
+ * Conditional directives are not evaluated, so the result is a superset of
+ * what the dependency command reports: headers included under inactive
+ * conditions are returned if they exist, and ones that don't exist are
+ * ignored. Files named in `__has_include()` are returned if they exist, so
+ * that the test gives the same result remotely.
+ *
+ * Constructs that can't be resolved statically (for example computed
+ * includes, `__has_include()` with a macro argument or `#embed`) cause an
+ * `unsupported_error`, in which case the caller should fall back to the
+ * dependency command.
+ */
+class IncludeScanner {
+  public:
+    class unsupported_error : public std::runtime_error {
+      public:
+        explicit unsupported_error(const std::string &what)
+            : std::runtime_error(what)
+        {
+        }
+    };
+
+    struct Directive {
+        enum Kind { Include, IncludeNext, HasInclude, HasIncludeNext };
+        Kind d_kind;
+        bool d_angled;
+        std::string d_name;
+    };
+
+    /**
+     * Include search path of a compiler invocation.
+     *
+     * `#include "..."` searches `d_directories` from the start (after the
+     * directory of the current file), `#include <...>` starts at
+     * `d_bracketStart`.
+     */
+    struct SearchPath {
+        std::vector<std::string> d_directories;
+        size_t d_bracketStart = 0;
+        // Directories ignored by the compiler because they did not exist. If
+        // one of them is created, the search path must be determined again.
+        std::vector<std::string> d_missingDirectories;
+        bool d_hasFrameworks = false;
+        // Location of the crtbegin.o file selected by clang, if any
+        std::string d_crtbegin;
+    };
+
+    /**
+     * Search paths reported by the compiler are cached in files below
+     * `cacheDirectory`, which is created on demand.
+     */
+    explicit IncludeScanner(const std::string &cacheDirectory);
+
+    /**
+     * Returns whether the given command can be scanned. Only gcc and clang
+     * compile commands are supported.
+     */
+    static bool isSupported(const ParsedCommand &command);
+
+    /**
+     * Returns the files needed to run the command, including the input
+     * files themselves, in the same form as the dependency command would.
+     *
+     * Throws `unsupported_error` if the dependency command needs to be used
+     * instead.
+     */
+    std::set<std::string> scan(const ParsedCommand &command);
+
+  protected: // for unit testing
+    struct FoundFile {
+        std::string d_path;
+        // Index into `SearchPath::d_directories` from which `#include_next`
+        // continues, or -1 if the file wasn't found via the search path.
+        int d_nextIndex;
+    };
+
+    /**
+     * Extracts the file inclusions from the contents of a source file.
+     *
+     * Throws `unsupported_error` if one can't be determined statically.
+     */
+    static std::vector<Directive> parseDirectives(const std::string &source);
+
+    /**
+     * Parses the output of `-E -v`.
+     */
+    static SearchPath parseSearchPath(const std::string &compilerOutput);
+
+    static std::string serializeSearchPath(const SearchPath &searchPath);
+
+    /**
+     * Throws `std::runtime_error` if the data is malformed.
+     */
+    static SearchPath deserializeSearchPath(const std::string &data);
+
+    /**
+     * Returns the files reached from `sources` and from
+     * `commandLineIncludes`, which are resolved as if they were included
+     * from a file in the working directory (as done for `-include` and
+     * `-imacros`).
+     */
+    std::set<std::string>
+    scanFiles(const std::vector<std::string> &sources,
+              const std::vector<Directive> &commandLineIncludes,
+              const SearchPath &searchPath);
+
+    /**
+     * Returns the search path for the given command, which must be a
+     * compiler invocation that only prints it (`-E -v`). The result is
+     * cached on disk.
+     */
+    SearchPath getSearchPath(const std::vector<std::string> &probeCommand);
+
+  private:
+    /**
+     * Resolves the file named by `directive` as the compiler would when it
+     * is found in `includer`.
+     */
+    bool resolve(const Directive &directive, const FoundFile &includer,
+                 const SearchPath &searchPath, FoundFile *result);
+
+    enum class FileType { Missing, File, Directory };
+
+    /**
+     * Returns the type of `directory/name`, caching the result. Directory
+     * listings are cached to avoid stat()ing every candidate in the search
+     * path.
+     */
+    FileType fileType(const std::string &directory, const std::string &name);
+
+    bool isFile(const std::string &directory, const std::string &name)
+    {
+        return fileType(directory, name) == FileType::File;
+    }
+
+    const std::vector<Directive> &directivesOf(const std::string &path);
+
+    typedef std::unordered_set<std::string> DirectoryListing;
+
+    std::string d_cacheDirectory;
+    std::unordered_map<std::string, FileType> d_fileTypes;
+    // A null pointer marks a directory that couldn't be listed
+    std::unordered_map<std::string, std::unique_ptr<DirectoryListing>>
+        d_directoryListings;
+    std::unordered_map<std::string, std::vector<Directive>> d_directives;
+};
+
+} // namespace recc
+
+#endif
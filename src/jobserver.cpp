@@ -0,0 +1,205 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <jobserver.h>
+
+#include <buildboxcommon_logging.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace recc {
+
+namespace {
+
+bool isPipe(int fd)
+{
+    struct stat st;
+    return fd >= 0 && fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+}
+
+bool parseFds(const std::string &value, int *readFd, int *writeFd)
+{
+    const size_t comma = value.find(',');
+    if (comma == std::string::npos) {
+        return false;
+    }
+    char *end;
+    const std::string read = value.substr(0, comma);
+    const std::string write = value.substr(comma + 1);
+    *readFd = static_cast<int>(strtol(read.c_str(), &end, 10));
+    if (read.empty() || *end != '\0') {
+        return false;
+    }
+    *writeFd = static_cast<int>(strtol(write.c_str(), &end, 10));
+    return !write.empty() && *end == '\0';
+}
+
+} // namespace
+
+std::shared_ptr<JobServer> JobServer::fromEnvironment()
+{
+    const char *makeflags = getenv("MAKEFLAGS");
+    if (makeflags == nullptr) {
+        return nullptr;
+    }
+    return fromMakeflags(makeflags);
+}
+
+std::shared_ptr<JobServer>
+JobServer::fromMakeflags(const std::string &makeflags)
+{
+    // The last option wins, as with make
+    std::string auth;
+    std::istringstream words(makeflags);
+    std::string word;
+    while (words >> word) {
+        for (const std::string option :
+             {"--jobserver-auth=", "--jobserver-fds="}) {
+            if (word.compare(0, option.size(), option) == 0) {
+                auth = word.substr(option.size());
+            }
+        }
+    }
+    if (auth.empty()) {
+        return nullptr;
+    }
+
+    if (auth.compare(0, 5, "fifo:") == 0) {
+        const std::string path = auth.substr(5);
+        const int readFd =
+            open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        if (readFd < 0) {
+            BUILDBOX_LOG_DEBUG("Not using the jobserver at \""
+                               << path << "\": " << strerror(errno));
+            return nullptr;
+        }
+        // Doesn't block, as there is a reader
+        const int writeFd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+        if (writeFd < 0 || !isPipe(readFd)) {
+            BUILDBOX_LOG_DEBUG("Not using the jobserver at \"" << path
+                                                               << "\"");
+            close(readFd);
+            if (writeFd >= 0) {
+                close(writeFd);
+            }
+            return nullptr;
+        }
+        return std::shared_ptr<JobServer>(
+            new JobServer(readFd, writeFd, true, true));
+    }
+
+    int readFd = -1, writeFd = -1;
+    if (!parseFds(auth, &readFd, &writeFd)) {
+        BUILDBOX_LOG_DEBUG("Unsupported jobserver \"" << auth << "\"");
+        return nullptr;
+    }
+    // Make closes the pipe for commands it doesn't consider recursive makes,
+    // unless their recipe is marked with `+`
+    if (!isPipe(readFd) || !isPipe(writeFd)) {
+        BUILDBOX_LOG_DEBUG("Not using the jobserver, its pipe was not passed "
+                           "to this process");
+        return nullptr;
+    }
+
+    // The pipe is shared with make and the other jobs, so it can't be made
+    // non-blocking. Where possible, reopen it to get a descriptor of our
+    // own instead.
+    const std::string procPath = "/proc/self/fd/" + std::to_string(readFd);
+    const int ownReadFd =
+        open(procPath.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (ownReadFd >= 0) {
+        return std::shared_ptr<JobServer>(
+            new JobServer(ownReadFd, writeFd, true, false));
+    }
+    return std::shared_ptr<JobServer>(
+        new JobServer(readFd, writeFd, false, false));
+}
+
+JobServer::JobServer(int readFd, int writeFd, bool closeReadFd,
+                     bool closeWriteFd)
+    : d_readFd(readFd), d_writeFd(writeFd), d_closeReadFd(closeReadFd),
+      d_closeWriteFd(closeWriteFd), d_tokensAcquired(0), d_waitMicroseconds(0)
+{
+}
+
+JobServer::~JobServer()
+{
+    while (!d_tokens.empty()) {
+        release();
+    }
+    if (d_closeReadFd) {
+        close(d_readFd);
+    }
+    if (d_closeWriteFd) {
+        close(d_writeFd);
+    }
+}
+
+bool JobServer::tryAcquire()
+{
+    // Without a descriptor of our own, another job can take the token
+    // between `poll()` and `read()`, which then blocks until one is given
+    // back
+    struct pollfd pollFd;
+    pollFd.fd = d_readFd;
+    pollFd.events = POLLIN;
+    if (poll(&pollFd, 1, 0) <= 0) {
+        return false;
+    }
+
+    char token;
+    ssize_t bytesRead;
+    do {
+        bytesRead = read(d_readFd, &token, 1);
+    } while (bytesRead < 0 && errno == EINTR);
+    if (bytesRead != 1) {
+        return false;
+    }
+
+    const std::lock_guard<std::mutex> lock(d_mutex);
+    d_tokens.push_back(token);
+    ++d_tokensAcquired;
+    return true;
+}
+
+void JobServer::release()
+{
+    char token;
+    {
+        const std::lock_guard<std::mutex> lock(d_mutex);
+        if (d_tokens.empty()) {
+            return;
+        }
+        token = d_tokens.back();
+        d_tokens.pop_back();
+    }
+
+    ssize_t written;
+    do {
+        written = write(d_writeFd, &token, 1);
+    } while (written < 0 && errno == EINTR);
+    if (written != 1) {
+        BUILDBOX_LOG_WARNING("Could not give a token back to the jobserver: "
+                             << strerror(errno));
+    }
+}
+
+} // namespace recc
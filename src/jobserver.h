@@ -0,0 +1,108 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef INCLUDED_JOBSERVER
+#define INCLUDED_JOBSERVER
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace recc {
+
+/**
+ * Client of the jobserver of GNU make, which hands out tokens to the jobs
+ * it runs so that they don't run more processes or threads in total than
+ * allowed by `-j`.
+ *
+ * A job implicitly holds a token for itself, so tokens are only needed for
+ * what it runs in addition, such as worker threads. Tokens must be given
+ * back as soon as they are not needed, as make can't start other jobs in
+ * the meantime.
+ *
+ * This class is thread-safe.
+ */
+class JobServer {
+  public:
+    /**
+     * Returns the jobserver passed in `MAKEFLAGS`, or null if there is none
+     * or it can't be used (e.g. make didn't pass the pipe of the jobserver
+     * to this process).
+     */
+    static std::shared_ptr<JobServer> fromEnvironment();
+
+    /**
+     * Same as `fromEnvironment()` for the given value of `MAKEFLAGS`. Both
+     * `--jobserver-auth=R,W` (pipe), `--jobserver-auth=fifo:PATH` (named
+     * pipe) and the older `--jobserver-fds=R,W` are supported.
+     */
+    static std::shared_ptr<JobServer>
+    fromMakeflags(const std::string &makeflags);
+
+    /**
+     * Gives back the tokens still held.
+     */
+    ~JobServer();
+
+    JobServer(const JobServer &) = delete;
+    JobServer &operator=(const JobServer &) = delete;
+
+    /**
+     * Takes a token if one is available right away.
+     */
+    bool tryAcquire();
+
+    /**
+     * Gives back a token taken with `tryAcquire()`.
+     */
+    void release();
+
+    int64_t tokensAcquired() const { return d_tokensAcquired; }
+
+    /**
+     * Records time spent with work to do but no token to do it.
+     */
+    void addWaitTime(std::chrono::microseconds waitTime)
+    {
+        d_waitMicroseconds += waitTime.count();
+    }
+
+    std::chrono::microseconds waitTime() const
+    {
+        return std::chrono::microseconds(d_waitMicroseconds.load());
+    }
+
+  private:
+    JobServer(int readFd, int writeFd, bool closeReadFd, bool closeWriteFd);
+
+    int d_readFd;
+    int d_writeFd;
+    bool d_closeReadFd;
+    bool d_closeWriteFd;
+
+    // Make may hand out different characters, and expects the same ones
+    // back
+    std::mutex d_mutex;
+    std::vector<char> d_tokens;
+    std::atomic<int64_t> d_tokensAcquired;
+    std::atomic<int64_t> d_waitMicroseconds;
+};
+
+} // namespace recc
+
+#endif
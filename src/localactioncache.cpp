@@ -0,0 +1,124 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <localactioncache.h>
+
+#include <digestgenerator.h>
+
+#include <buildboxcommon_fileutils.h>
+#include <buildboxcommon_logging.h>
+
+#include <cerrno>
+#include <ctime>
+#include <dirent.h>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace recc {
+
+LocalActionCache::LocalActionCache(const std::string &directory,
+                                   int64_t ttlSeconds)
+    : d_directory(directory), d_ttlSeconds(ttlSeconds)
+{
+}
+
+std::string LocalActionCache::path(const std::string &cacheDirectory,
+                                   const std::string &server,
+                                   const std::string &instance)
+{
+    const std::string scope =
+        DigestGenerator::make_digest(server + "\n" + instance).hash();
+    return cacheDirectory + "/action-results-" + scope.substr(0, 16);
+}
+
+std::string
+LocalActionCache::entryPath(const proto::Digest &actionDigest) const
+{
+    const std::string &hash = actionDigest.hash();
+    return d_directory + "/" + hash.substr(0, 2) + "/" + hash + "-" +
+           std::to_string(actionDigest.size_bytes());
+}
+
+bool LocalActionCache::isExpired(const std::string &path) const
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        return true;
+    }
+    return static_cast<int64_t>(time(nullptr)) - st.st_mtime >= d_ttlSeconds;
+}
+
+bool LocalActionCache::lookup(const proto::Digest &actionDigest,
+                              proto::ActionResult *result) const
+{
+    const std::string path = entryPath(actionDigest);
+    if (isExpired(path)) {
+        return false;
+    }
+
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    if (!file.good()) {
+        return false;
+    }
+    std::ostringstream contents;
+    contents << file.rdbuf();
+    if (!result->ParseFromString(contents.str())) {
+        BUILDBOX_LOG_WARNING("Ignoring invalid action result \"" << path
+                                                                 << "\"");
+        unlink(path.c_str());
+        return false;
+    }
+    return true;
+}
+
+void LocalActionCache::store(const proto::Digest &actionDigest,
+                             const proto::ActionResult &result) const
+{
+    const std::string path = entryPath(actionDigest);
+    const std::string directory = path.substr(0, path.rfind('/'));
+    try {
+        buildboxcommon::FileUtils::createDirectory(directory.c_str());
+        // Written to a temporary file and renamed into place so that
+        // concurrent readers never see a partial result.
+        buildboxcommon::FileUtils::writeFileAtomically(
+            path, result.SerializeAsString(), 0644, directory);
+    }
+    catch (const std::exception &e) {
+        BUILDBOX_LOG_WARNING("Could not store the result of action "
+                             << proto::toString(actionDigest)
+                             << " in the local action cache: " << e.what());
+        return;
+    }
+
+    DIR *dir = opendir(directory.c_str());
+    if (dir == nullptr) {
+        return;
+    }
+    while (const struct dirent *entry = readdir(dir)) {
+        const std::string child = directory + "/" + entry->d_name;
+        if (entry->d_name[0] != '.' && isExpired(child)) {
+            unlink(child.c_str());
+        }
+    }
+    closedir(dir);
+}
+
+void LocalActionCache::remove(const proto::Digest &actionDigest) const
+{
+    unlink(entryPath(actionDigest).c_str());
+}
+
+} // namespace recc
@@ -0,0 +1,81 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef INCLUDED_LOCALACTIONCACHE
+#define INCLUDED_LOCALACTIONCACHE
+
+#include <protos.h>
+
+#include <cstdint>
+#include <string>
+
+namespace recc {
+
+/**
+ * Local tier of the action cache, shared by all recc processes on a machine
+ * that use the same action cache server and instance, so that actions
+ * looked up, executed or uploaded recently are not queried again.
+ *
+ * Each `ActionResult` is stored in its own file, sharded by the first two
+ * characters of the hash of the action digest, and replaced atomically.
+ * Entries older than the time to live are ignored, as the server may have
+ * evicted the result or its outputs since. Expired entries of a shard are
+ * removed when an entry is stored in it.
+ */
+class LocalActionCache {
+  public:
+    /**
+     * Stores the entries below `directory`, which is created on demand.
+     */
+    LocalActionCache(const std::string &directory, int64_t ttlSeconds);
+
+    /**
+     * Returns the directory in `cacheDirectory` holding the results of the
+     * given action cache server and instance.
+     */
+    static std::string path(const std::string &cacheDirectory,
+                            const std::string &server,
+                            const std::string &instance);
+
+    /**
+     * Writes the result stored for the given action to `result`, if it is
+     * younger than the time to live. Returns whether it was found.
+     */
+    bool lookup(const proto::Digest &actionDigest,
+                proto::ActionResult *result) const;
+
+    /**
+     * Stores the result of the given action. Errors are logged.
+     */
+    void store(const proto::Digest &actionDigest,
+               const proto::ActionResult &result) const;
+
+    /**
+     * Removes the result stored for the given action, for example because
+     * its outputs are no longer available.
+     */
+    void remove(const proto::Digest &actionDigest) const;
+
+    std::string entryPath(const proto::Digest &actionDigest) const;
+
+  private:
+    bool isExpired(const std::string &path) const;
+
+    std::string d_directory;
+    int64_t d_ttlSeconds;
+};
+
+} // namespace recc
+
+#endif
@@ -0,0 +1,624 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <localcas.h>
+
+#include <digestgenerator.h>
+#include <filecontents.h>
+
+#include <buildboxcommon_fileutils.h>
+#include <buildboxcommon_logging.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <tuple>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+namespace recc {
+
+namespace {
+
+const uint64_t STATE_MAGIC = 0x315341434c434552; // "RECLCAS1"
+const uint64_t STATE_VERSION = 1;
+
+// Words of the state file
+enum StateWord { MAGIC, VERSION, TOTAL_SIZE };
+const size_t STATE_WORDS = 8;
+const size_t STATE_SIZE = STATE_WORDS * sizeof(uint64_t);
+
+// Eviction leaves room for this many percent of the maximum, so that it
+// doesn't run again at the next insert
+const int64_t EVICTION_TARGET_PERCENT = 90;
+
+// Blobs larger than this fraction of the maximum are not kept, so that a
+// single one can't evict most of the others
+const int64_t MAX_BLOB_FRACTION = 4;
+
+// Temporary files older than this were left behind by processes that
+// exited while inserting
+const std::chrono::hours STALE_TEMPORARY_AGE(1);
+
+int64_t modificationTimeNs(const struct stat &st)
+{
+#ifdef __APPLE__
+    const struct timespec &time = st.st_mtimespec;
+#else
+    const struct timespec &time = st.st_mtim;
+#endif
+    return static_cast<int64_t>(time.tv_sec) * 1000000000 + time.tv_nsec;
+}
+
+void createDirectoryIfMissing(const std::string &path)
+{
+    if (mkdir(path.c_str(), 0777) != 0 && errno != EEXIST) {
+        throw std::system_error(errno, std::system_category(),
+                                "Could not create directory \"" + path +
+                                    "\"");
+    }
+}
+
+std::string temporaryName(const std::string &name)
+{
+    static std::atomic<unsigned> s_count(0);
+    return ".recc-" + name + "." + std::to_string(getpid()) + "." +
+           std::to_string(s_count++);
+}
+
+/**
+ * Maps the state at `path`, creating it if it does not exist. As with the
+ * execution limit state, it is initialized under a temporary name and then
+ * linked into place.
+ */
+void *mapState(const std::string &path)
+{
+    if (!std::atomic<int64_t>().is_lock_free()) {
+        throw std::runtime_error(
+            "64-bit atomics are not lock-free on this platform");
+    }
+
+    int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0 && errno == ENOENT) {
+        const std::string temporaryPath =
+            path + "." + std::to_string(getpid()) + ".tmp";
+        fd = open(temporaryPath.c_str(),
+                  O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            throw std::system_error(errno, std::system_category(),
+                                    "Could not create \"" + temporaryPath +
+                                        "\"");
+        }
+        uint64_t state[STATE_WORDS] = {};
+        state[MAGIC] = STATE_MAGIC;
+        state[VERSION] = STATE_VERSION;
+        const bool initialized =
+            write(fd, state, sizeof(state)) ==
+            static_cast<ssize_t>(sizeof(state));
+        close(fd);
+        if (initialized && link(temporaryPath.c_str(), path.c_str()) != 0 &&
+            errno != EEXIST) {
+            const int error = errno;
+            unlink(temporaryPath.c_str());
+            throw std::system_error(error, std::system_category(),
+                                    "Could not create \"" + path + "\"");
+        }
+        unlink(temporaryPath.c_str());
+        fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+    }
+    if (fd < 0) {
+        throw std::system_error(errno, std::system_category(),
+                                "Could not open \"" + path + "\"");
+    }
+
+    struct stat st;
+    uint64_t state[STATE_WORDS] = {};
+    const bool readState =
+        fstat(fd, &st) == 0 && pread(fd, state, sizeof(state), 0) ==
+                                   static_cast<ssize_t>(sizeof(state));
+    if (!readState || state[MAGIC] != STATE_MAGIC ||
+        state[VERSION] != STATE_VERSION ||
+        static_cast<size_t>(st.st_size) != STATE_SIZE) {
+        close(fd);
+        throw std::runtime_error("\"" + path +
+                                 "\" is not a valid local CAS state");
+    }
+
+    void *mapping =
+        mmap(nullptr, STATE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    const int error = errno;
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        throw std::system_error(error, std::system_category(),
+                                "Could not map \"" + path + "\"");
+    }
+    return mapping;
+}
+
+void writeAll(int fd, const char *data, size_t size)
+{
+    while (size > 0) {
+        const ssize_t written = write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::system_error(errno, std::system_category(),
+                                    "Could not write blob");
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+    }
+}
+
+/**
+ * Copies the first `size` bytes of `source` to `target`, which is empty.
+ * The contents are shared instead if the filesystem supports it, and copied
+ * within the kernel if possible.
+ */
+void copyContents(int source, int target, size_t size)
+{
+#ifdef __linux__
+#ifdef FICLONE
+    if (ioctl(target, FICLONE, source) == 0) {
+        return;
+    }
+#endif
+#ifdef SYS_copy_file_range
+    loff_t sourceOffset = 0;
+    loff_t targetOffset = 0;
+    while (static_cast<size_t>(sourceOffset) < size) {
+        const ssize_t copied = static_cast<ssize_t>(
+            syscall(SYS_copy_file_range, source, &sourceOffset, target,
+                    &targetOffset, size - static_cast<size_t>(sourceOffset),
+                    0u));
+        if (copied < 0 && errno == EINTR) {
+            continue;
+        }
+        if (copied <= 0) {
+            // Not supported between these files: copy the rest below
+            break;
+        }
+    }
+    if (static_cast<size_t>(sourceOffset) == size) {
+        return;
+    }
+    size_t offset = static_cast<size_t>(sourceOffset);
+#else
+    size_t offset = 0;
+#endif
+#else
+    size_t offset = 0;
+#endif
+
+    char buffer[64 * 1024];
+    while (offset < size) {
+        const ssize_t bytesRead =
+            pread(source, buffer, std::min(sizeof(buffer), size - offset),
+                  static_cast<off_t>(offset));
+        if (bytesRead < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytesRead < 0) {
+            throw std::system_error(errno, std::system_category(),
+                                    "Could not read blob");
+        }
+        if (bytesRead == 0) {
+            throw std::runtime_error("Blob is shorter than its digest");
+        }
+        if (pwrite(target, buffer, static_cast<size_t>(bytesRead),
+                   static_cast<off_t>(offset)) != bytesRead) {
+            throw std::system_error(errno, std::system_category(),
+                                    "Could not write blob");
+        }
+        offset += static_cast<size_t>(bytesRead);
+    }
+}
+
+struct Blob {
+    int64_t d_lastUsed;
+    int64_t d_size;
+    // Relative to `objects/` and `access/`
+    std::string d_path;
+
+    bool operator<(const Blob &other) const
+    {
+        return std::tie(d_lastUsed, d_path) <
+               std::tie(other.d_lastUsed, other.d_path);
+    }
+};
+
+/**
+ * Calls `callback` with the path and status of each entry of `directory`.
+ */
+template <typename Callback>
+void forEachEntry(const std::string &directory, const Callback &callback)
+{
+    DIR *dir = opendir(directory.c_str());
+    if (dir == nullptr) {
+        return;
+    }
+    while (const struct dirent *entry = readdir(dir)) {
+        const std::string name = entry->d_name;
+        if (name == "." || name == "..") {
+            continue;
+        }
+        const std::string path = directory + "/" + name;
+        struct stat st;
+        if (lstat(path.c_str(), &st) == 0) {
+            callback(path, st);
+        }
+    }
+    closedir(dir);
+}
+
+} // namespace
+
+LocalCas::LocalCas(const std::string &directory, int64_t maxSize,
+                   bool hardLinks)
+    : d_directory(directory), d_maxSize(maxSize), d_hardLinks(hardLinks),
+      d_hits(0), d_misses(0)
+{
+    try {
+        buildboxcommon::FileUtils::createDirectory(directory.c_str());
+        createDirectoryIfMissing(directory + "/objects");
+        createDirectoryIfMissing(directory + "/access");
+        createDirectoryIfMissing(directory + "/tmp");
+        d_mapping = mapState(directory + "/state");
+    }
+    catch (const std::exception &e) {
+        BUILDBOX_LOG_WARNING("Local CAS disabled: " << e.what());
+    }
+}
+
+LocalCas::~LocalCas()
+{
+    if (d_mapping != nullptr) {
+        munmap(d_mapping, STATE_SIZE);
+    }
+}
+
+std::string LocalCas::path(const std::string &cacheDirectory,
+                           const std::string &digestFunction)
+{
+    return cacheDirectory + "/cas-" + digestFunction;
+}
+
+LocalCas::Word *LocalCas::totalSize() const
+{
+    return static_cast<Word *>(d_mapping) + TOTAL_SIZE;
+}
+
+int64_t LocalCas::size() const
+{
+    return d_mapping == nullptr ? 0 : totalSize()->load();
+}
+
+std::string LocalCas::objectPath(const proto::Digest &digest) const
+{
+    const std::string &hash = digest.hash();
+    return d_directory + "/objects/" + hash.substr(0, 2) + "/" +
+           hash.substr(2);
+}
+
+std::string LocalCas::accessPath(const proto::Digest &digest) const
+{
+    const std::string &hash = digest.hash();
+    return d_directory + "/access/" + hash.substr(0, 2) + "/" +
+           hash.substr(2);
+}
+
+void LocalCas::markUsed(const proto::Digest &digest) const
+{
+    const std::string path = accessPath(digest);
+    if (utimensat(AT_FDCWD, path.c_str(), nullptr, 0) == 0 ||
+        errno != ENOENT) {
+        return;
+    }
+    try {
+        createDirectoryIfMissing(path.substr(0, path.rfind('/')));
+    }
+    catch (const std::exception &) {
+        return;
+    }
+    const int fd =
+        open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (fd >= 0) {
+        futimens(fd, nullptr);
+        close(fd);
+    }
+}
+
+bool LocalCas::contains(const proto::Digest &digest)
+{
+    if (d_mapping == nullptr) {
+        return false;
+    }
+    struct stat st;
+    const bool found = stat(objectPath(digest).c_str(), &st) == 0 &&
+                       st.st_size == digest.size_bytes();
+    ++(found ? d_hits : d_misses);
+    return found;
+}
+
+bool LocalCas::materialize(const proto::Digest &digest, int dirfd,
+                           const std::string &path, bool executable)
+{
+    if (d_mapping == nullptr) {
+        return false;
+    }
+    const std::string object = objectPath(digest);
+    const size_t slash = path.rfind('/');
+    const std::string temporaryPath =
+        (slash == std::string::npos ? "" : path.substr(0, slash + 1)) +
+        temporaryName(path.substr(slash + 1));
+
+    // A hard link keeps the mode of the blob, which is not executable
+    bool written = d_hardLinks && !executable &&
+                   linkat(AT_FDCWD, object.c_str(), dirfd,
+                          temporaryPath.c_str(), 0) == 0;
+    if (!written) {
+        // Once open, the blob can be read even if it is evicted meanwhile
+        const int source = open(object.c_str(), O_RDONLY | O_CLOEXEC);
+        if (source < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(source, &st) != 0 || st.st_size != digest.size_bytes()) {
+            close(source);
+            return false;
+        }
+
+        // The mode is subject to the umask, as when the compiler writes it
+        const int target =
+            openat(dirfd, temporaryPath.c_str(),
+                   O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+                   executable ? 0777 : 0666);
+        if (target < 0) {
+            const int error = errno;
+            close(source);
+            throw std::system_error(error, std::system_category(),
+                                    "Could not create \"" + temporaryPath +
+                                        "\"");
+        }
+        try {
+            copyContents(source, target,
+                         static_cast<size_t>(digest.size_bytes()));
+        }
+        catch (...) {
+            close(source);
+            close(target);
+            unlinkat(dirfd, temporaryPath.c_str(), 0);
+            throw;
+        }
+        close(source);
+        close(target);
+    }
+
+    if (renameat(dirfd, temporaryPath.c_str(), dirfd, path.c_str()) != 0) {
+        const int error = errno;
+        unlinkat(dirfd, temporaryPath.c_str(), 0);
+        throw std::system_error(error, std::system_category(),
+                                "Could not rename \"" + temporaryPath +
+                                    "\" to \"" + path + "\"");
+    }
+
+    markUsed(digest);
+    return true;
+}
+
+void LocalCas::insert(const proto::Digest &digest, const char *data,
+                      size_t size)
+{
+    insertWith(digest, [data, size](int fd) { writeAll(fd, data, size); });
+}
+
+void LocalCas::insertFile(const proto::Digest &digest, int fd, bool verify)
+{
+    insertWith(digest, [&digest, fd, verify](int target) {
+        copyContents(fd, target, static_cast<size_t>(digest.size_bytes()));
+        if (!verify) {
+            return;
+        }
+        // Read back from the page cache
+        struct stat st;
+        if (fstat(target, &st) != 0) {
+            throw std::system_error(errno, std::system_category(),
+                                    "Could not stat blob");
+        }
+        const FileContents contents(target, "blob", st,
+                                    FileContents::OWNED);
+        const proto::Digest actual = DigestGenerator::make_digests(
+            {DigestGenerator::BlobView(contents.data(), contents.size())})[0];
+        if (actual != digest) {
+            throw std::runtime_error("Contents changed while inserting");
+        }
+    });
+}
+
+template <typename Writer>
+void LocalCas::insertWith(const proto::Digest &digest,
+                          const Writer &writeBlob)
+{
+    if (d_mapping == nullptr || digest.size_bytes() == 0 ||
+        digest.size_bytes() > d_maxSize / MAX_BLOB_FRACTION) {
+        return;
+    }
+    const std::string object = objectPath(digest);
+    if (access(object.c_str(), F_OK) == 0) {
+        markUsed(digest);
+        return;
+    }
+
+    const std::string temporaryPath =
+        d_directory + "/tmp/" + temporaryName(digest.hash());
+    try {
+        createDirectoryIfMissing(object.substr(0, object.rfind('/')));
+        // Opened for reading too, so that it can be hashed
+        const int fd = open(temporaryPath.c_str(),
+                            O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0444);
+        if (fd < 0) {
+            throw std::system_error(errno, std::system_category(),
+                                    "Could not create \"" + temporaryPath +
+                                        "\"");
+        }
+        try {
+            writeBlob(fd);
+        }
+        catch (...) {
+            close(fd);
+            throw;
+        }
+        close(fd);
+
+        // Only the process that links it into place accounts for it
+        if (link(temporaryPath.c_str(), object.c_str()) == 0) {
+            totalSize()->fetch_add(digest.size_bytes());
+        }
+        else if (errno != EEXIST) {
+            throw std::system_error(errno, std::system_category(),
+                                    "Could not create \"" + object + "\"");
+        }
+    }
+    catch (const std::exception &e) {
+        BUILDBOX_LOG_WARNING("Could not add blob "
+                             << proto::toString(digest)
+                             << " to the local CAS: " << e.what());
+    }
+    unlink(temporaryPath.c_str());
+
+    if (totalSize()->load() > d_maxSize) {
+        evict();
+    }
+}
+
+void LocalCas::evict()
+{
+    if (d_mapping == nullptr) {
+        return;
+    }
+    const std::string lockPath = d_directory + "/lock";
+    const int lock =
+        open(lockPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (lock < 0) {
+        BUILDBOX_LOG_WARNING("Could not open \"" << lockPath
+                                                 << "\": " << strerror(errno));
+        return;
+    }
+    if (flock(lock, LOCK_EX | LOCK_NB) != 0) {
+        // Another process is evicting
+        close(lock);
+        return;
+    }
+
+    const int64_t recordedSize = totalSize()->load();
+    const std::string objects = d_directory + "/objects";
+    const std::string accesses = d_directory + "/access";
+    std::vector<Blob> blobs;
+    std::unordered_map<std::string, size_t> blobIndex;
+    int64_t scannedSize = 0;
+    forEachEntry(objects, [&](const std::string &shard,
+                              const struct stat &st) {
+        if (!S_ISDIR(st.st_mode)) {
+            return;
+        }
+        forEachEntry(shard, [&](const std::string &path,
+                                const struct stat &blob) {
+            if (S_ISREG(blob.st_mode)) {
+                // Blobs never used since they were added
+                const std::string relativePath =
+                    path.substr(objects.size());
+                blobIndex[relativePath] = blobs.size();
+                blobs.push_back(
+                    {modificationTimeNs(blob), blob.st_size, relativePath});
+                scannedSize += blob.st_size;
+            }
+        });
+    });
+    forEachEntry(accesses, [&](const std::string &shard,
+                               const struct stat &st) {
+        if (!S_ISDIR(st.st_mode)) {
+            return;
+        }
+        forEachEntry(shard, [&](const std::string &path,
+                                const struct stat &used) {
+            const std::string relativePath = path.substr(accesses.size());
+            const auto it = blobIndex.find(relativePath);
+            if (it != blobIndex.end()) {
+                Blob &blob = blobs[it->second];
+                blob.d_lastUsed =
+                    std::max(blob.d_lastUsed, modificationTimeNs(used));
+            }
+            else if (access((objects + relativePath).c_str(), F_OK) != 0) {
+                // Left behind by a blob evicted while it was used
+                unlink(path.c_str());
+            }
+        });
+    });
+
+    const int64_t staleBefore =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            (std::chrono::system_clock::now() - STALE_TEMPORARY_AGE)
+                .time_since_epoch())
+            .count();
+    forEachEntry(d_directory + "/tmp",
+                 [staleBefore](const std::string &path,
+                               const struct stat &st) {
+                     if (modificationTimeNs(st) < staleBefore) {
+                         unlink(path.c_str());
+                     }
+                 });
+
+    std::sort(blobs.begin(), blobs.end());
+    const int64_t target = d_maxSize / 100 * EVICTION_TARGET_PERCENT;
+    int64_t remainingSize = scannedSize;
+    size_t evicted = 0;
+    for (const auto &blob : blobs) {
+        if (remainingSize <= target) {
+            break;
+        }
+        if (unlink((objects + blob.d_path).c_str()) == 0 ||
+            errno == ENOENT) {
+            unlink((accesses + blob.d_path).c_str());
+            remainingSize -= blob.d_size;
+            ++evicted;
+        }
+    }
+
+    // Corrects the recorded size with the one found, keeping what was
+    // inserted during the scan
+    totalSize()->fetch_add(remainingSize - recordedSize);
+    BUILDBOX_LOG_DEBUG("Evicted " << evicted << " blobs from the local CAS, "
+                                  << remainingSize << " bytes remain");
+
+    flock(lock, LOCK_UN);
+    close(lock);
+}
+
+} // namespace recc
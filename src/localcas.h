@@ -0,0 +1,147 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef INCLUDED_LOCALCAS
+#define INCLUDED_LOCALCAS
+
+#include <protos.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace recc {
+
+/**
+ * A directory holding the contents of output blobs, shared by all recc
+ * processes on a machine that use the same digest function, so that
+ * outputs already fetched or built by one of them are written from there
+ * instead of being fetched from the CAS.
+ *
+ * Each blob is stored read-only in `objects/`, sharded by the first two
+ * characters of its hash. It is written to `tmp/` first and then linked
+ * into place, so that readers only see complete blobs and concurrent
+ * inserts of the same blob keep one copy.
+ *
+ * The total size of the blobs is kept in a small memory-mapped file. When
+ * an insert makes it exceed the maximum, the least recently used blobs are
+ * removed by one process at a time. The last use of each blob is recorded
+ * as the modification time of an empty file in `access/`, with the same
+ * layout as `objects/`: access times are often not updated, and the blobs
+ * themselves are never touched, as outputs hard-linked to them in other
+ * workspaces would then look modified.
+ *
+ * Errors are logged and treated as misses: the cache is never needed for
+ * outputs to be written.
+ *
+ * This class is thread-safe.
+ */
+class LocalCas {
+  public:
+    /**
+     * Opens the cache in `directory`, creating it if it does not exist.
+     * `maxSize` is in bytes. If `hardLinks` is set, outputs that are not
+     * executable are written as hard links to the blobs, which makes them
+     * read-only.
+     */
+    LocalCas(const std::string &directory, int64_t maxSize, bool hardLinks);
+
+    ~LocalCas();
+
+    LocalCas(const LocalCas &) = delete;
+    LocalCas &operator=(const LocalCas &) = delete;
+
+    /**
+     * Returns the directory of the cache in `cacheDirectory` for the given
+     * digest function.
+     */
+    static std::string path(const std::string &cacheDirectory,
+                            const std::string &digestFunction);
+
+    /**
+     * Returns whether the blob with the given digest is in the cache,
+     * recording a hit or a miss.
+     */
+    bool contains(const proto::Digest &digest);
+
+    /**
+     * Writes the blob with the given digest to `path`, relative to
+     * `dirfd`, replacing it atomically. The contents are cloned if the
+     * filesystem supports it, and copied otherwise.
+     *
+     * Returns false if the blob is not in the cache. Throws
+     * `std::system_error` if the output can't be written.
+     */
+    bool materialize(const proto::Digest &digest, int dirfd,
+                     const std::string &path, bool executable);
+
+    /**
+     * Adds the blob with the given digest and contents, unless it is
+     * already present.
+     */
+    void insert(const proto::Digest &digest, const char *data, size_t size);
+
+    /**
+     * Adds the blob with the given digest from the file open as `fd`,
+     * which is not read from its current offset. If `verify` is set, the
+     * contents are checked against the digest first.
+     */
+    void insertFile(const proto::Digest &digest, int fd, bool verify);
+
+    /**
+     * Returns the total size of the blobs in the cache, as recorded.
+     */
+    int64_t size() const;
+
+    int64_t hits() const { return d_hits; }
+    int64_t misses() const { return d_misses; }
+
+  protected: // for unit testing
+    /**
+     * Removes the least recently used blobs until their total size is
+     * below 90% of the maximum, unless another process is doing it.
+     * Temporary files left behind by processes that exited are removed too.
+     */
+    void evict();
+
+  private:
+    typedef std::atomic<int64_t> Word;
+
+    std::string objectPath(const proto::Digest &digest) const;
+    std::string accessPath(const proto::Digest &digest) const;
+
+    // Records that the blob with the given digest was used
+    void markUsed(const proto::Digest &digest) const;
+
+    /**
+     * Creates a blob with the given digest, calling `writeBlob` with a file
+     * descriptor open on it. Exceptions thrown by `writeBlob` are logged.
+     */
+    template <typename Writer>
+    void insertWith(const proto::Digest &digest, const Writer &writeBlob);
+
+    Word *totalSize() const;
+
+    std::string d_directory;
+    int64_t d_maxSize;
+    bool d_hardLinks;
+    void *d_mapping = nullptr;
+    std::atomic<int64_t> d_hits;
+    std::atomic<int64_t> d_misses;
+};
+
+} // namespace recc
+
+#endif
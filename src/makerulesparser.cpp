@@ -0,0 +1,111 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <makerulesparser.h>
+
+namespace recc {
+
+namespace {
+
+/**
+ * Returns whether `character` may change the state of the parser. Runs of
+ * other characters are handled at once.
+ */
+inline bool isSpecial(char character)
+{
+    return character == '\\' || character == '\n' || character == ' ' ||
+           character == ':';
+}
+
+} // namespace
+
+MakeRulesParser::MakeRulesParser(bool isSunFormat,
+                                 const DependencyCallback &onDependency)
+    : d_isSunFormat(isSunFormat), d_onDependency(onDependency)
+{
+}
+
+void MakeRulesParser::parse(const char *data, size_t size)
+{
+    // The state is kept in locals while parsing, as the compiler can't keep
+    // members in registers across writes through `char` pointers
+    bool sawColonOnLine = d_sawColonOnLine;
+    bool sawBackslash = d_sawBackslash;
+
+    const char *pos = data;
+    const char *const end = data + size;
+    while (pos < end) {
+        const char character = *pos;
+        if (sawBackslash) {
+            sawBackslash = false;
+            if (character != '\n' && sawColonOnLine) {
+                d_currentFilename += character;
+            }
+            ++pos;
+        }
+        else if (character == '\\') {
+            sawBackslash = true;
+            ++pos;
+        }
+        else if (character == ':' && !sawColonOnLine) {
+            sawColonOnLine = true;
+            ++pos;
+        }
+        else if (character == '\n') {
+            sawColonOnLine = false;
+            addDependency();
+            ++pos;
+        }
+        else if (character == ' ') {
+            if (!d_isSunFormat) {
+                addDependency();
+            }
+            else if (!d_currentFilename.empty() && sawColonOnLine) {
+                d_currentFilename += character;
+            }
+            ++pos;
+        }
+        else {
+            const char *runEnd = pos + 1;
+            while (runEnd < end && !isSpecial(*runEnd)) {
+                ++runEnd;
+            }
+            // Targets (before the colon) are not dependencies
+            if (sawColonOnLine) {
+                d_currentFilename.append(pos,
+                                         static_cast<size_t>(runEnd - pos));
+            }
+            pos = runEnd;
+        }
+    }
+
+    d_sawColonOnLine = sawColonOnLine;
+    d_sawBackslash = sawBackslash;
+}
+
+void MakeRulesParser::finish() { addDependency(); }
+
+void MakeRulesParser::addDependency()
+{
+    if (d_currentFilename.empty()) {
+        return;
+    }
+    const auto inserted = d_dependencies.insert(d_currentFilename);
+    if (inserted.second && d_onDependency) {
+        d_onDependency(*inserted.first);
+    }
+    d_currentFilename.clear();
+}
+
+} // namespace recc
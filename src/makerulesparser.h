@@ -0,0 +1,94 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef INCLUDED_MAKERULESPARSER
+#define INCLUDED_MAKERULESPARSER
+
+#include <cstddef>
+#include <functional>
+#include <set>
+#include <string>
+#include <utility>
+
+namespace recc {
+
+/**
+ * Incremental parser for the Make rules written by the dependency command.
+ *
+ * The rules can be passed in chunks of any size as they are read from the
+ * compiler, so that parsing overlaps with the preprocessing and each
+ * dependency is reported as soon as it is complete.
+ */
+class MakeRulesParser {
+  public:
+    typedef std::function<void(const std::string &)> DependencyCallback;
+
+    /**
+     * If `isSunFormat` is set, the rules are expected to have one
+     * dependency per line and may contain unescaped spaces.
+     *
+     * If given, `onDependency` is called once for each distinct dependency
+     * as soon as it has been parsed.
+     */
+    explicit MakeRulesParser(
+        bool isSunFormat = false,
+        const DependencyCallback &onDependency = DependencyCallback());
+
+    /**
+     * Parses the next `size` bytes of the rules.
+     */
+    void parse(const char *data, size_t size);
+
+    void parse(const std::string &data) { parse(data.data(), data.size()); }
+
+    /**
+     * Signals the end of the rules. Must be called before reading the
+     * dependencies, as the last one may not have been terminated.
+     */
+    void finish();
+
+    /**
+     * Returns the dependencies found so far, including the input files.
+     */
+    const std::set<std::string> &dependencies() const
+    {
+        return d_dependencies;
+    }
+
+    /**
+     * Moves the dependencies out of the parser, which must not be used
+     * afterwards.
+     */
+    std::set<std::string> takeDependencies()
+    {
+        return std::move(d_dependencies);
+    }
+
+  private:
+    void addDependency();
+
+    bool d_isSunFormat;
+    DependencyCallback d_onDependency;
+
+    // State carried over between chunks
+    bool d_sawColonOnLine = false;
+    bool d_sawBackslash = false;
+    std::string d_currentFilename;
+
+    std::set<std::string> d_dependencies;
+};
+
+} // namespace recc
+
+#endif
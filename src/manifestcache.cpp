@@ -0,0 +1,326 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <manifestcache.h>
+
+#include <actionbuilder.h>
+#include <cachekey.h>
+#include <digestgenerator.h>
+#include <env.h>
+#include <fileutils.h>
+#include <reccdefaults.h>
+
+#include <buildboxcommon_exception.h>
+#include <buildboxcommon_fileutils.h>
+#include <buildboxcommon_logging.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+
+namespace recc {
+
+namespace {
+
+const std::string MANIFEST_HEADER = "recc-manifest 1";
+
+bool readDigest(std::istream &stream, proto::Digest *digest)
+{
+    std::string hash;
+    int64_t sizeBytes;
+    if (!(stream >> hash >> sizeBytes)) {
+        return false;
+    }
+    digest->set_hash(hash);
+    digest->set_size_bytes(sizeBytes);
+    return true;
+}
+
+/**
+ * Reads the remainder of the current line (after a single separating space),
+ * which holds a path that may contain spaces.
+ */
+bool readPath(std::istream &stream, std::string *path)
+{
+    if (stream.get() != ' ') {
+        return false;
+    }
+    return static_cast<bool>(std::getline(stream, *path)) && !path->empty();
+}
+
+} // namespace
+
+ManifestCache::ManifestCache(const std::string &cacheDirectory)
+    : d_cacheDirectory(cacheDirectory)
+{
+}
+
+bool ManifestCache::isSupported(const ParsedCommand &command)
+{
+    return command.is_compiler_command() && RECC_DEPS_OVERRIDE.empty() &&
+           RECC_DEPS_DIRECTORY_OVERRIDE.empty() && !RECC_FORCE_REMOTE &&
+           !RECC_SKIP_CACHE;
+}
+
+std::string ManifestCache::computeKey(const ParsedCommand &command,
+                                      const std::string &cwd)
+{
+    std::string keyData;
+    appendField(&keyData, MANIFEST_HEADER);
+
+    const std::vector<std::string> arguments = command.get_command();
+    appendField(&keyData, FileUtils::executableIdentity(arguments.at(0)));
+    appendField(&keyData, std::to_string(arguments.size()));
+    for (const auto &argument : arguments) {
+        appendField(&keyData, argument);
+    }
+    appendField(&keyData, cwd);
+
+    appendField(&keyData, "remote_env",
+                ActionBuilder::prepareRemoteEnv(command));
+    appendField(&keyData, "remote_platform", RECC_REMOTE_PLATFORM);
+    appendField(&keyData, "deps_env", RECC_DEPS_ENV);
+    appendField(&keyData, "deps_exclude_paths", RECC_DEPS_EXCLUDE_PATHS);
+    appendField(&keyData, "output_files", RECC_OUTPUT_FILES_OVERRIDE);
+    appendField(&keyData, "output_directories",
+                RECC_OUTPUT_DIRECTORIES_OVERRIDE);
+
+    const std::map<std::string, std::string> settings = {
+        {"action_salt", RECC_ACTION_SALT},
+        {"reapi_version", RECC_REAPI_VERSION},
+        {"digest_function", RECC_CAS_DIGEST_FUNCTION},
+        {"project_root", RECC_PROJECT_ROOT},
+        {"working_dir_prefix", RECC_WORKING_DIR_PREFIX},
+        {"no_path_rewrite", std::to_string(RECC_NO_PATH_REWRITE)},
+        {"deps_global_paths", std::to_string(RECC_DEPS_GLOBAL_PATHS)},
+        {"action_uncacheable", std::to_string(RECC_ACTION_UNCACHEABLE)}};
+    appendField(&keyData, "settings", settings);
+
+    appendField(&keyData, "prefix_map");
+    for (const auto &replacement : RECC_PREFIX_REPLACEMENT) {
+        appendField(&keyData, replacement.first);
+        appendField(&keyData, replacement.second);
+    }
+
+    // Including the digests of the source files keeps the number of entries
+    // per manifest small when the same object is rebuilt from a changing
+    // source file.
+    appendField(&keyData, "input_files");
+    for (const auto &inputFile : command.d_inputFiles) {
+        const auto file = DigestGenerator::make_file_digest(inputFile);
+        appendField(&keyData, inputFile);
+        appendField(&keyData, proto::toString(file.d_digest));
+    }
+
+    return DigestGenerator::make_digest(keyData).hash();
+}
+
+ManifestCache::Entry ManifestCache::createEntry(
+    const proto::Digest &actionDigest, const std::set<std::string> &products,
+    const std::set<std::string> &dependencies,
+    const buildboxcommon::digest_string_map &digest_to_filepaths)
+{
+    std::unordered_map<std::string, proto::Digest> knownDigests;
+    for (const auto &it : digest_to_filepaths) {
+        knownDigests.emplace(it.second, it.first);
+    }
+
+    Entry entry;
+    entry.d_actionDigest = actionDigest;
+    entry.d_products = products;
+    for (const auto &dependency : dependencies) {
+        const auto known = knownDigests.find(dependency);
+        if (known != knownDigests.end()) {
+            entry.d_dependencies[dependency] = known->second;
+        }
+        else {
+            entry.d_dependencies[dependency] =
+                DigestGenerator::make_file_digest(dependency).d_digest;
+        }
+    }
+    return entry;
+}
+
+std::string ManifestCache::manifestPath(const std::string &key) const
+{
+    return d_cacheDirectory + "/" + key.substr(0, 2) + "/" + key;
+}
+
+std::string
+ManifestCache::serializeEntries(const std::vector<Entry> &entries)
+{
+    std::ostringstream out;
+    out << MANIFEST_HEADER << "\n";
+    for (const auto &entry : entries) {
+        out << "entry " << entry.d_actionDigest.hash() << " "
+            << entry.d_actionDigest.size_bytes() << " "
+            << entry.d_products.size() << " " << entry.d_dependencies.size()
+            << "\n";
+        for (const auto &product : entry.d_products) {
+            out << "product " << product << "\n";
+        }
+        for (const auto &dependency : entry.d_dependencies) {
+            out << "dep " << dependency.second.hash() << " "
+                << dependency.second.size_bytes() << " " << dependency.first
+                << "\n";
+        }
+    }
+    return out.str();
+}
+
+std::vector<ManifestCache::Entry>
+ManifestCache::deserializeEntries(const std::string &data)
+{
+    std::istringstream in(data);
+    std::string line;
+    if (!std::getline(in, line) || line != MANIFEST_HEADER) {
+        BUILDBOXCOMMON_THROW_EXCEPTION(std::runtime_error,
+                                       "Unsupported manifest format");
+    }
+
+    std::vector<Entry> entries;
+    std::string tag;
+    while (in >> tag) {
+        size_t numProducts = 0;
+        size_t numDependencies = 0;
+        Entry entry;
+        if (tag != "entry" || !readDigest(in, &entry.d_actionDigest) ||
+            !(in >> numProducts >> numDependencies)) {
+            BUILDBOXCOMMON_THROW_EXCEPTION(std::runtime_error,
+                                           "Malformed manifest entry");
+        }
+        in.ignore(); // newline
+
+        for (size_t i = 0; i < numProducts; ++i) {
+            std::string product;
+            if (!(in >> tag) || tag != "product" || !readPath(in, &product)) {
+                BUILDBOXCOMMON_THROW_EXCEPTION(std::runtime_error,
+                                               "Malformed manifest product");
+            }
+            entry.d_products.insert(product);
+        }
+
+        for (size_t i = 0; i < numDependencies; ++i) {
+            proto::Digest digest;
+            std::string path;
+            if (!(in >> tag) || tag != "dep" || !readDigest(in, &digest) ||
+                !readPath(in, &path)) {
+                BUILDBOXCOMMON_THROW_EXCEPTION(
+                    std::runtime_error, "Malformed manifest dependency");
+            }
+            entry.d_dependencies[path] = digest;
+        }
+
+        entries.push_back(std::move(entry));
+    }
+    return entries;
+}
+
+std::vector<ManifestCache::Entry>
+ManifestCache::readEntries(const std::string &key) const
+{
+    const std::string path = manifestPath(key);
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    if (!file.good()) {
+        return {};
+    }
+    std::ostringstream contents;
+    contents << file.rdbuf();
+
+    try {
+        return deserializeEntries(contents.str());
+    }
+    catch (const std::runtime_error &e) {
+        BUILDBOX_LOG_WARNING("Ignoring manifest \"" << path
+                                                    << "\": " << e.what());
+        return {};
+    }
+}
+
+bool ManifestCache::lookup(const std::string &key, Entry *entry) const
+{
+    const std::vector<Entry> entries = readEntries(key);
+
+    // Entries commonly share most of their headers, so hash each file at
+    // most once. An empty hash marks a file that could not be read.
+    std::unordered_map<std::string, proto::Digest> currentDigests;
+    const auto currentDigest = [&](const std::string &path) {
+        auto it = currentDigests.find(path);
+        if (it == currentDigests.end()) {
+            proto::Digest digest;
+            try {
+                digest = DigestGenerator::make_file_digest(path).d_digest;
+            }
+            catch (const std::exception &) {
+                digest.Clear();
+            }
+            it = currentDigests.emplace(path, digest).first;
+        }
+        return it->second;
+    };
+
+    for (const auto &candidate : entries) {
+        bool matches = true;
+        for (const auto &dependency : candidate.d_dependencies) {
+            const proto::Digest digest = currentDigest(dependency.first);
+            if (digest.hash().empty() || digest != dependency.second) {
+                BUILDBOX_LOG_DEBUG("Direct mode: \"" << dependency.first
+                                                     << "\" changed");
+                matches = false;
+                break;
+            }
+        }
+
+        if (matches) {
+            *entry = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ManifestCache::store(const std::string &key, const Entry &entry) const
+{
+    for (const auto &dependency : entry.d_dependencies) {
+        if (dependency.first.find('\n') != std::string::npos) {
+            BUILDBOX_LOG_DEBUG("Not storing manifest entry for a dependency "
+                               "path containing a newline");
+            return;
+        }
+    }
+
+    std::vector<Entry> entries = {entry};
+    for (auto &existing : readEntries(key)) {
+        if (entries.size() >= DEFAULT_RECC_MANIFEST_MAX_ENTRIES) {
+            break;
+        }
+        if (existing.d_actionDigest != entry.d_actionDigest) {
+            entries.push_back(std::move(existing));
+        }
+    }
+
+    const std::string path = manifestPath(key);
+    const std::string directory = path.substr(0, path.rfind('/'));
+    buildboxcommon::FileUtils::createDirectory(directory.c_str());
+    // Written to a temporary file and renamed into place so that concurrent
+    // readers never see a partial manifest.
+    buildboxcommon::FileUtils::writeFileAtomically(
+        path, serializeEntries(entries), 0644, directory);
+}
+
+} // namespace recc
@@ -0,0 +1,127 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef INCLUDED_MANIFESTCACHE
+#define INCLUDED_MANIFESTCACHE
+
+#include <parsedcommand.h>
+#include <protos.h>
+
+#include <buildboxcommon_merklize.h>
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace recc {
+
+/**
+ * Local cache of previously observed dependency sets ("direct mode").
+ *
+ * A manifest is keyed by everything that influences the `Action` apart from
+ * the contents of the headers: the compiler, the command line, the working
+ * directory, the remote environment and platform, the relevant recc
+ * configuration and the digests of the source files. Each manifest stores a
+ * small number of entries, each consisting of the dependencies that the
+ * compiler reported together with their digests and the digest of the
+ * resulting `Action`.
+ *
+ * If all the dependencies recorded in an entry still have the same digests,
+ * the `Action` digest can be used to query the action cache without running
+ * the dependency command or building the input root.
+ *
+ * As with other compiler caches, a header newly created earlier in the
+ * include search path than a previously recorded one is not detected.
+ */
+class ManifestCache {
+  public:
+    struct Entry {
+        proto::Digest d_actionDigest;
+        std::set<std::string> d_products;
+        // Local path of each dependency to its digest
+        std::map<std::string, proto::Digest> d_dependencies;
+    };
+
+    /**
+     * Manifests are stored in files below `cacheDirectory`, which is created
+     * on demand.
+     */
+    explicit ManifestCache(const std::string &cacheDirectory);
+
+    /**
+     * Returns whether direct mode can be used for the given command with the
+     * current configuration. (For example, it is disabled when the
+     * dependencies are overridden, since the dependency command is not run in
+     * that case.)
+     */
+    static bool isSupported(const ParsedCommand &command);
+
+    /**
+     * Computes the key of the manifest for the given command.
+     *
+     * Throws `std::runtime_error` if one of the input files cannot be read.
+     */
+    static std::string computeKey(const ParsedCommand &command,
+                                  const std::string &cwd);
+
+    /**
+     * Creates an entry from the results of building an `Action`.
+     *
+     * The digests of dependencies are taken from `digest_to_filepaths` where
+     * possible, the remaining ones (for example excluded system headers) are
+     * hashed.
+     */
+    static Entry
+    createEntry(const proto::Digest &actionDigest,
+                const std::set<std::string> &products,
+                const std::set<std::string> &dependencies,
+                const buildboxcommon::digest_string_map &digest_to_filepaths);
+
+    /**
+     * Looks for an entry of the manifest with the given key whose recorded
+     * dependencies all match the files currently on disk. Returns `true` and
+     * writes it to `entry` if one is found.
+     */
+    bool lookup(const std::string &key, Entry *entry) const;
+
+    /**
+     * Adds `entry` to the manifest with the given key, keeping only the most
+     * recent `DEFAULT_RECC_MANIFEST_MAX_ENTRIES` entries.
+     */
+    void store(const std::string &key, const Entry &entry) const;
+
+    /**
+     * Returns the path to the file storing the manifest with the given key.
+     */
+    std::string manifestPath(const std::string &key) const;
+
+  protected: // for unit testing
+    static std::string serializeEntries(const std::vector<Entry> &entries);
+
+    /**
+     * Parses the contents of a manifest file. Throws `std::runtime_error`
+     * if the data is malformed.
+     */
+    static std::vector<Entry> deserializeEntries(const std::string &data);
+
+    std::vector<Entry> readEntries(const std::string &key) const;
+
+  private:
+    std::string d_cacheDirectory;
+};
+
+} // namespace recc
+
+#endif
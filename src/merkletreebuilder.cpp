@@ -0,0 +1,368 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <merkletreebuilder.h>
+
+#include <digestgenerator.h>
+#include <subtreedigestcache.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <numeric>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace recc {
+
+namespace {
+
+// Orders paths so that the contents of a directory immediately follow it,
+// with `/` sorting before any other character. Siblings are then in the byte
+// order of their names, as required in a `Directory`.
+bool pathLess(const char *a, size_t aLength, const char *b, size_t bLength)
+{
+    const size_t length = std::min(aLength, bLength);
+    for (size_t i = 0; i < length; ++i) {
+        if (a[i] != b[i]) {
+            const int x =
+                (a[i] == '/') ? 0 : static_cast<unsigned char>(a[i]) + 1;
+            const int y =
+                (b[i] == '/') ? 0 : static_cast<unsigned char>(b[i]) + 1;
+            return x < y;
+        }
+    }
+    return aLength < bLength;
+}
+
+std::string readSymlink(const std::string &path)
+{
+    std::vector<char> buffer(256);
+    while (true) {
+        const ssize_t length =
+            readlink(path.c_str(), buffer.data(), buffer.size());
+        if (length < 0) {
+            throw std::system_error(errno, std::system_category(),
+                                    "Could not read symlink \"" + path +
+                                        "\"");
+        }
+        if (static_cast<size_t>(length) < buffer.size()) {
+            return std::string(buffer.data(), static_cast<size_t>(length));
+        }
+        buffer.resize(buffer.size() * 2);
+    }
+}
+
+} // namespace
+
+MerkleTreeBuilder::MerkleTreeBuilder(SubtreeDigestCache *subtreeDigestCache)
+    : d_subtreeDigestCache(subtreeDigestCache)
+{
+}
+
+MerkleTreeBuilder::Entry &MerkleTreeBuilder::addEntry(const std::string &path,
+                                                      EntryType type)
+{
+    d_entries.emplace_back();
+    Entry &entry = d_entries.back();
+    entry.d_pathOffset = d_strings.size();
+    entry.d_targetOffset = 0;
+    entry.d_targetLength = 0;
+    entry.d_type = type;
+    entry.d_executable = false;
+
+    // Append the segments of the path, skipping empty and `.` ones
+    size_t start = 0;
+    while (start < path.size()) {
+        size_t end = path.find('/', start);
+        if (end == std::string::npos) {
+            end = path.size();
+        }
+        const size_t length = end - start;
+        if (length > 0 && !(length == 1 && path[start] == '.')) {
+            if (d_strings.size() > entry.d_pathOffset) {
+                d_strings += '/';
+            }
+            d_strings.append(path, start, length);
+        }
+        start = end + 1;
+    }
+    entry.d_pathLength = d_strings.size() - entry.d_pathOffset;
+    return entry;
+}
+
+void MerkleTreeBuilder::addFile(const std::string &path,
+                                const proto::Digest &digest, bool executable)
+{
+    Entry &entry = addEntry(path, EntryType::File);
+    entry.d_digest = digest;
+    entry.d_executable = executable;
+}
+
+void MerkleTreeBuilder::addSymlink(const std::string &path,
+                                   const std::string &target)
+{
+    Entry &entry = addEntry(path, EntryType::Symlink);
+    entry.d_targetOffset = d_strings.size();
+    entry.d_targetLength = target.size();
+    d_strings += target;
+}
+
+void MerkleTreeBuilder::addDirectory(const std::string &path)
+{
+    addEntry(path, EntryType::Directory);
+}
+
+void MerkleTreeBuilder::addLocalDirectory(
+    const std::string &directory, const std::string &path,
+    buildboxcommon::digest_string_map *digestToFilePaths)
+{
+    addDirectory(path);
+
+    // List the directory before visiting its subdirectories, so that only
+    // one is open at a time
+    DIR *dir = opendir(directory.c_str());
+    if (dir == nullptr) {
+        throw std::system_error(errno, std::system_category(),
+                                "Could not open directory \"" + directory +
+                                    "\"");
+    }
+    std::vector<std::string> names;
+    while (const struct dirent *dirEntry = readdir(dir)) {
+        const std::string name = dirEntry->d_name;
+        if (name != "." && name != "..") {
+            names.push_back(name);
+        }
+    }
+    closedir(dir);
+
+    // Regular files are hashed together once the directory is listed
+    std::vector<std::string> filePaths;
+    std::vector<std::string> fileMerklePaths;
+    for (const auto &name : names) {
+        const std::string localPath = directory + "/" + name;
+        const std::string merklePath = path.empty() ? name : path + "/" + name;
+
+        struct stat statResult;
+        if (lstat(localPath.c_str(), &statResult) != 0) {
+            throw std::system_error(errno, std::system_category(),
+                                    "Could not stat \"" + localPath + "\"");
+        }
+        if (S_ISLNK(statResult.st_mode)) {
+            addSymlink(merklePath, readSymlink(localPath));
+        }
+        else if (S_ISDIR(statResult.st_mode)) {
+            addLocalDirectory(localPath, merklePath, digestToFilePaths);
+        }
+        else if (S_ISREG(statResult.st_mode)) {
+            filePaths.push_back(localPath);
+            fileMerklePaths.push_back(merklePath);
+        }
+    }
+
+    const std::vector<buildboxcommon::File> files =
+        DigestGenerator::make_file_digests(filePaths);
+    for (size_t i = 0; i < files.size(); ++i) {
+        addFile(fileMerklePaths[i], files[i].d_digest,
+                files[i].d_executable);
+        if (digestToFilePaths != nullptr) {
+            (*digestToFilePaths)[files[i].d_digest] = filePaths[i];
+        }
+    }
+}
+
+proto::Digest
+MerkleTreeBuilder::emit(const Frame &frame,
+                        buildboxcommon::digest_string_map *blobs) const
+{
+    const char *strings = d_strings.data();
+    const auto leafName = [this, strings](
+                              const std::pair<size_t, size_t> &leaf,
+                              size_t *length) {
+        const Entry &entry = d_entries[leaf.first];
+        *length = entry.d_pathLength - leaf.second;
+        return strings + entry.d_pathOffset + leaf.second;
+    };
+
+    // An unchanged subtree is reused without building its `Directory`
+    std::string key;
+    if (d_subtreeDigestCache != nullptr) {
+        std::string keyData;
+        for (const auto &leaf : frame.d_leaves) {
+            const Entry &entry = d_entries[leaf.first];
+            size_t nameLength;
+            const char *name = leafName(leaf, &nameLength);
+            if (entry.d_type == EntryType::File) {
+                SubtreeDigestCache::appendFile(&keyData, name, nameLength,
+                                               entry.d_digest,
+                                               entry.d_executable);
+            }
+            else {
+                SubtreeDigestCache::appendSymlink(
+                    &keyData, name, nameLength,
+                    strings + entry.d_targetOffset, entry.d_targetLength);
+            }
+        }
+        for (const auto &subdirectory : frame.d_directories) {
+            SubtreeDigestCache::appendDirectory(
+                &keyData, subdirectory.first.data(),
+                subdirectory.first.size(), subdirectory.second);
+        }
+        key = SubtreeDigestCache::computeKey(keyData);
+
+        proto::Digest digest;
+        std::string blob;
+        if (d_subtreeDigestCache->lookup(key, &digest, &blob)) {
+            if (blobs != nullptr) {
+                (*blobs)[digest] = std::move(blob);
+            }
+            return digest;
+        }
+    }
+
+    proto::Directory directory;
+    for (const auto &leaf : frame.d_leaves) {
+        const Entry &entry = d_entries[leaf.first];
+        size_t nameLength;
+        const char *name = leafName(leaf, &nameLength);
+        if (entry.d_type == EntryType::File) {
+            auto node = directory.add_files();
+            node->set_name(name, nameLength);
+            node->mutable_digest()->CopyFrom(entry.d_digest);
+            node->set_is_executable(entry.d_executable);
+        }
+        else {
+            auto node = directory.add_symlinks();
+            node->set_name(name, nameLength);
+            node->set_target(strings + entry.d_targetOffset,
+                             entry.d_targetLength);
+        }
+    }
+    for (const auto &subdirectory : frame.d_directories) {
+        auto node = directory.add_directories();
+        node->set_name(subdirectory.first);
+        node->mutable_digest()->CopyFrom(subdirectory.second);
+    }
+
+    std::string blob = directory.SerializeAsString();
+    const proto::Digest digest = DigestGenerator::make_digest(blob);
+    if (d_subtreeDigestCache != nullptr) {
+        d_subtreeDigestCache->store(key, digest, blob);
+    }
+    if (blobs != nullptr) {
+        (*blobs)[digest] = std::move(blob);
+    }
+    return digest;
+}
+
+proto::Digest
+MerkleTreeBuilder::build(buildboxcommon::digest_string_map *blobs)
+{
+    // Sort indexes rather than the entries themselves, which are larger
+    std::vector<size_t> order(d_entries.size());
+    std::iota(order.begin(), order.end(), 0);
+    const char *strings = d_strings.data();
+    std::stable_sort(
+        order.begin(), order.end(), [this, strings](size_t a, size_t b) {
+            return pathLess(strings + d_entries[a].d_pathOffset,
+                            d_entries[a].d_pathLength,
+                            strings + d_entries[b].d_pathOffset,
+                            d_entries[b].d_pathLength);
+        });
+
+    const auto samePath = [strings](const Entry &a, const Entry &b) {
+        return a.d_pathLength == b.d_pathLength &&
+               memcmp(strings + a.d_pathOffset, strings + b.d_pathOffset,
+                      a.d_pathLength) == 0;
+    };
+
+    // `frames[i + 1]` is the directory named by the `i`th segment of the
+    // current path
+    std::vector<Frame> frames(1);
+    const auto closeFrame = [&]() {
+        Frame &frame = frames.back();
+        const proto::Digest digest = emit(frame, blobs);
+        frames[frames.size() - 2].d_directories.emplace_back(
+            std::move(frame.d_name), digest);
+        frames.pop_back();
+    };
+
+    // (offset, length) of each segment of the current path
+    std::vector<std::pair<size_t, size_t>> segments;
+    for (size_t i = 0; i < order.size(); ++i) {
+        const Entry &entry = d_entries[order[i]];
+
+        // Keep only the last entry of each type for a path
+        bool replaced = false;
+        for (size_t j = i + 1;
+             j < order.size() && samePath(entry, d_entries[order[j]]); ++j) {
+            replaced = replaced || d_entries[order[j]].d_type == entry.d_type;
+        }
+        if (replaced) {
+            continue;
+        }
+
+        const char *path = strings + entry.d_pathOffset;
+        segments.clear();
+        size_t start = 0;
+        for (size_t p = 0; p <= entry.d_pathLength; ++p) {
+            if (p == entry.d_pathLength || path[p] == '/') {
+                segments.emplace_back(start, p - start);
+                start = p + 1;
+            }
+        }
+        if (entry.d_pathLength == 0) {
+            // The root directory
+            segments.clear();
+            if (entry.d_type != EntryType::Directory) {
+                continue;
+            }
+        }
+        const size_t depth = (entry.d_type == EntryType::Directory)
+                                 ? segments.size()
+                                 : segments.size() - 1;
+
+        // Emit the directories that don't contain this entry and open the
+        // ones that do
+        size_t common = 0;
+        while (common + 1 < frames.size() && common < depth &&
+               frames[common + 1].d_name.compare(
+                   0, std::string::npos, path + segments[common].first,
+                   segments[common].second) == 0) {
+            ++common;
+        }
+        while (frames.size() > common + 1) {
+            closeFrame();
+        }
+        for (size_t s = common; s < depth; ++s) {
+            frames.emplace_back();
+            frames.back().d_name.assign(path + segments[s].first,
+                                        segments[s].second);
+        }
+
+        if (entry.d_type != EntryType::Directory) {
+            frames.back().d_leaves.emplace_back(order[i],
+                                                segments.back().first);
+        }
+    }
+
+    while (frames.size() > 1) {
+        closeFrame();
+    }
+    return emit(frames.front(), blobs);
+}
+
+} // namespace recc
@@ -0,0 +1,124 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef INCLUDED_MERKLETREEBUILDER
+#define INCLUDED_MERKLETREEBUILDER
+
+#include <protos.h>
+
+#include <buildboxcommon_merklize.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace recc {
+
+class SubtreeDigestCache;
+
+/**
+ * Builds the `Directory` messages of a Merkle tree from a flat list of
+ * paths.
+ *
+ * Entries are stored in a single vector and their paths in a single buffer.
+ * `build()` sorts them so that the contents of each directory are
+ * contiguous, then emits every `Directory` in one pass, bottom-up, as soon
+ * as all of its children are known. This produces the same digests as
+ * `buildboxcommon::NestedDirectory` without allocating a map per directory.
+ *
+ * Paths are relative to the root of the tree: leading slashes, empty and `.`
+ * segments are ignored. If a path is added twice with the same type, the
+ * last entry is kept.
+ */
+class MerkleTreeBuilder {
+  public:
+    /**
+     * If `subtreeDigestCache` is set, directories are looked up in it
+     * before building, serializing and hashing their `Directory`.
+     */
+    explicit MerkleTreeBuilder(
+        SubtreeDigestCache *subtreeDigestCache = nullptr);
+
+    void addFile(const std::string &path, const proto::Digest &digest,
+                 bool executable);
+
+    void addSymlink(const std::string &path, const std::string &target);
+
+    /**
+     * Adds a directory, which is empty in the tree if nothing is added in it.
+     * Parent directories of files and symlinks don't need to be added.
+     */
+    void addDirectory(const std::string &path);
+
+    /**
+     * Adds the contents of the local directory `directory` under `path`,
+     * hashing the files it contains and not following symlinks. The digest
+     * of each file is mapped to its local path in `digestToFilePaths`.
+     *
+     * Throws `std::system_error` if the directory can't be read.
+     */
+    void
+    addLocalDirectory(const std::string &directory, const std::string &path,
+                      buildboxcommon::digest_string_map *digestToFilePaths);
+
+    size_t size() const { return d_entries.size(); }
+
+    /**
+     * Returns the digest of the root directory, storing the serialized
+     * `Directory` messages in `blobs` if it is set.
+     */
+    proto::Digest build(buildboxcommon::digest_string_map *blobs = nullptr);
+
+  private:
+    enum class EntryType : uint8_t { Directory, File, Symlink };
+
+    struct Entry {
+        // Location of the normalized path in `d_strings`
+        size_t d_pathOffset;
+        size_t d_pathLength;
+        // Location of the target of a symlink in `d_strings`
+        size_t d_targetOffset;
+        size_t d_targetLength;
+        EntryType d_type;
+        bool d_executable;
+        proto::Digest d_digest;
+    };
+
+    // A directory of the path being visited by `build()`, which is emitted
+    // once all of its children have been added
+    struct Frame {
+        std::string d_name;
+        // Indexes of the files and symlinks in `d_entries`, in order, with
+        // the offset of their name in their path
+        std::vector<std::pair<size_t, size_t>> d_leaves;
+        std::vector<std::pair<std::string, proto::Digest>> d_directories;
+    };
+
+    Entry &addEntry(const std::string &path, EntryType type);
+
+    // Returns the digest of the directory of `frame`, storing its serialized
+    // `Directory` in `blobs` if it is set
+    proto::Digest emit(const Frame &frame,
+                       buildboxcommon::digest_string_map *blobs) const;
+
+    SubtreeDigestCache *d_subtreeDigestCache;
+    std::vector<Entry> d_entries;
+    std::string d_strings;
+};
+
+} // namespace recc
+
+#endif
@@ -0,0 +1,562 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <outputdownloader.h>
+
+#include <digestgenerator.h>
+#include <filecontents.h>
+#include <filedigestcache.h>
+#include <localcas.h>
+#include <threadpool.h>
+
+#include <buildboxcommon_logging.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <exception>
+#include <fcntl.h>
+#include <limits>
+#include <future>
+#include <set>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace recc {
+
+// Larger blobs are streamed to disk rather than held in memory
+const size_t OutputDownloader::MAX_BATCHED_BLOB_SIZE = 1024 * 1024;
+
+// Under the limit of most servers, so that each batch is one request
+const size_t OutputDownloader::MAX_BATCH_SIZE = 2 * 1024 * 1024;
+
+namespace {
+
+std::string joinPath(const std::string &directory, const std::string &name)
+{
+    return directory.empty() ? name : directory + "/" + name;
+}
+
+std::string parentPath(const std::string &path)
+{
+    const size_t slash = path.rfind('/');
+    return slash == std::string::npos ? "" : path.substr(0, slash);
+}
+
+// Create the directory at `path` relative to `dirfd` and its parents.
+void createDirectories(int dirfd, const std::string &path)
+{
+    if (path.empty()) {
+        return;
+    }
+    size_t end = 0;
+    while (end != std::string::npos) {
+        end = path.find('/', end + 1);
+        const std::string directory = path.substr(0, end);
+        if (mkdirat(dirfd, directory.c_str(), 0777) != 0 && errno != EEXIST) {
+            throw std::system_error(errno, std::system_category(),
+                                    "Could not create directory \"" +
+                                        directory + "\"");
+        }
+    }
+}
+
+void writeAll(int fd, const std::string &path, const char *data, size_t size)
+{
+    while (size > 0) {
+        const ssize_t written = write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::system_error(errno, std::system_category(),
+                                    "Could not write \"" + path + "\"");
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+    }
+}
+
+void throwIfDigestMismatch(const std::string &path,
+                           const proto::Digest &expected,
+                           const proto::Digest &actual)
+{
+    if (actual != expected) {
+        throw std::runtime_error(
+            "Contents fetched for \"" + path + "\" have the digest " +
+            proto::toString(actual) + " instead of " +
+            proto::toString(expected));
+    }
+}
+
+/**
+ * A file written next to `path`, relative to `dirfd`, and renamed to it by
+ * `publish()`. It is removed if not published.
+ */
+class TemporaryOutput {
+  public:
+    TemporaryOutput(int dirfd, const std::string &path, bool executable,
+                    size_t size)
+        : d_dirfd(dirfd), d_path(path)
+    {
+        static std::atomic<unsigned> s_count(0);
+        const std::string name = path.substr(path.rfind('/') + 1);
+        d_temporaryPath = joinPath(parentPath(path),
+                                   ".recc-" + name + "." +
+                                       std::to_string(getpid()) + "." +
+                                       std::to_string(s_count++));
+
+        // The mode is subject to the umask, as when the compiler writes it
+        d_fd = openat(dirfd, d_temporaryPath.c_str(),
+                      O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC,
+                      executable ? 0777 : 0666);
+        if (d_fd < 0) {
+            throw std::system_error(errno, std::system_category(),
+                                    "Could not create \"" + d_temporaryPath +
+                                        "\"");
+        }
+#ifdef __linux__
+        // Avoids fragmenting large outputs. Unlike `posix_fallocate()`, this
+        // is not emulated where it is not supported.
+        if (size > 0) {
+            fallocate(d_fd, 0, 0, static_cast<off_t>(size));
+        }
+#else
+        (void)size;
+#endif
+    }
+
+    ~TemporaryOutput()
+    {
+        if (d_fd >= 0) {
+            close(d_fd);
+        }
+        if (!d_published) {
+            unlinkat(d_dirfd, d_temporaryPath.c_str(), 0);
+        }
+    }
+
+    TemporaryOutput(const TemporaryOutput &) = delete;
+    TemporaryOutput &operator=(const TemporaryOutput &) = delete;
+
+    int fd() const { return d_fd; }
+
+    void publish()
+    {
+        close(d_fd);
+        d_fd = -1;
+        if (renameat(d_dirfd, d_temporaryPath.c_str(), d_dirfd,
+                     d_path.c_str()) != 0) {
+            throw std::system_error(errno, std::system_category(),
+                                    "Could not rename \"" + d_temporaryPath +
+                                        "\" to \"" + d_path + "\"");
+        }
+        d_published = true;
+    }
+
+  private:
+    int d_dirfd;
+    std::string d_path;
+    std::string d_temporaryPath;
+    int d_fd;
+    bool d_published = false;
+};
+
+int64_t modificationTimeNs(const struct stat &st)
+{
+#ifdef __APPLE__
+    const struct timespec &time = st.st_mtimespec;
+#else
+    const struct timespec &time = st.st_mtim;
+#endif
+    return static_cast<int64_t>(time.tv_sec) * 1000000000 + time.tv_nsec;
+}
+
+void writeFile(int dirfd, const std::string &path, bool executable,
+               const char *data, size_t size)
+{
+    TemporaryOutput output(dirfd, path, executable, size);
+    writeAll(output.fd(), path, data, size);
+    output.publish();
+}
+
+} // namespace
+
+OutputDownloader::OutputDownloader(buildboxcommon::CASClient *casClient,
+                                   ThreadPool *pool, LocalCas *localCas)
+    : d_casClient(casClient), d_pool(pool), d_localCas(localCas)
+{
+}
+
+OutputDownloader::~OutputDownloader() {}
+
+void OutputDownloader::download(const proto::ActionResult &result, int dirfd)
+{
+    d_files.clear();
+    d_digests.clear();
+    d_directories.clear();
+    d_symlinks.clear();
+
+    for (const auto &file : result.output_files()) {
+        d_files[file.digest().hash()].push_back(
+            {file.path(), file.is_executable()});
+        d_digests[file.digest().hash()] = file.digest();
+    }
+
+    // Fetch the trees of the output directories together
+    std::vector<std::future<std::string>> trees;
+    for (const auto &directory : result.output_directories()) {
+        const proto::Digest digest = directory.tree_digest();
+        trees.push_back(
+            d_pool->submit([this, digest]() { return fetchBlob(digest); }));
+    }
+    for (int i = 0; i < result.output_directories_size(); ++i) {
+        proto::Tree tree;
+        if (!tree.ParseFromString(d_pool->wait(trees[i]))) {
+            throw std::runtime_error(
+                "Could not parse the tree of output directory \"" +
+                result.output_directories(i).path() + "\"");
+        }
+        addTree(result.output_directories(i).path(), tree);
+    }
+
+    // Servers may report symlinks both in `output_symlinks` and in the
+    // fields it replaces
+    for (const auto &symlinks :
+         {&result.output_file_symlinks(), &result.output_directory_symlinks(),
+          &result.output_symlinks()}) {
+        for (const auto &symlink : *symlinks) {
+            d_symlinks[symlink.path()] = symlink.target();
+        }
+    }
+
+    std::set<std::string> directories(d_directories.cbegin(),
+                                      d_directories.cend());
+    for (const auto &files : d_files) {
+        for (const auto &file : files.second) {
+            directories.insert(parentPath(file.d_path));
+        }
+    }
+    for (const auto &symlink : d_symlinks) {
+        directories.insert(parentPath(symlink.first));
+    }
+    for (const auto &directory : directories) {
+        createDirectories(dirfd, directory);
+    }
+
+    // One task per batch of small blobs and per large blob. Blobs in the
+    // local CAS are written meanwhile.
+    std::vector<std::future<void>> tasks;
+    std::vector<proto::Digest> batch;
+    size_t batchSize = 0;
+    const auto submitBatch = [&]() {
+        if (batch.empty()) {
+            return;
+        }
+        tasks.push_back(d_pool->submit(
+            [this, batch, dirfd]() { writeBatch(batch, dirfd); }));
+        batch.clear();
+        batchSize = 0;
+    };
+    const auto fetch = [&](const proto::Digest &digest) {
+        const size_t size = static_cast<size_t>(digest.size_bytes());
+        if (size > MAX_BATCHED_BLOB_SIZE) {
+            tasks.push_back(d_pool->submit([this, digest, dirfd]() {
+                writeLargeBlob(digest, dirfd);
+            }));
+            return;
+        }
+        if (!batch.empty() && batchSize + size > MAX_BATCH_SIZE) {
+            submitBatch();
+        }
+        batch.push_back(digest);
+        batchSize += size;
+    };
+    std::vector<proto::Digest> local;
+    for (const auto &digest : d_digests) {
+        if (d_localCas != nullptr && digest.second.size_bytes() > 0 &&
+            d_localCas->contains(digest.second)) {
+            local.push_back(digest.second);
+        }
+        else {
+            fetch(digest.second);
+        }
+    }
+    submitBatch();
+
+    std::exception_ptr error;
+    try {
+        for (const auto &digest : local) {
+            // Evicted since it was looked up
+            if (!writeFromLocalCas(digest, dirfd)) {
+                fetch(digest);
+            }
+        }
+        submitBatch();
+
+        for (const auto &symlink : d_symlinks) {
+            if (unlinkat(dirfd, symlink.first.c_str(), 0) != 0 &&
+                errno != ENOENT) {
+                throw std::system_error(errno, std::system_category(),
+                                        "Could not replace \"" +
+                                            symlink.first + "\"");
+            }
+            if (symlinkat(symlink.second.c_str(), dirfd,
+                          symlink.first.c_str()) != 0) {
+                throw std::system_error(errno, std::system_category(),
+                                        "Could not create symlink \"" +
+                                            symlink.first + "\"");
+            }
+        }
+    }
+    catch (...) {
+        error = std::current_exception();
+    }
+
+    // The tasks refer to this object: wait for all of them
+    for (auto &task : tasks) {
+        try {
+            d_pool->wait(task);
+        }
+        catch (...) {
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+size_t OutputDownloader::skipUnchangedFiles(
+    proto::ActionResult *result, const std::set<std::string> &inputs,
+    FileDigestCache *fileDigestCache)
+{
+    // Only regular files of the right size and mode need to be hashed
+    std::vector<int> candidates;
+    std::vector<std::string> paths;
+    std::vector<int64_t> modificationTimes;
+    for (int i = 0; i < result->output_files_size(); ++i) {
+        const proto::OutputFile &file = result->output_files(i);
+        struct stat st;
+        if (stat(file.path().c_str(), &st) == 0 && S_ISREG(st.st_mode) &&
+            st.st_size == file.digest().size_bytes() &&
+            ((st.st_mode & S_IXUSR) != 0) == file.is_executable()) {
+            candidates.push_back(i);
+            paths.push_back(file.path());
+            modificationTimes.push_back(modificationTimeNs(st));
+        }
+    }
+    if (candidates.empty()) {
+        return 0;
+    }
+
+    std::vector<buildboxcommon::File> files;
+    try {
+        files = fileDigestCache != nullptr
+                    ? fileDigestCache->getFiles(paths)
+                    : DigestGenerator::make_file_digests(paths);
+    }
+    catch (const std::system_error &e) {
+        BUILDBOX_LOG_DEBUG(
+            "Could not hash the existing outputs: " << e.what());
+        return 0;
+    }
+
+    int64_t newestInput = inputs.empty()
+                              ? std::numeric_limits<int64_t>::max()
+                              : std::numeric_limits<int64_t>::min();
+    for (const auto &input : inputs) {
+        struct stat st;
+        if (stat(input.c_str(), &st) == 0) {
+            newestInput = std::max(newestInput, modificationTimeNs(st));
+        }
+    }
+
+    std::set<int> unchanged;
+    for (size_t j = 0; j < candidates.size(); ++j) {
+        const proto::OutputFile &file = result->output_files(candidates[j]);
+        if (files[j].d_digest != file.digest()) {
+            continue;
+        }
+        if (modificationTimes[j] < newestInput &&
+            utimensat(AT_FDCWD, paths[j].c_str(), nullptr, 0) != 0) {
+            // Written again instead
+            continue;
+        }
+        BUILDBOX_LOG_DEBUG("Output \"" << paths[j] << "\" is unchanged");
+        unchanged.insert(candidates[j]);
+    }
+
+    google::protobuf::RepeatedPtrField<proto::OutputFile> remaining;
+    for (int i = 0; i < result->output_files_size(); ++i) {
+        if (!unchanged.count(i)) {
+            *remaining.Add() = result->output_files(i);
+        }
+    }
+    result->mutable_output_files()->Swap(&remaining);
+    return unchanged.size();
+}
+
+void OutputDownloader::addTree(const std::string &path,
+                               const proto::Tree &tree)
+{
+    std::unordered_map<std::string, const proto::Directory *> children;
+    for (const auto &child : tree.children()) {
+        children[DigestGenerator::make_digest(child).hash()] = &child;
+    }
+    addDirectory(path, tree.root(), children);
+}
+
+void OutputDownloader::addDirectory(
+    const std::string &path, const proto::Directory &directory,
+    const std::unordered_map<std::string, const proto::Directory *> &children)
+{
+    d_directories.push_back(path);
+    for (const auto &file : directory.files()) {
+        d_files[file.digest().hash()].push_back(
+            {joinPath(path, file.name()), file.is_executable()});
+        d_digests[file.digest().hash()] = file.digest();
+    }
+    for (const auto &symlink : directory.symlinks()) {
+        d_symlinks[joinPath(path, symlink.name())] = symlink.target();
+    }
+    for (const auto &subdirectory : directory.directories()) {
+        const auto child = children.find(subdirectory.digest().hash());
+        if (child == children.cend()) {
+            throw std::runtime_error("Directory \"" +
+                                     joinPath(path, subdirectory.name()) +
+                                     "\" is missing from its output tree");
+        }
+        addDirectory(joinPath(path, subdirectory.name()), *child->second,
+                     children);
+    }
+}
+
+void OutputDownloader::writeBatch(const std::vector<proto::Digest> &batch,
+                                  int dirfd)
+{
+    // Empty blobs don't need to be fetched
+    std::vector<proto::Digest> toFetch;
+    for (const auto &digest : batch) {
+        if (digest.size_bytes() > 0) {
+            toFetch.push_back(digest);
+        }
+    }
+    std::unordered_map<std::string, std::string> blobs;
+    if (!toFetch.empty()) {
+        blobs = fetchBlobs(toFetch);
+    }
+
+    std::vector<DigestGenerator::BlobView> contents;
+    for (const auto &digest : batch) {
+        const auto blob = blobs.find(digest.hash());
+        if (digest.size_bytes() > 0 && blob == blobs.cend()) {
+            throw std::runtime_error("Blob " + proto::toString(digest) +
+                                     " missing from the response");
+        }
+        contents.push_back(digest.size_bytes() > 0
+                               ? DigestGenerator::BlobView(blob->second)
+                               : DigestGenerator::BlobView(nullptr, 0));
+    }
+    const std::vector<proto::Digest> digests =
+        DigestGenerator::make_digests(contents);
+
+    for (size_t i = 0; i < batch.size(); ++i) {
+        const auto &files = d_files.at(batch[i].hash());
+        throwIfDigestMismatch(files.front().d_path, batch[i], digests[i]);
+        if (d_localCas != nullptr) {
+            d_localCas->insert(batch[i], contents[i].d_data,
+                               contents[i].d_size);
+        }
+        for (const auto &file : files) {
+            writeFile(dirfd, file.d_path, file.d_executable,
+                      contents[i].d_data, contents[i].d_size);
+        }
+    }
+}
+
+void OutputDownloader::writeLargeBlob(const proto::Digest &digest, int dirfd)
+{
+    const auto &files = d_files.at(digest.hash());
+    const OutputFile &first = files.front();
+    TemporaryOutput output(dirfd, first.d_path, first.d_executable,
+                           static_cast<size_t>(digest.size_bytes()));
+    fetchBlobToFile(digest, output.fd());
+
+    // Check the digest from the page cache, and copy the contents from
+    // there to the other files with the same digest
+    struct stat st;
+    if (fstat(output.fd(), &st) != 0) {
+        throw std::system_error(errno, std::system_category(),
+                                "Could not stat \"" + first.d_path + "\"");
+    }
+    const FileContents contents(output.fd(), first.d_path, st,
+                                FileContents::OWNED);
+    const proto::Digest actual = DigestGenerator::make_digests(
+        {DigestGenerator::BlobView(contents.data(), contents.size())})[0];
+    throwIfDigestMismatch(first.d_path, digest, actual);
+    if (d_localCas != nullptr) {
+        d_localCas->insertFile(digest, output.fd(), false);
+    }
+
+    for (size_t i = 1; i < files.size(); ++i) {
+        writeFile(dirfd, files[i].d_path, files[i].d_executable,
+                  contents.data(), contents.size());
+    }
+    output.publish();
+}
+
+bool OutputDownloader::writeFromLocalCas(const proto::Digest &digest,
+                                         int dirfd)
+{
+    for (const auto &file : d_files.at(digest.hash())) {
+        if (!d_localCas->materialize(digest, dirfd, file.d_path,
+                                     file.d_executable)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::unordered_map<std::string, std::string>
+OutputDownloader::fetchBlobs(const std::vector<proto::Digest> &digests)
+{
+    auto results = d_casClient->downloadBlobs(digests);
+    std::unordered_map<std::string, std::string> blobs;
+    for (auto &result : results) {
+        const google::rpc::Status &status = result.second.first;
+        if (status.code() != google::rpc::Code::OK) {
+            throw std::runtime_error("Could not fetch blob " + result.first +
+                                     ": " + status.message());
+        }
+        blobs[result.first] = std::move(result.second.second);
+    }
+    return blobs;
+}
+
+void OutputDownloader::fetchBlobToFile(const proto::Digest &digest, int fd)
+{
+    d_casClient->download(fd, digest);
+}
+
+std::string OutputDownloader::fetchBlob(const proto::Digest &digest)
+{
+    return d_casClient->fetchString(digest);
+}
+
+} // namespace recc
@@ -0,0 +1,153 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef INCLUDED_OUTPUTDOWNLOADER
+#define INCLUDED_OUTPUTDOWNLOADER
+
+#include <protos.h>
+
+#include <buildboxcommon_casclient.h>
+
+#include <cstddef>
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace recc {
+
+class FileDigestCache;
+class LocalCas;
+class ThreadPool;
+
+/**
+ * Downloads the outputs of an action and writes them to disk, fetching
+ * them concurrently in a `ThreadPool`.
+ *
+ * Blobs up to `MAX_BATCHED_BLOB_SIZE` are fetched with `BatchReadBlobs()`,
+ * in batches of up to `MAX_BATCH_SIZE` bytes, and larger ones with
+ * ByteStream reads streamed straight to disk, one task per batch or blob.
+ * The trees of output directories are fetched first.
+ *
+ * Each file is written to a temporary file next to it, checked against its
+ * digest and then renamed into place, so that an output is either
+ * complete or left as it was.
+ *
+ * If a `LocalCas` is given, the blobs found there are written from it
+ * while the others are fetched, and the blobs fetched are added to it.
+ */
+class OutputDownloader {
+  public:
+    OutputDownloader(buildboxcommon::CASClient *casClient, ThreadPool *pool,
+                     LocalCas *localCas = nullptr);
+
+    virtual ~OutputDownloader();
+
+    OutputDownloader(const OutputDownloader &) = delete;
+    OutputDownloader &operator=(const OutputDownloader &) = delete;
+
+    /**
+     * Writes the output files, directories and symlinks of `result` under
+     * the directory open as `dirfd`, creating their parent directories.
+     *
+     * Throws if one of them can't be fetched or written, once the others
+     * are written.
+     */
+    void download(const proto::ActionResult &result, int dirfd);
+
+    /**
+     * Removes from `result` the output files that already exist, relative
+     * to the current directory, with the same contents and executable bit,
+     * so that they are neither fetched nor written again. Their digests are
+     * looked up in `fileDigestCache` if it is not null.
+     *
+     * The files kept are touched if they are older than one of `inputs`, or
+     * if `inputs` is empty, so that tools comparing timestamps, such as
+     * make, don't consider them out of date. Returns the number of files
+     * removed.
+     */
+    static size_t skipUnchangedFiles(proto::ActionResult *result,
+                                     const std::set<std::string> &inputs,
+                                     FileDigestCache *fileDigestCache);
+
+    static const size_t MAX_BATCHED_BLOB_SIZE;
+    static const size_t MAX_BATCH_SIZE;
+
+  protected: // for unit testing
+    /**
+     * Fetches the given blobs with `BatchReadBlobs()`, returning their
+     * contents by hash. Throws if one of them is missing.
+     */
+    virtual std::unordered_map<std::string, std::string>
+    fetchBlobs(const std::vector<proto::Digest> &digests);
+
+    /**
+     * Fetches the given blob with ByteStream and writes it to `fd`.
+     */
+    virtual void fetchBlobToFile(const proto::Digest &digest, int fd);
+
+    /**
+     * Fetches the given blob with ByteStream into memory.
+     */
+    virtual std::string fetchBlob(const proto::Digest &digest);
+
+  private:
+    struct OutputFile {
+        std::string d_path;
+        bool d_executable;
+    };
+
+    /**
+     * Adds the files, directories and symlinks of `tree` to those to write,
+     * under `path`.
+     */
+    void addTree(const std::string &path, const proto::Tree &tree);
+
+    void addDirectory(
+        const std::string &path, const proto::Directory &directory,
+        const std::unordered_map<std::string, const proto::Directory *>
+            &children);
+
+    /**
+     * Fetches the blobs of `batch` and writes the files with their digests.
+     */
+    void writeBatch(const std::vector<proto::Digest> &batch, int dirfd);
+
+    /**
+     * Streams the given blob to disk and writes the files with its digest.
+     */
+    void writeLargeBlob(const proto::Digest &digest, int dirfd);
+
+    /**
+     * Writes the files with the given digest from the local CAS. Returns
+     * false if the blob is no longer there.
+     */
+    bool writeFromLocalCas(const proto::Digest &digest, int dirfd);
+
+    buildboxcommon::CASClient *d_casClient;
+    ThreadPool *d_pool;
+    LocalCas *d_localCas;
+
+    // The files to write for each digest, by hash
+    std::map<std::string, std::vector<OutputFile>> d_files;
+    std::map<std::string, proto::Digest> d_digests;
+    std::vector<std::string> d_directories;
+    // Targets of the symlinks, by path
+    std::map<std::string, std::string> d_symlinks;
+};
+
+} // namespace recc
+
+#endif
@@ -56,6 +56,26 @@
 #define DEFAULT_RECC_CACHE_UPLOAD_FAILED_BUILD 1
 #define DEFAULT_RECC_WORKING_DIR_PREFIX ""
 #define DEFAULT_RECC_ACTION_SALT ""
+#define DEFAULT_RECC_DIRECT_MODE 0
+#define DEFAULT_RECC_CACHE_DIR ""
+#define DEFAULT_RECC_MANIFEST_MAX_ENTRIES 16
+#define DEFAULT_RECC_DEPS_SCANNER "compiler"
+#define DEFAULT_RECC_FILE_DIGEST_CACHE 0
+#define DEFAULT_RECC_FILE_DIGEST_CACHE_SLOTS (1 << 16)
+#define DEFAULT_RECC_SUBTREE_DIGEST_CACHE 0
+#define DEFAULT_RECC_CAS_PRESENCE_CACHE 0
+#define DEFAULT_RECC_CAS_PRESENCE_CACHE_SLOTS (1 << 18)
+#define DEFAULT_RECC_CAS_PRESENCE_CACHE_TTL 600
+#define DEFAULT_RECC_CAS_PRESENCE_CACHE_VERIFY 50
+#define DEFAULT_RECC_SPECULATIVE_FIND_MISSING_BLOBS 0
+#define DEFAULT_RECC_EXECUTE_LIMIT 0
+#define DEFAULT_RECC_EXECUTE_QUEUE_TARGET_MS 1000
+#define DEFAULT_RECC_LOCAL_CAS_MAX_SIZE_MB 0
+#define DEFAULT_RECC_LOCAL_CAS_HARDLINKS 0
+#define DEFAULT_RECC_LOCAL_ACTION_CACHE 0
+#define DEFAULT_RECC_LOCAL_ACTION_CACHE_TTL 600
+#define DEFAULT_RECC_LOCAL_ACTION_CACHE_VERIFY 0
+#define DEFAULT_RECC_FILE_CACHE_MAX_SIZE_MB 10240
 
 #define DEFAULT_RECC_DEPS_DIRECTORY_OVERRIDE ""
 #define DEFAULT_RECC_DEPS_OVERRIDE {}
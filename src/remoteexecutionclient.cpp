@@ -17,7 +17,9 @@
 #include <digestgenerator.h>
 #include <env.h>
 #include <fileutils.h>
+#include <outputdownloader.h>
 #include <reccdefaults.h>
+#include <threadpool.h>
 
 #include <buildboxcommon_fileutils.h>
 #include <buildboxcommon_logging.h>
@@ -63,7 +65,8 @@ RemoteExecutionClient::executeAction(const proto::Digest &actionDigest,
 }
 
 void RemoteExecutionClient::writeFilesToDisk(const proto::ActionResult &result,
-                                             const char *root)
+                                             const char *root,
+                                             LocalCas *localCas)
 {
     // Timed function
     buildboxcommon::buildboxcommonmetrics::MetricGuard<
@@ -78,7 +81,9 @@ void RemoteExecutionClient::writeFilesToDisk(const proto::ActionResult &result,
             "Error opening directory at path \"" << root << "\"");
     }
 
-    downloadOutputs(d_casClient.get(), result, root_dirfd.get());
+    OutputDownloader downloader(d_casClient.get(), &ThreadPool::defaultPool(),
+                                localCas);
+    downloader.download(result, root_dirfd.get());
 }
 
 } // namespace recc
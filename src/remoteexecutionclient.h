@@ -28,6 +28,8 @@
 
 namespace recc {
 
+class LocalCas;
+
 typedef std::shared_ptr<
     grpc::ClientAsyncReaderInterface<google::longrunning::Operation>>
     ReaderPointer;
@@ -59,10 +61,13 @@ class RemoteExecutionClient : public buildboxcommon::RemoteExecutionClient {
                                       bool skipCache = false);
 
     /**
-     * Write the given ActionResult's output files to disk.
+     * Write the given ActionResult's output files to disk, fetching them
+     * concurrently with `OutputDownloader`. Blobs found in `localCas`, if
+     * given, are not fetched.
      */
     void writeFilesToDisk(const proto::ActionResult &result,
-                          const char *root = ".");
+                          const char *root = ".",
+                          LocalCas *localCas = nullptr);
 };
 } // namespace recc
 #endif
@@ -32,6 +32,8 @@ const std::string RequestMetadataGenerator::RECC_METADATA_TOOL_VERSION =
 const std::string RequestMetadataGenerator::RECC_METADATA_HEADER_NAME =
     "build.bazel.remote.execution.v2.requestmetadata-bin";
 
+pid_t RequestMetadataGenerator::s_parentPid = 0;
+
 proto::ToolDetails RequestMetadataGenerator::recc_tool_details()
 {
     proto::ToolDetails toolDetails;
@@ -43,11 +45,14 @@ proto::ToolDetails RequestMetadataGenerator::recc_tool_details()
 std::string RequestMetadataGenerator::tool_invocation_id()
 {
     const std::string hostName = hostname();
-    const std::string parentPID = std::to_string(getppid());
+    const std::string parentPID =
+        std::to_string(s_parentPid != 0 ? s_parentPid : getppid());
 
     return hostName + ":" + parentPID;
 }
 
+void RequestMetadataGenerator::set_parent_pid(pid_t pid) { s_parentPid = pid; }
+
 std::string RequestMetadataGenerator::hostname()
 {
     char hostname[DEFAULT_RECC_HOSTNAME_MAX_LENGTH + 1];
@@ -17,6 +17,8 @@
 
 #include <protos.h>
 
+#include <sys/types.h>
+
 /** According to the REAPI specification:
  *
  * "An optional Metadata to attach to any RPC request to tell the server about
@@ -35,14 +37,28 @@ class RequestMetadataGenerator {
   public:
     static proto::ToolDetails recc_tool_details();
 
+    /**
+     * Returns the host name and the PID of the parent process, normally the
+     * build tool invoking recc.
+     */
     static std::string tool_invocation_id();
 
+    /**
+     * Makes `tool_invocation_id()` use `pid` instead of the parent of this
+     * process, or the parent again if it is 0. `reccd` sets it to the parent
+     * of the client it runs a command for.
+     */
+    static void set_parent_pid(pid_t pid);
+
     static const std::string RECC_METADATA_TOOL_NAME;
     static const std::string RECC_METADATA_TOOL_VERSION;
 
     static const std::string RECC_METADATA_HEADER_NAME;
 
     static std::string hostname();
+
+  private:
+    static pid_t s_parentPid;
 };
 
 } // namespace recc
@@ -0,0 +1,294 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <sha256multibuffer.h>
+
+#include <cpufeatures.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define RECC_SHA256_AVX2
+#include <immintrin.h>
+#endif
+
+namespace recc {
+
+const size_t Sha256MultiBuffer::LANES;
+const size_t Sha256MultiBuffer::DIGEST_SIZE;
+
+#ifdef RECC_SHA256_AVX2
+
+// Compiled for AVX2 regardless of the flags of the build, and only called
+// after checking that the CPU supports it
+#define RECC_TARGET_AVX2 __attribute__((target("avx2")))
+
+namespace {
+
+const uint32_t ROUND_CONSTANTS[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+const uint32_t INITIAL_STATE[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372,
+                                   0xa54ff53a, 0x510e527f, 0x9b05688c,
+                                   0x1f83d9ab, 0x5be0cd19};
+
+const size_t BLOCK_SIZE = 64;
+const size_t LANES = Sha256MultiBuffer::LANES;
+
+template <int N> RECC_TARGET_AVX2 inline __m256i rotateRight(__m256i x)
+{
+    return _mm256_or_si256(_mm256_srli_epi32(x, N),
+                           _mm256_slli_epi32(x, 32 - N));
+}
+
+RECC_TARGET_AVX2 inline __m256i add(__m256i a, __m256i b)
+{
+    return _mm256_add_epi32(a, b);
+}
+
+RECC_TARGET_AVX2 inline __m256i xor3(__m256i a, __m256i b, __m256i c)
+{
+    return _mm256_xor_si256(_mm256_xor_si256(a, b), c);
+}
+
+/**
+ * Runs the compression function on one block per lane. `state[i]` holds
+ * word `i` of the state of each lane and `words[t]` word `t` of the block
+ * of each lane, in host byte order.
+ */
+RECC_TARGET_AVX2 void compress(uint32_t state[8][LANES],
+                               const uint32_t words[16][LANES])
+{
+    __m256i s[8];
+    for (int i = 0; i < 8; ++i) {
+        s[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(state[i]));
+    }
+    __m256i a = s[0], b = s[1], c = s[2], d = s[3];
+    __m256i e = s[4], f = s[5], g = s[6], h = s[7];
+
+    __m256i w[16];
+    for (int t = 0; t < 64; ++t) {
+        __m256i wt;
+        if (t < 16) {
+            wt = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i *>(words[t]));
+        }
+        else {
+            const __m256i w15 = w[(t - 15) & 15];
+            const __m256i w2 = w[(t - 2) & 15];
+            const __m256i s0 = xor3(rotateRight<7>(w15), rotateRight<18>(w15),
+                                    _mm256_srli_epi32(w15, 3));
+            const __m256i s1 = xor3(rotateRight<17>(w2), rotateRight<19>(w2),
+                                    _mm256_srli_epi32(w2, 10));
+            wt = add(add(w[(t - 16) & 15], s0), add(w[(t - 7) & 15], s1));
+        }
+        w[t & 15] = wt;
+
+        const __m256i sigma1 = xor3(rotateRight<6>(e), rotateRight<11>(e),
+                                    rotateRight<25>(e));
+        const __m256i choice = _mm256_xor_si256(_mm256_and_si256(e, f),
+                                                _mm256_andnot_si256(e, g));
+        const __m256i t1 = add(
+            add(h, sigma1),
+            add(choice,
+                add(_mm256_set1_epi32(static_cast<int>(ROUND_CONSTANTS[t])),
+                    wt)));
+        const __m256i sigma0 = xor3(rotateRight<2>(a), rotateRight<13>(a),
+                                    rotateRight<22>(a));
+        const __m256i majority =
+            _mm256_or_si256(_mm256_and_si256(a, b),
+                            _mm256_and_si256(c, _mm256_or_si256(a, b)));
+        const __m256i t2 = add(sigma0, majority);
+
+        h = g;
+        g = f;
+        f = e;
+        e = add(d, t1);
+        d = c;
+        c = b;
+        b = a;
+        a = add(t1, t2);
+    }
+
+    const __m256i result[8] = {a, b, c, d, e, f, g, h};
+    for (int i = 0; i < 8; ++i) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(state[i]),
+                            add(s[i], result[i]));
+    }
+}
+
+uint32_t loadBigEndian(const unsigned char *bytes)
+{
+    uint32_t word;
+    memcpy(&word, bytes, sizeof(word));
+    return __builtin_bswap32(word);
+}
+
+void storeBigEndian(uint32_t word, unsigned char *bytes)
+{
+    bytes[0] = static_cast<unsigned char>(word >> 24);
+    bytes[1] = static_cast<unsigned char>(word >> 16);
+    bytes[2] = static_cast<unsigned char>(word >> 8);
+    bytes[3] = static_cast<unsigned char>(word);
+}
+
+/**
+ * A message being hashed in a lane: its whole blocks are read in place,
+ * the last partial block and the padding from `d_tail`.
+ */
+struct Lane {
+    bool d_active = false;
+    size_t d_message = 0;
+    const unsigned char *d_data = nullptr;
+    size_t d_wholeBlocks = 0;
+    unsigned char d_tail[2 * BLOCK_SIZE];
+    size_t d_tailBlocks = 0;
+    size_t d_tailBlocksDone = 0;
+
+    void start(size_t message, const char *data, size_t size)
+    {
+        d_active = true;
+        d_message = message;
+        d_data = reinterpret_cast<const unsigned char *>(data);
+        d_wholeBlocks = size / BLOCK_SIZE;
+
+        // The message is followed by a one bit, zeros and its length in
+        // bits, on one or two blocks
+        const size_t remainder = size % BLOCK_SIZE;
+        d_tailBlocks = remainder + 9 <= BLOCK_SIZE ? 1 : 2;
+        d_tailBlocksDone = 0;
+        memset(d_tail, 0, sizeof(d_tail));
+        if (remainder > 0) {
+            memcpy(d_tail, d_data + d_wholeBlocks * BLOCK_SIZE, remainder);
+        }
+        d_tail[remainder] = 0x80;
+        const uint64_t bits = static_cast<uint64_t>(size) * 8;
+        unsigned char *end = d_tail + d_tailBlocks * BLOCK_SIZE;
+        for (int i = 1; i <= 8; ++i) {
+            end[-i] = static_cast<unsigned char>(bits >> (8 * (i - 1)));
+        }
+    }
+
+    // Returns the next block to hash
+    const unsigned char *nextBlock()
+    {
+        if (d_wholeBlocks > 0) {
+            const unsigned char *block = d_data;
+            d_data += BLOCK_SIZE;
+            --d_wholeBlocks;
+            return block;
+        }
+        return d_tail + BLOCK_SIZE * d_tailBlocksDone++;
+    }
+
+    bool done() const
+    {
+        return d_wholeBlocks == 0 && d_tailBlocksDone == d_tailBlocks;
+    }
+};
+
+} // namespace
+
+bool Sha256MultiBuffer::isSupported() { return CpuFeatures::hasAvx2(); }
+
+bool Sha256MultiBuffer::isPreferred()
+{
+    return CpuFeatures::hasAvx2() && !CpuFeatures::hasShaExtensions();
+}
+
+void Sha256MultiBuffer::hash(const char *const *messages, const size_t *sizes,
+                             size_t count, unsigned char *digests)
+{
+    if (!isSupported()) {
+        throw std::logic_error("Multi-buffer SHA-256 is not supported");
+    }
+
+    Lane lanes[LANES];
+    uint32_t state[8][LANES];
+    size_t next = 0;
+    const auto startLane = [&](size_t lane) {
+        if (next == count) {
+            lanes[lane].d_active = false;
+            return;
+        }
+        lanes[lane].start(next, messages[next], sizes[next]);
+        for (size_t i = 0; i < 8; ++i) {
+            state[i][lane] = INITIAL_STATE[i];
+        }
+        ++next;
+    };
+    for (size_t lane = 0; lane < LANES; ++lane) {
+        startLane(lane);
+    }
+
+    // Idle lanes hash this block, and their result is discarded
+    static const unsigned char idleBlock[BLOCK_SIZE] = {};
+    uint32_t words[16][LANES];
+    size_t active = std::min(count, LANES);
+    while (active > 0) {
+        for (size_t lane = 0; lane < LANES; ++lane) {
+            const unsigned char *block =
+                lanes[lane].d_active ? lanes[lane].nextBlock() : idleBlock;
+            for (size_t t = 0; t < 16; ++t) {
+                words[t][lane] = loadBigEndian(block + 4 * t);
+            }
+        }
+
+        compress(state, words);
+
+        for (size_t lane = 0; lane < LANES; ++lane) {
+            if (!lanes[lane].d_active || !lanes[lane].done()) {
+                continue;
+            }
+            unsigned char *digest =
+                digests + lanes[lane].d_message * DIGEST_SIZE;
+            for (size_t i = 0; i < 8; ++i) {
+                storeBigEndian(state[i][lane], digest + 4 * i);
+            }
+            startLane(lane);
+            if (!lanes[lane].d_active) {
+                --active;
+            }
+        }
+    }
+}
+
+#else
+
+bool Sha256MultiBuffer::isSupported() { return false; }
+
+bool Sha256MultiBuffer::isPreferred() { return false; }
+
+void Sha256MultiBuffer::hash(const char *const *, const size_t *, size_t,
+                             unsigned char *)
+{
+    throw std::logic_error("Multi-buffer SHA-256 is not supported");
+}
+
+#endif
+
+} // namespace recc
@@ -0,0 +1,57 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef INCLUDED_SHA256MULTIBUFFER
+#define INCLUDED_SHA256MULTIBUFFER
+
+#include <cstddef>
+
+namespace recc {
+
+/**
+ * Computes the SHA-256 of several messages at once, each in a lane of the
+ * AVX2 vector registers. A lane is given the next message as soon as it is
+ * done with the previous one.
+ *
+ * Each lane is slower than hashing a single message with OpenSSL, so this
+ * only pays off for many small messages, and not on CPUs with the SHA
+ * extensions, which OpenSSL uses.
+ */
+struct Sha256MultiBuffer {
+    static const size_t LANES = 8;
+    static const size_t DIGEST_SIZE = 32;
+
+    /**
+     * Returns whether the CPU and compiler support it.
+     */
+    static bool isSupported();
+
+    /**
+     * Returns whether it is supported and expected to be faster than
+     * OpenSSL on this CPU.
+     */
+    static bool isPreferred();
+
+    /**
+     * Writes the digest of the `i`th message, of `sizes[i]` bytes at
+     * `messages[i]`, to the `DIGEST_SIZE` bytes at
+     * `digests + i * DIGEST_SIZE`. Must only be called if `isSupported()`.
+     */
+    static void hash(const char *const *messages, const size_t *sizes,
+                     size_t count, unsigned char *digests);
+};
+
+} // namespace recc
+
+#endif
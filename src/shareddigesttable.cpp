@@ -0,0 +1,309 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <shareddigesttable.h>
+
+#include <buildboxcommon_fileutils.h>
+
+#include <cerrno>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace recc {
+
+namespace {
+
+const uint64_t TABLE_MAGIC = 0x3143464443434552; // "RECCDFC1"
+const uint64_t TABLE_VERSION = 1;
+
+// The header occupies the first slot of the table
+enum HeaderWord { MAGIC, VERSION, NUM_SLOTS };
+
+// Layout of a slot. `SEQUENCE` is odd while the slot is being written.
+enum SlotWord {
+    SEQUENCE,
+    KEY,       // the five words of the key
+    FLAGS = 6, // flags, length of the hash in bytes and stamp of the entry
+    HASH,      // up to 72 bytes, enough for SHA-512
+    SLOT_WORDS = 16
+};
+const size_t KEY_WORDS = std::tuple_size<SharedDigestTable::Key>::value;
+const size_t MAX_HASH_BYTES = (SLOT_WORDS - HASH) * sizeof(uint64_t);
+
+// Index of the word of the key holding the size of the digest
+const size_t KEY_SIZE = 2;
+
+const size_t MAX_PROBES = 8;
+
+size_t homeSlot(const SharedDigestTable::Key &key, size_t numSlots)
+{
+    // splitmix64 finalizer over the identity of the entry
+    uint64_t hash = key[1] ^ (key[0] * 0x9e3779b97f4a7c15);
+    hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9;
+    hash = (hash ^ (hash >> 27)) * 0x94d049bb133111eb;
+    hash ^= hash >> 31;
+    return static_cast<size_t>(hash % numSlots);
+}
+
+int hexValue(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+bool hexToBytes(const std::string &hex, unsigned char *bytes, size_t *length)
+{
+    if (hex.empty() || hex.size() % 2 != 0 ||
+        hex.size() / 2 > MAX_HASH_BYTES) {
+        return false;
+    }
+    for (size_t i = 0; i < hex.size() / 2; ++i) {
+        const int high = hexValue(hex[2 * i]);
+        const int low = hexValue(hex[2 * i + 1]);
+        if (high < 0 || low < 0) {
+            return false;
+        }
+        bytes[i] = static_cast<unsigned char>(high * 16 + low);
+    }
+    *length = hex.size() / 2;
+    return true;
+}
+
+std::string bytesToHex(const unsigned char *bytes, size_t length)
+{
+    static const char digits[] = "0123456789abcdef";
+    std::string hex(2 * length, '\0');
+    for (size_t i = 0; i < length; ++i) {
+        hex[2 * i] = digits[bytes[i] >> 4];
+        hex[2 * i + 1] = digits[bytes[i] & 0xf];
+    }
+    return hex;
+}
+
+/**
+ * Creates an empty table at `path` unless one already exists. The table is
+ * initialized under a temporary name and then linked into place, so that
+ * other processes never see a partially initialized header.
+ */
+void createTable(const std::string &path, size_t numSlots)
+{
+    const std::string directory = path.substr(0, path.rfind('/'));
+    buildboxcommon::FileUtils::createDirectory(directory.c_str());
+
+    const std::string temporaryPath =
+        path + "." + std::to_string(getpid()) + ".tmp";
+    const int fd =
+        open(temporaryPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw std::system_error(errno, std::system_category(),
+                                "Could not create \"" + temporaryPath + "\"");
+    }
+
+    uint64_t header[SLOT_WORDS] = {};
+    header[MAGIC] = TABLE_MAGIC;
+    header[VERSION] = TABLE_VERSION;
+    header[NUM_SLOTS] = numSlots;
+    const off_t size =
+        static_cast<off_t>((numSlots + 1) * SLOT_WORDS * sizeof(uint64_t));
+    const bool initialized =
+        write(fd, header, sizeof(header)) ==
+            static_cast<ssize_t>(sizeof(header)) &&
+        ftruncate(fd, size) == 0;
+    const int error = errno;
+    close(fd);
+
+    if (initialized && link(temporaryPath.c_str(), path.c_str()) != 0 &&
+        errno != EEXIST) {
+        const int linkError = errno;
+        unlink(temporaryPath.c_str());
+        throw std::system_error(linkError, std::system_category(),
+                                "Could not create \"" + path + "\"");
+    }
+    unlink(temporaryPath.c_str());
+    if (!initialized) {
+        throw std::system_error(error, std::system_category(),
+                                "Could not initialize \"" + path + "\"");
+    }
+}
+
+} // namespace
+
+SharedDigestTable::SharedDigestTable(const std::string &path,
+                                     size_t numSlots)
+{
+    if (!Word().is_lock_free() || sizeof(Word) != sizeof(uint64_t)) {
+        throw std::runtime_error(
+            "64-bit atomics are not lock-free on this platform");
+    }
+
+    int fd = open(path.c_str(), O_RDWR);
+    if (fd < 0 && errno == ENOENT) {
+        createTable(path, numSlots);
+        fd = open(path.c_str(), O_RDWR);
+    }
+    if (fd < 0) {
+        throw std::system_error(errno, std::system_category(),
+                                "Could not open \"" + path + "\"");
+    }
+
+    struct stat st;
+    uint64_t header[SLOT_WORDS] = {};
+    const bool readHeader =
+        fstat(fd, &st) == 0 && pread(fd, header, sizeof(header), 0) ==
+                                   static_cast<ssize_t>(sizeof(header));
+    if (!readHeader || header[MAGIC] != TABLE_MAGIC ||
+        header[VERSION] != TABLE_VERSION || header[NUM_SLOTS] == 0 ||
+        static_cast<uint64_t>(st.st_size) !=
+            (header[NUM_SLOTS] + 1) * SLOT_WORDS * sizeof(uint64_t)) {
+        close(fd);
+        throw std::runtime_error("\"" + path +
+                                 "\" is not a valid digest cache");
+    }
+
+    const size_t mappingSize = static_cast<size_t>(st.st_size);
+    void *mapping = mmap(nullptr, mappingSize, PROT_READ | PROT_WRITE,
+                         MAP_SHARED, fd, 0);
+    const int error = errno;
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        throw std::system_error(error, std::system_category(),
+                                "Could not map \"" + path + "\"");
+    }
+
+    d_mapping = mapping;
+    d_mappingSize = mappingSize;
+    d_numSlots = static_cast<size_t>(header[NUM_SLOTS]);
+}
+
+SharedDigestTable::~SharedDigestTable() { munmap(d_mapping, d_mappingSize); }
+
+SharedDigestTable::Word *SharedDigestTable::slot(size_t index) const
+{
+    // Slot 0 holds the header
+    return static_cast<Word *>(d_mapping) + (index + 1) * SLOT_WORDS;
+}
+
+bool SharedDigestTable::lookup(const Key &key, proto::Digest *digest,
+                               uint8_t *flags, uint32_t *stamp) const
+{
+    const size_t home = homeSlot(key, d_numSlots);
+    for (size_t probe = 0; probe < MAX_PROBES; ++probe) {
+        Word *words = slot((home + probe) % d_numSlots);
+
+        const uint64_t sequence =
+            words[SEQUENCE].load(std::memory_order_acquire);
+        if (sequence == 0) {
+            // Empty slots end the probe sequence
+            return false;
+        }
+        if (sequence % 2 != 0) {
+            continue;
+        }
+
+        Key found;
+        for (size_t i = 0; i < KEY_WORDS; ++i) {
+            found[i] = words[KEY + i].load(std::memory_order_relaxed);
+        }
+        const uint64_t foundFlags =
+            words[FLAGS].load(std::memory_order_relaxed);
+        uint64_t hash[SLOT_WORDS - HASH];
+        for (size_t i = 0; i < SLOT_WORDS - HASH; ++i) {
+            hash[i] = words[HASH + i].load(std::memory_order_relaxed);
+        }
+
+        // Discard what was read if a writer modified the slot meanwhile
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (words[SEQUENCE].load(std::memory_order_relaxed) != sequence) {
+            continue;
+        }
+
+        if (found == key) {
+            const size_t hashLength =
+                static_cast<size_t>((foundFlags >> 8) & 0xff);
+            if (hashLength == 0 || hashLength > MAX_HASH_BYTES) {
+                return false;
+            }
+            digest->set_hash(bytesToHex(
+                reinterpret_cast<const unsigned char *>(hash), hashLength));
+            digest->set_size_bytes(static_cast<int64_t>(key[KEY_SIZE]));
+            *flags = static_cast<uint8_t>(foundFlags & 0xff);
+            if (stamp != nullptr) {
+                *stamp = static_cast<uint32_t>(foundFlags >> 32);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+void SharedDigestTable::store(const Key &key, const proto::Digest &digest,
+                              uint8_t flags, uint32_t stamp)
+{
+    uint64_t hash[SLOT_WORDS - HASH] = {};
+    size_t hashLength = 0;
+    if (digest.size_bytes() != static_cast<int64_t>(key[KEY_SIZE]) ||
+        !hexToBytes(digest.hash(), reinterpret_cast<unsigned char *>(hash),
+                    &hashLength)) {
+        return;
+    }
+
+    // Prefer a slot holding an older version of the same entry, then an
+    // empty one, and otherwise evict the entry in the home slot
+    const size_t home = homeSlot(key, d_numSlots);
+    Word *target = nullptr;
+    for (size_t probe = 0; probe < MAX_PROBES; ++probe) {
+        Word *words = slot((home + probe) % d_numSlots);
+        if (words[SEQUENCE].load(std::memory_order_relaxed) == 0 ||
+            (words[KEY].load(std::memory_order_relaxed) == key[0] &&
+             words[KEY + 1].load(std::memory_order_relaxed) == key[1])) {
+            target = words;
+            break;
+        }
+    }
+    if (target == nullptr) {
+        target = slot(home);
+    }
+
+    uint64_t sequence = target[SEQUENCE].load(std::memory_order_relaxed);
+    if (sequence % 2 != 0 ||
+        !target[SEQUENCE].compare_exchange_strong(
+            sequence, sequence + 1, std::memory_order_relaxed)) {
+        // Another process is writing this slot
+        return;
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+
+    for (size_t i = 0; i < KEY_WORDS; ++i) {
+        target[KEY + i].store(key[i], std::memory_order_relaxed);
+    }
+    target[FLAGS].store((static_cast<uint64_t>(stamp) << 32) |
+                            (hashLength << 8) | flags,
+                        std::memory_order_relaxed);
+    for (size_t i = 0; i < SLOT_WORDS - HASH; ++i) {
+        target[HASH + i].store(hash[i], std::memory_order_relaxed);
+    }
+
+    target[SEQUENCE].store(sequence + 2, std::memory_order_release);
+}
+
+} // namespace recc
@@ -0,0 +1,89 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef INCLUDED_SHAREDDIGESTTABLE
+#define INCLUDED_SHAREDDIGESTTABLE
+
+#include <protos.h>
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace recc {
+
+/**
+ * Table of digests shared by all recc processes on a machine.
+ *
+ * The table is a fixed-size, memory-mapped hash table with open addressing.
+ * Each slot is protected by a sequence lock, so that readers never block and
+ * a writer that loses a race to another one simply skips storing its entry.
+ *
+ * Keys are made of five words. The first two identify an entry: storing a
+ * key with the same identity replaces the older entry. The third one is the
+ * size of the digest, which is not stored separately.
+ *
+ * Along with its digest, each entry holds eight bits of flags and a 32-bit
+ * stamp, such as the time at which it was stored.
+ *
+ * This class is thread-safe.
+ */
+class SharedDigestTable {
+  public:
+    typedef std::array<uint64_t, 5> Key;
+
+    /**
+     * Opens the table at `path`, creating it with `numSlots` slots if it
+     * does not exist.
+     *
+     * Throws `std::runtime_error` if the table can't be used.
+     */
+    SharedDigestTable(const std::string &path, size_t numSlots);
+
+    ~SharedDigestTable();
+
+    SharedDigestTable(const SharedDigestTable &) = delete;
+    SharedDigestTable &operator=(const SharedDigestTable &) = delete;
+
+    /**
+     * Looks up the entry with the given key, writing its digest and the
+     * flags it was stored with to `digest` and `flags` on a hit, and its
+     * stamp to `stamp` if it is set.
+     */
+    bool lookup(const Key &key, proto::Digest *digest, uint8_t *flags,
+                uint32_t *stamp = nullptr) const;
+
+    /**
+     * Stores an entry, replacing any entry with the same identity. Does
+     * nothing if the slot is being written by another process, or if the
+     * size of `digest` doesn't match the key.
+     */
+    void store(const Key &key, const proto::Digest &digest, uint8_t flags,
+               uint32_t stamp = 0);
+
+  private:
+    typedef std::atomic<uint64_t> Word;
+
+    Word *slot(size_t index) const;
+
+    void *d_mapping = nullptr;
+    size_t d_mappingSize = 0;
+    size_t d_numSlots = 0;
+};
+
+} // namespace recc
+
+#endif
@@ -17,11 +17,12 @@
 #include <array>
 #include <cerrno>
 #include <cstring>
+#include <fcntl.h>
 #include <map>
 #include <memory>
+#include <poll.h>
+#include <spawn.h>
 #include <sstream>
-#include <sys/select.h>
-#include <sys/time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <system_error>
@@ -29,6 +30,8 @@
 
 #include <buildboxcommon_logging.h>
 
+extern char **environ;
+
 namespace recc {
 
 namespace {
@@ -40,116 +43,205 @@ static std::array<int, 2> createPipe()
         BUILDBOX_LOG_ERROR("Error calling `pipe()`: " << strerror(errno));
         throw std::system_error(errno, std::system_category());
     }
+    // Commands spawned concurrently by other threads must not inherit them
+    for (const int fd : pipe_fds) {
+        fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) | FD_CLOEXEC);
+    }
     return pipe_fds;
 }
 
-} // namespace
+/**
+ * The environment of this process with the variables in `env` added or
+ * replaced, as `posix_spawn()` expects it. The strings are kept in
+ * `storage`.
+ */
+std::vector<char *>
+environmentWith(const std::map<std::string, std::string> &env,
+                std::vector<std::string> *storage)
+{
+    for (char **variable = environ; *variable != nullptr; ++variable) {
+        const std::string name(*variable, strcspn(*variable, "="));
+        if (env.count(name) == 0) {
+            storage->push_back(*variable);
+        }
+    }
+    for (const auto &envPair : env) {
+        storage->push_back(envPair.first + "=" + envPair.second);
+    }
 
-Subprocess::SubprocessResult
-Subprocess::execute(const std::vector<std::string> &command, bool pipeStdOut,
-                    bool pipeStdErr,
-                    const std::map<std::string, std::string> &env)
+    std::vector<char *> envp;
+    for (auto &variable : *storage) {
+        envp.push_back(&variable[0]);
+    }
+    envp.push_back(nullptr);
+    return envp;
+}
+
+/**
+ * `posix_spawnp()` looks for commands in the `PATH` of this process, so
+ * commands are looked up here when `env` sets a different one. Returns an
+ * empty string if no executable file is found.
+ */
+std::string findInPath(const std::string &name, const std::string &path)
+{
+    std::istringstream directories(path);
+    std::string directory;
+    while (std::getline(directories, directory, ':')) {
+        const std::string candidate =
+            (directory.empty() ? "." : directory) + "/" + name;
+        if (access(candidate.c_str(), X_OK) == 0) {
+            return candidate;
+        }
+    }
+    return "";
+}
+
+// Following the Bash convention for exit codes.
+// (https://gnu.org/software/bash/manual/html_node/Exit-Status.html)
+int execErrorExitCode(int exec_error)
+{
+    if (exec_error == ENOENT) {
+        return 127; // "command not found"
+    }
+    return 126; // Command invoked cannot execute
+}
+
+// Convert the command to a char*[]
+std::unique_ptr<const char *[]>
+argvFromCommand(const std::vector<std::string> &command)
 {
-    // Convert the command to a char*[]
-    size_t argc = command.size();
+    const size_t argc = command.size();
     std::unique_ptr<const char *[]> argv(new const char *[argc + 1]);
     for (size_t i = 0; i < argc; ++i) {
         argv[i] = command[i].c_str();
     }
     argv[argc] = nullptr;
+    return argv;
+}
 
-    // Pipe, fork and exec
-    auto stdOutPipeFDs = createPipe();
-    auto stdErrPipeFDs = createPipe();
+} // namespace
 
-    const auto pid = fork();
-    if (pid == -1) {
-        BUILDBOX_LOG_ERROR("Error calling `fork()`: " << strerror(errno));
-        throw std::system_error(errno, std::system_category());
+Subprocess::SubprocessResult
+Subprocess::execute(const std::vector<std::string> &command, bool pipeStdOut,
+                    bool pipeStdErr,
+                    const std::map<std::string, std::string> &env,
+                    const OutputCallback &onStdOut,
+                    const OutputCallback &onStdErr)
+{
+    SubprocessResult result;
+    if (command.empty()) {
+        result.d_exitCode = execErrorExitCode(ENOENT);
+        return result;
     }
 
-    if (pid == 0) {
-        // (runs only in the child)
-        if (pipeStdOut) {
-            close(stdOutPipeFDs[0]);
-            dup2(stdOutPipeFDs[1],
-                 STDOUT_FILENO); // redirect stdout to input end of pipe
-            close(stdOutPipeFDs[1]);
-        }
-        if (pipeStdErr) {
-            close(stdErrPipeFDs[0]);
-            dup2(stdErrPipeFDs[1],
-                 STDERR_FILENO); // redirect stderr to input end of pipe
-            close(stdErrPipeFDs[1]);
-        }
+    const auto argv = argvFromCommand(command);
+    std::vector<std::string> envStorage;
+    const std::vector<char *> envp = environmentWith(env, &envStorage);
 
-        for (const auto &envPair : env) {
-            setenv(envPair.first.c_str(), envPair.second.c_str(), 1);
+    const auto path = env.find("PATH");
+    std::string executable = command[0];
+    if (path != env.end() && executable.find('/') == std::string::npos) {
+        executable = findInPath(executable, path->second);
+        if (executable.empty()) {
+            result.d_exitCode = execErrorExitCode(ENOENT);
+            return result;
         }
+    }
 
-        const auto exec_status =
-            execvp(argv[0], const_cast<char *const *>(argv.get()));
-
-        int exit_code = 1;
-        if (exec_status != 0) {
-            const auto exec_error = errno;
-            // Following the Bash convention for exit codes.
-            // (https://gnu.org/software/bash/manual/html_node/Exit-Status.html)
-            if (exec_error == ENOENT) {
-                exit_code = 127; // "command not found"
-            }
-            else {
-                exit_code = 126; // Command invoked cannot execute
-            }
-        }
+    // Pipe and spawn. Unlike `fork()`, `posix_spawn()` doesn't copy the
+    // page tables of this process, which can be large, and is safe to call
+    // while other threads hold locks.
+    auto stdOutPipeFDs = createPipe();
+    auto stdErrPipeFDs = createPipe();
 
-        _Exit(exit_code);
+    posix_spawn_file_actions_t fileActions;
+    posix_spawn_file_actions_init(&fileActions);
+    if (pipeStdOut) {
+        // redirect stdout to input end of pipe
+        posix_spawn_file_actions_adddup2(&fileActions, stdOutPipeFDs[1],
+                                         STDOUT_FILENO);
+    }
+    if (pipeStdErr) {
+        // redirect stderr to input end of pipe
+        posix_spawn_file_actions_adddup2(&fileActions, stdErrPipeFDs[1],
+                                         STDERR_FILENO);
     }
 
-    // (runs only in the parent)
-    SubprocessResult result;
+    pid_t pid;
+    const int spawn_error = posix_spawnp(
+        &pid, executable.c_str(), &fileActions, nullptr,
+        const_cast<char *const *>(argv.get()), envp.data());
+    posix_spawn_file_actions_destroy(&fileActions);
+
+    close(stdOutPipeFDs[1]);
+    close(stdErrPipeFDs[1]);
+    if (spawn_error != 0) {
+        close(stdOutPipeFDs[0]);
+        close(stdErrPipeFDs[0]);
+        result.d_exitCode = execErrorExitCode(spawn_error);
+        return result;
+    }
 
-    // Get the output from the child process
-    fd_set fdSet;
-    FD_ZERO(&fdSet);
+    // Get the output from the child process, as it is written
+    struct Stream {
+        int d_fd;
+        std::string *d_output;
+        const OutputCallback *d_callback;
+    };
+    std::vector<Stream> streams;
     if (pipeStdOut) {
-        FD_SET(stdOutPipeFDs[0], &fdSet);
-        close(stdOutPipeFDs[1]);
+        streams.push_back({stdOutPipeFDs[0], &result.d_stdOut, &onStdOut});
+    }
+    else {
+        close(stdOutPipeFDs[0]);
     }
     if (pipeStdErr) {
-        FD_SET(stdErrPipeFDs[0], &fdSet);
-        close(stdErrPipeFDs[1]);
+        streams.push_back({stdErrPipeFDs[0], &result.d_stdErr, &onStdErr});
+    }
+    else {
+        close(stdErrPipeFDs[0]);
     }
 
-    char buffer[4096];
-    while (FD_ISSET(stdOutPipeFDs[0], &fdSet) ||
-           FD_ISSET(stdErrPipeFDs[0], &fdSet)) {
-        fd_set readFDSet = fdSet;
-
-        struct timeval timeout;
-        timeout.tv_sec = 5;
-        timeout.tv_usec = 0;
+    std::vector<struct pollfd> pollFDs(streams.size());
+    for (size_t i = 0; i < streams.size(); ++i) {
+        pollFDs[i].fd = streams[i].d_fd;
+        pollFDs[i].events = POLLIN;
+    }
 
-        select(FD_SETSIZE, &readFDSet, nullptr, nullptr, &timeout);
+    // Large enough to drain a full pipe with a single read
+    char buffer[65536];
+    size_t openStreams = streams.size();
+    while (openStreams > 0) {
+        if (poll(pollFDs.data(), static_cast<nfds_t>(pollFDs.size()), -1) <
+            0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::system_error(errno, std::system_category());
+        }
 
-        if (FD_ISSET(stdOutPipeFDs[0], &readFDSet)) {
-            ssize_t bytesRead = read(stdOutPipeFDs[0], buffer, sizeof(buffer));
-            if (bytesRead > 0) {
-                result.d_stdOut.append(buffer, static_cast<size_t>(bytesRead));
+        for (size_t i = 0; i < streams.size(); ++i) {
+            // Closed streams have a negative descriptor, which is ignored
+            if (pollFDs[i].fd < 0 || pollFDs[i].revents == 0) {
+                continue;
             }
-            else {
-                close(stdOutPipeFDs[0]);
-                FD_CLR(stdOutPipeFDs[0], &fdSet);
+            const ssize_t bytesRead =
+                read(pollFDs[i].fd, buffer, sizeof(buffer));
+            if (bytesRead < 0 && errno == EINTR) {
+                continue;
             }
-        }
-        if (FD_ISSET(stdErrPipeFDs[0], &readFDSet)) {
-            ssize_t bytesRead = read(stdErrPipeFDs[0], buffer, sizeof(buffer));
-            if (bytesRead > 0) {
-                result.d_stdErr.append(buffer, static_cast<size_t>(bytesRead));
+            if (bytesRead > 0 && *streams[i].d_callback) {
+                (*streams[i].d_callback)(buffer,
+                                         static_cast<size_t>(bytesRead));
+            }
+            else if (bytesRead > 0) {
+                streams[i].d_output->append(buffer,
+                                            static_cast<size_t>(bytesRead));
             }
             else {
-                close(stdErrPipeFDs[0]);
-                FD_CLR(stdErrPipeFDs[0], &fdSet);
+                close(pollFDs[i].fd);
+                pollFDs[i].fd = -1;
+                --openStreams;
             }
         }
     }
@@ -187,4 +279,15 @@ Subprocess::execute(const std::vector<std::string> &command, bool pipeStdOut,
 
     return result;
 }
+
+int Subprocess::replaceProcess(const std::vector<std::string> &command)
+{
+    if (command.empty()) {
+        return execErrorExitCode(ENOENT);
+    }
+
+    const auto argv = argvFromCommand(command);
+    execvp(argv[0], const_cast<char *const *>(argv.get()));
+    return execErrorExitCode(errno);
+}
 } // namespace recc
@@ -15,6 +15,8 @@
 #ifndef INCLUDED_SUBPROCESS
 #define INCLUDED_SUBPROCESS
 
+#include <cstddef>
+#include <functional>
 #include <map>
 #include <string>
 #include <vector>
@@ -22,6 +24,8 @@
 namespace recc {
 
 struct Subprocess {
+    typedef std::function<void(const char *data, size_t size)> OutputCallback;
+
     /**
      * Represents the result of executing a subprocess.
      */
@@ -43,11 +47,26 @@ struct Subprocess {
      *
      * If cwd is non-empty, it specifies the current working directory of the
      * subprocess.
+     *
+     * If pipeStdOut is true and onStdOut is given, standard output is passed
+     * to it in chunks as it is read instead of being returned. The same goes
+     * for pipeStdErr and onStdErr.
      */
     static SubprocessResult
     execute(const std::vector<std::string> &command, bool pipeStdOut = false,
             bool pipeStdErr = false,
-            const std::map<std::string, std::string> &env = {});
+            const std::map<std::string, std::string> &env = {},
+            const OutputCallback &onStdOut = OutputCallback(),
+            const OutputCallback &onStdErr = OutputCallback());
+
+    /**
+     * Replace the current process with the given command, so that it runs
+     * without a parent waiting for it.
+     *
+     * Only returns if the command could not be executed, with the exit code
+     * a shell would have given.
+     */
+    static int replaceProcess(const std::vector<std::string> &command);
 };
 
 } // namespace recc
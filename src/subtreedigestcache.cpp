@@ -0,0 +1,144 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <subtreedigestcache.h>
+
+#include <cachekey.h>
+#include <digestgenerator.h>
+
+#include <buildboxcommon_fileutils.h>
+#include <buildboxcommon_logging.h>
+
+#include <fstream>
+#include <sstream>
+#include <utility>
+
+namespace recc {
+
+namespace {
+
+// First line of every entry, to be changed with the format
+const std::string ENTRY_HEADER = "recc-subtree-1";
+
+} // namespace
+
+SubtreeDigestCache::SubtreeDigestCache(const std::string &cacheDirectory)
+    : d_cacheDirectory(cacheDirectory), d_hits(0), d_misses(0)
+{
+}
+
+void SubtreeDigestCache::appendFile(std::string *keyData, const char *name,
+                                    size_t nameLength,
+                                    const proto::Digest &digest,
+                                    bool executable)
+{
+    appendField(keyData, "file");
+    appendField(keyData, name, nameLength);
+    appendField(keyData, digest.hash());
+    appendField(keyData, std::to_string(digest.size_bytes()));
+    appendField(keyData, executable ? "1" : "0");
+}
+
+void SubtreeDigestCache::appendDirectory(std::string *keyData,
+                                         const char *name, size_t nameLength,
+                                         const proto::Digest &digest)
+{
+    appendField(keyData, "directory");
+    appendField(keyData, name, nameLength);
+    appendField(keyData, digest.hash());
+    appendField(keyData, std::to_string(digest.size_bytes()));
+}
+
+void SubtreeDigestCache::appendSymlink(std::string *keyData, const char *name,
+                                       size_t nameLength, const char *target,
+                                       size_t targetLength)
+{
+    appendField(keyData, "symlink");
+    appendField(keyData, name, nameLength);
+    appendField(keyData, target, targetLength);
+}
+
+std::string SubtreeDigestCache::computeKey(const std::string &keyData)
+{
+    return DigestGenerator::make_digest(keyData).hash();
+}
+
+std::string SubtreeDigestCache::entryPath(const std::string &key) const
+{
+    return d_cacheDirectory + "/" + key.substr(0, 2) + "/" + key;
+}
+
+bool SubtreeDigestCache::lookup(const std::string &key, proto::Digest *digest,
+                                std::string *blob)
+{
+    const std::string path = entryPath(key);
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    std::string header;
+    std::string hash;
+    int64_t size = -1;
+    if (!file.good()) {
+        ++d_misses;
+        return false;
+    }
+
+    // The header and the digest are followed by the serialized `Directory`
+    std::getline(file, header);
+    file >> hash >> size;
+    if (file.get() != '\n' || header != ENTRY_HEADER || hash.empty() ||
+        size < 0) {
+        BUILDBOX_LOG_WARNING("Ignoring malformed subtree cache entry \""
+                             << path << "\"");
+        ++d_misses;
+        return false;
+    }
+    std::ostringstream contents;
+    contents << file.rdbuf();
+    std::string data = contents.str();
+    if (static_cast<int64_t>(data.size()) != size) {
+        BUILDBOX_LOG_WARNING("Ignoring truncated subtree cache entry \""
+                             << path << "\"");
+        ++d_misses;
+        return false;
+    }
+
+    digest->set_hash(hash);
+    digest->set_size_bytes(size);
+    *blob = std::move(data);
+    ++d_hits;
+    return true;
+}
+
+void SubtreeDigestCache::store(const std::string &key,
+                               const proto::Digest &digest,
+                               const std::string &blob) const
+{
+    const std::string path = entryPath(key);
+    const std::string directory = path.substr(0, path.rfind('/'));
+    try {
+        buildboxcommon::FileUtils::createDirectory(directory.c_str());
+        // Written to a temporary file and renamed into place so that
+        // concurrent readers never see a partial entry
+        buildboxcommon::FileUtils::writeFileAtomically(
+            path,
+            ENTRY_HEADER + "\n" + digest.hash() + " " +
+                std::to_string(digest.size_bytes()) + "\n" + blob,
+            0644, directory);
+    }
+    catch (const std::exception &e) {
+        BUILDBOX_LOG_WARNING("Could not store subtree cache entry \""
+                             << path << "\": " << e.what());
+    }
+}
+
+} // namespace recc
@@ -0,0 +1,101 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef INCLUDED_SUBTREEDIGESTCACHE
+#define INCLUDED_SUBTREEDIGESTCACHE
+
+#include <protos.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace recc {
+
+/**
+ * Local cache of the `Directory` messages of input roots, shared by all recc
+ * processes using the same cache directory, so that the subtrees that
+ * consecutive input roots have in common (include directories, system
+ * headers) are neither serialized nor hashed again.
+ *
+ * An entry is keyed by a digest of the names, digests and flags of the
+ * children of a directory, computed with the configured digest function,
+ * and stores the serialized `Directory` along with its digest. Node
+ * properties, which recc doesn't set, are not part of the key.
+ *
+ * This class is thread-safe.
+ */
+class SubtreeDigestCache {
+  public:
+    /**
+     * Entries are stored in files below `cacheDirectory`, which is created
+     * on demand.
+     */
+    explicit SubtreeDigestCache(const std::string &cacheDirectory);
+
+    /**
+     * Append a child of a directory to the material hashed by
+     * `computeKey()`. Children must be appended in the same order for the
+     * same directory.
+     */
+    static void appendFile(std::string *keyData, const char *name,
+                           size_t nameLength, const proto::Digest &digest,
+                           bool executable);
+    static void appendDirectory(std::string *keyData, const char *name,
+                                size_t nameLength,
+                                const proto::Digest &digest);
+    static void appendSymlink(std::string *keyData, const char *name,
+                              size_t nameLength, const char *target,
+                              size_t targetLength);
+
+    /**
+     * Returns the key of the directory whose children were appended to
+     * `keyData`.
+     */
+    static std::string computeKey(const std::string &keyData);
+
+    /**
+     * Looks up the directory with the given key. Returns `true` and writes
+     * its digest and serialized `Directory` to `digest` and `blob` if it is
+     * found.
+     */
+    bool lookup(const std::string &key, proto::Digest *digest,
+                std::string *blob);
+
+    /**
+     * Stores the digest and serialized `Directory` of the directory with
+     * the given key. Failures are logged and otherwise ignored.
+     */
+    void store(const std::string &key, const proto::Digest &digest,
+               const std::string &blob) const;
+
+    /**
+     * Returns the path to the file storing the entry with the given key.
+     */
+    std::string entryPath(const std::string &key) const;
+
+    int64_t hits() const { return d_hits; }
+
+    int64_t misses() const { return d_misses; }
+
+  private:
+    std::string d_cacheDirectory;
+    std::atomic<int64_t> d_hits;
+    std::atomic<int64_t> d_misses;
+};
+
+} // namespace recc
+
+#endif
@@ -0,0 +1,298 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <threadpool.h>
+
+#include <env.h>
+#include <jobserver.h>
+
+#include <algorithm>
+#include <exception>
+
+namespace recc {
+
+namespace {
+
+// Identifies the pool and queue of the current thread if it is a worker
+thread_local const ThreadPool *t_pool = nullptr;
+thread_local size_t t_queueIndex = 0;
+
+// Number of ranges per thread that `parallelFor()` aims for, so that threads
+// finishing early can steal the remaining ones
+const uint64_t RANGES_PER_THREAD = 4;
+
+// How often workers without a token try to take one while tasks are pending
+const std::chrono::milliseconds TOKEN_RETRY_INTERVAL(10);
+
+std::shared_ptr<JobServer> &defaultJobServerInstance()
+{
+    static std::shared_ptr<JobServer> jobServer;
+    return jobServer;
+}
+
+} // namespace
+
+ThreadPool::ThreadPool(size_t numWorkers,
+                       std::shared_ptr<JobServer> jobServer)
+    : d_pending(0), d_nextQueue(0), d_jobServer(std::move(jobServer))
+{
+    const size_t numQueues = std::max<size_t>(numWorkers, 1);
+    for (size_t i = 0; i < numQueues; ++i) {
+        d_queues.push_back(std::make_unique<Queue>());
+    }
+    d_threads.reserve(numWorkers);
+    for (size_t i = 0; i < numWorkers; ++i) {
+        d_threads.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        const std::lock_guard<std::mutex> lock(d_sleepMutex);
+        d_stopping = true;
+    }
+    d_wakeUp.notify_all();
+    for (auto &thread : d_threads) {
+        thread.join();
+    }
+}
+
+ThreadPool &ThreadPool::defaultPool()
+{
+    static ThreadPool pool(
+        []() -> size_t {
+            int numThreads = RECC_MAX_THREADS;
+            if (numThreads < 0 || defaultJobServer()) {
+                numThreads =
+                    static_cast<int>(std::thread::hardware_concurrency());
+            }
+            return numThreads > 1 ? static_cast<size_t>(numThreads - 1) : 0;
+        }(),
+        defaultJobServer());
+    return pool;
+}
+
+void ThreadPool::setDefaultJobServer(std::shared_ptr<JobServer> jobServer)
+{
+    defaultJobServerInstance() = std::move(jobServer);
+}
+
+const std::shared_ptr<JobServer> &ThreadPool::defaultJobServer()
+{
+    return defaultJobServerInstance();
+}
+
+void ThreadPool::push(Task task)
+{
+    // Workers push to their own queue, other threads spread their tasks
+    const size_t index =
+        (t_pool == this) ? t_queueIndex
+                         : d_nextQueue.fetch_add(1) % d_queues.size();
+    {
+        Queue &queue = *d_queues[index];
+        const std::lock_guard<std::mutex> lock(queue.d_mutex);
+        queue.d_tasks.push_back(std::move(task));
+    }
+    d_pending.fetch_add(1);
+
+    // Taking the lock orders this with a worker about to go to sleep
+    { const std::lock_guard<std::mutex> lock(d_sleepMutex); }
+    d_wakeUp.notify_one();
+}
+
+bool ThreadPool::popTask(Task *task)
+{
+    if (d_pending.load() == 0) {
+        return false;
+    }
+
+    // Take the most recent task of our own queue, which is likely to be
+    // related to the one that just finished, otherwise the oldest task of
+    // another queue
+    const size_t own = (t_pool == this) ? t_queueIndex : 0;
+    for (size_t i = 0; i < d_queues.size(); ++i) {
+        Queue &queue = *d_queues[(own + i) % d_queues.size()];
+        const std::lock_guard<std::mutex> lock(queue.d_mutex);
+        if (queue.d_tasks.empty()) {
+            continue;
+        }
+        if (i == 0 && t_pool == this) {
+            *task = std::move(queue.d_tasks.back());
+            queue.d_tasks.pop_back();
+        }
+        else {
+            *task = std::move(queue.d_tasks.front());
+            queue.d_tasks.pop_front();
+        }
+        d_pending.fetch_sub(1);
+        return true;
+    }
+    return false;
+}
+
+bool ThreadPool::runPendingTask()
+{
+    Task task;
+    if (!popTask(&task)) {
+        return false;
+    }
+    task();
+    return true;
+}
+
+bool ThreadPool::acquireToken(
+    std::chrono::steady_clock::time_point *waitingSince) const
+{
+    const auto now = std::chrono::steady_clock::now();
+    const bool waiting =
+        *waitingSince != std::chrono::steady_clock::time_point();
+    const bool pending = d_pending.load() > 0;
+    const bool acquired = pending && d_jobServer->tryAcquire();
+    if (waiting && (acquired || !pending)) {
+        d_jobServer->addWaitTime(
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                now - *waitingSince));
+        *waitingSince = std::chrono::steady_clock::time_point();
+    }
+    else if (!waiting && !acquired && pending) {
+        *waitingSince = now;
+    }
+    return acquired;
+}
+
+void ThreadPool::workerLoop(size_t index)
+{
+    t_pool = this;
+    t_queueIndex = index;
+
+    bool holdsToken = false;
+    std::chrono::steady_clock::time_point waitingSince;
+    while (true) {
+        if (d_jobServer && !holdsToken) {
+            holdsToken = acquireToken(&waitingSince);
+        }
+        if ((holdsToken || !d_jobServer) && runPendingTask()) {
+            continue;
+        }
+        if (holdsToken) {
+            d_jobServer->release();
+            holdsToken = false;
+        }
+
+        std::unique_lock<std::mutex> lock(d_sleepMutex);
+        if (d_jobServer && d_pending.load() > 0) {
+            // There was no token for the pending tasks, the threads waiting
+            // for them may run them in the meantime
+            d_wakeUp.wait_for(lock, TOKEN_RETRY_INTERVAL);
+        }
+        else {
+            d_wakeUp.wait(lock, [this]() {
+                return d_stopping || d_pending.load() > 0;
+            });
+        }
+        if (d_stopping) {
+            return;
+        }
+    }
+}
+
+void ThreadPool::waitUntil(const std::function<bool()> &done)
+{
+    while (!done()) {
+        if (runPendingTask()) {
+            continue;
+        }
+        // The awaited tasks are running on other threads
+        std::unique_lock<std::mutex> lock(d_sleepMutex);
+        d_wakeUp.wait_for(lock, std::chrono::milliseconds(1), [&]() {
+            return d_pending.load() > 0 || done();
+        });
+    }
+}
+
+void ThreadPool::parallelFor(size_t count,
+                             const std::function<uint64_t(size_t)> &cost,
+                             const std::function<void(size_t, size_t)> &work)
+{
+    if (count == 0) {
+        return;
+    }
+
+    std::vector<uint64_t> costs(count);
+    uint64_t totalCost = 0;
+    for (size_t i = 0; i < count; ++i) {
+        costs[i] = std::max<uint64_t>(cost(i), 1);
+        totalCost += costs[i];
+    }
+
+    const uint64_t numRanges = (numWorkers() + 1) * RANGES_PER_THREAD;
+    if (numWorkers() == 0 || count == 1) {
+        work(0, count);
+        return;
+    }
+    const uint64_t grainCost = std::max<uint64_t>(totalCost / numRanges, 1);
+
+    std::atomic<size_t> remaining(0);
+    std::mutex errorMutex;
+    std::exception_ptr error;
+
+    const auto runRange = [&](size_t begin, size_t end) {
+        try {
+            work(begin, end);
+        }
+        catch (...) {
+            const std::lock_guard<std::mutex> lock(errorMutex);
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+        // This closure may be destroyed as soon as `remaining` reaches zero
+        ThreadPool *const pool = this;
+        if (remaining.fetch_sub(1) == 1) {
+            // Wake up the thread waiting in `waitUntil()`
+            { const std::lock_guard<std::mutex> lock(pool->d_sleepMutex); }
+            pool->d_wakeUp.notify_all();
+        }
+    };
+
+    // Split [0, count) into ranges of roughly `grainCost`. The first range is
+    // kept for the calling thread.
+    std::vector<std::pair<size_t, size_t>> ranges;
+    size_t begin = 0;
+    uint64_t rangeCost = 0;
+    for (size_t i = 0; i < count; ++i) {
+        rangeCost += costs[i];
+        if (rangeCost >= grainCost || i + 1 == count) {
+            ranges.emplace_back(begin, i + 1);
+            begin = i + 1;
+            rangeCost = 0;
+        }
+    }
+
+    remaining = ranges.size();
+    for (size_t i = 1; i < ranges.size(); ++i) {
+        const auto range = ranges[i];
+        push([&runRange, range]() { runRange(range.first, range.second); });
+    }
+    runRange(ranges[0].first, ranges[0].second);
+
+    waitUntil([&remaining]() { return remaining.load() == 0; });
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+} // namespace recc
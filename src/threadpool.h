@@ -0,0 +1,173 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef INCLUDED_THREADPOOL
+#define INCLUDED_THREADPOOL
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace recc {
+
+class JobServer;
+
+/**
+ * Pool of worker threads with one task queue per worker.
+ *
+ * Workers take tasks from the back of their own queue and, when it is empty,
+ * steal from the front of the other queues. Tasks submitted from a worker go
+ * to its own queue, so tasks can submit and wait for further tasks: threads
+ * waiting for tasks to complete run pending tasks in the meantime instead of
+ * blocking.
+ *
+ * With a jobserver, workers only run tasks while they hold one of its
+ * tokens, which they give back as soon as there is nothing left to do.
+ * The threads waiting for tasks run them under the token of the process.
+ */
+class ThreadPool {
+  public:
+    typedef std::function<void()> Task;
+
+    /**
+     * Starts `numWorkers` threads. With no workers, tasks are run by the
+     * threads that wait for them.
+     */
+    explicit ThreadPool(size_t numWorkers,
+                        std::shared_ptr<JobServer> jobServer = nullptr);
+
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    /**
+     * Returns the pool shared by the whole process, which is created on
+     * first use with one worker less than the number of threads configured
+     * in `RECC_MAX_THREADS` (the calling thread being the remaining one).
+     *
+     * With a jobserver, it has one worker less than the number of cores
+     * instead, the tokens limiting how many of them run.
+     */
+    static ThreadPool &defaultPool();
+
+    /**
+     * Sets the jobserver of the default pool. Must be called before its
+     * first use.
+     */
+    static void setDefaultJobServer(std::shared_ptr<JobServer> jobServer);
+
+    static const std::shared_ptr<JobServer> &defaultJobServer();
+
+    size_t numWorkers() const { return d_threads.size(); }
+
+    /**
+     * Schedules `function` and returns a future for its result. Use `wait()`
+     * to wait for it from within a task.
+     */
+    template <typename F>
+    std::future<typename std::result_of<F()>::type> submit(F &&function)
+    {
+        typedef typename std::result_of<F()>::type Result;
+        auto task = std::make_shared<std::packaged_task<Result()>>(
+            std::forward<F>(function));
+        push([task]() { (*task)(); });
+        return task->get_future();
+    }
+
+    /**
+     * Waits for `future` (a `std::future` or `std::shared_future`), running
+     * pending tasks in the meantime, and returns its result.
+     */
+    template <typename Future>
+    auto wait(Future &future) -> decltype(future.get())
+    {
+        waitUntil([&future]() {
+            return future.wait_for(std::chrono::seconds(0)) ==
+                   std::future_status::ready;
+        });
+        return future.get();
+    }
+
+    /**
+     * Calls `work(begin, end)` for consecutive ranges covering [0, count)
+     * in parallel and waits for all of them, running some of the ranges on
+     * the calling thread.
+     *
+     * The ranges are sized so that the sum of `cost(i)` over each range is
+     * roughly the same, so that a few expensive items don't end up in the
+     * same range. If `work` throws, the first exception is rethrown after
+     * all ranges have completed.
+     */
+    void parallelFor(size_t count, const std::function<uint64_t(size_t)> &cost,
+                     const std::function<void(size_t, size_t)> &work);
+
+    /**
+     * Runs one pending task on the calling thread. Returns `false` if there
+     * was none.
+     */
+    bool runPendingTask();
+
+  private:
+    struct Queue {
+        std::mutex d_mutex;
+        std::deque<Task> d_tasks;
+    };
+
+    void push(Task task);
+
+    bool popTask(Task *task);
+
+    void workerLoop(size_t index);
+
+    /**
+     * Takes a token for a worker that doesn't have one, if tasks are
+     * pending. `waitingSince` is set while the worker waits for one, and
+     * the time waited is recorded in the jobserver once it stops waiting.
+     */
+    bool acquireToken(
+        std::chrono::steady_clock::time_point *waitingSince) const;
+
+    /**
+     * Runs pending tasks until `done()` returns `true`.
+     */
+    void waitUntil(const std::function<bool()> &done);
+
+    // One queue per worker, or a single one if there are no workers
+    std::vector<std::unique_ptr<Queue>> d_queues;
+    std::vector<std::thread> d_threads;
+
+    // Number of queued tasks. Idle workers sleep until it becomes non-zero
+    // or the pool is stopped.
+    std::atomic<size_t> d_pending;
+    std::atomic<size_t> d_nextQueue;
+    std::mutex d_sleepMutex;
+    std::condition_variable d_wakeUp;
+    bool d_stopping = false;
+
+    std::shared_ptr<JobServer> d_jobServer;
+};
+
+} // namespace recc
+
+#endif
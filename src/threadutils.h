@@ -16,8 +16,13 @@
 #define INCLUDED_THREADUTILS
 
 #include <env.h>
+#include <threadpool.h>
+
+#include <cstdint>
+#include <functional>
 #include <mutex>
 #include <thread>
+#include <vector>
 
 namespace recc {
 
@@ -25,10 +30,9 @@ struct ThreadUtils {
 
     /**
      * Apply doWorkInRange to a range of elements in the container, in
-     * parallel. Will partition the container according to the RECC_MAX_THREADS
-     * global variable.
-     * If there are less than 50 elements in the container, the work will not
-     * be parallelized.
+     * parallel, using the threads of `ThreadPool::defaultPool()`. Elements
+     * are assumed to have the same cost, see the overload below otherwise.
+     * If RECC_MAX_THREADS is 0, the work will not be parallelized.
      *
      * NOTE: This fuction makes no guarantees about thread safety or
      * ordering of the parallel operations done in doWorkInRange. It is up to
@@ -41,55 +45,47 @@ struct ThreadUtils {
         std::function<void(typename ContainerT::iterator,
                            typename ContainerT::iterator)> &doWorkInRange)
     {
-        int numThreads = RECC_MAX_THREADS;
-        typename ContainerT::iterator start = container.begin();
-        typename ContainerT::iterator end = container.end();
-        const auto containerLength = container.size();
-        if (containerLength < 50 || numThreads == 0) {
-            doWorkInRange(start, end);
+        parallelizeContainerOperations(
+            container, doWorkInRange,
+            [](const typename ContainerT::value_type &) -> uint64_t {
+                return 1;
+            });
+    }
+
+    /**
+     * Same as above, but ranges are formed so that each of them has roughly
+     * the same total cost, as returned by `cost` for each element (e.g. the
+     * size of a file to hash), so that threads get a similar amount of work
+     * when the cost of elements is skewed.
+     */
+    template <class ContainerT>
+    static void parallelizeContainerOperations(
+        ContainerT &container,
+        std::function<void(typename ContainerT::iterator,
+                           typename ContainerT::iterator)> &doWorkInRange,
+        const std::function<uint64_t(const typename ContainerT::value_type &)>
+            &cost)
+    {
+        const size_t containerLength = container.size();
+        if (containerLength < 2 || RECC_MAX_THREADS == 0) {
+            doWorkInRange(container.begin(), container.end());
+            return;
         }
-        else {
-            if (numThreads < 0) {
-                // This call can return 0. If so, default to numThreads.
-                int available_threads =
-                    static_cast<int>(std::thread::hardware_concurrency());
-                numThreads =
-                    available_threads ? available_threads : numThreads;
-            }
-            if (numThreads == 0) {
-                numThreads = 1;
-            }
 
-            auto positiveNumThreads = static_cast<unsigned long>(numThreads);
-            const auto numItemsPerPartition =
-                containerLength / positiveNumThreads;
-            std::vector<std::thread> threadObjects;
-            // The conversion to unsigned is fine here, as we handle negative
-            // values for numThreads above.
-            threadObjects.reserve(positiveNumThreads);
-            end = start;
-            for (auto partition = 0; partition < numThreads; ++partition) {
-                // To handle a none evenly divisible number of objects, the
-                // last partition goes to the end of the range.
-                //
-                // Additionally, the main thread will process the remaining
-                // elements.
-                if (partition == numThreads - 1) {
-                    end = container.end();
-                    doWorkInRange(start, end);
-                    continue;
-                }
-                else {
-                    std::advance(end, static_cast<long>(numItemsPerPartition));
-                }
-                threadObjects.push_back(
-                    std::thread(std::ref(doWorkInRange), start, end));
-                start = end;
-            }
-            for (auto &thread : threadObjects) {
-                thread.join();
-            }
+        // Ranges are given to the pool as indexes
+        std::vector<typename ContainerT::iterator> iterators;
+        iterators.reserve(containerLength + 1);
+        for (auto it = container.begin(); it != container.end(); ++it) {
+            iterators.push_back(it);
         }
+        iterators.push_back(container.end());
+
+        ThreadPool::defaultPool().parallelFor(
+            containerLength,
+            [&](size_t index) { return cost(*iterators[index]); },
+            [&](size_t begin, size_t end) {
+                doWorkInRange(iterators[begin], iterators[end]);
+            });
     }
 };
 
@@ -16,11 +16,15 @@
 #include <buildboxcommon_fileutils.h>
 #include <buildboxcommon_logging.h>
 #include <buildboxcommon_merklize.h>
+#include <buildboxcommon_temporarydirectory.h>
 #include <buildboxcommonmetrics_durationmetricvalue.h>
 #include <buildboxcommonmetrics_testingutils.h>
 #include <digestgenerator.h>
 #include <env.h>
+#include <filehashqueue.h>
 #include <fileutils.h>
+#include <merkletreebuilder.h>
+#include <threadpool.h>
 #include <fstream>
 #include <protos.h>
 
@@ -406,6 +410,59 @@ TEST_F(ActionBuilderTestFixture, BuildMerkleTreeVerifyMetricsCollection)
         collectedByName<DurationMetricValue>(TIMER_NAME_BUILD_MERKLE_TREE));
 }
 
+TEST_F(ActionBuilderTestFixture, BuildMerkleTreeInParallel)
+{
+    buildboxcommon::TemporaryDirectory directory;
+    DependencyPairs dep_pairs;
+    for (int i = 0; i < 200; ++i) {
+        const std::string relativePath = "sub" + std::to_string(i % 5) +
+                                         "/file" + std::to_string(i) + ".h";
+        const std::string path = directory.strname() + "/" + relativePath;
+        buildboxcommon::FileUtils::createDirectory(
+            (directory.strname() + "/sub" + std::to_string(i % 5)).c_str());
+        buildboxcommon::FileUtils::writeFileAtomically(path,
+                                                       std::to_string(i));
+        dep_pairs.emplace_back(path, relativePath);
+    }
+    // The directory before `..` must be created
+    dep_pairs.emplace_back(directory.strname() + "/sub0/file0.h",
+                           "extra/../sub0/file0.h");
+
+    const int previousMaxThreads = RECC_MAX_THREADS;
+    const auto buildDigest = [&](int maxThreads) {
+        RECC_MAX_THREADS = maxThreads;
+        MerkleTreeBuilder merkleTree;
+        buildboxcommon::digest_string_map digests;
+        buildMerkleTree(dep_pairs, "cwd", &merkleTree, &digests);
+        EXPECT_EQ(digests.size(), 200);
+        return merkleTree.build();
+    };
+    const auto serialDigest = buildDigest(0);
+    const auto parallelDigest = buildDigest(4);
+    EXPECT_EQ(serialDigest, parallelDigest);
+
+    // Some of the files hashed beforehand, as when they are reported by the
+    // dependency command
+    ThreadPool pool(2);
+    FileHashQueue hashQueue(&pool, nullptr, 8);
+    for (size_t i = 0; i < dep_pairs.size(); i += 2) {
+        hashQueue.push(dep_pairs[i].first);
+    }
+    MerkleTreeBuilder prehashedTree;
+    buildboxcommon::digest_string_map prehashedDigests;
+    buildMerkleTree(dep_pairs, "cwd", &prehashedTree, &prehashedDigests,
+                    &hashQueue);
+    RECC_MAX_THREADS = previousMaxThreads;
+    EXPECT_EQ(prehashedDigests.size(), 200);
+    EXPECT_EQ(serialDigest, prehashedTree.build());
+
+    // Same tree built from the directory itself
+    MerkleTreeBuilder expectedTree;
+    expectedTree.addLocalDirectory(directory.strname(), "cwd", nullptr);
+    expectedTree.addDirectory("cwd/extra");
+    EXPECT_EQ(serialDigest, expectedTree.build());
+}
+
 TEST_F(ActionBuilderTestFixture, GetDependenciesVerifyMetricsCollection)
 {
     const std::vector<std::string> recc_args = {"./gcc", "-c", "hello.cpp",
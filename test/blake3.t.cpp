@@ -0,0 +1,132 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <blake3.h>
+#include <threadpool.h>
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace recc;
+
+namespace {
+
+// Input of the official test vectors: bytes 0, 1, ..., 250, 0, 1, ...
+std::string testInput(size_t size)
+{
+    std::string input(size, '\0');
+    for (size_t i = 0; i < size; ++i) {
+        input[i] = static_cast<char>(i % 251);
+    }
+    return input;
+}
+
+std::string toHex(const unsigned char *hash)
+{
+    static const char hexDigits[] = "0123456789abcdef";
+    std::string result;
+    for (size_t i = 0; i < Blake3::DIGEST_SIZE; ++i) {
+        result += hexDigits[hash[i] >> 4];
+        result += hexDigits[hash[i] & 0xf];
+    }
+    return result;
+}
+
+std::string hashInParts(const std::string &input, size_t partSize,
+                        ThreadPool *pool)
+{
+    Blake3 hasher(pool);
+    for (size_t offset = 0; offset < input.size(); offset += partSize) {
+        hasher.update(input.data() + offset,
+                      std::min(partSize, input.size() - offset));
+    }
+    unsigned char hash[Blake3::DIGEST_SIZE];
+    hasher.finalize(hash);
+    return toHex(hash);
+}
+
+} // namespace
+
+TEST(Blake3Test, OfficialTestVectors)
+{
+    // From test_vectors.json in https://github.com/BLAKE3-team/BLAKE3
+    const std::vector<std::pair<size_t, std::string>> vectors = {
+        {0,
+         "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262"},
+        {1,
+         "2d3adedff11b61f14c886e35afa036736dcd87a74d27b5c1510225d0f592e213"},
+        {1023,
+         "10108970eeda3eb932baac1428c7a2163b0e924c9a9e25b35bba72b28f70bd11"},
+        {1024,
+         "42214739f095a406f3fc83deb889744ac00df831c10daa55189b5d121c855af7"},
+        {1025,
+         "d00278ae47eb27b34faecf67b4fe263f82d5412916c1ffd97c8cb7fb814b8444"},
+        {2049,
+         "5f4d72f40d7a5f82b15ca2b2e44b1de3c2ef86c426c95c1af0b6879522563030"},
+        {3073,
+         "7124b49501012f81cc7f11ca069ec9226cecb8a2c850cfe644e327d22d3e1cd3"},
+        {8192,
+         "aae792484c8efe4f19e2ca7d371d8c467ffb10748d8a5a1ae579948f718a2a63"},
+        {8193,
+         "bab6c09cb8ce8cf459261398d2e7aef35700bf488116ceb94a36d0f5f1b7bc3b"},
+        {31744,
+         "62b6960e1a44bcc1eb1a611a8d6235b6b4b78f32e7abc4fb4c6cdcce94895c47"},
+        {102400,
+         "bc3e3d41a1146b069abffad3c0d44860cf664390afce4d9661f7902e7943e085"}};
+
+    for (const auto &vector : vectors) {
+        const std::string input = testInput(vector.first);
+        unsigned char hash[Blake3::DIGEST_SIZE];
+        Blake3::hash(input.data(), input.size(), hash);
+        EXPECT_EQ(toHex(hash), vector.second)
+            << "input of " << vector.first << " bytes";
+    }
+}
+
+TEST(Blake3Test, PartsAndThreadsDoNotChangeHash)
+{
+    ThreadPool pool(3);
+    // Large enough to be split between threads, and not a whole number of
+    // chunks
+    const std::string input = testInput(3 * 1024 * 1024 + 12345);
+    unsigned char hash[Blake3::DIGEST_SIZE];
+    Blake3::hash(input.data(), input.size(), hash);
+    const std::string expected = toHex(hash);
+
+    Blake3::hash(input.data(), input.size(), hash, &pool);
+    EXPECT_EQ(toHex(hash), expected);
+    for (const size_t partSize : {1, 63, 1024, 1025, 65536, 1000000}) {
+        EXPECT_EQ(hashInParts(input, partSize, nullptr), expected)
+            << "parts of " << partSize << " bytes";
+    }
+    EXPECT_EQ(hashInParts(input, 4 * 1024 * 1024, &pool), expected);
+}
+
+TEST(Blake3Test, FinalizeCanBeCalledRepeatedly)
+{
+    const std::string input = testInput(5000);
+    Blake3 hasher;
+    hasher.update(input.data(), 2000);
+    unsigned char hash[Blake3::DIGEST_SIZE];
+    hasher.finalize(hash);
+    hasher.finalize(hash);
+    EXPECT_EQ(toHex(hash), hashInParts(input.substr(0, 2000), 2000, nullptr));
+
+    hasher.update(input.data() + 2000, 3000);
+    hasher.finalize(hash);
+    EXPECT_EQ(toHex(hash), hashInParts(input, 5000, nullptr));
+}
@@ -0,0 +1,123 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <caspresencecache.h>
+#include <digestgenerator.h>
+
+#include <buildboxcommon_temporarydirectory.h>
+
+#include <gtest/gtest.h>
+
+using namespace recc;
+
+namespace {
+const int64_t TTL = 600;
+const uint32_t NOW = 1000000;
+} // namespace
+
+// Exposes the protected members for testing
+class TestCasPresenceCache : public CasPresenceCache {
+  public:
+    using CasPresenceCache::CasPresenceCache;
+    using CasPresenceCache::isPresent;
+    using CasPresenceCache::markPresent;
+};
+
+class CasPresenceCacheTestFixture : public ::testing::Test {
+  protected:
+    CasPresenceCacheTestFixture()
+        : d_tablePath(d_cacheDirectory.strname() + "/presence/table"),
+          d_cache(d_tablePath, TTL, 64)
+    {
+    }
+
+    buildboxcommon::TemporaryDirectory d_cacheDirectory;
+    std::string d_tablePath;
+    TestCasPresenceCache d_cache;
+};
+
+TEST_F(CasPresenceCacheTestFixture, MarkedDigestIsPresent)
+{
+    const proto::Digest digest = DigestGenerator::make_digest("hello");
+    EXPECT_FALSE(d_cache.isPresent(digest, NOW));
+
+    d_cache.markPresent(digest, NOW);
+    EXPECT_TRUE(d_cache.isPresent(digest, NOW));
+    EXPECT_TRUE(d_cache.isPresent(digest, NOW + TTL - 1));
+    EXPECT_EQ(d_cache.hits(), 2);
+    EXPECT_EQ(d_cache.misses(), 1);
+}
+
+TEST_F(CasPresenceCacheTestFixture, EntriesExpire)
+{
+    const proto::Digest digest = DigestGenerator::make_digest("hello");
+    d_cache.markPresent(digest, NOW);
+    EXPECT_FALSE(d_cache.isPresent(digest, NOW + TTL));
+
+    // Marking the digest again refreshes it
+    d_cache.markPresent(digest, NOW + TTL);
+    EXPECT_TRUE(d_cache.isPresent(digest, NOW + TTL));
+
+    // Entries stamped in the future are not trusted either
+    EXPECT_FALSE(d_cache.isPresent(digest, NOW));
+}
+
+TEST_F(CasPresenceCacheTestFixture, MissingDigestIsNotPresent)
+{
+    const proto::Digest digest = DigestGenerator::make_digest("hello");
+    d_cache.markPresent(digest, NOW);
+    d_cache.markMissing(digest);
+    EXPECT_FALSE(d_cache.isPresent(digest, NOW));
+
+    d_cache.markPresent(digest, NOW);
+    EXPECT_TRUE(d_cache.isPresent(digest, NOW));
+}
+
+TEST_F(CasPresenceCacheTestFixture, OtherDigestsAreNotPresent)
+{
+    const proto::Digest digest = DigestGenerator::make_digest("hello");
+    d_cache.markPresent(digest, NOW);
+
+    EXPECT_FALSE(
+        d_cache.isPresent(DigestGenerator::make_digest("world"), NOW));
+
+    // Same hash with a different size
+    proto::Digest resized = digest;
+    resized.set_size_bytes(digest.size_bytes() + 1);
+    EXPECT_FALSE(d_cache.isPresent(resized, NOW));
+}
+
+TEST_F(CasPresenceCacheTestFixture, SharedBetweenInstances)
+{
+    const proto::Digest digest = DigestGenerator::make_digest("hello");
+    d_cache.markPresent(digest);
+
+    CasPresenceCache other(d_tablePath, TTL, 64);
+    EXPECT_TRUE(other.isPresent(digest));
+}
+
+TEST(CasPresenceCacheTest, PathDependsOnServerAndInstance)
+{
+    const std::string path =
+        CasPresenceCache::path("/cache", "http://cas:50051", "", "SHA256");
+    EXPECT_EQ(path.find("/cache/cas-presence-"), 0);
+    EXPECT_EQ(path, CasPresenceCache::path("/cache", "http://cas:50051", "",
+                                           "SHA256"));
+    EXPECT_NE(path, CasPresenceCache::path("/cache", "http://other:50051",
+                                           "", "SHA256"));
+    EXPECT_NE(path, CasPresenceCache::path("/cache", "http://cas:50051",
+                                           "main", "SHA256"));
+    EXPECT_NE(path, CasPresenceCache::path("/cache", "http://cas:50051", "",
+                                           "SHA512"));
+}
@@ -0,0 +1,438 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <daemonclient.h>
+#include <daemonprotocol.h>
+#include <daemonserver.h>
+#include <executioncontext.h>
+#include <fileutils.h>
+
+#include <buildboxcommon_fileutils.h>
+#include <buildboxcommon_temporarydirectory.h>
+
+#include <gtest/gtest.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+
+extern char **environ;
+
+using namespace recc;
+
+namespace {
+
+std::vector<std::string> currentEnvironment()
+{
+    std::vector<std::string> environment;
+    for (char **variable = environ; *variable != nullptr; ++variable) {
+        environment.push_back(*variable);
+    }
+    return environment;
+}
+
+std::string readAll(int fd)
+{
+    std::string data;
+    char buffer[256];
+    ssize_t count;
+    while ((count = read(fd, buffer, sizeof(buffer))) > 0) {
+        data.append(buffer, static_cast<size_t>(count));
+    }
+    return data;
+}
+
+int listenOn(const std::string &socketPath)
+{
+    const struct sockaddr_un address =
+        DaemonProtocol::socketAddress(socketPath);
+    const int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0 ||
+        bind(listener, reinterpret_cast<const struct sockaddr *>(&address),
+             sizeof(address)) != 0 ||
+        listen(listener, 1) != 0) {
+        throw std::system_error(errno, std::system_category(),
+                                "Could not listen on \"" + socketPath + "\"");
+    }
+    return listener;
+}
+
+} // namespace
+
+class DaemonTestFixture : public ::testing::Test {
+  protected:
+    void SetUp() override
+    {
+        ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, d_sockets), 0);
+        ASSERT_EQ(pipe(d_output), 0);
+    }
+
+    void TearDown() override
+    {
+        for (const int fd : {d_sockets[0], d_sockets[1], d_output[0],
+                             d_output[1]}) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+    }
+
+    void closeFd(int *fd)
+    {
+        close(*fd);
+        *fd = -1;
+    }
+
+    // Client and server ends of a connection
+    int d_sockets[2] = {-1, -1};
+    int d_output[2] = {-1, -1};
+    buildboxcommon::TemporaryDirectory d_directory;
+};
+
+TEST_F(DaemonTestFixture, RequestRoundTrip)
+{
+    DaemonRequest request;
+    request.d_arguments = {"gcc", "-c", "hello.c", ""};
+    request.d_workingDirectory = "/some/directory";
+    request.d_environment = {"PATH=/usr/bin", "RECC_SERVER=unix:/socket"};
+    request.d_parentPid = 1234;
+    request.d_fds[1] = d_output[1];
+    DaemonProtocol::sendRequest(d_sockets[0], request);
+
+    DaemonRequest received;
+    ASSERT_TRUE(DaemonProtocol::receiveRequest(d_sockets[1], &received));
+    EXPECT_EQ(received.d_arguments, request.d_arguments);
+    EXPECT_EQ(received.d_workingDirectory, request.d_workingDirectory);
+    EXPECT_EQ(received.d_environment, request.d_environment);
+    EXPECT_EQ(received.d_parentPid, 1234);
+    EXPECT_EQ(received.d_fds[0], -1);
+    EXPECT_EQ(received.d_fds[2], -1);
+
+    // The received descriptor refers to the same pipe
+    ASSERT_GE(received.d_fds[1], 0);
+    EXPECT_NE(received.d_fds[1], d_output[1]);
+    ASSERT_EQ(write(received.d_fds[1], "output", 6), 6);
+    close(received.d_fds[1]);
+    closeFd(&d_output[1]);
+    EXPECT_EQ(readAll(d_output[0]), "output");
+
+    DaemonProtocol::sendStatus(d_sockets[1], DaemonProtocol::ACCEPTED);
+    DaemonProtocol::sendExitCode(d_sockets[1], -3);
+    DaemonProtocol::Status status;
+    int exitCode;
+    ASSERT_TRUE(DaemonProtocol::receiveStatus(d_sockets[0], &status));
+    EXPECT_EQ(status, DaemonProtocol::ACCEPTED);
+    ASSERT_TRUE(DaemonProtocol::receiveExitCode(d_sockets[0], &exitCode));
+    EXPECT_EQ(exitCode, -3);
+}
+
+TEST_F(DaemonTestFixture, MalformedRequest)
+{
+    const char garbage[] = "not a request at all";
+    ASSERT_EQ(write(d_sockets[0], garbage, sizeof(garbage)),
+              static_cast<ssize_t>(sizeof(garbage)));
+    closeFd(&d_sockets[0]);
+
+    DaemonRequest received;
+    EXPECT_FALSE(DaemonProtocol::receiveRequest(d_sockets[1], &received));
+    EXPECT_EQ(received.d_fds[1], -1);
+
+    // A request missing its last bytes
+    DaemonRequest request;
+    request.d_arguments = {"gcc", "-c", "hello.c"};
+    int sockets[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+    DaemonProtocol::sendRequest(sockets[0], request);
+    close(sockets[0]);
+    const std::string message = readAll(sockets[1]);
+    close(sockets[1]);
+
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+    const size_t truncatedSize = message.size() - 3;
+    ASSERT_EQ(write(sockets[0], message.data(), truncatedSize),
+              static_cast<ssize_t>(truncatedSize));
+    close(sockets[0]);
+    EXPECT_FALSE(DaemonProtocol::receiveRequest(sockets[1], &received));
+    close(sockets[1]);
+}
+
+TEST_F(DaemonTestFixture, ConfigurationKey)
+{
+    const std::string directory = d_directory.name();
+    const std::vector<std::string> environment = {
+        "HOME=/home/user", "PATH=/usr/bin", "RECC_SERVER=http://server:80"};
+    const std::string key =
+        DaemonProtocol::configurationKey(environment, directory);
+
+    // Other variables and their order don't matter
+    EXPECT_EQ(DaemonProtocol::configurationKey(
+                  {"RECC_SERVER=http://server:80", "PATH=/bin",
+                   "HOME=/home/user", "CC=gcc"},
+                  directory),
+              key);
+
+    EXPECT_NE(DaemonProtocol::configurationKey(
+                  {"HOME=/home/other", "PATH=/usr/bin",
+                   "RECC_SERVER=http://server:80"},
+                  directory),
+              key);
+    EXPECT_NE(DaemonProtocol::configurationKey(
+                  {"HOME=/home/user", "PATH=/usr/bin",
+                   "RECC_SERVER=http://server:80", "RECC_CACHE_ONLY=1"},
+                  directory),
+              key);
+
+    // A configuration file in the working directory applies
+    buildboxcommon::FileUtils::createDirectory(
+        (directory + "/recc").c_str());
+    buildboxcommon::FileUtils::writeFileAtomically(
+        directory + "/recc/recc.conf", "server=http://other:80\n");
+    EXPECT_NE(DaemonProtocol::configurationKey(environment, directory), key);
+}
+
+TEST_F(DaemonTestFixture, ServerRunsCommand)
+{
+    const std::string cwd = FileUtils::getCurrentWorkingDirectory();
+    std::string commandDirectory;
+    std::string commandVariable;
+    DaemonServer server([&](int argc, char *argv[],
+                            const std::atomic_bool &stopRequested) {
+        commandDirectory = FileUtils::getCurrentWorkingDirectory();
+        const char *variable = getenv("DAEMON_TEST_VARIABLE");
+        commandVariable = variable != nullptr ? variable : "";
+        for (int i = 0; i < argc; ++i) {
+            std::cout << argv[i] << " ";
+        }
+        std::cout << stopRequested;
+        return 42;
+    });
+
+    DaemonRequest request;
+    request.d_arguments = {"echo", "hello"};
+    request.d_workingDirectory = d_directory.name();
+    request.d_environment = currentEnvironment();
+    request.d_environment.push_back("DAEMON_TEST_VARIABLE=value");
+    request.d_fds[1] = d_output[1];
+    DaemonProtocol::sendRequest(d_sockets[0], request);
+    closeFd(&d_output[1]);
+
+    server.handleConnection(d_sockets[1]);
+
+    DaemonProtocol::Status status;
+    int exitCode;
+    ASSERT_TRUE(DaemonProtocol::receiveStatus(d_sockets[0], &status));
+    EXPECT_EQ(status, DaemonProtocol::ACCEPTED);
+    ASSERT_TRUE(DaemonProtocol::receiveExitCode(d_sockets[0], &exitCode));
+    EXPECT_EQ(exitCode, 42);
+    EXPECT_EQ(readAll(d_output[0]), "echo hello 0");
+
+    EXPECT_EQ(commandDirectory, d_directory.strname());
+    EXPECT_EQ(commandVariable, "value");
+
+    // The state of the daemon is restored
+    EXPECT_EQ(FileUtils::getCurrentWorkingDirectory(), cwd);
+    EXPECT_EQ(getenv("DAEMON_TEST_VARIABLE"), nullptr);
+}
+
+TEST_F(DaemonTestFixture, ServerRefusesOtherConfiguration)
+{
+    bool ran = false;
+    DaemonServer server([&](int, char *[], const std::atomic_bool &) {
+        ran = true;
+        return 0;
+    });
+
+    DaemonRequest request;
+    request.d_arguments = {"echo", "hello"};
+    request.d_workingDirectory = FileUtils::getCurrentWorkingDirectory();
+    request.d_environment = currentEnvironment();
+    request.d_environment.push_back("RECC_DAEMON_TEST_VARIABLE=1");
+    DaemonProtocol::sendRequest(d_sockets[0], request);
+
+    server.handleConnection(d_sockets[1]);
+
+    DaemonProtocol::Status status;
+    ASSERT_TRUE(DaemonProtocol::receiveStatus(d_sockets[0], &status));
+    EXPECT_EQ(status, DaemonProtocol::REFUSED);
+    EXPECT_FALSE(ran);
+}
+
+TEST_F(DaemonTestFixture, ClientWithoutDaemon)
+{
+    const std::string socketPath = d_directory.strname() + "/reccd.sock";
+    char argument[] = "true";
+    char *argv[] = {argument, nullptr};
+    int exitCode = -1;
+    EXPECT_FALSE(DaemonClient::execute(socketPath, 1, argv, &exitCode));
+    EXPECT_EQ(exitCode, -1);
+}
+
+TEST_F(DaemonTestFixture, ClientUsesDaemon)
+{
+    const std::string socketPath = d_directory.strname() + "/reccd.sock";
+    const int listener = listenOn(socketPath);
+
+    // Refuses the first command and runs the second one
+    std::vector<std::string> arguments;
+    std::thread daemon([&]() {
+        for (const auto status :
+             {DaemonProtocol::REFUSED, DaemonProtocol::ACCEPTED}) {
+            const int connection = accept(listener, nullptr, nullptr);
+            DaemonRequest request;
+            if (DaemonProtocol::receiveRequest(connection, &request)) {
+                arguments = request.d_arguments;
+                for (const int fd : request.d_fds) {
+                    close(fd);
+                }
+                DaemonProtocol::sendStatus(connection, status);
+                DaemonProtocol::sendExitCode(connection, 7);
+            }
+            close(connection);
+        }
+    });
+
+    char compiler[] = "gcc";
+    char option[] = "-c";
+    char *argv[] = {compiler, option, nullptr};
+    int exitCode = -1;
+    EXPECT_FALSE(DaemonClient::execute(socketPath, 2, argv, &exitCode));
+    EXPECT_EQ(exitCode, -1);
+    EXPECT_TRUE(DaemonClient::execute(socketPath, 2, argv, &exitCode));
+    EXPECT_EQ(exitCode, 7);
+
+    daemon.join();
+    close(listener);
+    EXPECT_EQ(arguments, std::vector<std::string>({"gcc", "-c"}));
+}
+
+TEST_F(DaemonTestFixture, SocketAddress)
+{
+    const std::string socketPath = d_directory.strname() + "/reccd.sock";
+    const struct sockaddr_un address =
+        DaemonProtocol::socketAddress(socketPath);
+    EXPECT_EQ(address.sun_family, AF_UNIX);
+    EXPECT_EQ(std::string(address.sun_path), socketPath);
+
+    const std::string longPath(sizeof(address.sun_path), 'a');
+    EXPECT_THROW(DaemonProtocol::socketAddress(longPath), std::runtime_error);
+    EXPECT_NO_THROW(DaemonProtocol::socketAddress(longPath.substr(1)));
+}
+
+TEST_F(DaemonTestFixture, PeerIsSameUser)
+{
+    EXPECT_TRUE(DaemonProtocol::peerIsSameUser(d_sockets[0]));
+    EXPECT_TRUE(DaemonProtocol::peerIsSameUser(d_sockets[1]));
+
+    // Not a connected socket
+    EXPECT_FALSE(DaemonProtocol::peerIsSameUser(d_output[0]));
+}
+
+class DaemonCacheTestFixture : public DaemonTestFixture {
+  protected:
+    void SetUp() override
+    {
+        DaemonTestFixture::SetUp();
+        d_cwd = FileUtils::getCurrentWorkingDirectory();
+        ASSERT_EQ(chdir(d_workspace.name()), 0);
+        buildboxcommon::FileUtils::writeFileAtomically(
+            d_workspace.strname() + "/input.txt", "input");
+
+        const std::string cache = "file://" + d_cache.strname();
+        for (const auto &variable : d_variables) {
+            const std::string value = variable.second == nullptr
+                                          ? cache
+                                          : std::string(variable.second);
+            setenv(variable.first, value.c_str(), 1);
+        }
+    }
+
+    void TearDown() override
+    {
+        for (const auto &variable : d_variables) {
+            unsetenv(variable.first);
+        }
+        unsetenv("DAEMON_TEST_RUN");
+        ASSERT_EQ(chdir(d_cwd.c_str()), 0);
+        DaemonTestFixture::TearDown();
+    }
+
+    // Variables set for the test, with null standing for the cache URL
+    const std::vector<std::pair<const char *, const char *>> d_variables = {
+        {"RECC_SERVER", nullptr},
+        {"RECC_CACHE_ONLY", "1"},
+        {"RECC_CACHE_UPLOAD_LOCAL_BUILD", "1"},
+        {"RECC_FORCE_REMOTE", "1"},
+        {"RECC_DEPS_OVERRIDE", "input.txt"},
+        {"RECC_OUTPUT_FILES_OVERRIDE", "out.txt"}};
+    std::string d_cwd;
+    buildboxcommon::TemporaryDirectory d_workspace;
+    buildboxcommon::TemporaryDirectory d_cache;
+};
+
+TEST_F(DaemonCacheTestFixture, CommandsRunThroughExecutionContext)
+{
+    const std::string socketPath = d_directory.strname() + "/reccd.sock";
+    const int listener = listenOn(socketPath);
+
+    // Handles each command like `reccd`, sharing the connections to the
+    // cache between them
+    ExecutionContext::GrpcClients grpcClients;
+    DaemonServer server([&grpcClients](int argc, char *argv[],
+                                       const std::atomic_bool &stop) {
+        ExecutionContext context;
+        context.setStopToken(stop);
+        context.setGrpcClients(&grpcClients);
+        return context.execute(argc, argv);
+    });
+    std::string error;
+    std::thread daemon([&]() {
+        for (int i = 0; i < 2; ++i) {
+            const int connection = accept(listener, nullptr, nullptr);
+            try {
+                server.handleConnection(connection);
+            }
+            catch (const std::exception &e) {
+                error = e.what();
+            }
+            close(connection);
+        }
+    });
+
+    // The output of the command is not part of the action, so the second
+    // run gets the output of the first one from the cache
+    char shell[] = "sh";
+    char option[] = "-c";
+    char script[] = "echo $DAEMON_TEST_RUN > out.txt";
+    char *argv[] = {shell, option, script, nullptr};
+    const std::string output = d_workspace.strname() + "/out.txt";
+    for (const char *run : {"1", "2"}) {
+        setenv("DAEMON_TEST_RUN", run, 1);
+        int exitCode = -1;
+        EXPECT_TRUE(DaemonClient::execute(socketPath, 3, argv, &exitCode));
+        EXPECT_EQ(exitCode, 0);
+        EXPECT_EQ(buildboxcommon::FileUtils::getFileContents(output.c_str()),
+                  "1\n");
+        unlink(output.c_str());
+    }
+
+    daemon.join();
+    close(listener);
+    EXPECT_EQ(error, "");
+    EXPECT_NE(grpcClients.d_casClient, nullptr);
+}
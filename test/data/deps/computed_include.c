@@ -0,0 +1,2 @@
+#define HEADER "empty.h"
+#include HEADER
@@ -16,8 +16,16 @@
 #include <buildboxcommonmetrics_totaldurationmetricvalue.h>
 #include <digestgenerator.h>
 #include <env.h>
+#include <filecontents.h>
+#include <sha256multibuffer.h>
+
+#include <buildboxcommon_fileutils.h>
+#include <buildboxcommon_temporarydirectory.h>
 
 #include <string>
+#include <sys/stat.h>
+#include <system_error>
+#include <vector>
 
 #include <gtest/gtest.h>
 
@@ -61,6 +69,19 @@ TEST(DigestGeneratorTest, StringDefaultFunction)
     EXPECT_EQ(digest.size_bytes(), testString.size());
 }
 
+TEST(DigestGeneratorTest, IncrementalDigest)
+{
+    const std::string testString(
+        "This is a sample blob to hash, given in several parts.");
+
+    DigestGenerator::IncrementalDigest digest;
+    digest.update(testString.data(), 7);
+    digest.update(testString.data() + 7, 0);
+    digest.update(testString.data() + 7, testString.size() - 7);
+
+    EXPECT_EQ(digest.finalize(), DigestGenerator::make_digest(testString));
+}
+
 TEST(DigestGeneratorTest, ProtoDefaultFunction)
 {
     // Creating an arbitrary proto:
@@ -146,3 +167,157 @@ TEST(DigestGeneratorTest, TestStringSha512)
     EXPECT_EQ(d.hash(), expected_sha512_hash);
     EXPECT_EQ(d.size_bytes(), TEST_STRING.size());
 }
+
+namespace {
+// Blobs of sizes around the SHA-256 block and padding boundaries, and
+// larger than the ones hashed together
+std::vector<std::string> makeBlobs()
+{
+    std::vector<std::string> blobs;
+    for (const size_t size :
+         {0, 1, 55, 56, 63, 64, 65, 119, 120, 1000, 70000, 3, 4096}) {
+        std::string blob(size, '\0');
+        for (size_t i = 0; i < size; ++i) {
+            blob[i] = static_cast<char>((i * 31 + size) % 251);
+        }
+        blobs.push_back(blob);
+    }
+    return blobs;
+}
+} // namespace
+
+TEST(DigestGeneratorTest, MakeDigestsSha256)
+{
+    RECC_CAS_DIGEST_FUNCTION = "SHA256";
+    const std::vector<std::string> blobs = makeBlobs();
+    const std::vector<DigestGenerator::BlobView> views(blobs.cbegin(),
+                                                       blobs.cend());
+
+    const std::vector<Digest> digests = DigestGenerator::make_digests(views);
+    ASSERT_EQ(digests.size(), blobs.size());
+    for (size_t i = 0; i < blobs.size(); ++i) {
+        EXPECT_EQ(digests[i], DigestGenerator::make_digest(blobs[i]));
+    }
+
+    EXPECT_TRUE(DigestGenerator::make_digests({}).empty());
+}
+
+TEST(DigestGeneratorTest, MakeDigestsSha1)
+{
+    RECC_CAS_DIGEST_FUNCTION = "SHA1";
+    const std::vector<std::string> blobs = makeBlobs();
+    const std::vector<DigestGenerator::BlobView> views(blobs.cbegin(),
+                                                       blobs.cend());
+
+    const std::vector<Digest> digests = DigestGenerator::make_digests(views);
+    ASSERT_EQ(digests.size(), blobs.size());
+    for (size_t i = 0; i < blobs.size(); ++i) {
+        EXPECT_EQ(digests[i], DigestGenerator::make_digest(blobs[i]));
+        EXPECT_EQ(digests[i].hash().size(), 40);
+    }
+}
+
+TEST(DigestGeneratorTest, Sha256MultiBufferMatchesOpenSsl)
+{
+    if (!Sha256MultiBuffer::isSupported()) {
+        // Nothing to compare on this machine
+        return;
+    }
+    RECC_CAS_DIGEST_FUNCTION = "SHA256";
+
+    // More messages than lanes, so that lanes are refilled
+    const std::vector<std::string> blobs = makeBlobs();
+    std::vector<const char *> messages;
+    std::vector<size_t> sizes;
+    for (const auto &blob : blobs) {
+        messages.push_back(blob.data());
+        sizes.push_back(blob.size());
+    }
+    std::vector<unsigned char> hashes(blobs.size() *
+                                      Sha256MultiBuffer::DIGEST_SIZE);
+    Sha256MultiBuffer::hash(messages.data(), sizes.data(), blobs.size(),
+                            hashes.data());
+
+    for (size_t i = 0; i < blobs.size(); ++i) {
+        std::string hash;
+        for (size_t j = 0; j < Sha256MultiBuffer::DIGEST_SIZE; ++j) {
+            static const char hexDigits[] = "0123456789abcdef";
+            const unsigned char byte =
+                hashes[i * Sha256MultiBuffer::DIGEST_SIZE + j];
+            hash += hexDigits[byte >> 4];
+            hash += hexDigits[byte & 0xf];
+        }
+        EXPECT_EQ(hash, DigestGenerator::make_digest(blobs[i]).hash())
+            << "message of " << blobs[i].size() << " bytes";
+    }
+}
+
+TEST(DigestGeneratorTest, MakeFileDigests)
+{
+    RECC_CAS_DIGEST_FUNCTION = "SHA256";
+    buildboxcommon::TemporaryDirectory directory;
+    const std::string small = directory.strname() + "/small";
+    const std::string executable = directory.strname() + "/executable";
+    const std::string large = directory.strname() + "/large";
+    const std::string empty = directory.strname() + "/empty";
+    const std::string streamed = directory.strname() + "/streamed";
+    buildboxcommon::FileUtils::writeFileAtomically(small, "small file");
+    buildboxcommon::FileUtils::writeFileAtomically(executable, "#!/bin/sh");
+    ASSERT_EQ(chmod(executable.c_str(), 0755), 0);
+    buildboxcommon::FileUtils::writeFileAtomically(large,
+                                                   std::string(100000, 'x'));
+    buildboxcommon::FileUtils::writeFileAtomically(empty, "");
+    // Too large for `FileContentsCache`, so hashed in parts
+    buildboxcommon::FileUtils::writeFileAtomically(
+        streamed, std::string(FileContentsCache::MAX_FILE_SIZE + 7, 'y'));
+
+    const std::vector<std::string> paths = {small, executable, large, empty,
+                                            streamed};
+    const auto files = DigestGenerator::make_file_digests(paths);
+    ASSERT_EQ(files.size(), paths.size());
+    for (size_t i = 0; i < paths.size(); ++i) {
+        const buildboxcommon::File expected(paths[i].c_str());
+        EXPECT_EQ(files[i].d_digest, expected.d_digest) << paths[i];
+        EXPECT_EQ(files[i].d_executable, expected.d_executable) << paths[i];
+    }
+    EXPECT_TRUE(files[1].d_executable);
+
+    EXPECT_THROW(DigestGenerator::make_file_digests(
+                     {small, directory.strname() + "/missing"}),
+                 std::system_error);
+}
+
+TEST(DigestGeneratorTest, TestStringBlake3)
+{
+    RECC_CAS_DIGEST_FUNCTION = "BLAKE3";
+    const Digest d = DigestGenerator::make_digest(TEST_STRING);
+    EXPECT_EQ(d.hash().size(), 64);
+    EXPECT_EQ(d.size_bytes(), TEST_STRING.size());
+
+    EXPECT_EQ(
+        DigestGenerator::make_digest("").hash(),
+        "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262");
+
+    DigestGenerator::IncrementalDigest digest;
+    digest.update(TEST_STRING.data(), 10);
+    digest.update(TEST_STRING.data() + 10, TEST_STRING.size() - 10);
+    EXPECT_EQ(digest.finalize(), d);
+}
+
+TEST(DigestGeneratorTest, MakeFileDigestsBlake3)
+{
+    RECC_CAS_DIGEST_FUNCTION = "BLAKE3";
+    buildboxcommon::TemporaryDirectory directory;
+    // Hashed in parts, each of them in parallel
+    const std::string largeContents(9 * 1024 * 1024 + 7, 'x');
+    const std::string large = directory.strname() + "/large";
+    const std::string small = directory.strname() + "/small";
+    buildboxcommon::FileUtils::writeFileAtomically(large, largeContents);
+    buildboxcommon::FileUtils::writeFileAtomically(small, "small file");
+
+    const auto files = DigestGenerator::make_file_digests({large, small});
+    EXPECT_EQ(files[0].d_digest, DigestGenerator::make_digest(largeContents));
+    EXPECT_EQ(files[1].d_digest, DigestGenerator::make_digest("small file"));
+    EXPECT_EQ(DigestGenerator::make_file_digest(small).d_digest,
+              files[1].d_digest);
+}
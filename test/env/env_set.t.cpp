@@ -144,6 +144,18 @@ TEST_F(EnvTest, EnvTestServerBackwardCompatibleSSL)
     EXPECT_EQ(expectedServer, RECC_ACTION_CACHE_SERVER);
 }
 
+TEST_F(EnvTest, EnvTestServerFileUrl)
+{
+    const char *testEnviron[] = {"RECC_SERVER=file:///shared/recc-cache",
+                                 "RECC_SERVER_SSL=1", nullptr};
+    const std::string expectedServer = "file:///shared/recc-cache";
+    Env::parse_config_variables(testEnviron);
+    Env::handle_special_defaults();
+    EXPECT_EQ(expectedServer, RECC_SERVER);
+    EXPECT_EQ(expectedServer, RECC_CAS_SERVER);
+    EXPECT_EQ(expectedServer, RECC_ACTION_CACHE_SERVER);
+}
+
 TEST_F(EnvTest, EnvTestServerBackwardCompatibleSeparate)
 {
     const char *testEnviron[] = {
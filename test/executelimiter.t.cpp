@@ -0,0 +1,176 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <executelimiter.h>
+
+#include <buildboxcommon_fileutils.h>
+#include <buildboxcommon_temporarydirectory.h>
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace recc;
+
+namespace {
+const std::chrono::milliseconds QUEUE_TARGET(1000);
+const std::chrono::milliseconds NOT_QUEUED(0);
+} // namespace
+
+// Exposes the protected members for testing
+class TestExecuteLimiter : public ExecuteLimiter {
+  public:
+    using ExecuteLimiter::ExecuteLimiter;
+    using ExecuteLimiter::release;
+    using ExecuteLimiter::tryAcquire;
+};
+
+class ExecuteLimiterTestFixture : public ::testing::Test {
+  protected:
+    ExecuteLimiterTestFixture()
+        : d_path(d_cacheDirectory.strname() + "/limit/state")
+    {
+    }
+
+    buildboxcommon::TemporaryDirectory d_cacheDirectory;
+    std::string d_path;
+};
+
+TEST_F(ExecuteLimiterTestFixture, SlotsAreShared)
+{
+    TestExecuteLimiter first(d_path, 2, QUEUE_TARGET);
+    TestExecuteLimiter second(d_path, 2, QUEUE_TARGET);
+    TestExecuteLimiter third(d_path, 2, QUEUE_TARGET);
+    EXPECT_EQ(first.limit(), 2);
+
+    EXPECT_TRUE(first.tryAcquire(100, false));
+    EXPECT_FALSE(first.tryAcquire(100, false));
+    EXPECT_TRUE(second.tryAcquire(100, false));
+    EXPECT_FALSE(third.tryAcquire(100, false));
+
+    first.release(ExecuteLimiter::COMPLETED, NOT_QUEUED, 200);
+    EXPECT_TRUE(third.tryAcquire(200, false));
+}
+
+TEST_F(ExecuteLimiterTestFixture, OverloadHalvesLimitOncePerRound)
+{
+    TestExecuteLimiter first(d_path, 8, QUEUE_TARGET);
+    TestExecuteLimiter second(d_path, 8, QUEUE_TARGET);
+    ASSERT_TRUE(first.tryAcquire(100, false));
+    ASSERT_TRUE(second.tryAcquire(100, false));
+
+    first.release(ExecuteLimiter::OVERLOADED, NOT_QUEUED, 200);
+    EXPECT_EQ(first.limit(), 4);
+
+    // Made before the limit was lowered
+    second.release(ExecuteLimiter::OVERLOADED, NOT_QUEUED, 300);
+    EXPECT_EQ(first.limit(), 4);
+
+    // Queued for too long
+    ASSERT_TRUE(second.tryAcquire(400, false));
+    second.release(ExecuteLimiter::COMPLETED, QUEUE_TARGET * 2, 500);
+    EXPECT_EQ(first.limit(), 2);
+
+    for (int i = 0; i < 4; ++i) {
+        ASSERT_TRUE(first.tryAcquire(600 + i, false));
+        first.release(ExecuteLimiter::OVERLOADED, NOT_QUEUED, 600 + i);
+    }
+    EXPECT_EQ(first.limit(), 1);
+}
+
+TEST_F(ExecuteLimiterTestFixture, CompletionsRaiseLimit)
+{
+    TestExecuteLimiter limiter(d_path, 8, QUEUE_TARGET);
+    ASSERT_TRUE(limiter.tryAcquire(100, false));
+    limiter.release(ExecuteLimiter::OVERLOADED, NOT_QUEUED, 200);
+    ASSERT_EQ(limiter.limit(), 4);
+
+    // About one more call per round of calls
+    for (int i = 0; i < 5; ++i) {
+        ASSERT_TRUE(limiter.tryAcquire(300, false));
+        limiter.release(ExecuteLimiter::COMPLETED, QUEUE_TARGET, 300);
+    }
+    EXPECT_EQ(limiter.limit(), 5);
+
+    for (int i = 0; i < 100; ++i) {
+        ASSERT_TRUE(limiter.tryAcquire(400, false));
+        limiter.release(ExecuteLimiter::COMPLETED, NOT_QUEUED, 400);
+    }
+    EXPECT_EQ(limiter.limit(), 8);
+
+    // A caller with a lower maximum doesn't exceed it
+    TestExecuteLimiter other(d_path, 3, QUEUE_TARGET);
+    EXPECT_EQ(other.limit(), 3);
+}
+
+TEST_F(ExecuteLimiterTestFixture, StaleSlotIsReclaimed)
+{
+    const pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+    if (pid == 0) {
+        // Exits while holding the slot
+        TestExecuteLimiter limiter(d_path, 1, QUEUE_TARGET);
+        _exit(limiter.tryAcquire(100, false) ? 0 : 1);
+    }
+    int status;
+    ASSERT_EQ(waitpid(pid, &status, 0), pid);
+    ASSERT_EQ(WEXITSTATUS(status), 0);
+
+    TestExecuteLimiter limiter(d_path, 1, QUEUE_TARGET);
+    EXPECT_FALSE(limiter.tryAcquire(200, false));
+    EXPECT_TRUE(limiter.tryAcquire(200, true));
+}
+
+TEST_F(ExecuteLimiterTestFixture, AcquireStopsWhenRequested)
+{
+    auto first =
+        std::make_unique<TestExecuteLimiter>(d_path, 1, QUEUE_TARGET);
+    TestExecuteLimiter second(d_path, 1, QUEUE_TARGET);
+    const std::atomic_bool running(false);
+    const std::atomic_bool stopped(true);
+
+    EXPECT_TRUE(first->acquire(running));
+    EXPECT_FALSE(second.acquire(stopped));
+
+    // The slot is given back on destruction
+    first.reset();
+    EXPECT_TRUE(second.acquire(running));
+}
+
+TEST_F(ExecuteLimiterTestFixture, InvalidStateDisablesLimit)
+{
+    buildboxcommon::FileUtils::createDirectory(
+        (d_cacheDirectory.strname() + "/limit").c_str());
+    buildboxcommon::FileUtils::writeFileAtomically(d_path, "garbage");
+
+    TestExecuteLimiter limiter(d_path, 4, QUEUE_TARGET);
+    EXPECT_EQ(limiter.limit(), 0);
+    const std::atomic_bool running(false);
+    EXPECT_FALSE(limiter.acquire(running));
+}
+
+TEST(ExecuteLimiterTest, PathDependsOnServerAndInstance)
+{
+    const std::string path =
+        ExecuteLimiter::path("/cache", "http://server:50051", "");
+    EXPECT_EQ(path.compare(0, 7, "/cache/"), 0);
+    EXPECT_EQ(ExecuteLimiter::path("/cache", "http://server:50051", ""),
+              path);
+    EXPECT_NE(ExecuteLimiter::path("/cache", "http://other:50051", ""),
+              path);
+    EXPECT_NE(ExecuteLimiter::path("/cache", "http://server:50051", "dev"),
+              path);
+}
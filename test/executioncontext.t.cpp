@@ -0,0 +1,186 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <caspresencecache.h>
+#include <digestgenerator.h>
+#include <env.h>
+#include <executioncontext.h>
+#include <reccdefaults.h>
+#include <remoteexecutionclient.h>
+
+#include <buildboxcommon_grpctestserver.h>
+#include <buildboxcommon_temporarydirectory.h>
+
+#include <build/bazel/remote/execution/v2/remote_execution_mock.grpc.pb.h>
+#include <build/buildgrid/local_cas_mock.grpc.pb.h>
+#include <gmock/gmock.h>
+#include <google/bytestream/bytestream_mock.grpc.pb.h>
+#include <gtest/gtest.h>
+
+#include <thread>
+
+using namespace recc;
+using namespace testing;
+
+// Exposes the protected members for testing
+class TestExecutionContext : public ExecutionContext {
+  public:
+    using ExecutionContext::d_addDurationMetricCallback;
+    using ExecutionContext::d_casClient;
+    using ExecutionContext::executeUploadedAction;
+    using ExecutionContext::uploadResources;
+};
+
+class ExecutionContextTestFixture : public ::testing::Test {
+  protected:
+    ExecutionContextTestFixture()
+        : grpcClient(std::make_shared<buildboxcommon::GrpcClient>()),
+          casClient(std::make_shared<buildboxcommon::CASClient>(grpcClient)),
+          reClient(casClient, grpcClient, grpcClient),
+          executionStub(proto::Execution::NewStub(testServer.channel())),
+          casStub(
+              std::make_shared<proto::MockContentAddressableStorageStub>()),
+          actionCacheStub(std::make_shared<proto::MockActionCacheStub>()),
+          operationsStub(proto::Operations::NewStub(testServer.channel())),
+          byteStreamStub(
+              std::make_shared<google::bytestream::MockByteStreamStub>()),
+          localCasStub(
+              std::make_shared<
+                  build::buildgrid::MockLocalContentAddressableStorageStub>())
+    {
+        casClient->init(byteStreamStub, casStub, localCasStub, nullptr);
+        reClient.init(executionStub, actionCacheStub, operationsStub);
+
+        RECC_CACHE_DIR = cacheDirectory.strname();
+        RECC_CAS_PRESENCE_CACHE = true;
+        RECC_CAS_PRESENCE_CACHE_VERIFY = 0;
+
+        context.setStopToken(stopRequested);
+        context.d_casClient = casClient;
+        context.d_addDurationMetricCallback =
+            [](const std::string &,
+               buildboxcommon::buildboxcommonmetrics::DurationMetricValue) {};
+    }
+
+    ~ExecutionContextTestFixture() override
+    {
+        RECC_CACHE_DIR = DEFAULT_RECC_CACHE_DIR;
+        RECC_CAS_PRESENCE_CACHE = DEFAULT_RECC_CAS_PRESENCE_CACHE;
+        RECC_CAS_PRESENCE_CACHE_VERIFY =
+            DEFAULT_RECC_CAS_PRESENCE_CACHE_VERIFY;
+    }
+
+    // Returns a completed `Operation` with the given response
+    static google::longrunning::Operation
+    operation(const proto::ExecuteResponse &response)
+    {
+        google::longrunning::Operation result;
+        result.set_done(true);
+        result.mutable_response()->PackFrom(response);
+        return result;
+    }
+
+    buildboxcommon::TemporaryDirectory cacheDirectory;
+    buildboxcommon::GrpcTestServer testServer;
+    std::shared_ptr<buildboxcommon::GrpcClient> grpcClient;
+    std::shared_ptr<buildboxcommon::CASClient> casClient;
+    RemoteExecutionClient reClient;
+    std::shared_ptr<proto::Execution::StubInterface> executionStub;
+    std::shared_ptr<proto::MockContentAddressableStorageStub> casStub;
+    std::shared_ptr<proto::MockActionCacheStub> actionCacheStub;
+    std::shared_ptr<google::longrunning::Operations::StubInterface>
+        operationsStub;
+    std::shared_ptr<google::bytestream::MockByteStreamStub> byteStreamStub;
+    std::shared_ptr<build::buildgrid::MockLocalContentAddressableStorageStub>
+        localCasStub;
+    std::atomic_bool stopRequested{false};
+    TestExecutionContext context;
+};
+
+TEST_F(ExecutionContextTestFixture, EvictedInputsAreUploadedAgain)
+{
+    const std::string input = "input";
+    const proto::Digest inputDigest = DigestGenerator::make_digest(input);
+    const proto::Digest actionDigest = DigestGenerator::make_digest("action");
+    buildboxcommon::digest_string_map blobs;
+    blobs[inputDigest] = input;
+
+    // The input is recorded as present, but was evicted since
+    CasPresenceCache(CasPresenceCache::path(RECC_CACHE_DIR, RECC_CAS_SERVER,
+                                            RECC_INSTANCE,
+                                            RECC_CAS_DIGEST_FUNCTION),
+                     RECC_CAS_PRESENCE_CACHE_TTL)
+        .markPresent(inputDigest);
+    context.uploadResources(blobs, {});
+
+    // Execute() fails until the input is uploaded again, after a query that
+    // doesn't trust the cache
+    proto::FindMissingBlobsResponse missingResponse;
+    *missingResponse.add_missing_blob_digests() = inputDigest;
+    EXPECT_CALL(*casStub, FindMissingBlobs(_, _, _))
+        .WillOnce(DoAll(SetArgPointee<2>(missingResponse),
+                        Return(grpc::Status::OK)));
+    proto::BatchUpdateBlobsResponse updateResponse;
+    *updateResponse.add_responses()->mutable_digest() = inputDigest;
+    EXPECT_CALL(*casStub, BatchUpdateBlobs(_, _, _))
+        .WillOnce(DoAll(SetArgPointee<2>(updateResponse),
+                        Return(grpc::Status::OK)));
+
+    proto::ExecuteResponse failedResponse;
+    failedResponse.mutable_status()->set_code(
+        google::rpc::Code::FAILED_PRECONDITION);
+    failedResponse.mutable_status()->set_message("Missing input blobs");
+    proto::ExecuteResponse response;
+    response.mutable_result()->set_exit_code(7);
+
+    proto::ExecuteRequest expectedRequest;
+    *expectedRequest.mutable_action_digest() = actionDigest;
+    std::thread serverHandler([&]() {
+        for (const auto &executeResponse : {failedResponse, response}) {
+            buildboxcommon::GrpcTestServerContext ctx(
+                &testServer,
+                "/build.bazel.remote.execution.v2.Execution/Execute");
+            ctx.read(expectedRequest);
+            ctx.writeAndFinish(operation(executeResponse));
+        }
+    });
+
+    const proto::ActionResult result =
+        context.executeUploadedAction(&reClient, actionDigest, blobs, {});
+    serverHandler.join();
+    EXPECT_EQ(result.exit_code(), 7);
+}
+
+TEST_F(ExecutionContextTestFixture, OtherExecuteErrorsAreNotRetried)
+{
+    const proto::Digest actionDigest = DigestGenerator::make_digest("action");
+
+    proto::ExecuteResponse failedResponse;
+    failedResponse.mutable_status()->set_code(
+        google::rpc::Code::INVALID_ARGUMENT);
+    proto::ExecuteRequest expectedRequest;
+    *expectedRequest.mutable_action_digest() = actionDigest;
+    std::thread serverHandler([&]() {
+        buildboxcommon::GrpcTestServerContext ctx(
+            &testServer, "/build.bazel.remote.execution.v2.Execution/Execute");
+        ctx.read(expectedRequest);
+        ctx.writeAndFinish(operation(failedResponse));
+    });
+
+    EXPECT_CALL(*casStub, FindMissingBlobs(_, _, _)).Times(0);
+    EXPECT_THROW(
+        context.executeUploadedAction(&reClient, actionDigest, {}, {}),
+        std::exception);
+    serverHandler.join();
+}
@@ -0,0 +1,266 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <digestgenerator.h>
+#include <filebackend.h>
+
+#include <buildboxcommon_temporarydirectory.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdexcept>
+#include <string>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using namespace recc;
+
+class FileBackendTestFixture : public ::testing::Test {
+  protected:
+    FileBackendTestFixture() : d_root(d_directory.strname() + "/cache") {}
+
+    std::string blobPath(const proto::Digest &digest) const
+    {
+        return d_root + "/cas/" + digest.hash().substr(0, 2) + "/" +
+               digest.hash();
+    }
+
+    // Sets the modification time of `path` to `age` seconds ago
+    static void setAge(const std::string &path, time_t age)
+    {
+        const time_t mtime = time(nullptr) - age;
+        const struct timespec times[2] = {{mtime, 0}, {mtime, 0}};
+        ASSERT_EQ(utimensat(AT_FDCWD, path.c_str(), times, 0), 0);
+    }
+
+    static size_t countFiles(const std::string &path)
+    {
+        size_t count = 0;
+        DIR *dir = opendir(path.c_str());
+        while (dir != nullptr) {
+            const struct dirent *entry = readdir(dir);
+            if (entry == nullptr) {
+                closedir(dir);
+                break;
+            }
+            count += entry->d_name[0] != '.';
+        }
+        return count;
+    }
+
+    buildboxcommon::TemporaryDirectory d_directory;
+    std::string d_root;
+};
+
+TEST_F(FileBackendTestFixture, BlobRoundTrip)
+{
+    FileBackend backend(d_root, 0);
+    const std::string data = "int main() { return 0; }";
+    const proto::Digest digest = DigestGenerator::make_digest(data);
+    EXPECT_FALSE(backend.hasBlob(digest));
+    EXPECT_EQ(backend.openBlob(digest), -1);
+
+    backend.writeBlob(digest, data);
+    EXPECT_TRUE(backend.hasBlob(digest));
+    std::string read;
+    ASSERT_TRUE(backend.readBlob(digest, &read));
+    EXPECT_EQ(read, data);
+
+    // Written again without error
+    backend.writeBlob(digest, data);
+
+    const proto::Digest emptyDigest = DigestGenerator::make_digest("");
+    EXPECT_TRUE(backend.hasBlob(emptyDigest));
+    ASSERT_TRUE(backend.readBlob(emptyDigest, &read));
+    EXPECT_EQ(read, "");
+}
+
+TEST_F(FileBackendTestFixture, TemporaryFileIsCommitted)
+{
+    FileBackend backend(d_root, 0);
+    const std::string data(100000, 'x');
+    const proto::Digest digest = DigestGenerator::make_digest(data);
+
+    std::string path;
+    const int fd = backend.createTemporaryFile(&path);
+    ASSERT_EQ(write(fd, data.data(), data.size()),
+              static_cast<ssize_t>(data.size()));
+    backend.commitBlob(digest, fd, path);
+    close(fd);
+
+    std::string read;
+    ASSERT_TRUE(backend.readBlob(digest, &read));
+    EXPECT_EQ(read, data);
+    EXPECT_EQ(countFiles(d_root + "/tmp"), 0);
+}
+
+TEST_F(FileBackendTestFixture, MismatchedBlobIsRejected)
+{
+    FileBackend backend(d_root, 0);
+    const proto::Digest digest = DigestGenerator::make_digest("expected");
+    EXPECT_THROW(backend.writeBlob(digest, "tampered"),
+                 std::invalid_argument);
+
+    std::string path;
+    const int fd = backend.createTemporaryFile(&path);
+    ASSERT_EQ(write(fd, "tampered", 8), 8);
+    EXPECT_THROW(backend.commitBlob(digest, fd, path), std::invalid_argument);
+    close(fd);
+
+    EXPECT_FALSE(backend.hasBlob(digest));
+    EXPECT_EQ(countFiles(d_root + "/tmp"), 0);
+}
+
+TEST_F(FileBackendTestFixture, ActionResultNeedsItsBlobs)
+{
+    FileBackend backend(d_root, 0);
+    const proto::Digest actionDigest = DigestGenerator::make_digest("action");
+    proto::ActionResult result;
+    EXPECT_FALSE(backend.getActionResult(actionDigest, &result));
+
+    const std::string object = "object";
+    const std::string header = "header";
+    proto::Tree tree;
+    proto::FileNode *file = tree.mutable_root()->add_files();
+    file->set_name("a.h");
+    file->mutable_digest()->CopyFrom(DigestGenerator::make_digest(header));
+    const std::string treeData = tree.SerializeAsString();
+
+    result.set_exit_code(0);
+    proto::OutputFile *outputFile = result.add_output_files();
+    outputFile->set_path("a.o");
+    outputFile->mutable_digest()->CopyFrom(
+        DigestGenerator::make_digest(object));
+    proto::OutputDirectory *outputDirectory =
+        result.add_output_directories();
+    outputDirectory->set_path("include");
+    outputDirectory->mutable_tree_digest()->CopyFrom(
+        DigestGenerator::make_digest(treeData));
+    backend.updateActionResult(actionDigest, result);
+
+    proto::ActionResult stored;
+    EXPECT_FALSE(backend.getActionResult(actionDigest, &stored));
+    backend.writeBlob(DigestGenerator::make_digest(object), object);
+    EXPECT_FALSE(backend.getActionResult(actionDigest, &stored));
+    backend.writeBlob(DigestGenerator::make_digest(treeData), treeData);
+    EXPECT_FALSE(backend.getActionResult(actionDigest, &stored));
+    backend.writeBlob(DigestGenerator::make_digest(header), header);
+    ASSERT_TRUE(backend.getActionResult(actionDigest, &stored));
+    EXPECT_EQ(stored.SerializeAsString(), result.SerializeAsString());
+}
+
+TEST_F(FileBackendTestFixture, GarbageCollectionRemovesLeastRecentlyUsed)
+{
+    FileBackend backend(d_root, 1000);
+    std::vector<proto::Digest> digests;
+    for (char c : {'a', 'b', 'c'}) {
+        const std::string data(400, c);
+        digests.push_back(DigestGenerator::make_digest(data));
+        backend.writeBlob(digests.back(), data);
+    }
+    setAge(blobPath(digests[0]), 2 * FileBackend::TOUCH_INTERVAL);
+    setAge(blobPath(digests[1]), 3 * FileBackend::TOUCH_INTERVAL);
+    setAge(blobPath(digests[2]), 4 * FileBackend::TOUCH_INTERVAL);
+
+    // Used, so touched
+    EXPECT_TRUE(backend.hasBlob(digests[2]));
+
+    EXPECT_TRUE(backend.collectGarbage());
+    EXPECT_TRUE(backend.hasBlob(digests[0]));
+    EXPECT_FALSE(backend.hasBlob(digests[1]));
+    EXPECT_TRUE(backend.hasBlob(digests[2]));
+}
+
+TEST_F(FileBackendTestFixture, GarbageCollectionRunsOnceAtATime)
+{
+    FileBackend backend(d_root, 1000);
+    const std::string lockPath = d_root + "/gc-lock";
+    ASSERT_EQ(close(open(lockPath.c_str(), O_WRONLY | O_CREAT, 0644)), 0);
+    EXPECT_FALSE(backend.collectGarbage());
+
+    // Left behind by writers that exited
+    std::string recentPath;
+    close(backend.createTemporaryFile(&recentPath));
+    std::string stalePath;
+    close(backend.createTemporaryFile(&stalePath));
+    setAge(stalePath, 2 * 60 * 60);
+
+    // The lock of an interrupted collection eventually expires
+    setAge(lockPath, 2 * 60 * 60);
+    EXPECT_TRUE(backend.collectGarbage());
+    EXPECT_EQ(access(lockPath.c_str(), F_OK), -1);
+    EXPECT_EQ(access(recentPath.c_str(), F_OK), 0);
+    EXPECT_EQ(access(stalePath.c_str(), F_OK), -1);
+}
+
+TEST_F(FileBackendTestFixture, ConcurrentWritersFromSeveralProcesses)
+{
+    const int numProcesses = 4;
+    const int numBlobs = 50;
+    std::vector<pid_t> pids;
+    for (int i = 0; i < numProcesses; ++i) {
+        const pid_t pid = fork();
+        ASSERT_GE(pid, 0);
+        if (pid == 0) {
+            FileBackend backend(d_root, 1 << 20);
+            proto::ActionResult result;
+            for (int j = 0; j < numBlobs; ++j) {
+                const std::string data(static_cast<size_t>(1000 + j), 'x');
+                const proto::Digest digest =
+                    DigestGenerator::make_digest(data);
+                backend.writeBlob(digest, data);
+                result.add_output_files()->mutable_digest()->CopyFrom(digest);
+                backend.updateActionResult(
+                    DigestGenerator::make_digest(std::to_string(j)), result);
+            }
+            _exit(0);
+        }
+        pids.push_back(pid);
+    }
+    for (const pid_t pid : pids) {
+        int status;
+        ASSERT_EQ(waitpid(pid, &status, 0), pid);
+        ASSERT_EQ(WEXITSTATUS(status), 0);
+    }
+
+    FileBackend backend(d_root, 1 << 20);
+    for (int j = 0; j < numBlobs; ++j) {
+        const std::string data(static_cast<size_t>(1000 + j), 'x');
+        std::string read;
+        ASSERT_TRUE(
+            backend.readBlob(DigestGenerator::make_digest(data), &read));
+        EXPECT_EQ(read, data);
+        proto::ActionResult result;
+        ASSERT_TRUE(backend.getActionResult(
+            DigestGenerator::make_digest(std::to_string(j)), &result));
+        EXPECT_EQ(result.output_files_size(), j + 1);
+    }
+    EXPECT_EQ(countFiles(d_root + "/tmp"), 0);
+}
+
+TEST(FileBackendTest, PathFromUrl)
+{
+    EXPECT_TRUE(FileBackend::isFileUrl("file:///shared/recc-cache"));
+    EXPECT_FALSE(FileBackend::isFileUrl("http://localhost:50051"));
+    EXPECT_EQ(FileBackend::pathFromUrl("file:///shared/recc-cache"),
+              "/shared/recc-cache");
+    EXPECT_THROW(FileBackend::pathFromUrl("file://host/recc-cache"),
+                 std::invalid_argument);
+    EXPECT_THROW(FileBackend::pathFromUrl("http://localhost:50051"),
+                 std::invalid_argument);
+}
@@ -0,0 +1,180 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <digestgenerator.h>
+#include <env.h>
+#include <filecontents.h>
+
+#include <buildboxcommon_fileutils.h>
+#include <buildboxcommon_temporarydirectory.h>
+
+#include <fcntl.h>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+using namespace recc;
+
+namespace {
+std::shared_ptr<const FileContents>
+readContents(const std::string &path,
+             FileContents::Ownership ownership = FileContents::SHARED)
+{
+    const int fd = open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        throw std::runtime_error("Could not open " + path);
+    }
+    const auto contents = std::make_shared<FileContents>(fd, path, st, ownership);
+    close(fd);
+    return contents;
+}
+} // namespace
+
+class FileContentsTestFixture : public ::testing::Test {
+  protected:
+    FileContentsTestFixture()
+        : d_small(d_directory.strname() + "/small"),
+          d_large(d_directory.strname() + "/large"),
+          d_largeContents(FileContents::MIN_MAPPED_SIZE + 1, 'x')
+    {
+        buildboxcommon::FileUtils::writeFileAtomically(d_small, "small");
+        buildboxcommon::FileUtils::writeFileAtomically(d_large,
+                                                       d_largeContents);
+    }
+
+    ~FileContentsTestFixture()
+    {
+        FileContentsCache::defaultCache().setCapacity(0);
+    }
+
+    buildboxcommon::TemporaryDirectory d_directory;
+    std::string d_small;
+    std::string d_large;
+    std::string d_largeContents;
+};
+
+TEST_F(FileContentsTestFixture, SmallFilesAreReadLargeOnesMapped)
+{
+    const int64_t bytesRead = FileContents::totalBytesRead();
+
+    const auto small = readContents(d_small, FileContents::OWNED);
+    EXPECT_FALSE(small->isMapped());
+    EXPECT_EQ(std::string(small->data(), small->size()), "small");
+
+    const auto large = readContents(d_large, FileContents::OWNED);
+    EXPECT_TRUE(large->isMapped());
+    EXPECT_EQ(std::string(large->data(), large->size()), d_largeContents);
+
+    EXPECT_EQ(FileContents::totalBytesRead() - bytesRead,
+              5 + d_largeContents.size());
+}
+
+TEST_F(FileContentsTestFixture, SharedFilesAreNeverMapped)
+{
+    const auto large = readContents(d_large);
+    EXPECT_FALSE(large->isMapped());
+    EXPECT_EQ(std::string(large->data(), large->size()), d_largeContents);
+}
+
+TEST_F(FileContentsTestFixture, TruncatedSharedFileIsReadShort)
+{
+    const int fd = open(d_large.c_str(), O_RDONLY);
+    ASSERT_GE(fd, 0);
+    struct stat st;
+    ASSERT_EQ(fstat(fd, &st), 0);
+    // Truncated between the stat and the read, as by a parallel build step
+    ASSERT_EQ(truncate(d_large.c_str(), 10), 0);
+
+    const FileContents contents(fd, d_large, st);
+    close(fd);
+    EXPECT_EQ(std::string(contents.data(), contents.size()),
+              d_largeContents.substr(0, 10));
+    EXPECT_FALSE(contents.isUnchanged(d_large));
+}
+
+TEST_F(FileContentsTestFixture, ModifiedFileIsDetected)
+{
+    const auto contents = readContents(d_small);
+    EXPECT_TRUE(contents->isUnchanged(d_small));
+
+    buildboxcommon::FileUtils::writeFileAtomically(d_small, "modified");
+    EXPECT_FALSE(contents->isUnchanged(d_small));
+    // The contents read are not affected
+    EXPECT_EQ(std::string(contents->data(), contents->size()), "small");
+}
+
+TEST_F(FileContentsTestFixture, CacheKeepsNothingUntilEnabled)
+{
+    FileContentsCache &cache = FileContentsCache::defaultCache();
+    DigestGenerator::make_file_digests({d_small});
+    EXPECT_EQ(cache.size(), 0);
+
+    cache.setCapacity(1024 * 1024);
+    const auto files = DigestGenerator::make_file_digests({d_small, d_large});
+    EXPECT_EQ(cache.size(), 5 + d_largeContents.size());
+
+    const auto contents = cache.find(d_large, files[1].d_digest);
+    ASSERT_NE(contents, nullptr);
+    EXPECT_EQ(std::string(contents->data(), contents->size()),
+              d_largeContents);
+    EXPECT_EQ(cache.find(d_large, files[0].d_digest), nullptr);
+
+    cache.setCapacity(0);
+    EXPECT_EQ(cache.size(), 0);
+    EXPECT_EQ(cache.find(d_large, files[1].d_digest), nullptr);
+}
+
+TEST_F(FileContentsTestFixture, CacheRespectsCapacity)
+{
+    FileContentsCache &cache = FileContentsCache::defaultCache();
+    cache.setCapacity(d_largeContents.size() + 1);
+    const auto files = DigestGenerator::make_file_digests({d_large, d_small});
+    EXPECT_NE(cache.find(d_large, files[0].d_digest), nullptr);
+    EXPECT_EQ(cache.find(d_small, files[1].d_digest), nullptr);
+
+    // Replacing a file's contents frees the previous ones
+    DigestGenerator::make_file_digests({d_large});
+    EXPECT_EQ(cache.size(), d_largeContents.size());
+}
+
+TEST_F(FileContentsTestFixture, FilesTooLargeToKeepAreNotReadWhole)
+{
+    const std::string huge = d_directory.strname() + "/huge";
+    const std::string hugeContents(FileContentsCache::MAX_FILE_SIZE + 1, 'z');
+    buildboxcommon::FileUtils::writeFileAtomically(huge, hugeContents);
+
+    FileContentsCache &cache = FileContentsCache::defaultCache();
+    cache.setCapacity(4 * FileContentsCache::MAX_FILE_SIZE);
+    const int64_t bytesRead = FileContents::totalBytesRead();
+    const auto file = DigestGenerator::make_file_digest(huge);
+    EXPECT_EQ(file.d_digest, DigestGenerator::make_digest(hugeContents));
+    EXPECT_EQ(FileContents::totalBytesRead(), bytesRead);
+    EXPECT_EQ(cache.find(huge, file.d_digest), nullptr);
+}
+
+TEST_F(FileContentsTestFixture, CacheDropsModifiedFiles)
+{
+    FileContentsCache &cache = FileContentsCache::defaultCache();
+    cache.setCapacity(1024 * 1024);
+    const auto file = DigestGenerator::make_file_digest(d_small);
+    ASSERT_NE(cache.find(d_small, file.d_digest), nullptr);
+
+    buildboxcommon::FileUtils::writeFileAtomically(d_small, "other");
+    EXPECT_EQ(cache.find(d_small, file.d_digest), nullptr);
+}
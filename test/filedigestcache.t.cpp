@@ -0,0 +1,243 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <digestgenerator.h>
+#include <filedigestcache.h>
+
+#include <buildboxcommon_fileutils.h>
+#include <buildboxcommon_temporarydirectory.h>
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using namespace recc;
+
+// Exposes the protected members for testing
+class TestFileDigestCache : public FileDigestCache {
+  public:
+    using FileDigestCache::FileDigestCache;
+    using FileDigestCache::lookup;
+    using FileDigestCache::store;
+};
+
+class FileDigestCacheTestFixture : public ::testing::Test {
+  protected:
+    typedef FileDigestCache::Key Key;
+
+    FileDigestCacheTestFixture()
+        : d_tablePath(d_cacheDirectory.strname() + "/digests/table"),
+          d_cache(d_tablePath, 64)
+    {
+    }
+
+    std::string writeFile(const std::string &name,
+                          const std::string &contents)
+    {
+        const std::string path = d_sourceDirectory.strname() + "/" + name;
+        buildboxcommon::FileUtils::writeFileAtomically(path, contents);
+        return path;
+    }
+
+    static Key makeKey(uint64_t inode, int64_t mtimeNs = 1000)
+    {
+        Key key;
+        key.d_device = 1;
+        key.d_inode = inode;
+        key.d_size = 5;
+        key.d_mtimeNs = mtimeNs;
+        key.d_ctimeNs = mtimeNs;
+        return key;
+    }
+
+    buildboxcommon::TemporaryDirectory d_cacheDirectory;
+    buildboxcommon::TemporaryDirectory d_sourceDirectory;
+    std::string d_tablePath;
+    TestFileDigestCache d_cache;
+};
+
+TEST_F(FileDigestCacheTestFixture, StoreAndLookup)
+{
+    const proto::Digest digest = DigestGenerator::make_digest("hello");
+
+    proto::Digest found;
+    bool executable = false;
+    EXPECT_FALSE(d_cache.lookup(makeKey(1), &found, &executable));
+
+    d_cache.store(makeKey(1), digest, true);
+    ASSERT_TRUE(d_cache.lookup(makeKey(1), &found, &executable));
+    EXPECT_EQ(found, digest);
+    EXPECT_TRUE(executable);
+
+    // A different inode or timestamp misses
+    EXPECT_FALSE(d_cache.lookup(makeKey(2), &found, &executable));
+    EXPECT_FALSE(d_cache.lookup(makeKey(1, 2000), &found, &executable));
+}
+
+TEST_F(FileDigestCacheTestFixture, NewerVersionReplacesEntry)
+{
+    const proto::Digest oldDigest = DigestGenerator::make_digest("hello");
+    const proto::Digest newDigest = DigestGenerator::make_digest("world");
+    d_cache.store(makeKey(1), oldDigest, false);
+    d_cache.store(makeKey(1, 2000), newDigest, false);
+
+    proto::Digest found;
+    bool executable = true;
+    EXPECT_FALSE(d_cache.lookup(makeKey(1), &found, &executable));
+    ASSERT_TRUE(d_cache.lookup(makeKey(1, 2000), &found, &executable));
+    EXPECT_EQ(found, newDigest);
+    EXPECT_FALSE(executable);
+}
+
+TEST_F(FileDigestCacheTestFixture, ManyEntries)
+{
+    // More entries than slots: the most recent ones must still be found
+    for (uint64_t inode = 10001; inode <= 10200; ++inode) {
+        d_cache.store(makeKey(inode),
+                      DigestGenerator::make_digest(std::to_string(inode)),
+                      false);
+    }
+
+    proto::Digest found;
+    bool executable = false;
+    ASSERT_TRUE(d_cache.lookup(makeKey(10200), &found, &executable));
+    EXPECT_EQ(found, DigestGenerator::make_digest("10200"));
+}
+
+TEST_F(FileDigestCacheTestFixture, ConcurrentReadersNeverSeeTornEntries)
+{
+    // Writers keep replacing the entries of a few files with newer versions
+    // while readers check that whatever they find matches the key
+    const auto digestFor = [](const Key &key) {
+        return DigestGenerator::make_digest(
+            std::to_string(10000 + key.d_mtimeNs % 90000));
+    };
+
+    std::vector<std::thread> threads;
+    std::atomic<int> mismatches(0);
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&, t]() {
+            for (int64_t i = 0; i < 20000; ++i) {
+                const Key key = makeKey(static_cast<uint64_t>(i % 4), i);
+                if (t % 2 == 0) {
+                    d_cache.store(key, digestFor(key), false);
+                }
+                else {
+                    proto::Digest found;
+                    bool executable = false;
+                    if (d_cache.lookup(key, &found, &executable) &&
+                        found != digestFor(key)) {
+                        ++mismatches;
+                    }
+                }
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(mismatches, 0);
+}
+
+TEST_F(FileDigestCacheTestFixture, TableIsSharedBetweenInstances)
+{
+    d_cache.store(makeKey(1), DigestGenerator::make_digest("hello"), false);
+
+    TestFileDigestCache other(d_tablePath);
+    proto::Digest found;
+    bool executable = false;
+    ASSERT_TRUE(other.lookup(makeKey(1), &found, &executable));
+    EXPECT_EQ(found, DigestGenerator::make_digest("hello"));
+}
+
+TEST_F(FileDigestCacheTestFixture, InvalidTableIsIgnored)
+{
+    const std::string path = writeFile("table", "not a digest cache");
+    TestFileDigestCache cache(path);
+    cache.store(makeKey(1), DigestGenerator::make_digest("hello"), false);
+
+    proto::Digest found;
+    bool executable = false;
+    EXPECT_FALSE(cache.lookup(makeKey(1), &found, &executable));
+
+    const std::string file = writeFile("hello.h", "hello");
+    EXPECT_EQ(cache.getFile(file).d_digest,
+              DigestGenerator::make_digest("hello"));
+}
+
+TEST_F(FileDigestCacheTestFixture, RecentlyModifiedFilesAreNotCached)
+{
+    const std::string path = writeFile("hello.h", "hello");
+
+    EXPECT_EQ(d_cache.getFile(path).d_digest,
+              DigestGenerator::make_digest("hello"));
+    EXPECT_EQ(d_cache.getFile(path).d_digest,
+              DigestGenerator::make_digest("hello"));
+    EXPECT_EQ(d_cache.hits(), 0);
+    EXPECT_EQ(d_cache.misses(), 2);
+}
+
+TEST_F(FileDigestCacheTestFixture, GetFile)
+{
+    const std::string path = writeFile("hello.h", "hello");
+    // Wait until the file is old enough to be cached
+    std::this_thread::sleep_for(std::chrono::milliseconds(2100));
+
+    const auto file = d_cache.getFile(path);
+    EXPECT_EQ(file.d_digest, DigestGenerator::make_digest("hello"));
+    EXPECT_EQ(d_cache.misses(), 1);
+
+    const auto cachedFile = d_cache.getFile(path);
+    EXPECT_EQ(cachedFile.d_digest, file.d_digest);
+    EXPECT_EQ(cachedFile.d_executable, file.d_executable);
+    EXPECT_EQ(d_cache.hits(), 1);
+
+    // Replacing the file changes its inode and timestamps
+    writeFile("hello.h", "world");
+    EXPECT_EQ(d_cache.getFile(path).d_digest,
+              DigestGenerator::make_digest("world"));
+    EXPECT_EQ(d_cache.misses(), 2);
+}
+
+TEST_F(FileDigestCacheTestFixture, MissingFileThrows)
+{
+    EXPECT_THROW(d_cache.getFile(d_sourceDirectory.strname() + "/missing.h"),
+                 std::exception);
+}
+
+TEST_F(FileDigestCacheTestFixture, GetFiles)
+{
+    const std::string hello = writeFile("hello.h", "hello");
+    const std::string world = writeFile("world.h", "world");
+    std::this_thread::sleep_for(std::chrono::milliseconds(2100));
+    d_cache.getFile(hello);
+    ASSERT_EQ(d_cache.misses(), 1);
+
+    // Hits and misses are returned in order
+    const auto files = d_cache.getFiles({world, hello, world});
+    ASSERT_EQ(files.size(), 3);
+    EXPECT_EQ(files[0].d_digest, DigestGenerator::make_digest("world"));
+    EXPECT_EQ(files[1].d_digest, DigestGenerator::make_digest("hello"));
+    EXPECT_EQ(files[2].d_digest, DigestGenerator::make_digest("world"));
+    EXPECT_EQ(d_cache.hits(), 1);
+    EXPECT_EQ(d_cache.misses(), 3);
+
+    EXPECT_EQ(d_cache.getFiles({world}).front().d_digest,
+              DigestGenerator::make_digest("world"));
+    EXPECT_EQ(d_cache.hits(), 2);
+    EXPECT_TRUE(d_cache.getFiles({}).empty());
+}
@@ -0,0 +1,149 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <digestgenerator.h>
+#include <filehashqueue.h>
+#include <threadpool.h>
+
+#include <buildboxcommon_fileutils.h>
+#include <buildboxcommon_temporarydirectory.h>
+
+#include <gtest/gtest.h>
+
+using namespace recc;
+
+class FileHashQueueTestFixture : public ::testing::Test {
+  protected:
+    std::string writeFile(const std::string &name,
+                          const std::string &contents)
+    {
+        const std::string path = d_directory.strname() + "/" + name;
+        buildboxcommon::FileUtils::writeFileAtomically(path, contents);
+        return path;
+    }
+
+    buildboxcommon::TemporaryDirectory d_directory;
+};
+
+TEST_F(FileHashQueueTestFixture, TakeHashedFiles)
+{
+    ThreadPool pool(2);
+    FileHashQueue queue(&pool, nullptr, 4);
+
+    std::vector<std::string> paths;
+    for (int i = 0; i < 20; ++i) {
+        paths.push_back(
+            writeFile("file" + std::to_string(i), std::to_string(i)));
+        queue.push(paths.back());
+    }
+
+    for (int i = 19; i >= 0; --i) {
+        buildboxcommon::File file;
+        ASSERT_TRUE(queue.take(paths[i], &file));
+        EXPECT_EQ(file.d_digest,
+                  DigestGenerator::make_digest(std::to_string(i)));
+    }
+    // Paths can be taken again
+    buildboxcommon::File file;
+    ASSERT_TRUE(queue.take(paths[0], &file));
+    EXPECT_EQ(file.d_digest, DigestGenerator::make_digest("0"));
+}
+
+TEST_F(FileHashQueueTestFixture, FilesNotPushedAreNotTaken)
+{
+    ThreadPool pool(1);
+    FileHashQueue queue(&pool, nullptr, 4);
+    queue.push(writeFile("a", "a"));
+
+    buildboxcommon::File file;
+    EXPECT_FALSE(queue.take(writeFile("b", "b"), &file));
+}
+
+TEST_F(FileHashQueueTestFixture, ErrorsAreRethrownByTake)
+{
+    ThreadPool pool(1);
+    FileHashQueue queue(&pool, nullptr, 4);
+    const std::string path = d_directory.strname() + "/missing";
+    queue.push(path);
+
+    buildboxcommon::File file;
+    EXPECT_ANY_THROW(queue.take(path, &file));
+}
+
+TEST_F(FileHashQueueTestFixture, PoolWithoutWorkers)
+{
+    // Pushing beyond the bound runs the pending tasks on the calling thread
+    ThreadPool pool(0);
+    FileHashQueue queue(&pool, nullptr, 2);
+    std::vector<std::string> paths;
+    for (int i = 0; i < 10; ++i) {
+        paths.push_back(
+            writeFile("file" + std::to_string(i), std::to_string(i)));
+        queue.push(paths.back());
+    }
+
+    buildboxcommon::File file;
+    ASSERT_TRUE(queue.take(paths[9], &file));
+    EXPECT_EQ(file.d_digest, DigestGenerator::make_digest("9"));
+    EXPECT_GE(queue.busyTime().count(), 0);
+}
+
+TEST_F(FileHashQueueTestFixture, BusyTimeIsWallTime)
+{
+    // Threads hashing at the same time don't add up
+    ThreadPool pool(4);
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::string> paths;
+    {
+        FileHashQueue queue(&pool, nullptr, 64);
+        const std::string contents(1024 * 1024, 'x');
+        for (int i = 0; i < 64; ++i) {
+            paths.push_back(writeFile("file" + std::to_string(i), contents));
+            queue.push(paths.back());
+        }
+        buildboxcommon::File file;
+        for (const auto &path : paths) {
+            ASSERT_TRUE(queue.take(path, &file));
+        }
+        EXPECT_GT(queue.busyTime().count(), 0);
+        EXPECT_LE(queue.busyTime(),
+                  std::chrono::duration_cast<std::chrono::microseconds>(
+                      std::chrono::steady_clock::now() - start));
+    }
+}
+
+TEST_F(FileHashQueueTestFixture, ErrorsOnlyAffectTheirFile)
+{
+    ThreadPool pool(1);
+    FileHashQueue queue(&pool, nullptr, 16);
+
+    // Fewer files than a batch, the last one missing
+    std::vector<std::string> paths;
+    for (size_t i = 0; i + 1 < FileHashQueue::BATCH_SIZE; ++i) {
+        paths.push_back(
+            writeFile("file" + std::to_string(i), std::to_string(i)));
+        queue.push(paths.back());
+    }
+    const std::string missing = d_directory.strname() + "/missing";
+    queue.push(missing);
+
+    for (size_t i = 0; i < paths.size(); ++i) {
+        buildboxcommon::File file;
+        ASSERT_TRUE(queue.take(paths[i], &file));
+        EXPECT_EQ(file.d_digest,
+                  DigestGenerator::make_digest(std::to_string(i)));
+    }
+    buildboxcommon::File file;
+    EXPECT_ANY_THROW(queue.take(missing, &file));
+}
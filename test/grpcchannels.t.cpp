@@ -0,0 +1,61 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <env.h>
+#include <grpcchannels.h>
+
+#include <buildboxcommon_temporarydirectory.h>
+
+#include <stdexcept>
+#include <string>
+
+#include <gtest/gtest.h>
+
+using namespace recc;
+
+class GrpcChannelsTest : public ::testing::Test {
+  protected:
+    GrpcChannelsTest() : d_fileUrl("file://" + d_cacheDirectory.strname())
+    {
+        RECC_SERVER = RECC_CAS_SERVER = RECC_ACTION_CACHE_SERVER =
+            "http://localhost:8085";
+    }
+
+    void TearDown() override
+    {
+        RECC_SERVER = RECC_CAS_SERVER = RECC_ACTION_CACHE_SERVER = "";
+        RECC_CACHE_ONLY = false;
+    }
+
+    buildboxcommon::TemporaryDirectory d_cacheDirectory;
+    std::string d_fileUrl;
+};
+
+TEST_F(GrpcChannelsTest, FileUrlsNeedCacheOnlyMode)
+{
+    for (std::string *url :
+         {&RECC_SERVER, &RECC_CAS_SERVER, &RECC_ACTION_CACHE_SERVER}) {
+        *url = d_fileUrl;
+        EXPECT_THROW(GrpcChannels::get_channels_from_config(),
+                     std::runtime_error);
+        *url = "http://localhost:8085";
+    }
+}
+
+TEST_F(GrpcChannelsTest, FileUrlsAreServedInCacheOnlyMode)
+{
+    RECC_CACHE_ONLY = true;
+    RECC_CAS_SERVER = RECC_ACTION_CACHE_SERVER = d_fileUrl;
+    EXPECT_NO_THROW(GrpcChannels::get_channels_from_config());
+}
@@ -0,0 +1,411 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <deps.h>
+#include <env.h>
+#include <includescanner.h>
+#include <parsedcommandfactory.h>
+
+#include <buildboxcommon_fileutils.h>
+#include <buildboxcommon_temporarydirectory.h>
+
+#include <gtest/gtest.h>
+
+using namespace recc;
+
+// Exposes the protected members for testing
+class TestIncludeScanner : public IncludeScanner {
+  public:
+    using IncludeScanner::deserializeSearchPath;
+    using IncludeScanner::IncludeScanner;
+    using IncludeScanner::parseDirectives;
+    using IncludeScanner::parseSearchPath;
+    using IncludeScanner::scanFiles;
+    using IncludeScanner::serializeSearchPath;
+};
+
+typedef IncludeScanner::Directive Directive;
+
+class IncludeScannerTestFixture : public ::testing::Test {
+  protected:
+    IncludeScannerTestFixture()
+        : d_root(d_directory.strname()), d_scanner(d_root + "/cache")
+    {
+    }
+
+    std::string writeFile(const std::string &name,
+                          const std::string &contents)
+    {
+        const std::string path = d_root + "/" + name;
+        buildboxcommon::FileUtils::createDirectory(
+            path.substr(0, path.rfind('/')).c_str());
+        buildboxcommon::FileUtils::writeFileAtomically(path, contents);
+        return path;
+    }
+
+    IncludeScanner::SearchPath
+    searchPath(const std::vector<std::string> &quoteDirectories,
+               const std::vector<std::string> &bracketDirectories)
+    {
+        IncludeScanner::SearchPath result;
+        for (const auto &directory : quoteDirectories) {
+            result.d_directories.push_back(d_root + "/" + directory);
+        }
+        result.d_bracketStart = result.d_directories.size();
+        for (const auto &directory : bracketDirectories) {
+            result.d_directories.push_back(d_root + "/" + directory);
+        }
+        return result;
+    }
+
+    buildboxcommon::TemporaryDirectory d_directory;
+    const std::string d_root;
+    TestIncludeScanner d_scanner;
+};
+
+TEST(IncludeScannerTest, ParseDirectives)
+{
+    const std::string source = "#include <stdio.h>\n"
+                               "  #  include \"local.h\" // comment\n"
+                               "/* comment */ #include_next <next.h>\n"
+                               "#import \"imported.h\"\n"
+                               "#include \\\n"
+                               "    \"continued.h\"\n"
+                               "#define STR(x) \\\n"
+                               "#x\n"
+                               "int include = 1; // #include \"no.h\"\n"
+                               "#pragma once\n";
+    const auto directives = TestIncludeScanner::parseDirectives(source);
+
+    ASSERT_EQ(directives.size(), 5);
+    EXPECT_EQ(directives[0].d_kind, Directive::Include);
+    EXPECT_TRUE(directives[0].d_angled);
+    EXPECT_EQ(directives[0].d_name, "stdio.h");
+    EXPECT_EQ(directives[1].d_kind, Directive::Include);
+    EXPECT_FALSE(directives[1].d_angled);
+    EXPECT_EQ(directives[1].d_name, "local.h");
+    EXPECT_EQ(directives[2].d_kind, Directive::IncludeNext);
+    EXPECT_EQ(directives[2].d_name, "next.h");
+    EXPECT_EQ(directives[3].d_name, "imported.h");
+    EXPECT_EQ(directives[4].d_name, "continued.h");
+}
+
+TEST(IncludeScannerTest, DirectivesInCommentsAndLiteralsAreIgnored)
+{
+    const std::string source = "/*\n"
+                               "#include HEADER\n"
+                               "*/\n"
+                               "// line comment \\\n"
+                               "#include HEADER\n"
+                               "const char *s = \"\\\n"
+                               "#include HEADER\n"
+                               "\";\n"
+                               "const char *r = R\"x(\n"
+                               "#include HEADER\n"
+                               ")x\";\n"
+                               "#include /* multi-line\n"
+                               "comment */ \"a.h\"\n";
+    const auto directives = TestIncludeScanner::parseDirectives(source);
+
+    ASSERT_EQ(directives.size(), 1);
+    EXPECT_EQ(directives[0].d_name, "a.h");
+}
+
+TEST(IncludeScannerTest, ParseHasInclude)
+{
+    const std::string source =
+        "#if defined(__has_include) && __has_include(<optional>)\n"
+        "#elif __has_include_next ( \"config.h\" )\n"
+        "#endif\n"
+        "#define has_include __has_include\n";
+    const auto directives = TestIncludeScanner::parseDirectives(source);
+
+    ASSERT_EQ(directives.size(), 2);
+    EXPECT_EQ(directives[0].d_kind, Directive::HasInclude);
+    EXPECT_TRUE(directives[0].d_angled);
+    EXPECT_EQ(directives[0].d_name, "optional");
+    EXPECT_EQ(directives[1].d_kind, Directive::HasIncludeNext);
+    EXPECT_FALSE(directives[1].d_angled);
+    EXPECT_EQ(directives[1].d_name, "config.h");
+}
+
+TEST(IncludeScannerTest, UnsupportedConstructs)
+{
+    EXPECT_THROW(TestIncludeScanner::parseDirectives("#include HEADER\n"),
+                 IncludeScanner::unsupported_error);
+    EXPECT_THROW(TestIncludeScanner::parseDirectives(
+                     "#define HAS(x) __has_include(x)\n"),
+                 IncludeScanner::unsupported_error);
+    EXPECT_THROW(TestIncludeScanner::parseDirectives("#embed \"data.bin\"\n"),
+                 IncludeScanner::unsupported_error);
+}
+
+TEST(IncludeScannerTest, ParseSearchPath)
+{
+    const std::string output =
+        "Using built-in specs.\n"
+        "ignoring nonexistent directory \"/usr/local/include/x86_64\"\n"
+        "ignoring duplicate directory \"/usr/include\"\n"
+        "#include \"...\" search starts here:\n"
+        " quoted\n"
+        "#include <...> search starts here:\n"
+        " include\n"
+        " /usr/include\n"
+        "End of search list.\n";
+    const auto searchPath = TestIncludeScanner::parseSearchPath(output);
+
+    EXPECT_EQ(searchPath.d_directories,
+              std::vector<std::string>({"quoted", "include", "/usr/include"}));
+    EXPECT_EQ(searchPath.d_bracketStart, 1);
+    EXPECT_EQ(searchPath.d_missingDirectories,
+              std::vector<std::string>({"/usr/local/include/x86_64"}));
+    EXPECT_FALSE(searchPath.d_hasFrameworks);
+
+    const auto parsed = TestIncludeScanner::deserializeSearchPath(
+        TestIncludeScanner::serializeSearchPath(searchPath));
+    EXPECT_EQ(parsed.d_directories, searchPath.d_directories);
+    EXPECT_EQ(parsed.d_bracketStart, searchPath.d_bracketStart);
+    EXPECT_EQ(parsed.d_missingDirectories, searchPath.d_missingDirectories);
+
+    EXPECT_THROW(TestIncludeScanner::deserializeSearchPath("garbage"),
+                 std::runtime_error);
+}
+
+TEST(IncludeScannerTest, ParseSearchPathWithFrameworks)
+{
+    const std::string output =
+        "#include <...> search starts here:\n"
+        " /usr/include\n"
+        " /System/Library/Frameworks (framework directory)\n"
+        "End of search list.\n";
+    const auto searchPath = TestIncludeScanner::parseSearchPath(output);
+    EXPECT_TRUE(searchPath.d_hasFrameworks);
+    EXPECT_EQ(searchPath.d_directories,
+              std::vector<std::string>({"/usr/include"}));
+}
+
+TEST_F(IncludeScannerTestFixture, QuoteAndAngleIncludes)
+{
+    const std::string source =
+        writeFile("src/main.c", "#include \"local.h\"\n"
+                                "#include <local.h>\n"
+                                "#include \"quoted.h\"\n"
+                                "#include <quoted.h>\n");
+    const std::string local = writeFile("src/local.h", "");
+    const std::string systemLocal = writeFile("system/local.h", "");
+    const std::string quoted = writeFile("quote/quoted.h", "");
+    const std::string systemQuoted = writeFile("system/quoted.h", "");
+
+    const auto result = d_scanner.scanFiles(
+        {source}, {}, searchPath({"quote"}, {"system"}));
+    EXPECT_EQ(result, std::set<std::string>({source, local, systemLocal,
+                                             quoted, systemQuoted}));
+}
+
+TEST_F(IncludeScannerTestFixture, RecursiveAndCyclicIncludes)
+{
+    const std::string source = writeFile("main.c", "#include <a.h>\n");
+    const std::string a = writeFile("include/a.h", "#include \"b.h\"\n");
+    const std::string b = writeFile("include/b.h", "#include <a.h>\n");
+
+    const auto result =
+        d_scanner.scanFiles({source}, {}, searchPath({}, {"include"}));
+    EXPECT_EQ(result, std::set<std::string>({source, a, b}));
+}
+
+TEST_F(IncludeScannerTestFixture, IncludeNext)
+{
+    const std::string source = writeFile("main.c", "#include <stdlib.h>\n");
+    const std::string wrapper =
+        writeFile("wrapper/stdlib.h", "#include_next <stdlib.h>\n");
+    const std::string real = writeFile("real/stdlib.h", "");
+    const std::string other = writeFile("other/stdlib.h", "");
+
+    const auto result = d_scanner.scanFiles(
+        {source}, {}, searchPath({}, {"wrapper", "real", "other"}));
+    EXPECT_EQ(result, std::set<std::string>({source, wrapper, real}));
+}
+
+TEST_F(IncludeScannerTestFixture, MissingHeadersAreIgnored)
+{
+    const std::string source = writeFile("main.c", "#ifdef _WIN32\n"
+                                                   "#include <windows.h>\n"
+                                                   "#else\n"
+                                                   "#include <unistd.h>\n"
+                                                   "#endif\n");
+    const std::string header = writeFile("include/unistd.h", "");
+
+    const auto result =
+        d_scanner.scanFiles({source}, {}, searchPath({}, {"include"}));
+    EXPECT_EQ(result, std::set<std::string>({source, header}));
+}
+
+TEST_F(IncludeScannerTestFixture, HeadersUnderInactiveConditionsAreIncluded)
+{
+    const std::string source = writeFile("main.c", "#if 0\n"
+                                                   "#include \"unused.h\"\n"
+                                                   "#endif\n");
+    const std::string header = writeFile("unused.h", "");
+
+    const auto result = d_scanner.scanFiles({source}, {}, searchPath({}, {}));
+    EXPECT_EQ(result, std::set<std::string>({source, header}));
+}
+
+TEST_F(IncludeScannerTestFixture, HasIncludeIsReported)
+{
+    const std::string source =
+        writeFile("main.c", "#if __has_include(<feature.h>)\n"
+                            "#endif\n"
+                            "#if __has_include(<missing.h>)\n"
+                            "#endif\n");
+    // Not scanned, since it isn't necessarily included
+    const std::string feature =
+        writeFile("include/feature.h", "#include \"notscanned.h\"\n");
+    writeFile("include/notscanned.h", "");
+
+    const auto result =
+        d_scanner.scanFiles({source}, {}, searchPath({}, {"include"}));
+    EXPECT_EQ(result, std::set<std::string>({source, feature}));
+}
+
+TEST_F(IncludeScannerTestFixture, CommandLineIncludes)
+{
+    const std::string source = writeFile("main.c", "");
+    const std::string config = writeFile("config.h", "#include <a.h>\n");
+    const std::string a = writeFile("include/a.h", "");
+    const std::string predefs = writeFile("include/predefs.h", "");
+
+    const auto result = d_scanner.scanFiles(
+        {source},
+        {{Directive::Include, false, config},
+         {Directive::Include, true, "predefs.h"},
+         {Directive::Include, true, "missing.h"}},
+        searchPath({}, {"include"}));
+    EXPECT_EQ(result, std::set<std::string>({source, config, a, predefs}));
+}
+
+TEST_F(IncludeScannerTestFixture, PrecompiledHeadersAreUnsupported)
+{
+    const std::string source = writeFile("main.c", "#include \"pch.h\"\n");
+    writeFile("pch.h", "");
+    writeFile("pch.h.gch", "");
+
+    EXPECT_THROW(d_scanner.scanFiles({source}, {}, searchPath({}, {})),
+                 IncludeScanner::unsupported_error);
+}
+
+TEST_F(IncludeScannerTestFixture, UnreadableSourceIsUnsupported)
+{
+    EXPECT_THROW(
+        d_scanner.scanFiles({d_root + "/missing.c"}, {}, searchPath({}, {})),
+        IncludeScanner::unsupported_error);
+}
+
+// Set in the top-level CMakeLists.txt depending on the platform.
+#ifdef RECC_PLATFORM_COMPILER
+
+std::set<std::string> normalize(const std::set<std::string> &paths)
+{
+    std::set<std::string> result;
+    for (const auto &path : paths) {
+        result.insert(buildboxcommon::FileUtils::normalizePath(path.c_str()));
+    }
+    return result;
+}
+
+// Scanning is only compared with gcc, since clang reports framework
+// directories on some platforms
+bool compilerIsGcc()
+{
+    return ParsedCommand::commandBasename(RECC_PLATFORM_COMPILER) == "gcc";
+}
+
+class IncludeScannerCompilerTest : public ::testing::Test {
+  protected:
+    IncludeScannerCompilerTest() { Env::parse_config_variables(); }
+
+    // Compares the results of the scanner and of the dependency command
+    void expectSameDependencies(const std::vector<std::string> &arguments)
+    {
+        const auto command =
+            ParsedCommandFactory::createParsedCommand(arguments, "");
+        IncludeScanner scanner(d_cacheDirectory.strname());
+        EXPECT_EQ(normalize(scanner.scan(command)),
+                  normalize(Deps::dependencies_from_compiler(command)));
+    }
+
+    buildboxcommon::TemporaryDirectory d_cacheDirectory;
+};
+
+TEST_F(IncludeScannerCompilerTest, MatchesDependencyCommand)
+{
+    if (!compilerIsGcc()) {
+        return;
+    }
+    expectSameDependencies({RECC_PLATFORM_COMPILER, "-c", "-I.", "empty.c"});
+    expectSameDependencies(
+        {RECC_PLATFORM_COMPILER, "-c", "-I.", "includes_includes_empty.c"});
+    expectSameDependencies({RECC_PLATFORM_COMPILER, "-c", "-I.",
+                            "includes_includes_empty.c", "includes_empty.c"});
+    expectSameDependencies({RECC_PLATFORM_COMPILER, "-c", "-I.",
+                            "-Isubdirectory", "includes_from_subdirectory.c"});
+    expectSameDependencies({RECC_PLATFORM_COMPILER, "-c", "-I.", "-include",
+                            "empty.h", "empty.c"});
+    expectSameDependencies(
+        {RECC_PLATFORM_COMPILER, "-c", "subdirectory/empty.c"});
+    expectSameDependencies({RECC_PLATFORM_COMPILER, "-c", "ctype_include.c"});
+}
+
+TEST_F(IncludeScannerCompilerTest, InactiveIncludesAreASuperset)
+{
+    if (!compilerIsGcc()) {
+        return;
+    }
+    const auto command = ParsedCommandFactory::createParsedCommand(
+        {RECC_PLATFORM_COMPILER, "-c", "-I.", "edge_cases.c"});
+    IncludeScanner scanner(d_cacheDirectory.strname());
+    const auto scanned = normalize(scanner.scan(command));
+    for (const auto &dependency :
+         normalize(Deps::dependencies_from_compiler(command))) {
+        EXPECT_EQ(scanned.count(dependency), 1) << dependency;
+    }
+    EXPECT_EQ(scanned.count("includes_empty.h"), 1);
+}
+
+TEST_F(IncludeScannerCompilerTest, GetFileInfoUsesScanner)
+{
+    if (!compilerIsGcc()) {
+        return;
+    }
+    RECC_DEPS_SCANNER = "native";
+    RECC_CACHE_DIR = d_cacheDirectory.strname();
+    const auto command = ParsedCommandFactory::createParsedCommand(
+        {RECC_PLATFORM_COMPILER, "-c", "-I.", "includes_empty.c"});
+    const auto fileInfo = Deps::get_file_info(command);
+    EXPECT_EQ(fileInfo.d_possibleProducts,
+              std::set<std::string>({"includes_empty.o"}));
+    EXPECT_EQ(normalize(fileInfo.d_dependencies),
+              normalize(Deps::dependencies_from_compiler(command)));
+
+    // Computed includes fall back to the dependency command
+    const auto computed = ParsedCommandFactory::createParsedCommand(
+        {RECC_PLATFORM_COMPILER, "-c", "-I.", "computed_include.c"});
+    IncludeScanner scanner(d_cacheDirectory.strname());
+    EXPECT_THROW(scanner.scan(computed), IncludeScanner::unsupported_error);
+    EXPECT_EQ(normalize(Deps::get_file_info(computed).d_dependencies),
+              normalize(Deps::dependencies_from_compiler(computed)));
+    RECC_DEPS_SCANNER = DEFAULT_RECC_DEPS_SCANNER;
+}
+
+#endif
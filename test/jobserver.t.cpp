@@ -0,0 +1,189 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <jobserver.h>
+#include <threadpool.h>
+
+#include <buildboxcommon_temporarydirectory.h>
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <fcntl.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace recc;
+
+class JobServerTestFixture : public ::testing::Test {
+  protected:
+    void SetUp() override { ASSERT_EQ(pipe(d_pipe), 0); }
+
+    void TearDown() override
+    {
+        close(d_pipe[0]);
+        close(d_pipe[1]);
+    }
+
+    std::string auth() const
+    {
+        return std::to_string(d_pipe[0]) + "," + std::to_string(d_pipe[1]);
+    }
+
+    void addTokens(const std::string &tokens)
+    {
+        ASSERT_EQ(write(d_pipe[1], tokens.data(), tokens.size()),
+                  static_cast<ssize_t>(tokens.size()));
+    }
+
+    std::string availableTokens()
+    {
+        const int flags = fcntl(d_pipe[0], F_GETFL);
+        fcntl(d_pipe[0], F_SETFL, flags | O_NONBLOCK);
+        std::string tokens;
+        char token;
+        while (read(d_pipe[0], &token, 1) == 1) {
+            tokens += token;
+        }
+        fcntl(d_pipe[0], F_SETFL, flags);
+        return tokens;
+    }
+
+    int d_pipe[2];
+};
+
+TEST_F(JobServerTestFixture, NoJobServer)
+{
+    EXPECT_EQ(JobServer::fromMakeflags(""), nullptr);
+    EXPECT_EQ(JobServer::fromMakeflags("s -j4"), nullptr);
+    EXPECT_EQ(JobServer::fromMakeflags("--jobserver-auth=nonsense"),
+              nullptr);
+}
+
+TEST_F(JobServerTestFixture, PipeNotPassed)
+{
+    // Descriptors that are closed or not pipes are ignored
+    const int fd = open("/dev/null", O_RDONLY);
+    ASSERT_GE(fd, 0);
+    EXPECT_EQ(JobServer::fromMakeflags("--jobserver-auth=" +
+                                       std::to_string(fd) + "," +
+                                       std::to_string(fd)),
+              nullptr);
+    close(fd);
+    EXPECT_EQ(JobServer::fromMakeflags("--jobserver-auth=" +
+                                       std::to_string(fd) + "," +
+                                       std::to_string(fd)),
+              nullptr);
+}
+
+TEST_F(JobServerTestFixture, AcquireAndReleaseTokens)
+{
+    const auto jobServer =
+        JobServer::fromMakeflags(" -j4 --jobserver-auth=" + auth());
+    ASSERT_NE(jobServer, nullptr);
+
+    EXPECT_FALSE(jobServer->tryAcquire());
+    addTokens("ab");
+    EXPECT_TRUE(jobServer->tryAcquire());
+    EXPECT_TRUE(jobServer->tryAcquire());
+    EXPECT_FALSE(jobServer->tryAcquire());
+    EXPECT_EQ(jobServer->tokensAcquired(), 2);
+
+    // The same tokens are given back
+    jobServer->release();
+    jobServer->release();
+    const std::string tokens = availableTokens();
+    EXPECT_EQ(tokens.size(), 2);
+    EXPECT_NE(tokens.find('a'), std::string::npos);
+    EXPECT_NE(tokens.find('b'), std::string::npos);
+}
+
+TEST_F(JobServerTestFixture, TokensReleasedOnDestruction)
+{
+    // Older versions of make use `--jobserver-fds`
+    auto jobServer = JobServer::fromMakeflags("--jobserver-fds=" + auth());
+    ASSERT_NE(jobServer, nullptr);
+    addTokens("+");
+    ASSERT_TRUE(jobServer->tryAcquire());
+    jobServer.reset();
+    EXPECT_EQ(availableTokens(), "+");
+}
+
+TEST_F(JobServerTestFixture, NamedPipe)
+{
+    buildboxcommon::TemporaryDirectory directory;
+    const std::string path = directory.strname() + "/jobserver";
+    ASSERT_EQ(mkfifo(path.c_str(), 0600), 0);
+    const int readFd = open(path.c_str(), O_RDONLY | O_NONBLOCK);
+    const int writeFd = open(path.c_str(), O_WRONLY);
+    ASSERT_GE(readFd, 0);
+    ASSERT_GE(writeFd, 0);
+
+    const auto jobServer =
+        JobServer::fromMakeflags("--jobserver-auth=fifo:" + path);
+    ASSERT_NE(jobServer, nullptr);
+    EXPECT_FALSE(jobServer->tryAcquire());
+    ASSERT_EQ(write(writeFd, "x", 1), 1);
+    EXPECT_TRUE(jobServer->tryAcquire());
+    jobServer->release();
+    char token = 0;
+    EXPECT_EQ(read(readFd, &token, 1), 1);
+    EXPECT_EQ(token, 'x');
+
+    close(readFd);
+    close(writeFd);
+    EXPECT_EQ(JobServer::fromMakeflags("--jobserver-auth=fifo:" + path +
+                                       ".missing"),
+              nullptr);
+}
+
+TEST_F(JobServerTestFixture, ThreadPoolWithoutTokens)
+{
+    // The calling thread does all the work when make has no tokens left
+    const auto jobServer = JobServer::fromMakeflags("--jobserver-auth=" +
+                                                    auth());
+    ASSERT_NE(jobServer, nullptr);
+    std::atomic<size_t> visits(0);
+    {
+        ThreadPool pool(3, jobServer);
+        pool.parallelFor(
+            100, [](size_t) -> uint64_t { return 1; },
+            [&](size_t begin, size_t end) { visits += end - begin; });
+    }
+    EXPECT_EQ(visits, 100);
+    EXPECT_EQ(jobServer->tokensAcquired(), 0);
+}
+
+TEST_F(JobServerTestFixture, ThreadPoolGivesTokensBack)
+{
+    const auto jobServer = JobServer::fromMakeflags("--jobserver-auth=" +
+                                                    auth());
+    ASSERT_NE(jobServer, nullptr);
+    addTokens("12");
+    std::atomic<size_t> visits(0);
+    {
+        ThreadPool pool(3, jobServer);
+        for (int i = 0; i < 10; ++i) {
+            pool.parallelFor(
+                1000, [](size_t) -> uint64_t { return 1; },
+                [&](size_t begin, size_t end) {
+                    visits += end - begin;
+                    usleep(100);
+                });
+        }
+    }
+    EXPECT_EQ(visits, 10000);
+    EXPECT_EQ(availableTokens().size(), 2);
+}
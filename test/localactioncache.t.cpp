@@ -0,0 +1,143 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <digestgenerator.h>
+#include <localactioncache.h>
+
+#include <buildboxcommon_fileutils.h>
+#include <buildboxcommon_temporarydirectory.h>
+
+#include <ctime>
+#include <fcntl.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+using namespace recc;
+
+namespace {
+const int64_t TTL = 600;
+
+proto::ActionResult actionResult(const std::string &output)
+{
+    proto::ActionResult result;
+    auto file = result.add_output_files();
+    file->set_path(output);
+    *file->mutable_digest() = DigestGenerator::make_digest(output);
+    result.set_stdout_raw("compiled " + output);
+    return result;
+}
+
+// Makes the file at `path` look `seconds` old
+void age(const std::string &path, int64_t seconds)
+{
+    const time_t when = time(nullptr) - static_cast<time_t>(seconds);
+    const struct timespec times[2] = {{when, 0}, {when, 0}};
+    ASSERT_EQ(utimensat(AT_FDCWD, path.c_str(), times, 0), 0);
+}
+} // namespace
+
+class LocalActionCacheTestFixture : public ::testing::Test {
+  protected:
+    LocalActionCacheTestFixture()
+        : d_cache(d_cacheDirectory.strname() + "/results", TTL)
+    {
+    }
+
+    buildboxcommon::TemporaryDirectory d_cacheDirectory;
+    LocalActionCache d_cache;
+};
+
+TEST_F(LocalActionCacheTestFixture, StoredResultsAreFound)
+{
+    const proto::Digest action = DigestGenerator::make_digest("action");
+    const proto::Digest other = DigestGenerator::make_digest("other");
+    proto::ActionResult result;
+    EXPECT_FALSE(d_cache.lookup(action, &result));
+
+    d_cache.store(action, actionResult("a.o"));
+    ASSERT_TRUE(d_cache.lookup(action, &result));
+    EXPECT_EQ(result.output_files(0).path(), "a.o");
+    EXPECT_EQ(result.stdout_raw(), "compiled a.o");
+    EXPECT_FALSE(d_cache.lookup(other, &result));
+
+    // Replaced by a newer result
+    d_cache.store(action, actionResult("b.o"));
+    ASSERT_TRUE(d_cache.lookup(action, &result));
+    EXPECT_EQ(result.output_files(0).path(), "b.o");
+
+    d_cache.remove(action);
+    EXPECT_FALSE(d_cache.lookup(action, &result));
+}
+
+TEST_F(LocalActionCacheTestFixture, ExpiredResultsAreIgnored)
+{
+    const proto::Digest action = DigestGenerator::make_digest("action");
+    d_cache.store(action, actionResult("a.o"));
+    age(d_cache.entryPath(action), TTL - 10);
+    proto::ActionResult result;
+    EXPECT_TRUE(d_cache.lookup(action, &result));
+
+    age(d_cache.entryPath(action), TTL + 10);
+    EXPECT_FALSE(d_cache.lookup(action, &result));
+}
+
+TEST_F(LocalActionCacheTestFixture, ExpiredResultsAreRemovedFromTheShard)
+{
+    // Actions whose entries are in the same shard
+    proto::Digest first, second;
+    for (int i = 0; second.hash().empty(); ++i) {
+        const proto::Digest digest =
+            DigestGenerator::make_digest("action " + std::to_string(i));
+        if (first.hash().empty()) {
+            first = digest;
+        }
+        else if (digest.hash().substr(0, 2) == first.hash().substr(0, 2)) {
+            second = digest;
+        }
+    }
+
+    d_cache.store(first, actionResult("a.o"));
+    age(d_cache.entryPath(first), TTL + 10);
+    d_cache.store(second, actionResult("b.o"));
+    EXPECT_FALSE(buildboxcommon::FileUtils::isRegularFile(
+        d_cache.entryPath(first).c_str()));
+    EXPECT_TRUE(buildboxcommon::FileUtils::isRegularFile(
+        d_cache.entryPath(second).c_str()));
+}
+
+TEST_F(LocalActionCacheTestFixture, InvalidResultsAreIgnored)
+{
+    const proto::Digest action = DigestGenerator::make_digest("action");
+    d_cache.store(action, actionResult("a.o"));
+    buildboxcommon::FileUtils::writeFileAtomically(d_cache.entryPath(action),
+                                                   "\xff garbage");
+    proto::ActionResult result;
+    EXPECT_FALSE(d_cache.lookup(action, &result));
+}
+
+TEST(LocalActionCacheTest, PathDependsOnServerAndInstance)
+{
+    const std::string path =
+        LocalActionCache::path("/cache", "http://server:50051", "");
+    EXPECT_EQ(path.compare(0, 7, "/cache/"), 0);
+    EXPECT_EQ(LocalActionCache::path("/cache", "http://server:50051", ""),
+              path);
+    EXPECT_NE(LocalActionCache::path("/cache", "http://other:50051", ""),
+              path);
+    EXPECT_NE(LocalActionCache::path("/cache", "http://server:50051", "dev"),
+              path);
+}
@@ -0,0 +1,320 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <digestgenerator.h>
+#include <localcas.h>
+
+#include <buildboxcommon_fileutils.h>
+#include <buildboxcommon_temporarydirectory.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <string>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using namespace recc;
+
+// Exposes the protected members for testing
+class TestLocalCas : public LocalCas {
+  public:
+    using LocalCas::evict;
+    using LocalCas::LocalCas;
+};
+
+class LocalCasTestFixture : public ::testing::Test {
+  protected:
+    LocalCasTestFixture()
+        : d_casPath(d_cacheDirectory.strname() + "/cas"),
+          d_outputPath(d_outputDirectory.strname())
+    {
+    }
+
+    std::string objectPath(const proto::Digest &digest) const
+    {
+        return d_casPath + "/objects/" + digest.hash().substr(0, 2) + "/" +
+               digest.hash().substr(2);
+    }
+
+    std::string contents(const std::string &name) const
+    {
+        return buildboxcommon::FileUtils::getFileContents(
+            (d_outputPath + "/" + name).c_str());
+    }
+
+    // Returns the paths of the blobs in the cache
+    std::vector<std::string> objects() const
+    {
+        std::vector<std::string> paths;
+        for (const auto &shard : list(d_casPath + "/objects")) {
+            for (const auto &object : list(shard)) {
+                paths.push_back(object);
+            }
+        }
+        return paths;
+    }
+
+    static std::vector<std::string> list(const std::string &path)
+    {
+        std::vector<std::string> paths;
+        DIR *dir = opendir(path.c_str());
+        while (dir != nullptr) {
+            const struct dirent *entry = readdir(dir);
+            if (entry == nullptr) {
+                closedir(dir);
+                break;
+            }
+            const std::string name = entry->d_name;
+            if (name != "." && name != "..") {
+                paths.push_back(path + "/" + name);
+            }
+        }
+        return paths;
+    }
+
+    buildboxcommon::TemporaryDirectory d_cacheDirectory;
+    buildboxcommon::TemporaryDirectory d_outputDirectory;
+    std::string d_casPath;
+    std::string d_outputPath;
+};
+
+TEST_F(LocalCasTestFixture, InsertedBlobsAreMaterialized)
+{
+    TestLocalCas cas(d_casPath, 1024 * 1024, false);
+    const std::string blob = "int main() { return 0; }";
+    const proto::Digest digest = DigestGenerator::make_digest(blob);
+
+    EXPECT_FALSE(cas.contains(digest));
+    EXPECT_FALSE(cas.materialize(digest, AT_FDCWD, d_outputPath + "/a.o",
+                                 false));
+    cas.insert(digest, blob.data(), blob.size());
+    EXPECT_TRUE(cas.contains(digest));
+    EXPECT_EQ(cas.hits(), 1);
+    EXPECT_EQ(cas.misses(), 1);
+    EXPECT_EQ(cas.size(), digest.size_bytes());
+
+    // Inserting it again changes nothing
+    cas.insert(digest, blob.data(), blob.size());
+    EXPECT_EQ(cas.size(), digest.size_bytes());
+
+    buildboxcommon::FileUtils::writeFileAtomically(d_outputPath + "/a.o",
+                                                   "old");
+    EXPECT_TRUE(cas.materialize(digest, AT_FDCWD, d_outputPath + "/a.o",
+                                false));
+    EXPECT_TRUE(cas.materialize(digest, AT_FDCWD, d_outputPath + "/a.out",
+                                true));
+    EXPECT_EQ(contents("a.o"), blob);
+    EXPECT_EQ(contents("a.out"), blob);
+    EXPECT_FALSE(buildboxcommon::FileUtils::isExecutable(
+        (d_outputPath + "/a.o").c_str()));
+    EXPECT_TRUE(buildboxcommon::FileUtils::isExecutable(
+        (d_outputPath + "/a.out").c_str()));
+
+    // The blob is shared by the processes using the same directory
+    TestLocalCas other(d_casPath, 1024 * 1024, false);
+    EXPECT_TRUE(other.contains(digest));
+    EXPECT_EQ(other.size(), digest.size_bytes());
+}
+
+TEST_F(LocalCasTestFixture, HardLinksAreOnlyUsedForNonExecutables)
+{
+    TestLocalCas cas(d_casPath, 1024 * 1024, true);
+    const std::string blob = "contents";
+    const proto::Digest digest = DigestGenerator::make_digest(blob);
+    cas.insert(digest, blob.data(), blob.size());
+
+    ASSERT_TRUE(cas.materialize(digest, AT_FDCWD, d_outputPath + "/a.o",
+                                false));
+    ASSERT_TRUE(cas.materialize(digest, AT_FDCWD, d_outputPath + "/a.out",
+                                true));
+    struct stat object, linked, copied;
+    ASSERT_EQ(stat(objectPath(digest).c_str(), &object), 0);
+    ASSERT_EQ(stat((d_outputPath + "/a.o").c_str(), &linked), 0);
+    ASSERT_EQ(stat((d_outputPath + "/a.out").c_str(), &copied), 0);
+    EXPECT_EQ(linked.st_ino, object.st_ino);
+    EXPECT_NE(copied.st_ino, object.st_ino);
+    EXPECT_EQ(contents("a.out"), blob);
+}
+
+TEST_F(LocalCasTestFixture, HardLinkedOutputsAreNotTouched)
+{
+    TestLocalCas cas(d_casPath, 1024 * 1024, true);
+    const std::string blob = "contents";
+    const proto::Digest digest = DigestGenerator::make_digest(blob);
+    cas.insert(digest, blob.data(), blob.size());
+
+    const std::string first = d_outputPath + "/first.o";
+    ASSERT_TRUE(cas.materialize(digest, AT_FDCWD, first, false));
+    const struct timespec times[2] = {{1000, 0}, {1000, 0}};
+    ASSERT_EQ(utimensat(AT_FDCWD, first.c_str(), times, 0), 0);
+
+    // Materializing it in another workspace doesn't make the first output
+    // look modified
+    buildboxcommon::TemporaryDirectory otherWorkspace;
+    const std::string second = otherWorkspace.strname() + "/second.o";
+    ASSERT_TRUE(cas.materialize(digest, AT_FDCWD, second, false));
+    cas.insert(digest, blob.data(), blob.size());
+
+    struct stat firstStat, secondStat;
+    ASSERT_EQ(stat(first.c_str(), &firstStat), 0);
+    ASSERT_EQ(stat(second.c_str(), &secondStat), 0);
+    EXPECT_EQ(firstStat.st_ino, secondStat.st_ino);
+    EXPECT_EQ(firstStat.st_mtime, 1000);
+
+    // The use is recorded in the access index instead
+    struct stat used;
+    const std::string accessPath = d_casPath + "/access/" +
+                                   digest.hash().substr(0, 2) + "/" +
+                                   digest.hash().substr(2);
+    ASSERT_EQ(stat(accessPath.c_str(), &used), 0);
+    EXPECT_GT(used.st_mtime, 1000);
+}
+
+TEST_F(LocalCasTestFixture, FilesAreVerifiedIfRequested)
+{
+    TestLocalCas cas(d_casPath, 1024 * 1024, false);
+    const std::string path = d_outputPath + "/a.o";
+    buildboxcommon::FileUtils::writeFileAtomically(path, "modified");
+    const int fd = open(path.c_str(), O_RDONLY);
+    ASSERT_GE(fd, 0);
+
+    const proto::Digest stale = DigestGenerator::make_digest("original");
+    cas.insertFile(stale, fd, true);
+    EXPECT_FALSE(cas.contains(stale));
+
+    const proto::Digest digest = DigestGenerator::make_digest("modified");
+    cas.insertFile(digest, fd, true);
+    close(fd);
+    EXPECT_TRUE(cas.contains(digest));
+    EXPECT_TRUE(list(d_casPath + "/tmp").empty());
+}
+
+TEST_F(LocalCasTestFixture, LeastRecentlyUsedBlobsAreEvicted)
+{
+    TestLocalCas cas(d_casPath, 4000, false);
+    std::vector<proto::Digest> digests;
+    for (int i = 0; i < 9; ++i) {
+        const std::string blob(500, static_cast<char>('a' + i));
+        digests.push_back(DigestGenerator::make_digest(blob));
+        cas.insert(digests.back(), blob.data(), blob.size());
+        if (i < 7) {
+            // Used long ago, in order
+            const struct timespec times[2] = {{1000 + i, 0}, {1000 + i, 0}};
+            ASSERT_EQ(utimensat(AT_FDCWD, objectPath(digests[i]).c_str(),
+                                times, 0),
+                      0);
+        }
+        if (i == 6) {
+            // Used again
+            ASSERT_TRUE(cas.materialize(digests[0], AT_FDCWD,
+                                        d_outputPath + "/a", false));
+        }
+    }
+
+    EXPECT_TRUE(cas.contains(digests[0]));
+    EXPECT_FALSE(cas.contains(digests[1]));
+    EXPECT_FALSE(cas.contains(digests[2]));
+    for (int i = 3; i < 9; ++i) {
+        EXPECT_TRUE(cas.contains(digests[i]));
+    }
+    EXPECT_EQ(cas.size(), 3500);
+    EXPECT_EQ(objects().size(), 7);
+
+    // Blobs too large for the cache are not kept
+    const std::string large(2000, 'x');
+    const proto::Digest largeDigest = DigestGenerator::make_digest(large);
+    cas.insert(largeDigest, large.data(), large.size());
+    EXPECT_FALSE(cas.contains(largeDigest));
+}
+
+TEST_F(LocalCasTestFixture, EvictionCorrectsTheRecordedSize)
+{
+    TestLocalCas cas(d_casPath, 4000, false);
+    const std::string blob(500, 'a');
+    const proto::Digest digest = DigestGenerator::make_digest(blob);
+    cas.insert(digest, blob.data(), blob.size());
+    ASSERT_EQ(unlink(objectPath(digest).c_str()), 0);
+    EXPECT_EQ(cas.size(), 500);
+
+    cas.evict();
+    EXPECT_EQ(cas.size(), 0);
+}
+
+TEST_F(LocalCasTestFixture, ConcurrentProcessesShareTheCache)
+{
+    // Twice as many blobs as fit in the cache, so that they are evicted
+    // while the processes use them
+    const int numBlobs = 40;
+    const int64_t maxSize = numBlobs / 2 * 300;
+    const auto blobContents = [](int i) {
+        return std::string(300 - i, static_cast<char>('a' + i % 26)) +
+               std::to_string(i);
+    };
+
+    const int numProcesses = 4;
+    std::vector<pid_t> pids;
+    for (int p = 0; p < numProcesses; ++p) {
+        const pid_t pid = fork();
+        ASSERT_GE(pid, 0);
+        if (pid == 0) {
+            TestLocalCas cas(d_casPath, maxSize, p % 2 == 0);
+            const std::string output =
+                d_outputPath + "/output-" + std::to_string(p);
+            for (int k = 0; k < 300; ++k) {
+                const int i = (k * (p + 1) + p) % numBlobs;
+                const std::string blob = blobContents(i);
+                const proto::Digest digest =
+                    DigestGenerator::make_digest(blob);
+                if (!cas.contains(digest) ||
+                    !cas.materialize(digest, AT_FDCWD, output, false)) {
+                    cas.insert(digest, blob.data(), blob.size());
+                    continue;
+                }
+                if (buildboxcommon::FileUtils::getFileContents(
+                        output.c_str()) != blob) {
+                    _exit(1);
+                }
+            }
+            _exit(0);
+        }
+        pids.push_back(pid);
+    }
+    for (const pid_t pid : pids) {
+        int status;
+        ASSERT_EQ(waitpid(pid, &status, 0), pid);
+        EXPECT_TRUE(WIFEXITED(status));
+        EXPECT_EQ(WEXITSTATUS(status), 0);
+    }
+
+    // Every blob left is complete, and the recorded size is exact once
+    // corrected
+    TestLocalCas cas(d_casPath, maxSize, false);
+    cas.evict();
+    int64_t totalSize = 0;
+    for (const auto &path : objects()) {
+        const std::string blob =
+            buildboxcommon::FileUtils::getFileContents(path.c_str());
+        const proto::Digest digest = DigestGenerator::make_digest(blob);
+        EXPECT_EQ(objectPath(digest), path);
+        totalSize += digest.size_bytes();
+    }
+    EXPECT_GT(totalSize, 0);
+    EXPECT_LE(totalSize, maxSize);
+    EXPECT_EQ(cas.size(), totalSize);
+    EXPECT_TRUE(list(d_casPath + "/tmp").empty());
+}
@@ -0,0 +1,121 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <makerulesparser.h>
+
+#include <buildboxcommon_fileutils.h>
+
+#include <gtest/gtest.h>
+
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace recc;
+
+namespace {
+
+std::set<std::string> parseInChunks(const std::string &rules,
+                                    size_t chunkSize,
+                                    bool isSunFormat = false)
+{
+    MakeRulesParser parser(isSunFormat);
+    for (size_t pos = 0; pos < rules.size(); pos += chunkSize) {
+        parser.parse(rules.substr(pos, chunkSize));
+    }
+    parser.finish();
+    return parser.dependencies();
+}
+
+} // namespace
+
+TEST(MakeRulesParserTest, SimpleRules)
+{
+    const std::string rules = "sample.o: sample.c sample.h \\\n"
+                              " /usr/include/cstring.h \\\n"
+                              " file\\ with\\ spaces.h C:\\\\dir/x.h\n";
+    const std::set<std::string> expected = {
+        "sample.c", "sample.h", "/usr/include/cstring.h",
+        "file with spaces.h", "C:\\dir/x.h"};
+
+    MakeRulesParser parser;
+    parser.parse(rules);
+    parser.finish();
+    EXPECT_EQ(parser.dependencies(), expected);
+}
+
+TEST(MakeRulesParserTest, LastDependencyNeedsFinish)
+{
+    MakeRulesParser parser;
+    parser.parse("sample.o: sample.c sample.h");
+    EXPECT_EQ(parser.dependencies(), std::set<std::string>({"sample.c"}));
+
+    parser.finish();
+    EXPECT_EQ(parser.dependencies(),
+              std::set<std::string>({"sample.c", "sample.h"}));
+}
+
+TEST(MakeRulesParserTest, ChunkBoundariesDontMatter)
+{
+    const std::string rules = "sample.o: sample.c subdir/sample.h \\\n"
+                              " with\\ space.h \\\n"
+                              " C:/x.h\n"
+                              "sample.h:\n";
+    const auto expected = parseInChunks(rules, rules.size());
+    ASSERT_EQ(expected.size(), 4);
+
+    for (size_t chunkSize = 1; chunkSize < rules.size(); ++chunkSize) {
+        EXPECT_EQ(parseInChunks(rules, chunkSize), expected)
+            << "chunk size " << chunkSize;
+    }
+}
+
+TEST(MakeRulesParserTest, SunFormatInChunks)
+{
+    const std::string rules = "sample.o : ./sample.c\n"
+                              "sample.o : ./sample.h\n"
+                              "rule3.o : ./sample with spaces.c";
+    const std::set<std::string> expected = {"./sample.c", "./sample.h",
+                                            "./sample with spaces.c"};
+
+    for (size_t chunkSize = 1; chunkSize <= rules.size(); ++chunkSize) {
+        EXPECT_EQ(parseInChunks(rules, chunkSize, true), expected)
+            << "chunk size " << chunkSize;
+    }
+}
+
+TEST(MakeRulesParserTest, LargeMakeOutputInChunks)
+{
+    const auto rules =
+        buildboxcommon::FileUtils::getFileContents("giant_make_output.mk");
+
+    const auto dependencies = parseInChunks(rules, 4096);
+    EXPECT_EQ(dependencies.size(), 679);
+    EXPECT_EQ(dependencies, parseInChunks(rules, rules.size()));
+}
+
+TEST(MakeRulesParserTest, CallbackReportsEachDependencyOnce)
+{
+    std::vector<std::string> reported;
+    MakeRulesParser parser(false, [&reported](const std::string &path) {
+        reported.push_back(path);
+    });
+    parser.parse("a.o: a.c common.h\n");
+    EXPECT_EQ(reported, std::vector<std::string>({"a.c", "common.h"}));
+
+    parser.parse("b.o: b.c common.h");
+    parser.finish();
+    EXPECT_EQ(reported,
+              std::vector<std::string>({"a.c", "common.h", "b.c"}));
+}
@@ -0,0 +1,213 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <digestgenerator.h>
+#include <env.h>
+#include <manifestcache.h>
+#include <parsedcommandfactory.h>
+#include <reccdefaults.h>
+
+#include <buildboxcommon_fileutils.h>
+#include <buildboxcommon_temporarydirectory.h>
+
+#include <gtest/gtest.h>
+
+using namespace recc;
+
+// Exposes the protected members for testing
+class TestManifestCache : public ManifestCache {
+  public:
+    using ManifestCache::ManifestCache;
+    using ManifestCache::deserializeEntries;
+    using ManifestCache::readEntries;
+    using ManifestCache::serializeEntries;
+};
+
+class ManifestCacheTestFixture : public ::testing::Test {
+  protected:
+    typedef ManifestCache::Entry Entry;
+
+    ManifestCacheTestFixture()
+        : d_cache(d_cacheDirectory.strname() + "/manifests")
+    {
+    }
+
+    std::string writeFile(const std::string &name,
+                          const std::string &contents)
+    {
+        const std::string path = d_sourceDirectory.strname() + "/" + name;
+        buildboxcommon::FileUtils::writeFileAtomically(path, contents);
+        return path;
+    }
+
+    Entry makeEntry(const std::string &actionData,
+                    const std::vector<std::string> &dependencies)
+    {
+        std::set<std::string> dependencySet(dependencies.begin(),
+                                            dependencies.end());
+        return ManifestCache::createEntry(
+            DigestGenerator::make_digest(actionData), {"hello.o"},
+            dependencySet, {});
+    }
+
+    buildboxcommon::TemporaryDirectory d_cacheDirectory;
+    buildboxcommon::TemporaryDirectory d_sourceDirectory;
+    TestManifestCache d_cache;
+};
+
+TEST_F(ManifestCacheTestFixture, LookupWithoutManifest)
+{
+    Entry entry;
+    EXPECT_FALSE(d_cache.lookup("0123456789abcdef", &entry));
+}
+
+TEST_F(ManifestCacheTestFixture, StoreAndLookup)
+{
+    const std::string header = writeFile("hello.h", "#define HELLO 1\n");
+    const std::string source =
+        writeFile("hello.cpp", "#include \"hello.h\"\nint main() {}\n");
+
+    const Entry stored = makeEntry("action", {header, source});
+    d_cache.store("0123456789abcdef", stored);
+
+    Entry entry;
+    ASSERT_TRUE(d_cache.lookup("0123456789abcdef", &entry));
+    EXPECT_EQ(entry.d_actionDigest, stored.d_actionDigest);
+    EXPECT_EQ(entry.d_products, std::set<std::string>({"hello.o"}));
+    EXPECT_EQ(entry.d_dependencies, stored.d_dependencies);
+}
+
+TEST_F(ManifestCacheTestFixture, ChangedDependencyIsAMiss)
+{
+    const std::string header = writeFile("hello.h", "#define HELLO 1\n");
+    d_cache.store("0123456789abcdef", makeEntry("action", {header}));
+
+    writeFile("hello.h", "#define HELLO 2\n");
+
+    Entry entry;
+    EXPECT_FALSE(d_cache.lookup("0123456789abcdef", &entry));
+}
+
+TEST_F(ManifestCacheTestFixture, DeletedDependencyIsAMiss)
+{
+    const std::string header = writeFile("hello.h", "#define HELLO 1\n");
+    d_cache.store("0123456789abcdef", makeEntry("action", {header}));
+
+    ASSERT_EQ(unlink(header.c_str()), 0);
+
+    Entry entry;
+    EXPECT_FALSE(d_cache.lookup("0123456789abcdef", &entry));
+}
+
+TEST_F(ManifestCacheTestFixture, OlderEntryStillMatches)
+{
+    const std::string header = writeFile("config.h", "#define A 1\n");
+    const Entry first = makeEntry("first", {header});
+    d_cache.store("0123456789abcdef", first);
+
+    writeFile("config.h", "#define A 2\n");
+    const Entry second = makeEntry("second", {header});
+    d_cache.store("0123456789abcdef", second);
+
+    Entry entry;
+    ASSERT_TRUE(d_cache.lookup("0123456789abcdef", &entry));
+    EXPECT_EQ(entry.d_actionDigest, second.d_actionDigest);
+
+    // Switching back to the previous contents finds the older entry
+    writeFile("config.h", "#define A 1\n");
+    ASSERT_TRUE(d_cache.lookup("0123456789abcdef", &entry));
+    EXPECT_EQ(entry.d_actionDigest, first.d_actionDigest);
+}
+
+TEST_F(ManifestCacheTestFixture, NumberOfEntriesIsBounded)
+{
+    const std::string header = writeFile("config.h", "0");
+    const Entry oldest = makeEntry("0", {header});
+    d_cache.store("0123456789abcdef", oldest);
+    for (int i = 1; i <= DEFAULT_RECC_MANIFEST_MAX_ENTRIES; ++i) {
+        writeFile("config.h", std::to_string(i));
+        d_cache.store("0123456789abcdef",
+                      makeEntry(std::to_string(i), {header}));
+    }
+
+    EXPECT_EQ(d_cache.readEntries("0123456789abcdef").size(),
+              DEFAULT_RECC_MANIFEST_MAX_ENTRIES);
+
+    writeFile("config.h", "0");
+    Entry entry;
+    EXPECT_FALSE(d_cache.lookup("0123456789abcdef", &entry));
+}
+
+TEST_F(ManifestCacheTestFixture, SerializationRoundTrip)
+{
+    Entry entry;
+    entry.d_actionDigest = DigestGenerator::make_digest("action");
+    entry.d_products = {"out dir/hello.o", "hello.d"};
+    entry.d_dependencies["/usr/include/stdio.h"] =
+        DigestGenerator::make_digest("stdio");
+    entry.d_dependencies["path with spaces/a.h"] =
+        DigestGenerator::make_digest("a");
+
+    const auto entries = TestManifestCache::deserializeEntries(
+        TestManifestCache::serializeEntries({entry, entry}));
+    ASSERT_EQ(entries.size(), 2);
+    for (const auto &parsed : entries) {
+        EXPECT_EQ(parsed.d_actionDigest, entry.d_actionDigest);
+        EXPECT_EQ(parsed.d_products, entry.d_products);
+        EXPECT_EQ(parsed.d_dependencies, entry.d_dependencies);
+    }
+}
+
+TEST_F(ManifestCacheTestFixture, MalformedManifestIsIgnored)
+{
+    EXPECT_THROW(TestManifestCache::deserializeEntries("garbage"),
+                 std::runtime_error);
+    EXPECT_THROW(
+        TestManifestCache::deserializeEntries("recc-manifest 1\nentry abc\n"),
+        std::runtime_error);
+
+    const std::string path = d_cache.manifestPath("0123456789abcdef");
+    buildboxcommon::FileUtils::createDirectory(
+        path.substr(0, path.rfind('/')).c_str());
+    buildboxcommon::FileUtils::writeFileAtomically(path, "garbage");
+
+    Entry entry;
+    EXPECT_FALSE(d_cache.lookup("0123456789abcdef", &entry));
+}
+
+TEST_F(ManifestCacheTestFixture, KeyDependsOnCommandAndConfiguration)
+{
+    const std::string source = writeFile("hello.cpp", "int main() {}\n");
+    const std::string cwd = d_sourceDirectory.strname();
+
+    const auto command = ParsedCommandFactory::createParsedCommand(
+        {"gcc", "-c", source, "-o", "hello.o"}, cwd);
+    const auto otherCommand = ParsedCommandFactory::createParsedCommand(
+        {"gcc", "-O2", "-c", source, "-o", "hello.o"}, cwd);
+
+    const std::string key = ManifestCache::computeKey(command, cwd);
+    EXPECT_EQ(key, ManifestCache::computeKey(command, cwd));
+    EXPECT_NE(key, ManifestCache::computeKey(otherCommand, cwd));
+    EXPECT_NE(key,
+              ManifestCache::computeKey(command, "/some/other/directory"));
+
+    const std::string previousSalt = RECC_ACTION_SALT;
+    RECC_ACTION_SALT = "salt";
+    EXPECT_NE(key, ManifestCache::computeKey(command, cwd));
+    RECC_ACTION_SALT = previousSalt;
+
+    // The contents of the source file are part of the key
+    writeFile("hello.cpp", "int main() { return 1; }\n");
+    EXPECT_NE(key, ManifestCache::computeKey(command, cwd));
+}
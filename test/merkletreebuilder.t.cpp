@@ -0,0 +1,141 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <digestgenerator.h>
+#include <merkletreebuilder.h>
+
+#include <buildboxcommon_fileutils.h>
+#include <buildboxcommon_merklize.h>
+#include <buildboxcommon_temporarydirectory.h>
+
+#include <gtest/gtest.h>
+
+#include <unistd.h>
+
+using namespace recc;
+
+namespace {
+
+buildboxcommon::File makeFile(const std::string &contents, bool executable)
+{
+    buildboxcommon::File file;
+    file.d_digest = DigestGenerator::make_digest(contents);
+    file.d_executable = executable;
+    return file;
+}
+
+} // namespace
+
+TEST(MerkleTreeBuilderTest, EmptyTree)
+{
+    buildboxcommon::NestedDirectory expected;
+    EXPECT_EQ(MerkleTreeBuilder().build(), expected.to_digest());
+}
+
+TEST(MerkleTreeBuilderTest, SameDigestsAsNestedDirectory)
+{
+    // Names sharing prefixes with characters sorting before and after `/`
+    const std::vector<std::string> paths = {
+        "a",       "a.b",     "b/a-b/q",  "b/a/z",    "b/a/y/x",
+        "b/a0",    "b/a.c/d", "c/d/e/f",  "c/d/e/g",  "c/d/h",
+        "c/i",     "d/j",     "a b/k",    "z/z/z/z/z"};
+
+    buildboxcommon::NestedDirectory expected;
+    MerkleTreeBuilder builder;
+    // Insertion order must not matter
+    for (auto it = paths.rbegin(); it != paths.rend(); ++it) {
+        const auto file = makeFile(*it, it->size() % 2 == 0);
+        expected.add(file, it->c_str());
+        builder.addFile(*it, file.d_digest, file.d_executable);
+    }
+    expected.addSymlink("../a", "c/d/link");
+    builder.addSymlink("c/d/link", "../a");
+    expected.addDirectory("c/empty/nested");
+    builder.addDirectory("c/empty/nested");
+    expected.addDirectory("b/a");
+    builder.addDirectory("b/a");
+
+    buildboxcommon::digest_string_map expectedBlobs;
+    buildboxcommon::digest_string_map blobs;
+    EXPECT_EQ(builder.build(&blobs), expected.to_digest(&expectedBlobs));
+    EXPECT_EQ(blobs, expectedBlobs);
+}
+
+TEST(MerkleTreeBuilderTest, PathsAreNormalized)
+{
+    const auto file = makeFile("hello", false);
+
+    MerkleTreeBuilder expected;
+    expected.addFile("a/b/hello.c", file.d_digest, false);
+
+    MerkleTreeBuilder builder;
+    builder.addFile("/a//./b/hello.c", file.d_digest, false);
+    builder.addDirectory(".");
+    builder.addDirectory("");
+    builder.addDirectory("a/");
+
+    EXPECT_EQ(builder.build(), expected.build());
+}
+
+TEST(MerkleTreeBuilderTest, LastEntryForAPathWins)
+{
+    const auto oldFile = makeFile("old", false);
+    const auto newFile = makeFile("new", true);
+
+    MerkleTreeBuilder expected;
+    expected.addFile("dir/file", newFile.d_digest, true);
+
+    MerkleTreeBuilder builder;
+    builder.addFile("dir/file", oldFile.d_digest, false);
+    builder.addDirectory("dir");
+    builder.addFile("dir/file", newFile.d_digest, true);
+    builder.addDirectory("dir");
+
+    EXPECT_EQ(builder.size(), 4);
+    EXPECT_EQ(builder.build(), expected.build());
+}
+
+TEST(MerkleTreeBuilderTest, AddLocalDirectory)
+{
+    buildboxcommon::TemporaryDirectory directory;
+    const std::string root = directory.strname();
+    buildboxcommon::FileUtils::createDirectory((root + "/src/empty").c_str());
+    buildboxcommon::FileUtils::writeFileAtomically(root + "/src/hello.c",
+                                                   "hello");
+    buildboxcommon::FileUtils::writeFileAtomically(root + "/run.sh", "run",
+                                                   0755);
+    ASSERT_EQ(symlink("src/hello.c", (root + "/link").c_str()), 0);
+
+    buildboxcommon::digest_string_map expectedFiles;
+    auto expected =
+        buildboxcommon::make_nesteddirectory(root.c_str(), &expectedFiles,
+                                             false);
+    buildboxcommon::NestedDirectory expectedRoot;
+    expectedRoot.d_subdirs->emplace("prefix", std::move(expected));
+
+    buildboxcommon::digest_string_map files;
+    MerkleTreeBuilder builder;
+    builder.addLocalDirectory(root, "prefix", &files);
+
+    EXPECT_EQ(builder.build(), expectedRoot.to_digest());
+    EXPECT_EQ(files, expectedFiles);
+}
+
+TEST(MerkleTreeBuilderTest, MissingLocalDirectoryThrows)
+{
+    MerkleTreeBuilder builder;
+    EXPECT_THROW(builder.addLocalDirectory("/nonexistent/directory", "",
+                                           nullptr),
+                 std::system_error);
+}
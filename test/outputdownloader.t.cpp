@@ -0,0 +1,355 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <digestgenerator.h>
+#include <localcas.h>
+#include <outputdownloader.h>
+#include <threadpool.h>
+
+#include <buildboxcommon_fileutils.h>
+#include <buildboxcommon_temporarydirectory.h>
+
+#include <atomic>
+#include <dirent.h>
+#include <fcntl.h>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using namespace recc;
+
+// Serves the blobs from memory
+class TestOutputDownloader : public OutputDownloader {
+  public:
+    explicit TestOutputDownloader(ThreadPool *pool,
+                                  LocalCas *localCas = nullptr)
+        : OutputDownloader(nullptr, pool, localCas)
+    {
+    }
+
+    proto::Digest add(const std::string &blob)
+    {
+        const proto::Digest digest = DigestGenerator::make_digest(blob);
+        d_blobs[digest.hash()] = blob;
+        return digest;
+    }
+
+    std::unordered_map<std::string, std::string> d_blobs;
+    std::vector<size_t> d_batchSizes;
+    std::atomic<int> d_streamed{0};
+
+  protected:
+    std::unordered_map<std::string, std::string>
+    fetchBlobs(const std::vector<proto::Digest> &digests) override
+    {
+        std::unordered_map<std::string, std::string> blobs;
+        size_t size = 0;
+        for (const auto &digest : digests) {
+            blobs[digest.hash()] = d_blobs.at(digest.hash());
+            size += static_cast<size_t>(digest.size_bytes());
+        }
+        const std::lock_guard<std::mutex> lock(d_mutex);
+        d_batchSizes.push_back(size);
+        return blobs;
+    }
+
+    void fetchBlobToFile(const proto::Digest &digest, int fd) override
+    {
+        ++d_streamed;
+        const std::string &blob = d_blobs.at(digest.hash());
+        ASSERT_EQ(write(fd, blob.data(), blob.size()),
+                  static_cast<ssize_t>(blob.size()));
+    }
+
+    std::string fetchBlob(const proto::Digest &digest) override
+    {
+        return d_blobs.at(digest.hash());
+    }
+
+  private:
+    std::mutex d_mutex;
+};
+
+class OutputDownloaderTestFixture : public ::testing::Test {
+  protected:
+    OutputDownloaderTestFixture()
+        : d_pool(2), d_downloader(&d_pool),
+          d_dirfd(open(d_directory.name(), O_RDONLY | O_DIRECTORY))
+    {
+    }
+
+    ~OutputDownloaderTestFixture() { close(d_dirfd); }
+
+    proto::OutputFile outputFile(const std::string &path,
+                                 const std::string &contents,
+                                 bool executable = false)
+    {
+        proto::OutputFile file;
+        file.set_path(path);
+        *file.mutable_digest() = d_downloader.add(contents);
+        file.set_is_executable(executable);
+        return file;
+    }
+
+    std::string contents(const std::string &path) const
+    {
+        return buildboxcommon::FileUtils::getFileContents(
+            (d_directory.strname() + "/" + path).c_str());
+    }
+
+    // Returns the names in the given directory
+    std::vector<std::string> list(const std::string &path) const
+    {
+        std::vector<std::string> names;
+        DIR *dir = opendir((d_directory.strname() + "/" + path).c_str());
+        while (dir != nullptr) {
+            const struct dirent *entry = readdir(dir);
+            if (entry == nullptr) {
+                closedir(dir);
+                break;
+            }
+            const std::string name = entry->d_name;
+            if (name != "." && name != "..") {
+                names.push_back(name);
+            }
+        }
+        return names;
+    }
+
+    buildboxcommon::TemporaryDirectory d_directory;
+    ThreadPool d_pool;
+    TestOutputDownloader d_downloader;
+    int d_dirfd;
+};
+
+TEST_F(OutputDownloaderTestFixture, WritesFilesDirectoriesAndSymlinks)
+{
+    proto::ActionResult result;
+    *result.add_output_files() = outputFile("a.o", "object");
+    *result.add_output_files() = outputFile("bin/tool", "#!/bin/sh", true);
+    *result.add_output_files() = outputFile("empty", "");
+
+    proto::Tree tree;
+    proto::Directory nested;
+    auto nestedFile = nested.add_files();
+    nestedFile->set_name("nested.txt");
+    *nestedFile->mutable_digest() = d_downloader.add("nested");
+    auto nestedSymlink = nested.add_symlinks();
+    nestedSymlink->set_name("link");
+    nestedSymlink->set_target("nested.txt");
+    *tree.add_children() = nested;
+    auto rootFile = tree.mutable_root()->add_files();
+    rootFile->set_name("root.txt");
+    *rootFile->mutable_digest() = d_downloader.add("object");
+    auto subdirectory = tree.mutable_root()->add_directories();
+    subdirectory->set_name("sub");
+    *subdirectory->mutable_digest() = DigestGenerator::make_digest(nested);
+    tree.mutable_root()->add_directories()->set_name("empty");
+    *tree.mutable_root()->mutable_directories(1)->mutable_digest() =
+        DigestGenerator::make_digest(proto::Directory());
+    *tree.add_children() = proto::Directory();
+    auto outputDirectory = result.add_output_directories();
+    outputDirectory->set_path("out/dir");
+    *outputDirectory->mutable_tree_digest() =
+        d_downloader.add(tree.SerializeAsString());
+
+    auto symlink = result.add_output_file_symlinks();
+    symlink->set_path("links/a");
+    symlink->set_target("../a.o");
+    *result.add_output_symlinks() = *symlink;
+
+    d_downloader.download(result, d_dirfd);
+
+    EXPECT_EQ(contents("a.o"), "object");
+    EXPECT_EQ(contents("bin/tool"), "#!/bin/sh");
+    EXPECT_TRUE(buildboxcommon::FileUtils::isExecutable(
+        (d_directory.strname() + "/bin/tool").c_str()));
+    EXPECT_FALSE(buildboxcommon::FileUtils::isExecutable(
+        (d_directory.strname() + "/a.o").c_str()));
+    EXPECT_EQ(contents("empty"), "");
+    EXPECT_EQ(contents("out/dir/root.txt"), "object");
+    EXPECT_EQ(contents("out/dir/sub/nested.txt"), "nested");
+    EXPECT_EQ(contents("out/dir/sub/link"), "nested");
+    EXPECT_TRUE(list("out/dir/empty").empty());
+    EXPECT_EQ(contents("links/a"), "object");
+
+    // Blobs with several files are fetched once
+    ASSERT_EQ(d_downloader.d_batchSizes.size(), 1);
+    EXPECT_EQ(d_downloader.d_batchSizes[0], 6 + 9 + 6);
+}
+
+TEST_F(OutputDownloaderTestFixture, SmallBlobsAreFetchedInBatches)
+{
+    proto::ActionResult result;
+    const size_t size = OutputDownloader::MAX_BATCH_SIZE / 3;
+    for (char c = 'a'; c < 'h'; ++c) {
+        *result.add_output_files() =
+            outputFile(std::string(1, c), std::string(size, c));
+    }
+
+    d_downloader.download(result, d_dirfd);
+
+    // Three blobs per batch
+    EXPECT_EQ(d_downloader.d_batchSizes.size(), 3);
+    for (const size_t batchSize : d_downloader.d_batchSizes) {
+        EXPECT_LE(batchSize, OutputDownloader::MAX_BATCH_SIZE);
+    }
+    EXPECT_EQ(d_downloader.d_streamed, 0);
+    EXPECT_EQ(contents("g"), std::string(size, 'g'));
+}
+
+TEST_F(OutputDownloaderTestFixture, LargeBlobsAreStreamed)
+{
+    const std::string large(OutputDownloader::MAX_BATCHED_BLOB_SIZE + 1,
+                            'x');
+    proto::ActionResult result;
+    *result.add_output_files() = outputFile("large.o", large);
+    *result.add_output_files() = outputFile("copy/large.o", large, true);
+
+    d_downloader.download(result, d_dirfd);
+
+    EXPECT_EQ(d_downloader.d_streamed, 1);
+    EXPECT_TRUE(d_downloader.d_batchSizes.empty());
+    EXPECT_EQ(contents("large.o"), large);
+    EXPECT_EQ(contents("copy/large.o"), large);
+    EXPECT_TRUE(buildboxcommon::FileUtils::isExecutable(
+        (d_directory.strname() + "/copy/large.o").c_str()));
+}
+
+TEST_F(OutputDownloaderTestFixture, BlobsInLocalCasAreNotFetched)
+{
+    buildboxcommon::TemporaryDirectory cacheDirectory;
+    LocalCas cas(cacheDirectory.strname() + "/cas", 64 * 1024 * 1024, false);
+    const std::string large(OutputDownloader::MAX_BATCHED_BLOB_SIZE + 1,
+                            'x');
+    proto::ActionResult result;
+    *result.add_output_files() = outputFile("a.o", "small");
+    *result.add_output_files() = outputFile("large.o", large);
+
+    TestOutputDownloader first(&d_pool, &cas);
+    first.d_blobs = d_downloader.d_blobs;
+    first.download(result, d_dirfd);
+    EXPECT_EQ(first.d_batchSizes.size(), 1);
+    EXPECT_EQ(first.d_streamed, 1);
+    EXPECT_EQ(cas.misses(), 2);
+
+    // Written from the local CAS only
+    *result.add_output_files() = outputFile("copy/a.o", "small", true);
+    TestOutputDownloader second(&d_pool, &cas);
+    second.download(result, d_dirfd);
+    EXPECT_TRUE(second.d_batchSizes.empty());
+    EXPECT_EQ(second.d_streamed, 0);
+    EXPECT_EQ(cas.hits(), 2);
+    EXPECT_EQ(contents("a.o"), "small");
+    EXPECT_EQ(contents("large.o"), large);
+    EXPECT_EQ(contents("copy/a.o"), "small");
+    EXPECT_TRUE(buildboxcommon::FileUtils::isExecutable(
+        (d_directory.strname() + "/copy/a.o").c_str()));
+}
+
+TEST_F(OutputDownloaderTestFixture, ExistingFilesAreReplaced)
+{
+    buildboxcommon::FileUtils::writeFileAtomically(
+        d_directory.strname() + "/a.o", "old");
+    proto::ActionResult result;
+    *result.add_output_files() = outputFile("a.o", "new");
+
+    d_downloader.download(result, d_dirfd);
+
+    EXPECT_EQ(contents("a.o"), "new");
+    EXPECT_EQ(list("").size(), 1);
+}
+
+TEST_F(OutputDownloaderTestFixture, CorruptBlobsAreNotWritten)
+{
+    buildboxcommon::FileUtils::writeFileAtomically(
+        d_directory.strname() + "/a.o", "old");
+    const std::string large(OutputDownloader::MAX_BATCHED_BLOB_SIZE + 1,
+                            'x');
+    proto::ActionResult result;
+    *result.add_output_files() = outputFile("a.o", "new");
+    *result.add_output_files() = outputFile("large.o", large);
+    d_downloader.d_blobs[result.output_files(0).digest().hash()] = "bad";
+    d_downloader.d_blobs[result.output_files(1).digest().hash()][0] = 'y';
+
+    EXPECT_THROW(d_downloader.download(result, d_dirfd), std::runtime_error);
+
+    // No temporary files are left behind
+    EXPECT_EQ(contents("a.o"), "old");
+    EXPECT_EQ(list("").size(), 1);
+}
+
+TEST_F(OutputDownloaderTestFixture, UnchangedFilesAreSkipped)
+{
+    const std::string directory = d_directory.strname();
+    for (const std::string name : {"same", "different", "executable"}) {
+        buildboxcommon::FileUtils::writeFileAtomically(directory + "/" + name,
+                                                       "contents");
+    }
+    proto::ActionResult result;
+    *result.add_output_files() = outputFile(directory + "/same", "contents");
+    *result.add_output_files() =
+        outputFile(directory + "/different", "CONTENTS");
+    *result.add_output_files() =
+        outputFile(directory + "/executable", "contents", true);
+    *result.add_output_files() =
+        outputFile(directory + "/missing", "contents");
+
+    EXPECT_EQ(OutputDownloader::skipUnchangedFiles(&result, {}, nullptr), 1);
+    ASSERT_EQ(result.output_files_size(), 3);
+    EXPECT_EQ(result.output_files(0).path(), directory + "/different");
+    EXPECT_EQ(result.output_files(1).path(), directory + "/executable");
+    EXPECT_EQ(result.output_files(2).path(), directory + "/missing");
+}
+
+TEST_F(OutputDownloaderTestFixture, UnchangedFilesOlderThanInputsAreTouched)
+{
+    const std::string output = d_directory.strname() + "/a.o";
+    const std::string input = d_directory.strname() + "/a.c";
+    buildboxcommon::FileUtils::writeFileAtomically(output, "object");
+    buildboxcommon::FileUtils::writeFileAtomically(input, "source");
+    const auto setModificationTime = [](const std::string &path,
+                                        time_t seconds) {
+        const struct timespec times[2] = {{seconds, 0}, {seconds, 0}};
+        ASSERT_EQ(utimensat(AT_FDCWD, path.c_str(), times, 0), 0);
+    };
+    const auto modificationTime = [](const std::string &path) {
+        struct stat st;
+        EXPECT_EQ(stat(path.c_str(), &st), 0);
+        return st.st_mtime;
+    };
+
+    // Newer than its input: left alone
+    setModificationTime(output, 2000000);
+    setModificationTime(input, 1000000);
+    proto::ActionResult result;
+    *result.add_output_files() = outputFile(output, "object");
+    EXPECT_EQ(
+        OutputDownloader::skipUnchangedFiles(&result, {input}, nullptr), 1);
+    EXPECT_EQ(modificationTime(output), 2000000);
+
+    // Older than its input: touched
+    setModificationTime(input, 3000000);
+    *result.add_output_files() = outputFile(output, "object");
+    EXPECT_EQ(
+        OutputDownloader::skipUnchangedFiles(&result, {input}, nullptr), 1);
+    EXPECT_GT(modificationTime(output), 3000000);
+    EXPECT_EQ(result.output_files_size(), 0);
+}
@@ -18,6 +18,8 @@
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
+#include <unistd.h>
+
 using namespace recc;
 using namespace testing;
 
@@ -47,3 +49,17 @@ TEST(RequestMetadataTest, ToolInvocationID)
     // PPID is a number:
     ASSERT_NO_THROW(std::stoi(parentPid));
 }
+
+TEST(RequestMetadataTest, ToolInvocationIDWithParentPid)
+{
+    RequestMetadataGenerator::set_parent_pid(12345);
+    const std::string toolInvocationId =
+        RequestMetadataGenerator::tool_invocation_id();
+    RequestMetadataGenerator::set_parent_pid(0);
+
+    EXPECT_EQ(toolInvocationId,
+              RequestMetadataGenerator::hostname() + ":12345");
+    EXPECT_EQ(RequestMetadataGenerator::tool_invocation_id(),
+              RequestMetadataGenerator::hostname() + ":" +
+                  std::to_string(getppid()));
+}
@@ -15,6 +15,9 @@
 #include <subprocess.h>
 
 #include <fstream>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include <buildboxcommon_temporarydirectory.h>
 
@@ -76,3 +79,106 @@ TEST(SubprocessTest, Environment)
                 std::string::npos);
     EXPECT_EQ(result.d_exitCode, 0);
 }
+
+TEST(SubprocessTest, EnvironmentReplacesVariable)
+{
+    setenv("RECC_SUBPROCESS_TEST_VAR", "old", 1);
+    std::vector<std::string> command = {"env"};
+    std::map<std::string, std::string> env = {
+        {"RECC_SUBPROCESS_TEST_VAR", "new"}};
+    auto result = Subprocess::execute(command, true, true, env);
+    unsetenv("RECC_SUBPROCESS_TEST_VAR");
+
+    EXPECT_EQ(result.d_exitCode, 0);
+    EXPECT_NE(result.d_stdOut.find("RECC_SUBPROCESS_TEST_VAR=new\n"),
+              std::string::npos);
+    EXPECT_EQ(result.d_stdOut.find("RECC_SUBPROCESS_TEST_VAR=old"),
+              std::string::npos);
+}
+
+TEST(SubprocessTest, CommandFoundInEnvironmentPath)
+{
+    buildboxcommon::TemporaryDirectory temp_dir;
+    const std::string script_path =
+        std::string(temp_dir.name()) + "/recc-subprocess-test-command";
+    std::ofstream script(script_path);
+    script << "#!/bin/sh\necho found\n";
+    script.close();
+    chmod(script_path.c_str(), 0755);
+
+    std::vector<std::string> command = {"recc-subprocess-test-command"};
+    auto result = Subprocess::execute(command, true, true,
+                                      {{"PATH", temp_dir.name()}});
+    EXPECT_EQ(result.d_exitCode, 0);
+    EXPECT_EQ(result.d_stdOut, "found\n");
+
+    result = Subprocess::execute(command, true, true);
+    EXPECT_EQ(result.d_exitCode, 127);
+}
+
+TEST(SubprocessTest, OutputCallback)
+{
+    std::vector<std::string> command = {"sh", "-c",
+                                        "echo hello; echo world >&2"};
+    std::string streamed;
+    auto result = Subprocess::execute(
+        command, true, true, {},
+        [&streamed](const char *data, size_t size) {
+            streamed.append(data, size);
+        });
+    EXPECT_EQ(result.d_exitCode, 0);
+    EXPECT_EQ(streamed, "hello\n");
+    EXPECT_EQ(result.d_stdOut, "");
+    EXPECT_EQ(result.d_stdErr, "world\n");
+}
+
+TEST(SubprocessTest, ReplaceProcess)
+{
+    std::vector<std::string> command = {"sh", "-c", "exit 3"};
+    const pid_t pid = fork();
+    ASSERT_NE(pid, -1);
+    if (pid == 0) {
+        Subprocess::replaceProcess(command);
+        _Exit(1);
+    }
+
+    int status;
+    ASSERT_EQ(waitpid(pid, &status, 0), pid);
+    ASSERT_TRUE(WIFEXITED(status));
+    EXPECT_EQ(WEXITSTATUS(status), 3);
+}
+
+TEST(SubprocessTest, ReplaceProcessCommandNotFound)
+{
+    std::vector<std::string> command = {"this-command-does-not-exist-1234"};
+    EXPECT_EQ(Subprocess::replaceProcess(command), 127);
+}
+
+TEST(SubprocessTest, OutputCallbacksWhileRunning)
+{
+    // The command only exits once its first line of output was seen
+    buildboxcommon::TemporaryDirectory temp_dir;
+    const std::string fifo_path = std::string(temp_dir.name()) + "/fifo";
+    ASSERT_EQ(mkfifo(fifo_path.c_str(), 0600), 0);
+    std::vector<std::string> command = {
+        "sh", "-c",
+        "echo first >&2; read line < " + fifo_path + "; echo $line"};
+
+    std::string streamedOut;
+    std::string streamedErr;
+    auto result = Subprocess::execute(
+        command, true, true, {},
+        [&streamedOut](const char *data, size_t size) {
+            streamedOut.append(data, size);
+        },
+        [&streamedErr, &fifo_path](const char *data, size_t size) {
+            streamedErr.append(data, size);
+            std::ofstream fifo(fifo_path);
+            fifo << "second" << std::endl;
+        });
+    EXPECT_EQ(result.d_exitCode, 0);
+    EXPECT_EQ(streamedErr, "first\n");
+    EXPECT_EQ(streamedOut, "second\n");
+    EXPECT_EQ(result.d_stdOut, "");
+    EXPECT_EQ(result.d_stdErr, "");
+}
@@ -0,0 +1,177 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <digestgenerator.h>
+#include <env.h>
+#include <merkletreebuilder.h>
+#include <subtreedigestcache.h>
+
+#include <buildboxcommon_fileutils.h>
+#include <buildboxcommon_temporarydirectory.h>
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+using namespace recc;
+
+class SubtreeDigestCacheTestFixture : public ::testing::Test {
+  protected:
+    SubtreeDigestCacheTestFixture()
+        : d_cachePath(d_cacheDirectory.strname() + "/subtrees"),
+          d_cache(d_cachePath)
+    {
+        RECC_CAS_DIGEST_FUNCTION = "SHA256";
+    }
+
+    static std::string fileKey(const std::string &name, bool executable)
+    {
+        std::string keyData;
+        SubtreeDigestCache::appendFile(&keyData, name.data(), name.size(),
+                                       DigestGenerator::make_digest(name),
+                                       executable);
+        return SubtreeDigestCache::computeKey(keyData);
+    }
+
+    buildboxcommon::TemporaryDirectory d_cacheDirectory;
+    std::string d_cachePath;
+    SubtreeDigestCache d_cache;
+};
+
+TEST_F(SubtreeDigestCacheTestFixture, HitAfterStore)
+{
+    const std::string key = fileKey("a.h", false);
+    proto::Digest digest;
+    std::string blob;
+    EXPECT_FALSE(d_cache.lookup(key, &digest, &blob));
+    EXPECT_EQ(d_cache.misses(), 1);
+
+    const std::string storedBlob("directory\n\0message", 18);
+    const proto::Digest storedDigest =
+        DigestGenerator::make_digest(storedBlob);
+    d_cache.store(key, storedDigest, storedBlob);
+
+    ASSERT_TRUE(d_cache.lookup(key, &digest, &blob));
+    EXPECT_EQ(digest, storedDigest);
+    EXPECT_EQ(blob, storedBlob);
+    EXPECT_EQ(d_cache.hits(), 1);
+    EXPECT_EQ(d_cache.misses(), 1);
+}
+
+TEST_F(SubtreeDigestCacheTestFixture, KeysDependOnEveryChild)
+{
+    const std::string key = fileKey("a.h", false);
+    EXPECT_EQ(key.size(), 64);
+    EXPECT_EQ(fileKey("a.h", false), key);
+    EXPECT_NE(fileKey("a.h", true), key);
+    EXPECT_NE(fileKey("b.h", false), key);
+
+    // A symlink or a directory with the same name
+    std::string symlinkData;
+    SubtreeDigestCache::appendSymlink(&symlinkData, "a.h", 3, "b.h", 3);
+    std::string directoryData;
+    SubtreeDigestCache::appendDirectory(&directoryData, "a.h", 3,
+                                        DigestGenerator::make_digest("a.h"));
+    EXPECT_NE(SubtreeDigestCache::computeKey(symlinkData), key);
+    EXPECT_NE(SubtreeDigestCache::computeKey(directoryData), key);
+    EXPECT_NE(SubtreeDigestCache::computeKey(symlinkData),
+              SubtreeDigestCache::computeKey(directoryData));
+}
+
+TEST_F(SubtreeDigestCacheTestFixture, SharedBetweenInstances)
+{
+    const std::string key = fileKey("a.h", false);
+    d_cache.store(key, DigestGenerator::make_digest("blob"), "blob");
+
+    SubtreeDigestCache other(d_cachePath);
+    proto::Digest digest;
+    std::string blob;
+    EXPECT_TRUE(other.lookup(key, &digest, &blob));
+    EXPECT_EQ(blob, "blob");
+}
+
+TEST_F(SubtreeDigestCacheTestFixture, MalformedEntriesMiss)
+{
+    const std::string key = fileKey("a.h", false);
+    d_cache.store(key, DigestGenerator::make_digest("blob"), "blob");
+    const std::string path = d_cache.entryPath(key);
+    buildboxcommon::FileUtils::writeFileAtomically(path, "garbage");
+
+    proto::Digest digest;
+    std::string blob;
+    EXPECT_FALSE(d_cache.lookup(key, &digest, &blob));
+
+    // Truncated after the digest
+    d_cache.store(key, DigestGenerator::make_digest("blob"), "blob");
+    const std::string contents =
+        buildboxcommon::FileUtils::getFileContents(path.c_str());
+    buildboxcommon::FileUtils::writeFileAtomically(
+        path, contents.substr(0, contents.size() - 2));
+    EXPECT_FALSE(d_cache.lookup(key, &digest, &blob));
+    EXPECT_EQ(d_cache.hits(), 0);
+    EXPECT_EQ(d_cache.misses(), 2);
+}
+
+TEST_F(SubtreeDigestCacheTestFixture, UnusableDirectoryAlwaysMisses)
+{
+    // The cache directory is a file
+    buildboxcommon::FileUtils::writeFileAtomically(d_cachePath, "");
+    const std::string key = fileKey("a.h", false);
+    d_cache.store(key, DigestGenerator::make_digest("blob"), "blob");
+
+    proto::Digest digest;
+    std::string blob;
+    EXPECT_FALSE(d_cache.lookup(key, &digest, &blob));
+    EXPECT_EQ(d_cache.misses(), 1);
+}
+
+TEST_F(SubtreeDigestCacheTestFixture, MerkleTreeBuilderReusesSubtrees)
+{
+    const auto populate = [](MerkleTreeBuilder *builder,
+                             const std::string &source) {
+        builder->addFile("include/a.h", DigestGenerator::make_digest("a"),
+                         false);
+        builder->addFile("include/sys/b.h", DigestGenerator::make_digest("b"),
+                         false);
+        builder->addSymlink("include/c.h", "a.h");
+        builder->addFile("src/main.c", DigestGenerator::make_digest(source),
+                         true);
+        builder->addDirectory("empty");
+    };
+
+    MerkleTreeBuilder uncached;
+    populate(&uncached, "int main() {}");
+    buildboxcommon::digest_string_map expectedBlobs;
+    const proto::Digest expected = uncached.build(&expectedBlobs);
+
+    MerkleTreeBuilder first(&d_cache);
+    populate(&first, "int main() {}");
+    EXPECT_EQ(first.build(), expected);
+    EXPECT_EQ(d_cache.misses(), 5);
+
+    // Only the directories containing the modified file are built again
+    MerkleTreeBuilder second(&d_cache);
+    populate(&second, "int main() { return 1; }");
+    second.build();
+    EXPECT_EQ(d_cache.hits(), 3);
+    EXPECT_EQ(d_cache.misses(), 7);
+
+    // Reused subtrees come with their serialized `Directory`
+    MerkleTreeBuilder third(&d_cache);
+    populate(&third, "int main() {}");
+    buildboxcommon::digest_string_map blobs;
+    EXPECT_EQ(third.build(&blobs), expected);
+    EXPECT_EQ(blobs, expectedBlobs);
+    EXPECT_EQ(d_cache.hits(), 8);
+}
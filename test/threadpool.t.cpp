@@ -0,0 +1,139 @@
+// Copyright 2021 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <threadpool.h>
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace recc;
+
+TEST(ThreadPoolTest, SubmitReturnsResult)
+{
+    ThreadPool pool(3);
+    std::vector<std::future<int>> futures;
+    for (int i = 0; i < 100; ++i) {
+        futures.push_back(pool.submit([i]() { return i * i; }));
+    }
+    for (int i = 0; i < 100; ++i) {
+        EXPECT_EQ(pool.wait(futures[static_cast<size_t>(i)]), i * i);
+    }
+}
+
+TEST(ThreadPoolTest, SubmitPropagatesExceptions)
+{
+    ThreadPool pool(2);
+    auto future = pool.submit([]() -> int { throw std::runtime_error("!"); });
+    EXPECT_THROW(pool.wait(future), std::runtime_error);
+}
+
+TEST(ThreadPoolTest, ParallelForCoversEveryIndexOnce)
+{
+    ThreadPool pool(4);
+    for (const size_t count : {1, 2, 7, 1000}) {
+        std::vector<std::atomic<int>> visits(count);
+        pool.parallelFor(
+            count, [](size_t) -> uint64_t { return 1; },
+            [&](size_t begin, size_t end) {
+                ASSERT_LT(begin, end);
+                for (size_t i = begin; i < end; ++i) {
+                    ++visits[i];
+                }
+            });
+        for (size_t i = 0; i < count; ++i) {
+            EXPECT_EQ(visits[i], 1) << "index " << i << " of " << count;
+        }
+    }
+}
+
+TEST(ThreadPoolTest, ParallelForSplitsExpensiveItems)
+{
+    // The first items account for almost all of the cost and must not end up
+    // in the same range
+    ThreadPool pool(3);
+    std::mutex mutex;
+    std::set<std::pair<size_t, size_t>> ranges;
+    pool.parallelFor(
+        100, [](size_t i) -> uint64_t { return i < 4 ? 1000000 : 1; },
+        [&](size_t begin, size_t end) {
+            const std::lock_guard<std::mutex> lock(mutex);
+            ranges.emplace(begin, end);
+        });
+
+    for (const auto &range : ranges) {
+        if (range.first < 4) {
+            EXPECT_EQ(range.second, range.first + 1);
+        }
+    }
+}
+
+TEST(ThreadPoolTest, ParallelForRethrowsAfterAllRangesComplete)
+{
+    ThreadPool pool(2);
+    std::atomic<size_t> processed(0);
+    EXPECT_THROW(pool.parallelFor(
+                     100, [](size_t) -> uint64_t { return 1; },
+                     [&](size_t begin, size_t end) {
+                         processed += end - begin;
+                         if (begin == 0) {
+                             throw std::runtime_error("failed");
+                         }
+                     }),
+                 std::runtime_error);
+    EXPECT_EQ(processed, 100);
+}
+
+TEST(ThreadPoolTest, NestedParallelism)
+{
+    // Tasks waiting for other tasks must not deadlock, even when there are
+    // more of them than workers
+    ThreadPool pool(2);
+    std::atomic<int> total(0);
+    pool.parallelFor(
+        8, [](size_t) -> uint64_t { return 1; },
+        [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                auto future = pool.submit([&pool, &total]() {
+                    pool.parallelFor(
+                        50, [](size_t) -> uint64_t { return 1; },
+                        [&total](size_t b, size_t e) {
+                            total += static_cast<int>(e - b);
+                        });
+                    return 1;
+                });
+                EXPECT_EQ(pool.wait(future), 1);
+            }
+        });
+    EXPECT_EQ(total, 8 * 50);
+}
+
+TEST(ThreadPoolTest, NoWorkers)
+{
+    ThreadPool pool(0);
+    EXPECT_EQ(pool.numWorkers(), 0);
+
+    auto future = pool.submit([]() { return std::this_thread::get_id(); });
+    EXPECT_EQ(pool.wait(future), std::this_thread::get_id());
+
+    size_t processed = 0;
+    pool.parallelFor(
+        10, [](size_t) -> uint64_t { return 1; },
+        [&](size_t begin, size_t end) { processed += end - begin; });
+    EXPECT_EQ(processed, 10);
+}